@@ -114,7 +114,7 @@ bool Application::poll()
 	if (fs)
 		fs->poll_notifications();
 	if (em)
-		em->dispatch();
+		em->dispatch(GRANITE_THREAD_GROUP());
 
 #ifdef HAVE_GRANITE_AUDIO
 	auto *backend = GRANITE_AUDIO_BACKEND();
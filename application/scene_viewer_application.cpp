@@ -1358,8 +1358,7 @@ void SceneViewerApplication::update_scene(TaskComposer &composer, double frame_t
 	animation_system->animate(composer, frame_time, elapsed_time);
 	scene.update_transform_tree(composer);
 
-	constexpr unsigned NumTasks = 8;
-	Threaded::scene_update_cached_transforms(scene, composer, NumTasks);
+	Threaded::scene_update_cached_transforms(scene, composer);
 
 	// Perform updates which depend on node transforms.
 	auto &updates = composer.begin_pipeline_stage();
@@ -26,9 +26,18 @@
 #include "timer.hpp"
 #include "logging.hpp"
 #include "bitops.hpp"
+#include "dsp/dsp.hpp"
+#include "thread_name.hpp"
+#include "thread_priority.hpp"
 #include <string.h>
+#include <algorithm>
+#include <functional>
 #include <cmath>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define NON_CRITICAL_THREAD_LOCK() \
 	std::lock_guard<std::mutex> holder{non_critical_lock}
 
@@ -44,12 +53,70 @@ void MixerStream::install_message_queue(StreamID id, Util::LockFreeMessageQueue
 	message_queue = queue;
 }
 
+size_t MixerStream::skip_frames(float *const *scratch, size_t num_frames) noexcept
+{
+	const float gains[Backend::MaxAudioChannels] = {};
+	return accumulate_samples(scratch, gains, num_frames);
+}
+
+// Plays back what the streams of a bus were mixed into, so bus effects are regular mixer streams.
+class BusInputStream final : public MixerStream
+{
+public:
+	BusInputStream(float * const *input_, unsigned num_channels_, float sample_rate_)
+		: num_channels(num_channels_), sample_rate(sample_rate_)
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+			input[c] = input_[c];
+	}
+
+	bool setup(float, unsigned mixer_channels, size_t) override
+	{
+		return mixer_channels == num_channels;
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept override
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+			DSP::accumulate_channel(channels[c], input[c], gain[c], num_frames);
+		return num_frames;
+	}
+
+	size_t skip_frames(float * const *, size_t num_frames) noexcept override
+	{
+		return num_frames;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return sample_rate;
+	}
+
+private:
+	const float *input[Backend::MaxAudioChannels] = {};
+	unsigned num_channels;
+	float sample_rate;
+};
+
 void Mixer::set_backend_parameters(float sample_rate_, unsigned channels_, size_t max_num_samples_)
 {
 	max_num_samples = max_num_samples_;
 	sample_rate = sample_rate_;
 	num_channels = channels_;
 	inv_sample_rate = 1.0 / sample_rate;
+
+	for (auto &buffer : scratch_buffers)
+		buffer.clear();
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		scratch_buffers[c].resize(max_num_samples);
+		scratch_channels[c] = scratch_buffers[c].data();
+	}
 }
 
 void Mixer::on_backend_start()
@@ -94,17 +161,46 @@ static float saturate(float v)
 		return v;
 }
 
+static void compute_channel_gains(float *gains, unsigned num_channels, float gain, float pan)
+{
+	if (num_channels != 2)
+	{
+		for (unsigned c = 0; c < num_channels; c++)
+			gains[c] = gain;
+	}
+	else
+	{
+		gains[0] = gain * saturate(1.0f - pan);
+		gains[1] = gain * saturate(1.0f + pan);
+	}
+}
+
 Mixer::Mixer()
 {
 	for (auto &pan : panning)
 		pan = f32_to_u32(0.0f);
 	for (auto &gain : gain_linear)
 		gain = f32_to_u32(1.0f);
+	for (auto &prio : stream_priority)
+		prio = 0;
+	for (auto &bus : stream_bus)
+		bus = 0;
+	for (auto &pan : bus_panning)
+		pan = f32_to_u32(0.0f);
+	for (auto &gain : bus_gain_linear)
+		gain = f32_to_u32(1.0f);
+	active_bus_mask = 0;
+	kill_bus_mask = 0;
+	mix_job_state = 0;
+	mix_jobs_done = 0;
+	num_mixer_threads = 0;
 	for (auto &active : active_channel_mask)
 		active = 0;
+	active_mask_words = 0;
 	for (auto &mask : kill_channel_mask)
 		mask = 0;
 	latency = 0;
+	max_real_voices = DefaultMaxRealVoices;
 }
 
 void Mixer::on_backend_stop()
@@ -115,10 +211,14 @@ void Mixer::on_backend_stop()
 
 Mixer::~Mixer()
 {
+	stop_mixer_threads();
 	on_backend_stop();
 	for (auto *stream : mixer_streams)
 		if (stream)
 			stream->dispose();
+	for (auto &bus : buses)
+		if (bus.output)
+			bus.output->dispose();
 }
 
 unsigned Mixer::get_stream_index(StreamID id)
@@ -197,23 +297,155 @@ void Mixer::update_stream_play_cursor(unsigned index, double new_latency) noexce
 		stream_adjusted_play_cursors_usec[index].store(t_usec, std::memory_order_release);
 }
 
+void Mixer::render_voice(VoiceCandidate &candidate, float * const *output, float * const *scratch) noexcept
+{
+	unsigned index = candidate.index;
+	auto *stream = mixer_streams[index];
+	size_t num_frames = mix_num_frames;
+	bool real = candidate.real;
+
+	float gains[Backend::MaxAudioChannels];
+	compute_channel_gains(gains, num_channels, candidate.gain, candidate.pan);
+
+#ifdef AUDIO_MIXER_DEBUG
+	auto start_time = Util::get_current_time_nsecs();
+#endif
+
+	auto state = voice_state[index];
+	size_t got;
+
+	if (real && state != VoiceState::Virtual)
+	{
+		// New voices start from the beginning, so they do not need a fade-in.
+		got = stream->accumulate_samples(output, gains, num_frames);
+	}
+	else if (real || state == VoiceState::Real)
+	{
+		// Render with unit gain, and ramp in or out while mixing.
+		float unit_gains[Backend::MaxAudioChannels];
+		for (auto &g : unit_gains)
+			g = 1.0f;
+		for (unsigned c = 0; c < num_channels; c++)
+			memset(scratch[c], 0, num_frames * sizeof(float));
+		got = stream->accumulate_samples(scratch, unit_gains, num_frames);
+
+		for (unsigned c = 0; c < num_channels; c++)
+		{
+			DSP::accumulate_channel_ramp(output[c], scratch[c],
+			                             real ? 0.0f : gains[c], real ? gains[c] : 0.0f, got);
+		}
+	}
+	else
+		got = stream->skip_frames(scratch, num_frames);
+
+	voice_state[index] = real ? VoiceState::Real : VoiceState::Virtual;
+	candidate.got = uint32_t(got);
+
+#ifdef AUDIO_MIXER_DEBUG
+	candidate.render_time_ns = Util::get_current_time_nsecs() - start_time;
+#endif
+}
+
+void Mixer::render_bus(unsigned bus) noexcept
+{
+	size_t num_frames = mix_num_frames;
+	auto &submix = buses[bus];
+	float * const *output = bus ? submix.input : mix_output;
+	float * const *scratch = bus ? submix.scratch : scratch_channels;
+
+	if (bus)
+		for (unsigned c = 0; c < num_channels; c++)
+			memset(submix.input[c], 0, num_frames * sizeof(float));
+
+	for (uint32_t i = bus_voice_offsets[bus]; i < bus_voice_offsets[bus + 1]; i++)
+		render_voice(voice_candidates[voice_order[i]], output, scratch);
+
+	if (bus)
+	{
+		// Effects keep running without input, so tails ring out.
+		float gains[Backend::MaxAudioChannels];
+		compute_channel_gains(gains, num_channels,
+		                      u32_to_f32(bus_gain_linear[bus].load(std::memory_order_relaxed)),
+		                      u32_to_f32(bus_panning[bus].load(std::memory_order_relaxed)));
+		for (unsigned c = 0; c < num_channels; c++)
+			memset(submix.mixed[c], 0, num_frames * sizeof(float));
+		submix.output->accumulate_samples(submix.mixed, gains, num_frames);
+	}
+}
+
+void Mixer::run_mix_jobs() noexcept
+{
+	uint64_t state = mix_job_state.load(std::memory_order_acquire);
+	for (;;)
+	{
+		auto next = uint32_t(state & 0xffff);
+		auto count = uint32_t(state >> 16) & 0xffff;
+		if (next >= count)
+			break;
+
+		// If a new block was started in the meantime, this fails and we pick up jobs from that block instead.
+		if (mix_job_state.compare_exchange_weak(state, state + 1,
+		                                        std::memory_order_acq_rel, std::memory_order_acquire))
+		{
+			render_bus(mix_jobs[next]);
+			mix_jobs_done.fetch_add(1, std::memory_order_release);
+			state++;
+		}
+	}
+}
+
+void Mixer::mixer_thread_loop()
+{
+	Util::set_current_thread_name("audio-mixer");
+	Util::set_current_thread_priority(Util::ThreadPriority::Realtime);
+
+	auto epoch = uint32_t(mix_job_state.load(std::memory_order_relaxed) >> 32);
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> holder{mixer_thread_lock};
+			mixer_thread_cond.wait(holder, [&]() {
+				return mixer_threads_dead || uint32_t(mix_job_state.load(std::memory_order_relaxed) >> 32) != epoch;
+			});
+			if (mixer_threads_dead)
+				return;
+		}
+
+		epoch = uint32_t(mix_job_state.load(std::memory_order_relaxed) >> 32);
+		run_mix_jobs();
+	}
+}
+
+// Streams below -80 dB are never mixed.
+static constexpr float MinAudibleGain = 0.0001f;
+// Real voices compete as if they were 6 dB louder, so voices close in loudness do not keep trading places.
+static constexpr float RealVoiceBias = 2.0f;
+
 void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 {
 	for (unsigned c = 0; c < num_channels; c++)
 		memset(channels[c], 0, num_frames * sizeof(float));
-	float gains[Backend::MaxAudioChannels];
 
 	auto current_latency = double(latency.load(std::memory_order_acquire)) * 1e-6;
+	size_t num_candidates = 0;
 
-	constexpr unsigned iter = MaxSources / 32;
+	// Streams of a killed bus were killed along with it, so they are gone below.
+	uint32_t dead_buses = kill_bus_mask.exchange(0, std::memory_order_acquire);
+	if (dead_buses)
+		active_bus_mask.fetch_and(~dead_buses, std::memory_order_release);
+	uint32_t bus_mask = active_bus_mask.load(std::memory_order_acquire) & ~dead_buses;
+
+	unsigned iter = active_mask_words.load(std::memory_order_acquire);
 	for (unsigned i = 0; i < iter; i++)
 	{
+		finished_channel_mask[i] = 0;
 		uint32_t active_mask = active_channel_mask[i].load(std::memory_order_acquire);
 		if (!active_mask)
 			continue;
 
 		uint32_t dead_mask = kill_channel_mask[i].exchange(0, std::memory_order_relaxed);
 		active_mask &= ~dead_mask;
+		finished_channel_mask[i] = dead_mask;
 
 		Util::for_each_bit(dead_mask, [&](unsigned bit) {
 			emplace_audio_event_on_queue<StreamStoppedEvent>(message_queue, bit + 32 * i);
@@ -222,48 +454,151 @@ void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 		Util::for_each_bit(active_mask, [&](unsigned bit) {
 			unsigned index = bit + 32 * i;
 			if (!stream_playing[index].load(std::memory_order_acquire))
+			{
+				// The stream does not advance while paused, so fade it back in when it resumes.
+				if (voice_state[index] == VoiceState::Real)
+					voice_state[index] = VoiceState::Virtual;
+				return;
+			}
+
+			// The bus was added after this block started. Hold the stream until the next one.
+			uint32_t bus = stream_bus[index].load(std::memory_order_relaxed);
+			if (bus && (bus_mask & (1u << bus)) == 0)
 				return;
 
-			float gain = u32_to_f32(gain_linear[index].load(std::memory_order_relaxed));
-			float pan = u32_to_f32(panning[index].load(std::memory_order_relaxed));
+			auto &candidate = voice_candidates[num_candidates++];
+			candidate.index = index;
+			candidate.bus = uint8_t(bus);
+			candidate.gain = u32_to_f32(gain_linear[index].load(std::memory_order_relaxed));
+			candidate.pan = u32_to_f32(panning[index].load(std::memory_order_relaxed));
+
+			float loudness = candidate.gain;
+			if (voice_state[index] == VoiceState::Real)
+				loudness *= RealVoiceBias;
+			candidate.key = (uint64_t(stream_priority[index].load(std::memory_order_relaxed)) << 32) |
+			                f32_to_u32(loudness);
+		});
+	}
+
+	// Voices with a key above the threshold are real, along with the first threshold_ties voices equal to it.
+	// Gains are never negative, so the float bits sort like the floats themselves.
+	// Only a copy of the keys is partitioned, so the voices are still visited in slot order below.
+	size_t num_real = std::min<size_t>(num_candidates, max_real_voices.load(std::memory_order_relaxed));
+	uint64_t threshold_key = 0;
+	size_t threshold_ties = num_candidates;
+	if (num_real < num_candidates)
+	{
+		threshold_key = UINT64_MAX;
+		threshold_ties = 0;
+		for (size_t i = 0; i < num_candidates; i++)
+			voice_keys[i] = voice_candidates[i].key;
+
+		if (num_real)
+		{
+			std::nth_element(voice_keys, voice_keys + num_real - 1, voice_keys + num_candidates,
+			                 std::greater<uint64_t>());
+			threshold_key = voice_keys[num_real - 1];
+			for (size_t i = 0; i < num_real; i++)
+				if (voice_keys[i] == threshold_key)
+					threshold_ties++;
+		}
+	}
+
+	uint32_t bus_counts[MaxBuses] = {};
+	for (size_t i = 0; i < num_candidates; i++)
+	{
+		auto &candidate = voice_candidates[i];
+		bool real = candidate.key > threshold_key;
+		if (!real && candidate.key == threshold_key && threshold_ties)
+		{
+			threshold_ties--;
+			real = true;
+		}
+		candidate.real = real && candidate.gain >= MinAudibleGain;
+		bus_counts[candidate.bus]++;
+	}
+
+	// Group voices by bus, keeping slot order within a bus.
+	uint32_t bus_cursors[MaxBuses];
+	bus_voice_offsets[0] = 0;
+	for (unsigned bus = 0; bus < MaxBuses; bus++)
+	{
+		bus_cursors[bus] = bus_voice_offsets[bus];
+		bus_voice_offsets[bus + 1] = bus_voice_offsets[bus] + bus_counts[bus];
+	}
+	for (size_t i = 0; i < num_candidates; i++)
+		voice_order[bus_cursors[voice_candidates[i].bus]++] = uint32_t(i);
+
+	unsigned num_jobs = 0;
+	if (bus_counts[0])
+		mix_jobs[num_jobs++] = 0;
+	Util::for_each_bit(bus_mask, [&](unsigned bus) {
+		mix_jobs[num_jobs++] = uint8_t(bus);
+	});
+
+	mix_output = channels;
+	mix_num_frames = num_frames;
 
-			if (num_channels != 2)
+	if (num_jobs > 1 && num_mixer_threads.load(std::memory_order_relaxed) != 0)
+	{
+		// Helpers which wake up late find no work left, since we take jobs ourselves as well.
+		// The only wait is for jobs which helpers have already started.
+		uint64_t epoch = (mix_job_state.load(std::memory_order_relaxed) >> 32) + 1;
+		mix_jobs_done.store(0, std::memory_order_relaxed);
+		mix_job_state.store((epoch << 32) | (uint64_t(num_jobs) << 16), std::memory_order_release);
+		mixer_thread_cond.notify_all();
+
+		run_mix_jobs();
+
+		// If a helper was preempted in the middle of a job, let it run rather than spin through our time slice.
+		unsigned spins = 0;
+		while (mix_jobs_done.load(std::memory_order_acquire) != num_jobs)
+		{
+			if (++spins < 1024)
 			{
-				for (unsigned c = 0; c < num_channels; c++)
-					gains[c] = gain;
+#ifdef __SSE2__
+				_mm_pause();
+#endif
 			}
 			else
-			{
-				gains[0] = gain * saturate(1.0f - pan);
-				gains[1] = gain * saturate(1.0f + pan);
-			}
+				std::this_thread::yield();
+		}
+	}
+	else
+	{
+		for (unsigned i = 0; i < num_jobs; i++)
+			render_bus(mix_jobs[i]);
+	}
 
-#ifdef AUDIO_MIXER_DEBUG
-			auto start_time = Util::get_current_time_nsecs();
-#endif
+	Util::for_each_bit(bus_mask, [&](unsigned bus) {
+		for (unsigned c = 0; c < num_channels; c++)
+			DSP::accumulate_channel_nogain(channels[c], buses[bus].mixed[c], num_frames);
+	});
 
-			size_t got = mixer_streams[index]->accumulate_samples(channels, gains, num_frames);
+	for (size_t i = 0; i < num_candidates; i++)
+	{
+		auto &candidate = voice_candidates[i];
+		unsigned index = candidate.index;
 
 #ifdef AUDIO_MIXER_DEBUG
-			auto end_time = Util::get_current_time_nsecs();
-			emplace_audio_event_on_queue<AudioStreamPerformanceEvent>(message_queue, mixer_streams[index]->get_stream_id(),
-			                                                          1e-9 * (end_time - start_time), got);
-
+		emplace_audio_event_on_queue<AudioStreamPerformanceEvent>(message_queue, mixer_streams[index]->get_stream_id(),
+		                                                          1e-9 * candidate.render_time_ns, candidate.got);
 #endif
 
-			stream_raw_play_cursors[index] += got;
-			update_stream_play_cursor(index, current_latency);
+		stream_raw_play_cursors[index] += candidate.got;
+		update_stream_play_cursor(index, current_latency);
 
-			if (got < num_frames)
-			{
-				dead_mask |= 1u << bit;
-				emplace_audio_event_on_queue<StreamStoppedEvent>(message_queue, bit + 32 * i);
-			}
-		});
-
-		active_channel_mask[i].fetch_and(~dead_mask, std::memory_order_release);
+		if (candidate.got < num_frames)
+		{
+			finished_channel_mask[index / 32] |= 1u << (index & 31);
+			emplace_audio_event_on_queue<StreamStoppedEvent>(message_queue, index);
+		}
 	}
 
+	for (unsigned i = 0; i < iter; i++)
+		if (finished_channel_mask[i])
+			active_channel_mask[i].fetch_and(~finished_channel_mask[i], std::memory_order_release);
+
 #ifdef AUDIO_MIXER_DEBUG
 	// Pump audio data to the event queue, so applications can monitor the audio backend visually :3
 	for (unsigned c = 0; c < num_channels; c++)
@@ -275,7 +610,8 @@ void Mixer::mix_samples(float *const *channels, size_t num_frames) noexcept
 }
 
 StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
-                                 float initial_gain_db, float initial_panning)
+                                 float initial_gain_db, float initial_panning,
+                                 unsigned priority, BusID bus)
 {
 	if (!stream)
 		return {};
@@ -315,6 +651,13 @@ StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
 	// The only important non-locking code is the audio thread, which can only use atomics.
 	NON_CRITICAL_THREAD_LOCK();
 
+	if (bus && !verify_bus_id(bus))
+	{
+		LOGE("Mixer bus does not exist.\n");
+		stream->dispose();
+		return {};
+	}
+
 	constexpr unsigned iter = MaxSources / 32;
 	for (unsigned i = 0; i < iter; i++)
 	{
@@ -336,11 +679,16 @@ StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
 		stream_adjusted_play_cursors_usec[index].store(0, std::memory_order_relaxed);
 		gain_linear[index].store(f32_to_u32(std::pow(10.0f, initial_gain_db / 20.0f)), std::memory_order_relaxed);
 		panning[index].store(f32_to_u32(initial_panning), std::memory_order_relaxed);
+		stream_priority[index].store(priority, std::memory_order_relaxed);
+		stream_bus[index].store(bus ? get_bus_index(bus) : 0, std::memory_order_relaxed);
+		voice_state[index] = VoiceState::New;
 		kill_channel_mask[i].fetch_and(~(1u << subindex), std::memory_order_relaxed);
 		stream_playing[index].store(start_playing, std::memory_order_relaxed);
 
 		// Kick mixer thread.
 		active_channel_mask[i].fetch_or(1u << subindex, std::memory_order_release);
+		if (i >= active_mask_words.load(std::memory_order_relaxed))
+			active_mask_words.store(i + 1, std::memory_order_release);
 
 		if (old_stream)
 			old_stream->dispose();
@@ -355,11 +703,16 @@ StreamID Mixer::add_mixer_stream(MixerStream *stream, bool start_playing,
 void Mixer::dispose_dead_streams()
 {
 	NON_CRITICAL_THREAD_LOCK();
-	constexpr unsigned iter = MaxSources / 32;
+	// Slots above the high water mark were already cleared when it was lowered.
+	unsigned iter = active_mask_words.load(std::memory_order_relaxed);
+	unsigned used_words = 0;
 	for (unsigned i = 0; i < iter; i++)
 	{
-		uint32_t dead_mask = ~active_channel_mask[i].load(std::memory_order_acquire);
-		Util::for_each_bit(dead_mask, [&](unsigned bit) {
+		uint32_t active_mask = active_channel_mask[i].load(std::memory_order_acquire);
+		if (active_mask)
+			used_words = i + 1;
+
+		Util::for_each_bit(~active_mask, [&](unsigned bit) {
 			MixerStream *old_stream = mixer_streams[bit + 32 * i];
 			if (old_stream)
 				old_stream->dispose();
@@ -367,6 +720,162 @@ void Mixer::dispose_dead_streams()
 			stream_generation[bit + 32 * i] = 0;
 		});
 	}
+
+	// Streams are only added with the lock held, so the words above cannot become active behind our back.
+	// A block which already loaded the old value scans a few empty words.
+	active_mask_words.store(used_words, std::memory_order_relaxed);
+
+	uint32_t dead_buses = ~active_bus_mask.load(std::memory_order_acquire);
+	Util::for_each_bit(dead_buses, [&](unsigned bus) {
+		if (buses[bus].output)
+			buses[bus].output->dispose();
+		buses[bus].output = nullptr;
+	});
+}
+
+unsigned Mixer::get_bus_index(BusID id)
+{
+	static_assert((MaxBuses & (MaxBuses - 1)) == 0, "MaxBuses must be POT.");
+	return unsigned(id.id & (MaxBuses - 1));
+}
+
+BusID Mixer::generate_bus_id(unsigned index)
+{
+	uint32_t generation = bus_generation[index] = (bus_generation[index] + 1) & (uint32_t(-1) / MaxBuses);
+	return { generation * MaxBuses + index };
+}
+
+bool Mixer::verify_bus_id(BusID id) const
+{
+	if (!id)
+		return false;
+
+	unsigned index = get_bus_index(id);
+	return index != 0 && bus_generation[index] == id.id / unsigned(MaxBuses);
+}
+
+BusID Mixer::add_mixer_bus(const BusEffectFactory &create_effects, float initial_gain_db, float initial_panning)
+{
+	NON_CRITICAL_THREAD_LOCK();
+
+	// Bus 0 is the output.
+	uint32_t vacant_mask = ~active_bus_mask.load(std::memory_order_acquire) & ~1u;
+	if (!vacant_mask)
+	{
+		LOGE("No vacant mixer bus.\n");
+		return {};
+	}
+
+	unsigned index = trailing_zeroes(vacant_mask);
+	auto &bus = buses[index];
+	if (bus.output)
+	{
+		bus.output->dispose();
+		bus.output = nullptr;
+	}
+
+	// The mixer thread does not touch a vacant bus, so we can allocate here.
+	bus.storage.resize(3 * num_channels * max_num_samples);
+	for (unsigned c = 0; c < num_channels; c++)
+	{
+		bus.input[c] = bus.storage.data() + c * max_num_samples;
+		bus.mixed[c] = bus.storage.data() + (num_channels + c) * max_num_samples;
+		bus.scratch[c] = bus.storage.data() + (2 * num_channels + c) * max_num_samples;
+	}
+
+	MixerStream *output = new BusInputStream(bus.input, num_channels, sample_rate);
+	if (create_effects)
+	{
+		// The effects only take ownership of the input on success.
+		auto *effects = create_effects(output);
+		if (!effects)
+		{
+			LOGE("Failed to create bus effects.\n");
+			output->dispose();
+			return {};
+		}
+		output = effects;
+	}
+
+	if (!output->setup(sample_rate, num_channels, max_num_samples) ||
+	    output->get_sample_rate() != sample_rate || output->get_num_channels() != num_channels)
+	{
+		LOGE("Bus effects must run at the mixer rate and channel count.\n");
+		output->dispose();
+		return {};
+	}
+
+	BusID id = generate_bus_id(index);
+	output->install_message_queue({}, &message_queue);
+	bus.output = output;
+	bus_gain_linear[index].store(f32_to_u32(std::pow(10.0f, initial_gain_db / 20.0f)), std::memory_order_relaxed);
+	bus_panning[index].store(f32_to_u32(initial_panning), std::memory_order_relaxed);
+	kill_bus_mask.fetch_and(~(1u << index), std::memory_order_relaxed);
+
+	// Kick mixer thread.
+	active_bus_mask.fetch_or(1u << index, std::memory_order_release);
+	return id;
+}
+
+void Mixer::kill_bus(BusID id)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	if (!verify_bus_id(id))
+		return;
+
+	unsigned bus = get_bus_index(id);
+	unsigned iter = active_mask_words.load(std::memory_order_relaxed);
+	for (unsigned i = 0; i < iter; i++)
+	{
+		uint32_t kill_mask = 0;
+		Util::for_each_bit(active_channel_mask[i].load(std::memory_order_acquire), [&](unsigned bit) {
+			if (stream_bus[bit + 32 * i].load(std::memory_order_relaxed) == bus)
+				kill_mask |= 1u << bit;
+		});
+		if (kill_mask)
+			kill_channel_mask[i].fetch_or(kill_mask, std::memory_order_relaxed);
+	}
+
+	// Old IDs are invalid from here on. The streams are killed no later than the bus itself.
+	bus_generation[bus] = (bus_generation[bus] + 1) & (uint32_t(-1) / MaxBuses);
+	kill_bus_mask.fetch_or(1u << bus, std::memory_order_release);
+}
+
+void Mixer::set_bus_mixer_parameters(BusID id, float new_gain_db, float new_panning)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	if (!verify_bus_id(id))
+		return;
+
+	unsigned index = get_bus_index(id);
+	bus_gain_linear[index].store(f32_to_u32(std::pow(10.0f, new_gain_db / 20.0f)), std::memory_order_release);
+	bus_panning[index].store(f32_to_u32(new_panning), std::memory_order_release);
+}
+
+void Mixer::stop_mixer_threads()
+{
+	num_mixer_threads.store(0, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> holder{mixer_thread_lock};
+		mixer_threads_dead = true;
+	}
+	mixer_thread_cond.notify_all();
+
+	// A helper which is in the middle of a job finishes it first, so the mixer thread is never left waiting.
+	for (auto &thread : mixer_threads)
+		thread.join();
+	mixer_threads.clear();
+}
+
+void Mixer::set_num_mixer_threads(unsigned count)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	stop_mixer_threads();
+
+	mixer_threads_dead = false;
+	for (unsigned i = 0; i < count; i++)
+		mixer_threads.emplace_back(&Mixer::mixer_thread_loop, this);
+	num_mixer_threads.store(count, std::memory_order_relaxed);
 }
 
 Util::LockFreeMessageQueue &Mixer::get_message_queue()
@@ -407,6 +916,21 @@ void Mixer::set_stream_mixer_parameters(StreamID id, float new_gain_db, float ne
 	panning[index].store(f32_to_u32(new_panning), std::memory_order_release);
 }
 
+void Mixer::set_stream_priority(StreamID id, unsigned priority)
+{
+	NON_CRITICAL_THREAD_LOCK();
+	if (!verify_stream_id(id))
+		return;
+
+	unsigned index = get_stream_index(id);
+	stream_priority[index].store(priority, std::memory_order_relaxed);
+}
+
+void Mixer::set_max_real_voices(unsigned count)
+{
+	max_real_voices.store(count, std::memory_order_relaxed);
+}
+
 void Mixer::event_start(EventManagerInterface &iface)
 {
 	static_cast<EventManager &>(iface).enqueue_latched<MixerStartEvent>(*this);
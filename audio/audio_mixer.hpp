@@ -26,7 +26,10 @@
 #include "message_queue.hpp"
 #include "global_managers.hpp"
 #include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 namespace Granite
@@ -39,6 +42,12 @@ struct StreamID
 	explicit inline operator bool() const { return id != uint32_t(-1); }
 };
 
+struct BusID
+{
+	uint32_t id = uint32_t(-1);
+	explicit inline operator bool() const { return id != uint32_t(-1); }
+};
+
 class MixerStream
 {
 public:
@@ -61,6 +70,13 @@ public:
 	// Must increment.
 	virtual size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept = 0;
 
+	// Advances the stream without rendering, which is how the mixer plays virtual voices.
+	// Returns the number of frames skipped, with the same end of stream semantics as accumulate_samples().
+	// scratch has get_num_channels() buffers of at least max_num_frames from setup(), and its contents are discarded.
+	// By default, the stream is rendered silently into scratch.
+	// Streams which can seek or keep track of a position cheaply should override this.
+	virtual size_t skip_frames(float * const *scratch, size_t num_frames) noexcept;
+
 	// Called after setup().
 	// If get_num_channels() returns != mixer_channels, the stream is refused.
 	// Mono streams can trivially mix to stereo.
@@ -75,6 +91,9 @@ public:
 	}
 
 protected:
+	// The queue has a single producer, the audio thread.
+	// Streams mixed into a submix bus, and bus effects, may run on a mixer helper thread instead,
+	// so they must not post messages.
 	Util::LockFreeMessageQueue &get_message_queue()
 	{
 		return *message_queue;
@@ -99,10 +118,33 @@ public:
 	// Returns StreamID(-1) if a mixer stream slot cannot be found.
 	// The add_mixer_stream() always takes ownership and disposes the stream
 	// on error or there is no vacant stream.
+	// If bus is set, the stream is mixed into that submix bus instead of the output.
 	StreamID add_mixer_stream(MixerStream *stream, bool start_playing = true,
-	                          float initial_gain_db = 0.0f, float initial_panning = 0.0f);
+	                          float initial_gain_db = 0.0f, float initial_panning = 0.0f,
+	                          unsigned priority = 0, BusID bus = {});
 	void kill_stream(StreamID id);
 
+	// A submix bus mixes its streams into an intermediate buffer, which is then fed through the bus effects.
+	// create_effects() receives a stream which plays back the intermediate buffer,
+	// and returns the stream to mix into the output, e.g. DSP::create_tone_filter_stream(input).
+	// The returned stream owns input. If create_effects() returns nullptr, the mixer still owns input and disposes it.
+	// Without create_effects, the bus is a plain group with its own gain and panning.
+	// Buses do not depend on each other, so they are rendered in parallel if there are mixer threads.
+	// Streams in a bus, and the effects, must not post to the message queue, see MixerStream.
+	// Can only be called from a non-critical thread. Returns BusID(-1) if no bus slot is vacant or the effects failed to set up.
+	using BusEffectFactory = std::function<MixerStream *(MixerStream *input)>;
+	BusID add_mixer_bus(const BusEffectFactory &create_effects = {},
+	                    float initial_gain_db = 0.0f, float initial_panning = 0.0f);
+	// Kills the bus along with every stream which is mixed into it.
+	void kill_bus(BusID id);
+	void set_bus_mixer_parameters(BusID id, float new_gain_db, float new_panning);
+
+	// Helper threads which render buses alongside the audio thread. The default is 0.
+	// The audio thread takes work itself and never waits for a helper to wake up,
+	// so late helpers only cost parallelism, not the deadline.
+	// Can only be called from a non-critical thread.
+	void set_num_mixer_threads(unsigned count);
+
 	// Garbage collection. Should be called regularly from a non-critical thread.
 	void dispose_dead_streams();
 
@@ -110,6 +152,13 @@ public:
 	// Panning is -1 (left), 0 (center), 1 (right).
 	void set_stream_mixer_parameters(StreamID id, float new_gain_db, float new_panning);
 
+	// Every block, only the highest priority streams are mixed, and among streams of the same priority, the loudest.
+	// The rest, and streams which are too quiet to be heard, are virtual voices.
+	// They keep playing through MixerStream::skip_frames(), but are not rendered.
+	// Voices are faded in and out over one block when they change between real and virtual.
+	void set_stream_priority(StreamID id, unsigned priority);
+	void set_max_real_voices(unsigned count);
+
 	// Returns latency-adjusted play cursor in seconds from add_mixer_stream.
 	// The play cursor monotonically increases.
 	// Returns a negative number if the stream no longer exists.
@@ -134,9 +183,16 @@ public:
 	void on_backend_stop() override;
 	void set_latency_usec(uint32_t usec) override;
 
+	// Slot storage is a fixed array, sized for MaxSources logical voices, about 1.4 MiB per Mixer.
+	// The audio thread indexes it without locks, so it cannot be reallocated while the mixer runs.
+	// Slots are handed out lowest first, and the audio thread only scans up to the highest slot in use.
+	enum { MaxSources = 16 * 1024, DefaultMaxRealVoices = 128, MaxBuses = 32 };
+
 private:
-	enum { MaxSources = 128 };
 	std::atomic_uint32_t active_channel_mask[MaxSources / 32];
+	// Mask words at and above this never have active bits.
+	// Raised by add_mixer_stream() and lowered by dispose_dead_streams().
+	std::atomic_uint32_t active_mask_words;
 	std::atomic_uint32_t kill_channel_mask[MaxSources / 32];
 	MixerStream *mixer_streams[MaxSources] = {};
 
@@ -145,6 +201,9 @@ private:
 	std::atomic_uint32_t gain_linear[MaxSources];
 	std::atomic_uint32_t latency;
 	std::atomic_bool stream_playing[MaxSources];
+	std::atomic_uint32_t stream_priority[MaxSources];
+	std::atomic_uint32_t stream_bus[MaxSources];
+	std::atomic_uint32_t max_real_voices;
 
 	uint64_t stream_raw_play_cursors[MaxSources];
 	std::atomic_uint64_t stream_adjusted_play_cursors_usec[MaxSources];
@@ -165,6 +224,77 @@ private:
 
 	void update_stream_play_cursor(unsigned index, double new_latency) noexcept;
 
+	// Only touched by the mixer thread, except when a stream is added to a vacant slot.
+	enum class VoiceState : uint8_t
+	{
+		New,
+		Real,
+		Virtual
+	};
+	VoiceState voice_state[MaxSources] = {};
+
+	struct VoiceCandidate
+	{
+		uint64_t key;
+		uint32_t index;
+		float gain;
+		float pan;
+		uint32_t got;
+		uint8_t bus;
+		bool real;
+#ifdef AUDIO_MIXER_DEBUG
+		uint64_t render_time_ns;
+#endif
+	};
+	VoiceCandidate voice_candidates[MaxSources];
+	uint64_t voice_keys[MaxSources];
+	uint32_t finished_channel_mask[MaxSources / 32] = {};
+	std::vector<float> scratch_buffers[Backend::MaxAudioChannels];
+	float *scratch_channels[Backend::MaxAudioChannels] = {};
+
+	// Bus 0 is the output itself, and is never allocated.
+	struct SubmixBus
+	{
+		MixerStream *output = nullptr;
+		std::vector<float> storage;
+		float *input[Backend::MaxAudioChannels] = {};
+		float *mixed[Backend::MaxAudioChannels] = {};
+		float *scratch[Backend::MaxAudioChannels] = {};
+	};
+	SubmixBus buses[MaxBuses];
+	uint32_t bus_generation[MaxBuses] = {};
+	std::atomic_uint32_t active_bus_mask;
+	std::atomic_uint32_t kill_bus_mask;
+	std::atomic_uint32_t bus_gain_linear[MaxBuses];
+	std::atomic_uint32_t bus_panning[MaxBuses];
+
+	BusID generate_bus_id(unsigned index);
+	bool verify_bus_id(BusID id) const;
+	static unsigned get_bus_index(BusID id);
+
+	// Per block, voices are sorted by bus, and every bus with voices or effects is a job.
+	// Only valid while a block is mixed.
+	uint32_t bus_voice_offsets[MaxBuses + 1];
+	uint32_t voice_order[MaxSources];
+	uint8_t mix_jobs[MaxBuses];
+	float * const *mix_output = nullptr;
+	size_t mix_num_frames = 0;
+
+	// Epoch in the upper 32 bits, then the job count, then the next job to claim.
+	std::atomic_uint64_t mix_job_state;
+	std::atomic_uint32_t mix_jobs_done;
+	std::atomic_uint32_t num_mixer_threads;
+	std::vector<std::thread> mixer_threads;
+	std::mutex mixer_thread_lock;
+	std::condition_variable mixer_thread_cond;
+	bool mixer_threads_dead = false;
+
+	void run_mix_jobs() noexcept;
+	void render_bus(unsigned bus) noexcept;
+	void render_voice(VoiceCandidate &candidate, float * const *output, float * const *scratch) noexcept;
+	void mixer_thread_loop();
+	void stop_mixer_threads();
+
 	Util::LockFreeMessageQueue message_queue;
 
 private:
@@ -38,6 +38,7 @@ public:
 
 	bool setup(float output_rate, unsigned channels, size_t frames) override;
 	size_t accumulate_samples(float * const *channels, const float *gain, size_t num_frames) noexcept override;
+	size_t skip_frames(float * const *scratch, size_t num_frames) noexcept override;
 
 	void install_message_queue(StreamID id, Util::LockFreeMessageQueue *queue) override
 	{
@@ -63,7 +64,8 @@ private:
 	size_t max_num_frames = 0;
 
 	std::vector<float> input_buffer[Backend::MaxAudioChannels];
-	std::unique_ptr<DSP::SincResampler> resamplers[Backend::MaxAudioChannels];
+	// All channels are resampled in one pass.
+	std::unique_ptr<DSP::SincResampler> resampler;
 };
 }
 }
@@ -115,6 +115,63 @@ static inline void accumulate_channel(float * __restrict output, const float * _
 #endif
 }
 
+// Gain moves linearly from start_gain towards end_gain, and reaches end_gain on the last frame.
+static inline void accumulate_channel_ramp(float * __restrict output, const float * __restrict input,
+                                           float start_gain, float end_gain, size_t count) noexcept
+{
+	if (!count)
+		return;
+
+	float step = (end_gain - start_gain) / float(count);
+	float gain = start_gain + step;
+
+#ifdef __ARM_NEON
+	size_t rounded_count = count & ~3;
+	const float ramp[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+	float32x4_t gains = vmlaq_n_f32(vdupq_n_f32(gain), vld1q_f32(ramp), step);
+	float32x4_t gain_step = vdupq_n_f32(4.0f * step);
+	for (size_t i = 0; i < rounded_count; i += 4)
+	{
+		float32x4_t acc = vld1q_f32(output);
+		float32x4_t in = vld1q_f32(input);
+		acc = vmlaq_f32(acc, in, gains);
+		vst1q_f32(output, acc);
+		gains = vaddq_f32(gains, gain_step);
+
+		output += 4;
+		input += 4;
+	}
+
+	gain += float(rounded_count) * step;
+	size_t overflow_count = count & 3;
+	for (size_t i = 0; i < overflow_count; i++, gain += step)
+		output[i] += input[i] * gain;
+#elif defined(__SSE__)
+	size_t rounded_count = count & ~3;
+	__m128 gains = _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(step)));
+	__m128 gain_step = _mm_set1_ps(4.0f * step);
+	for (size_t i = 0; i < rounded_count; i += 4)
+	{
+		__m128 acc = _mm_loadu_ps(output);
+		__m128 in = _mm_loadu_ps(input);
+		acc = _mm_add_ps(acc, _mm_mul_ps(in, gains));
+		_mm_storeu_ps(output, acc);
+		gains = _mm_add_ps(gains, gain_step);
+
+		output += 4;
+		input += 4;
+	}
+
+	gain += float(rounded_count) * step;
+	size_t overflow_count = count & 3;
+	for (size_t i = 0; i < overflow_count; i++, gain += step)
+		output[i] += input[i] * gain;
+#else
+	for (size_t i = 0; i < count; i++, gain += step)
+		output[i] += input[i] * gain;
+#endif
+}
+
 static inline void accumulate_channel_s32(float * __restrict output, const int32_t * __restrict input,
                                           float gain, size_t count) noexcept
 {
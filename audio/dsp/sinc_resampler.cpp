@@ -88,10 +88,11 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include "simd_headers.hpp"
-#include "sinc_resampler.hpp"
+#include "sinc_resampler_kernels.hpp"
 #include "aligned_alloc.hpp"
 #include "dsp.hpp"
+#include <atomic>
+#include <assert.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -106,54 +107,168 @@ namespace Audio
 {
 namespace DSP
 {
-void SincResampler::init_table_kaiser(double cutoff, unsigned phase_count, unsigned num_taps, double beta)
+namespace
 {
-	double window_mod = DSP::kaiser_window_function(0.0, beta);
-	const unsigned stride = 2;
-	double sidelobes = num_taps / 2.0;
+static const Internal::SincResamplerKernels *get_kernels_for_isa(SIMD::BatchISA isa)
+{
+	// The SIMD batch functions are built for the same instruction sets, so their CPU check applies here too.
+	if (isa == SIMD::BatchISA::Scalar)
+		return create_sinc_resampler_kernels<ScalarOps>();
+	else if (!SIMD::batch_isa_is_supported(isa))
+		return nullptr;
+	else if (isa == VectorOps::ISA)
+		return create_sinc_resampler_kernels<VectorOps>();
+	else if (isa == SIMD::BatchISA::AVX2)
+		return Internal::get_sinc_resampler_kernels_avx2();
+	else if (isa == SIMD::BatchISA::AVX512)
+		return Internal::get_sinc_resampler_kernels_avx512();
+	else
+		return nullptr;
+}
 
-	for (unsigned i = 0; i < phase_count; i++)
+static const Internal::SincResamplerKernels *select_kernels()
+{
+	// Widest first. The baseline kernels are built for whatever the build targets, so they always run.
+	static const SIMD::BatchISA candidates[] = { SIMD::BatchISA::AVX512, SIMD::BatchISA::AVX2 };
+	for (auto isa : candidates)
 	{
-		for (unsigned j = 0; j < num_taps; j++)
-		{
-			unsigned n = j * phase_count + i;
-			double window_phase = double(n) / double(phase_count * num_taps); /* [0, 1). */
-			window_phase = 2.0 * window_phase - 1.0; /* [-1, 1) */
-			double sinc_phase = sidelobes * window_phase;
-			float val = float(cutoff * DSP::sinc(PI * sinc_phase * cutoff) * DSP::kaiser_window_function(window_phase, beta) / window_mod);
-			phase_table[i * stride * num_taps + j] = val;
-		}
+		// Don't go narrower than the baseline.
+		if (isa == VectorOps::ISA)
+			break;
+		if (auto *kernels = get_kernels_for_isa(isa))
+			return kernels;
 	}
 
-	for (unsigned p = 0; p < phase_count - 1; p++)
+	return create_sinc_resampler_kernels<VectorOps>();
+}
+
+// A filter shorter than a vector would mostly multiply padding, so step down to narrower kernels.
+static const Internal::SincResamplerKernels *fit_kernels_to_taps(const Internal::SincResamplerKernels *kernels,
+                                                                 unsigned taps)
+{
+	static const SIMD::BatchISA narrower[] = { SIMD::BatchISA::AVX2, VectorOps::ISA };
+	for (auto isa : narrower)
 	{
-		for (unsigned j = 0; j < num_taps; j++)
-		{
-			float delta = phase_table[(p + 1) * stride * num_taps + j] - phase_table[p * stride * num_taps + j];
-			phase_table[(p * stride + 1) * num_taps + j] = delta;
-		}
+		if (kernels->lanes <= taps)
+			break;
+		auto *candidate = get_kernels_for_isa(isa);
+		if (candidate && candidate->lanes < kernels->lanes)
+			kernels = candidate;
 	}
 
-	unsigned phase = phase_count - 1;
-	for (unsigned j = 0; j < num_taps; j++)
+	return kernels;
+}
+
+static std::atomic<const Internal::SincResamplerKernels *> active_kernels;
+
+static const Internal::SincResamplerKernels *get_active_kernels()
+{
+	auto *kernels = active_kernels.load(std::memory_order_relaxed);
+	if (!kernels)
+	{
+		kernels = select_kernels();
+		active_kernels.store(kernels, std::memory_order_relaxed);
+	}
+	return kernels;
+}
+
+// Reduces the rate ratio to whole numbers of output and input frames, if both rates are whole numbers.
+static bool find_integer_ratio(float out_rate, float in_rate, uint32_t &out_frames, uint32_t &in_frames)
+{
+	constexpr float MaxRate = float(1 << 24);
+	if (out_rate < 1.0f || in_rate < 1.0f || out_rate > MaxRate || in_rate > MaxRate ||
+	    floorf(out_rate) != out_rate || floorf(in_rate) != in_rate)
+	{
+		return false;
+	}
+
+	auto a = uint32_t(out_rate);
+	auto b = uint32_t(in_rate);
+	uint32_t x = a, y = b;
+	while (y)
 	{
-		unsigned n = j * phase_count + (phase + 1);
-		double window_phase = double(n) / double(phase_count * num_taps); /* (0, 1]. */
-		window_phase = 2.0 * window_phase - 1.0; /* (-1, 1] */
+		uint32_t r = x % y;
+		x = y;
+		y = r;
+	}
+
+	out_frames = a / x;
+	in_frames = b / x;
+	return true;
+}
+
+static unsigned align_floats(unsigned count)
+{
+	// Keep every array in the buffer 64 byte aligned.
+	return (count + 15) & ~15u;
+}
+}
+
+SIMD::BatchISA SincResampler::get_default_isa()
+{
+	return get_active_kernels()->isa;
+}
+
+bool SincResampler::set_default_isa(SIMD::BatchISA isa)
+{
+	auto *kernels = get_kernels_for_isa(isa);
+	if (!kernels)
+		return false;
+	active_kernels.store(kernels, std::memory_order_relaxed);
+	return true;
+}
+
+SIMD::BatchISA SincResampler::get_isa() const noexcept
+{
+	return kernels->isa;
+}
+
+void SincResampler::init_table_kaiser(float *table, double cutoff, unsigned phase_count, unsigned num_taps,
+                                      double beta, bool deltas)
+{
+	double window_mod = DSP::kaiser_window_function(0.0, beta);
+	unsigned row_stride = deltas ? 2 * stride : stride;
+	double sidelobes = num_taps / 2.0;
+
+	auto filter = [&](unsigned n) -> float {
+		double window_phase = double(n) / double(phase_count * num_taps); /* [0, 1]. */
+		window_phase = 2.0 * window_phase - 1.0; /* [-1, 1] */
 		double sinc_phase = sidelobes * window_phase;
+		return float(cutoff * DSP::sinc(PI * sinc_phase * cutoff) *
+		             DSP::kaiser_window_function(window_phase, beta) / window_mod);
+	};
+
+	// Tap j applies to the frame j frames before the newest one, rows are stored oldest frame first.
+	unsigned last = stride - 1;
+	for (unsigned i = 0; i < phase_count; i++)
+		for (unsigned j = 0; j < num_taps; j++)
+			table[i * row_stride + last - j] = filter(j * phase_count + i);
 
-		float val = float(cutoff * DSP::sinc(PI * sinc_phase * cutoff) * kaiser_window_function(window_phase, beta) / window_mod);
-		float delta = (val - phase_table[phase * stride * num_taps + j]);
-		phase_table[(phase * stride + 1) * num_taps + j] = delta;
+	if (!deltas)
+		return;
+
+	for (unsigned p = 0; p < phase_count; p++)
+	{
+		for (unsigned j = 0; j < num_taps; j++)
+		{
+			// The last phase interpolates towards the first phase of the next tap.
+			float next = p + 1 < phase_count ?
+			             table[(p + 1) * row_stride + last - j] : filter(j * phase_count + phase_count);
+			table[p * row_stride + stride + last - j] = next - table[p * row_stride + last - j];
+		}
 	}
 }
 
-SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
+SincResampler::SincResampler(float out_rate, float in_rate, Quality quality, unsigned num_channels_)
+	: num_channels(num_channels_)
 {
 	double cutoff;
 	unsigned sidelobes;
 	double kaiser_beta;
 
+	if (num_channels == 0 || num_channels > MaxChannels)
+		std::abort();
+
 	switch (quality)
 	{
 	case Quality::Low:
@@ -200,27 +315,67 @@ SincResampler::SincResampler(float out_rate, float in_rate, Quality quality)
 	/* Be SIMD-friendly. */
 	taps = (taps + 3) & ~3;
 
-	unsigned phase_elems = ((1u << phase_bits) * taps);
-	phase_elems = phase_elems * 2;
-	unsigned elems = phase_elems + 2 * taps;
+	// Wider kernels read whole vectors, the padding coefficients are 0.
+	kernels = fit_kernels_to_taps(get_active_kernels(), taps);
+	stride = (taps + kernels->lanes - 1) & ~(kernels->lanes - 1);
+
+	uint32_t exact_in_frames = 0;
+	if (!find_integer_ratio(out_rate, in_rate, exact_phases, exact_in_frames) || exact_phases > (1u << phase_bits))
+		exact_phases = 0;
+	exact_ratio = exact_in_frames;
+
+	unsigned phase_elems = align_floats((1u << phase_bits) * stride * 2);
+	unsigned exact_elems = align_floats(exact_phases * stride);
+	unsigned window_elems = align_floats(stride + Internal::SincHistoryFrames);
+	unsigned elems = phase_elems + exact_elems + num_channels * window_elems;
 
 	main_buffer = static_cast<float *>(Util::memalign_calloc(128, sizeof(float) * elems));
 	if (!main_buffer)
 		throw std::bad_alloc();
 
 	phase_table = main_buffer;
-	window_buffer = main_buffer + phase_elems;
+	exact_phase_table = main_buffer + phase_elems;
+	for (unsigned c = 0; c < num_channels; c++)
+		window_buffers[c] = main_buffer + phase_elems + exact_elems + c * window_elems;
+
+	// The history starts out as stride frames of silence.
+	ptr = stride;
 
-	init_table_kaiser(cutoff, 1u << phase_bits, taps, kaiser_beta);
+	init_table_kaiser(phase_table, cutoff, 1u << phase_bits, taps, kaiser_beta, true);
 	set_sample_rate_ratio(bandwidth_mod);
+
+	if (exact_phases)
+	{
+		init_table_kaiser(exact_phase_table, cutoff, exact_phases, taps, kaiser_beta, false);
+		use_exact_phases = true;
+		phases = exact_phases;
+		fixed_ratio = exact_ratio;
+	}
 }
 
 void SincResampler::set_sample_rate_ratio(float ratio) noexcept
 {
-	phases = 1u << (phase_bits + subphase_bits);
+	uint32_t interpolated_phases = 1u << (phase_bits + subphase_bits);
+	if (use_exact_phases)
+	{
+		time = uint32_t(uint64_t(time) * interpolated_phases / phases);
+		use_exact_phases = false;
+	}
+
+	phases = interpolated_phases;
 	fixed_ratio = uint32_t(round(float(phases) / ratio));
 }
 
+bool SincResampler::is_using_exact_phases() const noexcept
+{
+	return use_exact_phases;
+}
+
+unsigned SincResampler::get_num_channels() const noexcept
+{
+	return num_channels;
+}
+
 SincResampler::~SincResampler()
 {
 	Util::memalign_free(main_buffer);
@@ -230,7 +385,7 @@ size_t SincResampler::get_maximum_input_for_output_frames(size_t out_frames) con
 {
 	uint64_t max_start_time = phases - 1;
 	max_start_time += uint64_t(fixed_ratio) * out_frames;
-	max_start_time >>= phase_bits + subphase_bits;
+	max_start_time /= phases;
 	return size_t(max_start_time);
 }
 
@@ -238,7 +393,7 @@ size_t SincResampler::get_current_input_for_output_frames(size_t out_frames) con
 {
 	uint64_t start_time = time;
 	start_time += uint64_t(fixed_ratio) * out_frames;
-	start_time >>= phase_bits + subphase_bits;
+	start_time /= phases;
 	return size_t(start_time);
 }
 
@@ -249,167 +404,92 @@ size_t SincResampler::get_maximum_output_for_input_frames(size_t in_frames) cons
 	return size_t(max_output_time);
 }
 
-template <bool accumulate>
-inline void SincResampler::process(float *output) const noexcept
+void SincResampler::fill_state(Internal::SincResamplerState &state) const noexcept
 {
-	const float *buffer = window_buffer + ptr;
-	unsigned num_taps = taps;
-	unsigned phase = time >> subphase_bits;
-
-	const float *sample_phase_table = phase_table + phase * num_taps * 2;
-	const float *delta_table = sample_phase_table + num_taps;
-
-#ifdef __SSE__
-	__m128 sum = _mm_setzero_ps();
-	__m128 delta = _mm_set1_ps(float(time & subphase_mask) * subphase_mod);
-	for (unsigned i = 0; i < num_taps; i += 4)
-	{
-		__m128 buf = _mm_loadu_ps(buffer + i);
-		__m128 deltas = _mm_load_ps(delta_table + i);
-		__m128 _sinc  = _mm_add_ps(_mm_load_ps(sample_phase_table + i), _mm_mul_ps(deltas, delta));
-		sum = _mm_add_ps(sum, _mm_mul_ps(buf, _sinc));
-	}
-
-	// Horizontal add.
-	sum = _mm_add_ps(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 2, 3)), sum);
-	sum = _mm_add_ss(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)), sum);
-
-	if (accumulate)
-		_mm_store_ss(output, _mm_add_ss(_mm_load_ss(output), sum));
-	else
-		_mm_store_ss(output, sum);
-#elif defined(__ARM_NEON)
-	float delta = float(time & subphase_mask) * subphase_mod;
-	float32x4_t sum = vdupq_n_f32(0.0f);
-	for (unsigned i = 0; i < taps; i += 4)
-	{
-		float32x4_t _phases = vld1q_f32(phase_table + i);
-		float32x4_t deltas = vld1q_f32(delta_table + i);
-		float32x4_t buf = vld1q_f32(buffer + i);
-		float32x4_t _sinc = vmlaq_n_f32(_phases, deltas, delta);
-		sum = vmlaq_f32(sum, buf, _sinc);
-	}
-
-	float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
-	float32x2_t res = vpadd_f32(half, half);
-
-	if (accumulate)
-	{
-		float32x2_t o = vld1_dup_f32(output);
-		res = vadd_f32(o, res);
-		vst1_lane_f32(output, res, 0);
-	}
-	else
-		vst1_lane_f32(output, res, 0);
-#else
-	float delta = float(time & subphase_mask) * subphase_mod;
-	float sum = 0.0f;
-	for (unsigned i = 0; i < taps; i++)
-	{
-		float sinc_val = phase_table[i] + delta_table[i] * delta;
-		sum += buffer[i] * sinc_val;
-	}
-
-	if (accumulate)
-		*output += sum;
-	else
-		*output = sum;
-#endif
+	state.phase_table = use_exact_phases ? exact_phase_table : phase_table;
+	for (unsigned c = 0; c < num_channels; c++)
+		state.windows[c] = window_buffers[c];
+	state.stride = stride;
+	state.channels = num_channels;
+	state.ptr = ptr;
+	state.fill = ptr;
+	state.capacity = stride + Internal::SincHistoryFrames;
+	state.time = time;
+	state.fixed_ratio = fixed_ratio;
+	state.phases = phases;
+	state.subphase_bits = subphase_bits;
+	state.subphase_mask = subphase_mask;
+	state.subphase_mod = subphase_mod;
 }
 
 template <bool accumulate>
-inline size_t SincResampler::process_input(float *output, const float *input, size_t in_frames) noexcept
+inline size_t SincResampler::process_input(float *const *outputs, const float *const *inputs, size_t in_frames) noexcept
 {
-	uint32_t ratio = fixed_ratio;
-	size_t rendered_frames = 0;
-
-	while (in_frames)
-	{
-		// Drain inputs.
-		while (in_frames && time >= phases)
-		{
-			// Push in reverse to make filter more obvious.
-			if (!ptr)
-				ptr = taps;
-			ptr--;
-
-			const float v = *input;
-			window_buffer[ptr + taps] = v;
-			window_buffer[ptr] = v;
-			time -= phases;
-			in_frames--;
-			input++;
-		}
-
-		// Pump out samples.
-		while (time < phases)
-		{
-			process<accumulate>(output);
-			output++;
-			time += ratio;
-			rendered_frames++;
-		}
-	}
-
-	return rendered_frames;
+	Internal::SincResamplerState state;
+	fill_state(state);
+	size_t rendered = kernels->process_input[use_exact_phases][accumulate](state, outputs, inputs, in_frames);
+	ptr = state.ptr;
+	time = state.time;
+	return rendered;
 }
 
 template <bool accumulate>
-inline size_t SincResampler::process_output(float *output, const float *input, size_t out_frames) noexcept
+inline size_t SincResampler::process_output(float *const *outputs, const float *const *inputs, size_t out_frames) noexcept
 {
-	uint32_t ratio = fixed_ratio;
-	size_t consumed_frames = 0;
+	Internal::SincResamplerState state;
+	fill_state(state);
+	size_t consumed = kernels->process_output[use_exact_phases][accumulate](state, outputs, inputs, out_frames);
+	ptr = state.ptr;
+	time = state.time;
+	return consumed;
+}
 
-	while (out_frames)
-	{
-		// Pump out samples.
-		while (out_frames && time < phases)
-		{
-			process<accumulate>(output);
-			output++;
-			out_frames--;
-			time += ratio;
-		}
+size_t SincResampler::process_output_frames(float *const *outputs, const float *const *inputs, size_t out_frames) noexcept
+{
+	return process_output<false>(outputs, inputs, out_frames);
+}
 
-		// Drain inputs.
-		while (time >= phases)
-		{
-			// Push in reverse to make filter more obvious.
-			if (!ptr)
-				ptr = taps;
-			ptr--;
-
-			const float v = input[consumed_frames];
-			window_buffer[ptr + taps] = v;
-			window_buffer[ptr] = v;
-			consumed_frames++;
-			time -= phases;
-		}
-	}
+size_t SincResampler::process_input_frames(float *const *outputs, const float *const *inputs, size_t in_frames) noexcept
+{
+	return process_input<false>(outputs, inputs, in_frames);
+}
+
+size_t SincResampler::process_and_accumulate_output_frames(float *const *outputs, const float *const *inputs,
+                                                           size_t out_frames) noexcept
+{
+	return process_output<true>(outputs, inputs, out_frames);
+}
 
-	return consumed_frames;
+size_t SincResampler::process_and_accumulate_input_frames(float *const *outputs, const float *const *inputs,
+                                                          size_t in_frames) noexcept
+{
+	return process_input<true>(outputs, inputs, in_frames);
 }
 
 size_t SincResampler::process_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept
 {
-	return process_output<false>(outputs, inputs, out_frames);
+	assert(num_channels == 1);
+	return process_output<false>(&outputs, &inputs, out_frames);
 }
 
 size_t SincResampler::process_input_frames(float *outputs, const float *inputs, size_t in_frames) noexcept
 {
-	return process_input<false>(outputs, inputs, in_frames);
+	assert(num_channels == 1);
+	return process_input<false>(&outputs, &inputs, in_frames);
 }
 
 size_t SincResampler::process_and_accumulate_output_frames(float *outputs, const float *inputs,
                                                            size_t out_frames) noexcept
 {
-	return process_output<true>(outputs, inputs, out_frames);
+	assert(num_channels == 1);
+	return process_output<true>(&outputs, &inputs, out_frames);
 }
 
 size_t SincResampler::process_and_accumulate_input_frames(float *outputs, const float *inputs,
                                                           size_t in_frames) noexcept
 {
-	return process_input<true>(outputs, inputs, in_frames);
+	assert(num_channels == 1);
+	return process_input<true>(&outputs, &inputs, in_frames);
 }
 }
 }
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include "simd_batch.hpp"
 #include <vector>
 #include <stdint.h>
 #include <stddef.h>
@@ -32,6 +33,12 @@ namespace Audio
 {
 namespace DSP
 {
+namespace Internal
+{
+struct SincResamplerKernels;
+struct SincResamplerState;
+}
+
 class SincResampler
 {
 public:
@@ -41,14 +48,27 @@ public:
 		Medium,
 		High
 	};
-	SincResampler(float out_rate, float in_rate, Quality quality);
+
+	enum { MaxChannels = 8 };
+
+	// With more than one channel, every channel is resampled in the same pass and shares the filter computation.
+	// If both rates are whole numbers with a ratio of few enough phases, like 48000 / 44100 = 160 / 147,
+	// the filter is precomputed for exactly those phases and no interpolation between phases is needed.
+	SincResampler(float out_rate, float in_rate, Quality quality, unsigned num_channels = 1);
 	~SincResampler();
 
+	// Mono. Only valid if the resampler was created with one channel.
 	size_t process_and_accumulate_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept;
 	size_t process_and_accumulate_input_frames(float *outputs, const float *inputs, size_t in_frames) noexcept;
 	size_t process_output_frames(float *outputs, const float *inputs, size_t out_frames) noexcept;
 	size_t process_input_frames(float *outputs, const float *inputs, size_t in_frames) noexcept;
 
+	// One buffer per channel.
+	size_t process_and_accumulate_output_frames(float *const *outputs, const float *const *inputs, size_t out_frames) noexcept;
+	size_t process_and_accumulate_input_frames(float *const *outputs, const float *const *inputs, size_t in_frames) noexcept;
+	size_t process_output_frames(float *const *outputs, const float *const *inputs, size_t out_frames) noexcept;
+	size_t process_input_frames(float *const *outputs, const float *const *inputs, size_t in_frames) noexcept;
+
 	void operator=(const SincResampler &) = delete;
 	SincResampler(const SincResampler &) = delete;
 
@@ -56,31 +76,50 @@ public:
 	size_t get_current_input_for_output_frames(size_t out_frames) const noexcept;
 	size_t get_maximum_output_for_input_frames(size_t in_frames) const noexcept;
 
+	// Leaves the exact phase table for the interpolated one, since the new ratio is arbitrary.
 	void set_sample_rate_ratio(float ratio) noexcept;
+	bool is_using_exact_phases() const noexcept;
+
+	unsigned get_num_channels() const noexcept;
+
+	// Convolution kernels for wider instruction sets are selected at runtime like the SIMD batch functions.
+	// A resampler keeps the instruction set which was selected when it was created.
+	SIMD::BatchISA get_isa() const noexcept;
+	static SIMD::BatchISA get_default_isa();
+	// Returns false, and leaves the selection alone, if the instruction set is not supported by the build or the CPU.
+	static bool set_default_isa(SIMD::BatchISA isa);
 
 private:
 	unsigned phase_bits = 0;
 	unsigned subphase_bits = 0;
 	unsigned subphase_mask = 0;
 	unsigned taps = 0;
+	unsigned stride = 0;
+	unsigned num_channels = 0;
 	unsigned ptr = 0;
 	uint32_t time = 0;
 	uint32_t fixed_ratio = 0;
 	uint32_t phases = 0;
 	float subphase_mod = 0.0f;
 
+	uint32_t exact_phases = 0;
+	uint32_t exact_ratio = 0;
+	bool use_exact_phases = false;
+
 	float *main_buffer = nullptr;
 	float *phase_table = nullptr;
-	float *window_buffer = nullptr;
+	float *exact_phase_table = nullptr;
+	float *window_buffers[MaxChannels] = {};
+	const Internal::SincResamplerKernels *kernels = nullptr;
 
-	void init_table_kaiser(double cutoff, unsigned phase_count, unsigned num_taps, double beta);
+	void fill_state(Internal::SincResamplerState &state) const noexcept;
+	void init_table_kaiser(float *table, double cutoff, unsigned phase_count, unsigned num_taps,
+	                       double beta, bool deltas);
 
 	template <bool accumulate>
-	inline void process(float *output) const noexcept;
-	template <bool accumulate>
-	inline size_t process_output(float *outputs, const float *inputs, size_t out_frames) noexcept;
+	inline size_t process_output(float *const *outputs, const float *const *inputs, size_t out_frames) noexcept;
 	template <bool accumulate>
-	inline size_t process_input(float *outputs, const float *inputs, size_t in_frames) noexcept;
+	inline size_t process_input(float *const *outputs, const float *const *inputs, size_t in_frames) noexcept;
 };
 }
 }
@@ -0,0 +1,367 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+// Convolution loops shared by the SincResampler translation units. Every translation unit which includes this header
+// instantiates the kernels for the instruction set it is compiled for, so everything except the kernel table
+// must have internal linkage.
+
+#include "sinc_resampler.hpp"
+#include "simd_headers.hpp"
+#include <algorithm>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace Granite
+{
+namespace Audio
+{
+namespace DSP
+{
+namespace Internal
+{
+// Input frames which are copied into the history in one go. Rendering right after storing a single input frame
+// would load the frame back with wide loads before the store has retired, which stalls on store forwarding.
+enum { SincHistoryFrames = 256 };
+
+struct SincResamplerState
+{
+	// Interpolated: per phase, a row of coefficients followed by a row of deltas to the next phase.
+	// Exact: per phase, a row of coefficients.
+	// Rows are in history order, oldest frame first.
+	const float *phase_table;
+	// Per channel, frames in input order. The filter reads the stride frames before ptr.
+	float *windows[SincResampler::MaxChannels];
+	// Row length in the phase table, taps rounded up to the kernel width. The padding coefficients are 0.
+	unsigned stride;
+	unsigned channels;
+	unsigned ptr;
+	// Frames up to fill are copied from the input, but not consumed yet.
+	unsigned fill;
+	unsigned capacity;
+	uint32_t time;
+	uint32_t fixed_ratio;
+	uint32_t phases;
+	unsigned subphase_bits;
+	uint32_t subphase_mask;
+	float subphase_mod;
+};
+
+using SincProcessFunc = size_t (*)(SincResamplerState &state, float *const *outputs,
+                                   const float *const *inputs, size_t frames);
+
+struct SincResamplerKernels
+{
+	SIMD::BatchISA isa;
+	unsigned lanes;
+	// Indexed by [exact][accumulate].
+	SincProcessFunc process_output[2][2];
+	SincProcessFunc process_input[2][2];
+};
+
+// Return nullptr if the build did not compile kernels for the instruction set.
+const SincResamplerKernels *get_sinc_resampler_kernels_avx2();
+const SincResamplerKernels *get_sinc_resampler_kernels_avx512();
+}
+
+namespace
+{
+struct ScalarOps
+{
+	using V = float;
+	enum { Lanes = 1 };
+	static constexpr SIMD::BatchISA ISA = SIMD::BatchISA::Scalar;
+	static V load(const float *p) { return *p; }
+	static V zero() { return 0.0f; }
+	static V splat(float v) { return v; }
+	static V add(V a, V b) { return a + b; }
+	static V madd(V a, V b, V c) { return a * b + c; }
+	static float reduce(V v) { return v; }
+};
+
+#if defined(__AVX512F__)
+struct VectorOps
+{
+	using V = __m512;
+	enum { Lanes = 16 };
+	static constexpr SIMD::BatchISA ISA = SIMD::BatchISA::AVX512;
+	static V load(const float *p) { return _mm512_loadu_ps(p); }
+	static V zero() { return _mm512_setzero_ps(); }
+	static V splat(float v) { return _mm512_set1_ps(v); }
+	static V add(V a, V b) { return _mm512_add_ps(a, b); }
+	static V madd(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+
+	// GCC's unmasked AVX-512 extracts and casts, which _mm512_reduce_add_ps is built on, pass an undefined
+	// source and trip -Wuninitialized. A zero-masked extract with every lane selected is the same instruction.
+	// AVX-512F has no 256-bit float extract, so go through the 64-bit lane view.
+	template <int Half>
+	static __m256 extract_half(V v)
+	{
+		return _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xff, _mm512_castps_pd(v), Half));
+	}
+
+	static float reduce(V v)
+	{
+		__m256 sum256 = _mm256_add_ps(extract_half<0>(v), extract_half<1>(v));
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum256), _mm256_extractf128_ps(sum256, 1));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(sum);
+	}
+};
+#elif defined(__AVX__)
+struct VectorOps
+{
+	using V = __m256;
+	enum { Lanes = 8 };
+#if defined(__AVX2__) && defined(__FMA__)
+	static constexpr SIMD::BatchISA ISA = SIMD::BatchISA::AVX2;
+	static V madd(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+	static constexpr SIMD::BatchISA ISA = SIMD::BatchISA::AVX;
+	static V madd(V a, V b, V c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+	static V load(const float *p) { return _mm256_loadu_ps(p); }
+	static V zero() { return _mm256_setzero_ps(); }
+	static V splat(float v) { return _mm256_set1_ps(v); }
+	static V add(V a, V b) { return _mm256_add_ps(a, b); }
+
+	static float reduce(V v)
+	{
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(sum);
+	}
+};
+#elif defined(__SSE__)
+struct VectorOps
+{
+	using V = __m128;
+	enum { Lanes = 4 };
+	static constexpr SIMD::BatchISA ISA = SIMD::BatchISA::SSE2;
+	static V load(const float *p) { return _mm_loadu_ps(p); }
+	static V zero() { return _mm_setzero_ps(); }
+	static V splat(float v) { return _mm_set1_ps(v); }
+	static V add(V a, V b) { return _mm_add_ps(a, b); }
+	static V madd(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+	static float reduce(V v)
+	{
+		v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(v);
+	}
+};
+#elif defined(__ARM_NEON)
+struct VectorOps
+{
+	using V = float32x4_t;
+	enum { Lanes = 4 };
+	static constexpr SIMD::BatchISA ISA = SIMD::BatchISA::NEON;
+	static V load(const float *p) { return vld1q_f32(p); }
+	static V zero() { return vdupq_n_f32(0.0f); }
+	static V splat(float v) { return vdupq_n_f32(v); }
+	static V add(V a, V b) { return vaddq_f32(a, b); }
+	static V madd(V a, V b, V c) { return vmlaq_f32(c, a, b); }
+
+	static float reduce(V v)
+	{
+		float32x2_t half = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+		return vget_lane_f32(vpadd_f32(half, half), 0);
+	}
+};
+#else
+struct VectorOps : ScalarOps
+{
+};
+#endif
+
+// Renders one output frame for Channels channels starting at first_channel.
+// The filter coefficients are computed once and shared by the channels.
+template <typename Ops, unsigned Channels, bool exact, bool accumulate>
+static inline void render_frame(const Internal::SincResamplerState &state, float *const *outputs,
+                                size_t frame, unsigned first_channel) noexcept
+{
+	using V = typename Ops::V;
+	unsigned stride = state.stride;
+	unsigned phase = exact ? state.time : (state.time >> state.subphase_bits);
+	const float *coeffs = state.phase_table + phase * stride * (exact ? 1 : 2);
+	const float *deltas = coeffs + stride;
+	V frac = Ops::splat(exact ? 0.0f : float(state.time & state.subphase_mask) * state.subphase_mod);
+
+	const float *windows[Channels];
+	V sums[Channels], odd_sums[Channels];
+	for (unsigned c = 0; c < Channels; c++)
+	{
+		windows[c] = state.windows[first_channel + c] + state.ptr - stride;
+		sums[c] = Ops::zero();
+		odd_sums[c] = Ops::zero();
+	}
+
+	// Two accumulators per channel, so long filters are not bound by the latency of a single chain of madds.
+	unsigned i = 0;
+	for (; i + 2 * Ops::Lanes <= stride; i += 2 * Ops::Lanes)
+	{
+		V sinc = exact ? Ops::load(coeffs + i) : Ops::madd(Ops::load(deltas + i), frac, Ops::load(coeffs + i));
+		V odd_sinc = exact ? Ops::load(coeffs + i + Ops::Lanes) :
+		             Ops::madd(Ops::load(deltas + i + Ops::Lanes), frac, Ops::load(coeffs + i + Ops::Lanes));
+		for (unsigned c = 0; c < Channels; c++)
+		{
+			sums[c] = Ops::madd(Ops::load(windows[c] + i), sinc, sums[c]);
+			odd_sums[c] = Ops::madd(Ops::load(windows[c] + i + Ops::Lanes), odd_sinc, odd_sums[c]);
+		}
+	}
+
+	if (i < stride)
+	{
+		V sinc = exact ? Ops::load(coeffs + i) : Ops::madd(Ops::load(deltas + i), frac, Ops::load(coeffs + i));
+		for (unsigned c = 0; c < Channels; c++)
+			sums[c] = Ops::madd(Ops::load(windows[c] + i), sinc, sums[c]);
+	}
+
+	for (unsigned c = 0; c < Channels; c++)
+	{
+		float *output = outputs[first_channel + c] + frame;
+		float sum = Ops::reduce(Ops::add(sums[c], odd_sums[c]));
+		*output = accumulate ? *output + sum : sum;
+	}
+}
+
+template <typename Ops, bool exact, bool accumulate>
+static inline void render_frame(const Internal::SincResamplerState &state, float *const *outputs, size_t frame) noexcept
+{
+	unsigned c = 0;
+	for (; c + 2 <= state.channels; c += 2)
+		render_frame<Ops, 2, exact, accumulate>(state, outputs, frame, c);
+	if (c < state.channels)
+		render_frame<Ops, 1, exact, accumulate>(state, outputs, frame, c);
+}
+
+static inline void push_frame(Internal::SincResamplerState &state, const float *const *inputs,
+                              size_t &copied_frames, size_t total_frames) noexcept
+{
+	if (state.ptr == state.fill)
+	{
+		if (state.fill == state.capacity)
+		{
+			// Only the frames the filter reads from are kept.
+			for (unsigned c = 0; c < state.channels; c++)
+				memmove(state.windows[c], state.windows[c] + state.ptr - state.stride, state.stride * sizeof(float));
+			state.ptr = state.stride;
+			state.fill = state.stride;
+		}
+
+		// Only copy what this call consumes, so nothing refers to the input after returning.
+		size_t count = std::min<size_t>(state.capacity - state.fill, total_frames - copied_frames);
+		for (unsigned c = 0; c < state.channels; c++)
+			memcpy(state.windows[c] + state.fill, inputs[c] + copied_frames, count * sizeof(float));
+		copied_frames += count;
+		state.fill += unsigned(count);
+	}
+
+	state.ptr++;
+}
+
+template <typename Ops, bool exact, bool accumulate>
+static size_t process_input(Internal::SincResamplerState &state, float *const *outputs,
+                            const float *const *inputs, size_t in_frames) noexcept
+{
+	size_t consumed_frames = 0;
+	size_t copied_frames = 0;
+	size_t rendered_frames = 0;
+
+	while (consumed_frames < in_frames)
+	{
+		// Drain inputs.
+		while (consumed_frames < in_frames && state.time >= state.phases)
+		{
+			push_frame(state, inputs, copied_frames, in_frames);
+			consumed_frames++;
+			state.time -= state.phases;
+		}
+
+		// Pump out samples.
+		while (state.time < state.phases)
+		{
+			render_frame<Ops, exact, accumulate>(state, outputs, rendered_frames++);
+			state.time += state.fixed_ratio;
+		}
+	}
+
+	return rendered_frames;
+}
+
+template <typename Ops, bool exact, bool accumulate>
+static size_t process_output(Internal::SincResamplerState &state, float *const *outputs,
+                             const float *const *inputs, size_t out_frames) noexcept
+{
+	size_t consumed_frames = 0;
+	size_t copied_frames = 0;
+	size_t rendered_frames = 0;
+	// Same as SincResampler::get_current_input_for_output_frames().
+	size_t in_frames = size_t((uint64_t(state.time) + uint64_t(state.fixed_ratio) * out_frames) / state.phases);
+
+	while (rendered_frames < out_frames)
+	{
+		// Pump out samples.
+		while (rendered_frames < out_frames && state.time < state.phases)
+		{
+			render_frame<Ops, exact, accumulate>(state, outputs, rendered_frames++);
+			state.time += state.fixed_ratio;
+		}
+
+		// Drain inputs.
+		while (state.time >= state.phases)
+		{
+			push_frame(state, inputs, copied_frames, in_frames);
+			consumed_frames++;
+			state.time -= state.phases;
+		}
+	}
+
+	return consumed_frames;
+}
+
+template <typename Ops>
+static const Internal::SincResamplerKernels *create_sinc_resampler_kernels()
+{
+	static const Internal::SincResamplerKernels kernels = {
+		Ops::ISA,
+		Ops::Lanes,
+		{
+			{ process_output<Ops, false, false>, process_output<Ops, false, true> },
+			{ process_output<Ops, true, false>, process_output<Ops, true, true> },
+		},
+		{
+			{ process_input<Ops, false, false>, process_input<Ops, false, true> },
+			{ process_input<Ops, true, false>, process_input<Ops, true, true> },
+		},
+	};
+	return &kernels;
+}
+}
+}
+}
+}
@@ -91,6 +91,11 @@ struct ToneFilterStream : MixerStream
 		return ret;
 	}
 
+	size_t skip_frames(float *const *, size_t num_frames) noexcept override
+	{
+		return source->skip_frames(mix_ptrs, num_frames);
+	}
+
 	unsigned get_num_channels() const override
 	{
 		return source->get_num_channels();
@@ -118,6 +123,8 @@ MixerStream *create_tone_filter_stream(MixerStream *source, float tuning_rate)
 	auto *filt = new ToneFilterStream;
 	if (!filt->init(source, tuning_rate))
 	{
+		// The caller keeps ownership of source on failure.
+		filt->source = nullptr;
 		delete filt;
 		return nullptr;
 	}
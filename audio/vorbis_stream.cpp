@@ -26,8 +26,18 @@
 #include "dsp/dsp.hpp"
 #include "stb_vorbis.h"
 #include "logging.hpp"
+#include "thread_name.hpp"
+#include "thread_priority.hpp"
+#include "lru_cache.hpp"
+#include "intrusive.hpp"
+#include "hash.hpp"
 #include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
 
 namespace Granite
 {
@@ -39,6 +49,7 @@ struct VorbisStream : MixerStream
 	bool init(const std::string &path);
 
 	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override;
+	size_t skip_frames(float * const *scratch, size_t num_frames) noexcept override;
 
 	float get_sample_rate() const override
 	{
@@ -80,19 +91,41 @@ struct VorbisStream : MixerStream
 	unsigned num_mixer_channels = 0;
 	bool looping = false;
 
+	// Skipping only moves the position, the decoder seeks there once the stream is rendered again.
+	size_t total_frames = 0;
+	size_t position = 0;
+	bool seek_pending = false;
+
 	std::vector<float> mix_buffer[Backend::MaxAudioChannels];
 	float *mix_channels[Backend::MaxAudioChannels] = {};
 };
 
+// Decoded audio is shared between every stream playing the same file.
+struct DecodedVorbisClip : Util::ThreadSafeIntrusivePtrEnabled<DecodedVorbisClip>
+{
+	std::string path;
+	std::vector<float> decoded_audio[Backend::MaxAudioChannels];
+	size_t num_frames = 0;
+	float sample_rate = 0.0f;
+	unsigned num_channels = 0;
+
+	uint64_t get_size() const
+	{
+		return uint64_t(num_frames) * num_channels * sizeof(float);
+	}
+};
+using DecodedVorbisClipHandle = Util::IntrusivePtr<DecodedVorbisClip>;
+
 struct DecodedVorbisStream : MixerStream
 {
 	bool init(const std::string &path);
 
 	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override;
+	size_t skip_frames(float * const *scratch, size_t num_frames) noexcept override;
 
 	float get_sample_rate() const override
 	{
-		return sample_rate;
+		return clip->sample_rate;
 	}
 
 	unsigned get_num_channels() const override
@@ -103,68 +136,145 @@ struct DecodedVorbisStream : MixerStream
 	bool setup(float, unsigned mixer_channels_, size_t) override
 	{
 		num_mixer_channels = mixer_channels_;
-		if (num_mixer_channels != num_input_channels && num_input_channels != 1)
+		if (num_mixer_channels != clip->num_channels && clip->num_channels != 1)
 			return false;
 
 		for (unsigned i = 0; i < num_mixer_channels; i++)
-			decoded_audio_ptr[i] = decoded_audio[num_input_channels == 1 ? 0 : i].data();
+			decoded_audio_ptr[i] = clip->decoded_audio[clip->num_channels == 1 ? 0 : i].data();
 		return true;
 	}
 
-	std::vector<float> decoded_audio[Backend::MaxAudioChannels];
+	DecodedVorbisClipHandle clip;
 	const float *decoded_audio_ptr[Backend::MaxAudioChannels] = {};
 	size_t offset = 0;
+	unsigned num_mixer_channels = 0;
+	bool looping = false;
+};
+
+// Decodes ahead into a ring buffer on the decode service's thread, the audio thread only copies out of it.
+// The ring is single producer (decode thread), single consumer (mixer).
+struct BufferedVorbisStream : MixerStream, Util::ThreadSafeIntrusivePtrEnabled<BufferedVorbisStream>
+{
+	~BufferedVorbisStream();
+	bool init(const std::string &path, float buffer_seconds);
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override;
+	size_t skip_frames(float * const *scratch, size_t num_frames) noexcept override;
+
+	float get_sample_rate() const override
+	{
+		return sample_rate;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_mixer_channels;
+	}
+
+	bool setup(float, unsigned mixer_channels_, size_t) override
+	{
+		num_mixer_channels = mixer_channels_;
+		if (num_mixer_channels != num_input_channels && num_input_channels != 1)
+			return false;
+
+		for (unsigned i = 0; i < num_mixer_channels; i++)
+			ring_channels[i] = ring.data() + (num_input_channels == 1 ? 0 : i) * ring_frames;
+		return true;
+	}
+
+	// The mixer is done with the stream, the decode service drops its reference next time it runs.
+	void dispose() override
+	{
+		disposed.store(true, std::memory_order_release);
+		release_reference();
+	}
+
+	// Called from the decode thread only. Returns the number of frames decoded.
+	size_t decode_ahead(size_t max_frames);
+	bool seek_forward(uint64_t frames);
+	uint64_t get_memory_size() const;
+
+	stb_vorbis *file = nullptr;
+	FileMappingHandle filesystem_mapping;
+	uint64_t decoder_memory = 0;
+
 	float sample_rate = 0.0f;
 	unsigned num_input_channels = 0;
 	unsigned num_mixer_channels = 0;
 	bool looping = false;
+
+	// Decoder side.
+	size_t total_frames = 0;
+	size_t position = 0;
+
+	// Planar, ring_frames per input channel.
+	std::vector<float> ring;
+	size_t ring_frames = 0;
+	const float *ring_channels[Backend::MaxAudioChannels] = {};
+
+	// Frames ever written and read. Skipping may move the read count ahead of the write count,
+	// the decoder then seeks forward to catch up.
+	std::atomic<uint64_t> write_count;
+	std::atomic<uint64_t> read_count;
+	// Set once nothing more will be written.
+	std::atomic_bool complete;
+	std::atomic_bool disposed;
+	std::atomic<uint64_t> underruns;
 };
 
-bool VorbisStream::init(const std::string &path)
+static stb_vorbis *open_vorbis_file(const std::string &path, FileMappingHandle &mapping)
 {
-	filesystem_mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
-	if (!filesystem_mapping)
-		return false;
+	mapping = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
+	if (!mapping)
+		return nullptr;
 
-	if (filesystem_mapping->get_size() == 0)
-		return false;
+	if (mapping->get_size() == 0)
+		return nullptr;
 
 	int error;
-	file = stb_vorbis_open_memory(filesystem_mapping->data<unsigned char>(),
-	                              int(filesystem_mapping->get_size()),
-	                              &error, nullptr);
+	stb_vorbis *file = stb_vorbis_open_memory(mapping->data<unsigned char>(),
+	                                          int(mapping->get_size()),
+	                                          &error, nullptr);
 	if (!file)
-	{
 		LOGE("Failed to load Vorbis file, error: %d\n", error);
+	return file;
+}
+
+bool VorbisStream::init(const std::string &path)
+{
+	file = open_vorbis_file(path, filesystem_mapping);
+	if (!file)
 		return false;
-	}
 
 	auto info = stb_vorbis_get_info(file);
 	sample_rate = info.sample_rate;
 	num_input_channels = unsigned(info.channels);
+	total_frames = stb_vorbis_stream_length_in_samples(file);
 
 	return true;
 }
 
-bool DecodedVorbisStream::init(const std::string &path)
+static DecodedVorbisClipHandle decode_vorbis_clip(const std::string &path)
 {
-	auto mapped = GRANITE_FILESYSTEM()->open_readonly_mapping(path);
-	if (!mapped)
-		return false;
-
-	int error;
-	stb_vorbis *file = stb_vorbis_open_memory(mapped->data<unsigned char>(),
-	                                          int(mapped->get_size()),
-	                                          &error, nullptr);
+	FileMappingHandle mapped;
+	stb_vorbis *file = open_vorbis_file(path, mapped);
 	if (!file)
-	{
-		LOGE("Failed to load Vorbis file, error: %d\n", error);
-		return false;
-	}
+		return {};
+
+	auto clip = Util::make_handle<DecodedVorbisClip>();
+	clip->path = path;
 
 	auto info = stb_vorbis_get_info(file);
-	sample_rate = info.sample_rate;
-	num_input_channels = unsigned(info.channels);
+	clip->sample_rate = info.sample_rate;
+	clip->num_channels = unsigned(info.channels);
+
+	unsigned num_input_channels = clip->num_channels;
+	auto &decoded_audio = clip->decoded_audio;
+
+	// Avoids growing the buffers while decoding when the length is known up front.
+	if (size_t total_frames = stb_vorbis_stream_length_in_samples(file))
+		for (unsigned c = 0; c < num_input_channels; c++)
+			decoded_audio[c].reserve(total_frames);
 
 	float block[Backend::MaxAudioChannels][256];
 	float *mix_channels[Backend::MaxAudioChannels];
@@ -176,27 +286,131 @@ bool DecodedVorbisStream::init(const std::string &path)
 		for (unsigned c = 0; c < num_input_channels; c++)
 			decoded_audio[c].insert(end(decoded_audio[c]), mix_channels[c], mix_channels[c] + ret);
 
+	stb_vorbis_close(file);
 	if (ret < 0)
-		goto error;
+		return {};
 
-	stb_vorbis_close(file);
-	return true;
+	clip->num_frames = decoded_audio[0].size();
+	return clip;
+}
 
-error:
-	stb_vorbis_close(file);
-	return false;
+namespace
+{
+struct DecodedVorbisCache
+{
+	std::mutex lock;
+	Util::LRUCache<DecodedVorbisClipHandle> lru;
+	uint64_t size = 64 * 1024 * 1024;
+	DecodedVorbisCacheStats stats = {};
+
+	DecodedVorbisCache()
+	{
+		lru.set_total_cost(size);
+	}
+
+	void prune_locked()
+	{
+		lru.prune();
+
+		unsigned count = 0;
+		for (auto itr = lru.begin(); itr != lru.end(); ++itr)
+			count++;
+
+		if (count < stats.cached_files)
+			stats.evictions += stats.cached_files - count;
+		stats.cached_files = count;
+		stats.cached_bytes = lru.get_current_cost();
+	}
+};
+}
+
+static DecodedVorbisCache &get_decoded_vorbis_cache()
+{
+	static DecodedVorbisCache cache;
+	return cache;
+}
+
+static DecodedVorbisClipHandle acquire_decoded_vorbis_clip(const std::string &path)
+{
+	auto &cache = get_decoded_vorbis_cache();
+	Util::Hasher h;
+	h.string(path);
+	auto key = h.get();
+
+	{
+		std::lock_guard<std::mutex> holder{cache.lock};
+		auto *clip = cache.lru.find_and_mark_as_recent(key);
+		if (clip && (*clip)->path == path)
+		{
+			cache.stats.hits++;
+			return *clip;
+		}
+		cache.stats.misses++;
+	}
+
+	// Decode without holding the lock, so other files can be looked up in the meantime.
+	// If two threads miss on the same file at once, both decode it.
+	auto clip = decode_vorbis_clip(path);
+	if (!clip)
+		return {};
+
+	std::lock_guard<std::mutex> holder{cache.lock};
+	uint64_t size = clip->get_size();
+	if (size && size <= cache.size)
+	{
+		bool existing = cache.lru.find_and_mark_as_recent(key) != nullptr;
+		*cache.lru.allocate(key, size) = clip;
+		if (!existing)
+			cache.stats.cached_files++;
+		cache.prune_locked();
+	}
+
+	return clip;
+}
+
+void set_decoded_vorbis_cache_size(uint64_t size)
+{
+	auto &cache = get_decoded_vorbis_cache();
+	std::lock_guard<std::mutex> holder{cache.lock};
+	cache.size = size;
+	cache.lru.set_total_cost(size);
+	cache.prune_locked();
+}
+
+DecodedVorbisCacheStats get_decoded_vorbis_cache_stats()
+{
+	auto &cache = get_decoded_vorbis_cache();
+	std::lock_guard<std::mutex> holder{cache.lock};
+	return cache.stats;
+}
+
+void clear_decoded_vorbis_cache()
+{
+	auto &cache = get_decoded_vorbis_cache();
+	std::lock_guard<std::mutex> holder{cache.lock};
+	// Not evictions.
+	cache.stats.cached_files = 0;
+	cache.lru.set_total_cost(0);
+	cache.prune_locked();
+	cache.lru.set_total_cost(cache.size);
+}
+
+bool DecodedVorbisStream::init(const std::string &path)
+{
+	clip = acquire_decoded_vorbis_clip(path);
+	return bool(clip);
 }
 
 size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const float *gains, size_t num_frames) noexcept
 {
-	size_t to_write = std::min(decoded_audio[0].size() - offset, num_frames);
+	size_t to_write = std::min(clip->num_frames - offset, num_frames);
 
 	for (unsigned c = 0; c < num_mixer_channels; c++)
 		DSP::accumulate_channel(channels[c], decoded_audio_ptr[c] + offset, gains[c], to_write);
 
 	offset += to_write;
 
-	if (offset >= decoded_audio[0].size())
+	if (offset >= clip->num_frames)
 	{
 		if (looping)
 			offset = 0;
@@ -208,7 +422,7 @@ size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const flo
 	if (spill_to_write)
 	{
 		float *modified_channels[Backend::MaxAudioChannels];
-		for (unsigned c = 0; c < num_input_channels; c++)
+		for (unsigned c = 0; c < num_mixer_channels; c++)
 			modified_channels[c] = channels[c] + to_write;
 
 		return accumulate_samples(modified_channels, gains, spill_to_write) + to_write;
@@ -217,11 +431,63 @@ size_t DecodedVorbisStream::accumulate_samples(float *const *channels, const flo
 		return to_write;
 }
 
+size_t DecodedVorbisStream::skip_frames(float *const *, size_t num_frames) noexcept
+{
+	size_t total_frames = clip->num_frames;
+	size_t to_skip = std::min(total_frames - offset, num_frames);
+	offset += to_skip;
+
+	if (offset >= total_frames)
+	{
+		if (looping && total_frames)
+		{
+			offset = (num_frames - to_skip) % total_frames;
+			return num_frames;
+		}
+		else
+			return to_skip;
+	}
+	else
+		return to_skip;
+}
+
+size_t VorbisStream::skip_frames(float *const *scratch, size_t num_frames) noexcept
+{
+	// Without a known length, we cannot tell where the stream ends without decoding it.
+	if (!total_frames)
+		return MixerStream::skip_frames(scratch, num_frames);
+
+	size_t to_skip = std::min(total_frames - position, num_frames);
+	position += to_skip;
+	seek_pending = true;
+
+	if (position >= total_frames)
+	{
+		if (looping)
+		{
+			position = (num_frames - to_skip) % total_frames;
+			return num_frames;
+		}
+		else
+			return to_skip;
+	}
+	else
+		return to_skip;
+}
+
 size_t VorbisStream::accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept
 {
+	if (seek_pending)
+	{
+		if (!stb_vorbis_seek(file, unsigned(position)))
+			return 0;
+		seek_pending = false;
+	}
+
 	auto actual_frames = stb_vorbis_get_samples_float(file, int(num_input_channels), mix_channels, int(num_frames));
 	if (actual_frames < 0)
 		return 0;
+	position += size_t(actual_frames);
 
 	for (unsigned c = 0; c < num_mixer_channels; c++)
 		DSP::accumulate_channel(channels[c], mix_channels[c], gains[c], size_t(actual_frames));
@@ -229,8 +495,9 @@ size_t VorbisStream::accumulate_samples(float * const *channels, const float *ga
 	if (looping && size_t(actual_frames) < num_frames)
 	{
 		stb_vorbis_seek_start(file);
+		position = 0;
 		float *moved_channels[Backend::MaxAudioChannels];
-		for (unsigned c = 0; c < num_input_channels; c++)
+		for (unsigned c = 0; c < num_mixer_channels; c++)
 			moved_channels[c] = channels[c] + actual_frames;
 
 		actual_frames += accumulate_samples(moved_channels, gains, num_frames - actual_frames);
@@ -244,6 +511,319 @@ VorbisStream::~VorbisStream()
 		stb_vorbis_close(file);
 }
 
+bool BufferedVorbisStream::init(const std::string &path, float buffer_seconds)
+{
+	write_count.store(0, std::memory_order_relaxed);
+	read_count.store(0, std::memory_order_relaxed);
+	complete.store(false, std::memory_order_relaxed);
+	disposed.store(false, std::memory_order_relaxed);
+	underruns.store(0, std::memory_order_relaxed);
+
+	file = open_vorbis_file(path, filesystem_mapping);
+	if (!file)
+		return false;
+
+	auto info = stb_vorbis_get_info(file);
+	sample_rate = info.sample_rate;
+	num_input_channels = unsigned(info.channels);
+	total_frames = stb_vorbis_stream_length_in_samples(file);
+	decoder_memory = info.setup_memory_required + info.setup_temp_memory_required + info.temp_memory_required;
+
+	if (num_input_channels == 0 || num_input_channels > Backend::MaxAudioChannels)
+		return false;
+
+	// Power of two, so the ring can be indexed with a mask.
+	size_t target_frames = size_t(sample_rate * buffer_seconds);
+	ring_frames = 4096;
+	while (ring_frames < target_frames)
+		ring_frames <<= 1;
+	ring.resize(ring_frames * num_input_channels);
+	return true;
+}
+
+BufferedVorbisStream::~BufferedVorbisStream()
+{
+	if (file)
+		stb_vorbis_close(file);
+}
+
+uint64_t BufferedVorbisStream::get_memory_size() const
+{
+	return ring.size() * sizeof(float) + decoder_memory;
+}
+
+bool BufferedVorbisStream::seek_forward(uint64_t frames)
+{
+	if (total_frames)
+	{
+		uint64_t target = position + frames;
+		if (target >= total_frames)
+		{
+			if (!looping)
+				return false;
+			target %= total_frames;
+		}
+
+		position = size_t(target);
+		return stb_vorbis_seek(file, unsigned(position)) != 0;
+	}
+
+	// Without a known length, decode and throw the audio away.
+	// The read count is ahead of the write count, so nothing in the ring is being read.
+	float *ptrs[Backend::MaxAudioChannels];
+	for (unsigned c = 0; c < num_input_channels; c++)
+		ptrs[c] = ring.data() + c * ring_frames;
+
+	while (frames)
+	{
+		int ret = stb_vorbis_get_samples_float(file, int(num_input_channels), ptrs,
+		                                       int(std::min<uint64_t>(frames, ring_frames)));
+		if (ret == 0 && looping && position != 0)
+		{
+			stb_vorbis_seek_start(file);
+			position = 0;
+		}
+		else if (ret <= 0)
+			return false;
+		else
+		{
+			position += size_t(ret);
+			frames -= uint64_t(ret);
+		}
+	}
+
+	return true;
+}
+
+size_t BufferedVorbisStream::decode_ahead(size_t max_frames)
+{
+	if (complete.load(std::memory_order_relaxed))
+		return 0;
+
+	uint64_t written = write_count.load(std::memory_order_relaxed);
+	uint64_t read = read_count.load(std::memory_order_acquire);
+
+	if (read > written)
+	{
+		if (!seek_forward(read - written))
+		{
+			complete.store(true, std::memory_order_release);
+			return 0;
+		}
+
+		written = read;
+		write_count.store(written, std::memory_order_release);
+	}
+
+	size_t to_decode = std::min<size_t>(ring_frames - size_t(written - read), max_frames);
+	size_t decoded = 0;
+	float *ptrs[Backend::MaxAudioChannels];
+
+	while (decoded < to_decode)
+	{
+		size_t index = size_t(written) & (ring_frames - 1);
+		size_t count = std::min(to_decode - decoded, ring_frames - index);
+		for (unsigned c = 0; c < num_input_channels; c++)
+			ptrs[c] = ring.data() + c * ring_frames + index;
+
+		int ret = stb_vorbis_get_samples_float(file, int(num_input_channels), ptrs, int(count));
+		if (ret == 0 && looping && position != 0)
+		{
+			stb_vorbis_seek_start(file);
+			position = 0;
+		}
+		else if (ret <= 0)
+		{
+			// Everything written so far is visible to the mixer once it observes complete.
+			complete.store(true, std::memory_order_release);
+			break;
+		}
+		else
+		{
+			position += size_t(ret);
+			written += uint64_t(ret);
+			decoded += size_t(ret);
+			write_count.store(written, std::memory_order_release);
+		}
+	}
+
+	return decoded;
+}
+
+size_t BufferedVorbisStream::accumulate_samples(float *const *channels, const float *gains, size_t num_frames) noexcept
+{
+	// Observe completion before the write count, so we cannot end the stream before reading the last frames.
+	bool done = complete.load(std::memory_order_acquire);
+	uint64_t written = write_count.load(std::memory_order_acquire);
+	uint64_t read = read_count.load(std::memory_order_relaxed);
+
+	size_t to_read = written > read ? size_t(std::min<uint64_t>(written - read, num_frames)) : 0;
+	size_t offset = 0;
+	while (offset < to_read)
+	{
+		size_t index = size_t(read + offset) & (ring_frames - 1);
+		size_t count = std::min(to_read - offset, ring_frames - index);
+		for (unsigned c = 0; c < num_mixer_channels; c++)
+			DSP::accumulate_channel(channels[c] + offset, ring_channels[c] + index, gains[c], count);
+		offset += count;
+	}
+
+	if (to_read)
+		read_count.store(read + to_read, std::memory_order_release);
+
+	if (to_read == num_frames || done)
+		return to_read;
+
+	// The decoder fell behind, play silence rather than ending the stream.
+	underruns.store(underruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	return num_frames;
+}
+
+size_t BufferedVorbisStream::skip_frames(float *const *, size_t num_frames) noexcept
+{
+	bool done = complete.load(std::memory_order_acquire);
+	uint64_t written = write_count.load(std::memory_order_acquire);
+	uint64_t read = read_count.load(std::memory_order_relaxed);
+
+	if (done)
+	{
+		size_t to_skip = written > read ? size_t(std::min<uint64_t>(written - read, num_frames)) : 0;
+		read_count.store(read + to_skip, std::memory_order_release);
+		return to_skip;
+	}
+
+	// If this skips past what has been decoded, the decoder seeks forward.
+	read_count.store(read + num_frames, std::memory_order_release);
+	return num_frames;
+}
+
+struct VorbisDecodeService::Impl
+{
+	explicit Impl(float buffer_seconds_)
+		: buffer_seconds(buffer_seconds_)
+	{
+		decoded_frames.store(0, std::memory_order_relaxed);
+	}
+
+	void decode_loop();
+
+	float buffer_seconds;
+	std::thread decode_thread;
+
+	mutable std::mutex lock;
+	std::condition_variable cond;
+	std::vector<Util::IntrusivePtr<BufferedVorbisStream>> streams;
+	uint64_t retired_underruns = 0;
+	bool running = false;
+
+	std::atomic<uint64_t> decoded_frames;
+};
+
+void VorbisDecodeService::Impl::decode_loop()
+{
+	// Decode in small chunks round robin, so one stream catching up after a long skip
+	// does not starve the others.
+	constexpr size_t DecodeChunkFrames = 2048;
+
+	// Wake up often enough that the rings never drain fully between passes.
+	auto refill_interval = std::chrono::microseconds(
+			std::max<int64_t>(1000, int64_t(buffer_seconds * 1e6f) / 8));
+
+	Util::set_current_thread_name("vorbis-decode");
+	// Falling behind is audible, unlike most background work.
+	Util::set_current_thread_priority(Util::ThreadPriority::High);
+
+	std::vector<Util::IntrusivePtr<BufferedVorbisStream>> active;
+	std::unique_lock<std::mutex> holder{lock};
+
+	while (running)
+	{
+		// Streams the mixer has disposed are only kept alive by us now.
+		auto itr = std::remove_if(streams.begin(), streams.end(),
+		                          [this](const Util::IntrusivePtr<BufferedVorbisStream> &stream) {
+			                          if (!stream->disposed.load(std::memory_order_acquire))
+				                          return false;
+			                          retired_underruns += stream->underruns.load(std::memory_order_relaxed);
+			                          return true;
+		                          });
+		streams.erase(itr, streams.end());
+		active = streams;
+		holder.unlock();
+
+		size_t decoded;
+		do
+		{
+			decoded = 0;
+			for (auto &stream : active)
+				decoded += stream->decode_ahead(DecodeChunkFrames);
+			decoded_frames.fetch_add(decoded, std::memory_order_relaxed);
+		} while (decoded);
+
+		active.clear();
+		holder.lock();
+		if (running)
+			cond.wait_for(holder, refill_interval);
+	}
+}
+
+VorbisDecodeService::VorbisDecodeService(float buffer_seconds)
+{
+	impl = std::make_unique<Impl>(buffer_seconds);
+	impl->running = true;
+	impl->decode_thread = std::thread(&Impl::decode_loop, impl.get());
+}
+
+VorbisDecodeService::~VorbisDecodeService()
+{
+	{
+		std::lock_guard<std::mutex> holder{impl->lock};
+		impl->running = false;
+	}
+	impl->cond.notify_one();
+	impl->decode_thread.join();
+
+	// Streams still playing end once they have drained their buffers.
+	for (auto &stream : impl->streams)
+		stream->complete.store(true, std::memory_order_release);
+}
+
+MixerStream *VorbisDecodeService::create_stream(const std::string &path, bool looping)
+{
+	auto vorbis = new BufferedVorbisStream;
+	if (!vorbis->init(path, impl->buffer_seconds))
+	{
+		vorbis->dispose();
+		return nullptr;
+	}
+
+	vorbis->looping = looping;
+
+	// Prime the buffer here, so the stream can start playing before the decode thread gets to it.
+	constexpr size_t PrimeFrames = 4096;
+	impl->decoded_frames.fetch_add(vorbis->decode_ahead(PrimeFrames), std::memory_order_relaxed);
+
+	// The mixer owns one reference, the decode thread another.
+	vorbis->add_reference();
+	std::lock_guard<std::mutex> holder{impl->lock};
+	impl->streams.emplace_back(vorbis);
+	return vorbis;
+}
+
+VorbisDecodeService::Stats VorbisDecodeService::get_stats() const
+{
+	Stats stats = {};
+	std::lock_guard<std::mutex> holder{impl->lock};
+	stats.num_streams = unsigned(impl->streams.size());
+	stats.decoded_frames = impl->decoded_frames.load(std::memory_order_relaxed);
+	stats.underruns = impl->retired_underruns;
+	for (auto &stream : impl->streams)
+	{
+		stats.buffer_bytes += stream->get_memory_size();
+		stats.underruns += stream->underruns.load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
 MixerStream *create_vorbis_stream(const std::string &path, bool looping)
 {
 	auto vorbis = new VorbisStream;
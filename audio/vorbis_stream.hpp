@@ -23,13 +23,66 @@
 #pragma once
 
 #include "audio_mixer.hpp"
+#include <memory>
 #include <string>
+#include <stdint.h>
 
 namespace Granite
 {
 namespace Audio
 {
+// Decodes on the audio thread while playing.
 MixerStream *create_vorbis_stream(const std::string &path, bool looping = false);
+
+// Decodes the whole file up front. Decoded files are kept in a cache which is shared by all streams,
+// so playing the same short clip again does not decode it again.
 MixerStream *create_decoded_vorbis_stream(const std::string &path, bool looping = false);
+
+struct DecodedVorbisCacheStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t cached_bytes;
+	unsigned cached_files;
+};
+
+// Bytes of decoded audio to keep around, the least recently used files are evicted first.
+// Files which are larger than the cache are decoded every time. 0 disables the cache.
+// Streams keep their decoded audio alive even if it is evicted.
+void set_decoded_vorbis_cache_size(uint64_t size);
+DecodedVorbisCacheStats get_decoded_vorbis_cache_stats();
+void clear_decoded_vorbis_cache();
+
+// Decodes streams ahead of playback on a dedicated thread, so the audio thread only
+// copies decoded audio out of a lock-free ring buffer per stream.
+// The thread wakes up a few times per buffer length and sleeps while all buffers are full.
+// Streams outlive the service, but end once they have played what was decoded.
+class VorbisDecodeService
+{
+public:
+	explicit VorbisDecodeService(float buffer_seconds = 0.5f);
+	~VorbisDecodeService();
+
+	VorbisDecodeService(const VorbisDecodeService &) = delete;
+	void operator=(const VorbisDecodeService &) = delete;
+
+	MixerStream *create_stream(const std::string &path, bool looping = false);
+
+	struct Stats
+	{
+		unsigned num_streams;
+		// Ring buffers and decoder state.
+		uint64_t buffer_bytes;
+		uint64_t decoded_frames;
+		// Blocks where a stream ran out of decoded audio and played silence instead.
+		uint64_t underruns;
+	};
+	Stats get_stats() const;
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> impl;
+};
 }
 }
@@ -21,9 +21,214 @@
  */
 
 #include "ecs.hpp"
+#include "aligned_alloc.hpp"
+#include <string.h>
 
 namespace Granite
 {
+static size_t align_offset(size_t offset, size_t alignment)
+{
+	return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+Archetype::Archetype(std::vector<const ComponentTypeInfo *> types_)
+	: types(std::move(types_))
+{
+	offsets.resize(types.size());
+
+	// Start every array on a cache line.
+	constexpr size_t ArrayAlignment = 64;
+	auto compute_layout = [&](unsigned count) -> size_t {
+		size_t offset = 0;
+		for (size_t i = 0; i < types.size(); i++)
+		{
+			offset = align_offset(offset, std::max<size_t>(types[i]->alignment, ArrayAlignment));
+			offsets[i] = offset;
+			offset += types[i]->size * count;
+		}
+		offset = align_offset(offset, alignof(Entity *));
+		entities_offset = offset;
+		return offset + sizeof(Entity *) * count;
+	};
+
+	size_t row_size = sizeof(Entity *);
+	for (auto *type : types)
+		row_size += type->size;
+
+	capacity = std::max<unsigned>(1, unsigned(ChunkSize / row_size));
+	while (capacity > 1 && compute_layout(capacity) > ChunkSize)
+		capacity--;
+
+	// Very large components end up with one entity per chunk, and such chunks may exceed ChunkSize.
+	chunk_bytes = std::max<size_t>(compute_layout(capacity), ChunkSize);
+}
+
+Archetype::~Archetype()
+{
+	for (auto &chunk : chunks)
+	{
+		for (size_t i = 0; i < types.size(); i++)
+		{
+			auto *type = types[i];
+			for (unsigned row = 0; row < chunk.count; row++)
+				type->destroy(chunk.data + offsets[i] + row * type->size);
+		}
+		Util::memalign_free(chunk.data);
+	}
+}
+
+void Archetype::allocate_row(Entity &entity)
+{
+	if (chunks.empty() || chunks.back().count == capacity)
+	{
+		Chunk chunk = {};
+		chunk.data = static_cast<uint8_t *>(Util::memalign_alloc(64, chunk_bytes));
+		if (!chunk.data)
+			throw std::bad_alloc();
+		chunk.entities = reinterpret_cast<Entity **>(chunk.data + entities_offset);
+		chunks.push_back(chunk);
+	}
+
+	auto &chunk = chunks.back();
+	entity.archetype = this;
+	entity.archetype_chunk = unsigned(chunks.size() - 1);
+	entity.archetype_row = chunk.count;
+	chunk.entities[chunk.count++] = &entity;
+}
+
+void Archetype::free_row(unsigned chunk_index, unsigned row)
+{
+	// Keep every chunk but the last one full by filling the hole with the very last row.
+	auto &last_chunk = chunks.back();
+	unsigned last_row = last_chunk.count - 1;
+	auto &chunk = chunks[chunk_index];
+
+	if (&chunk != &last_chunk || row != last_row)
+	{
+		for (size_t i = 0; i < types.size(); i++)
+		{
+			auto *type = types[i];
+			void *src = last_chunk.data + offsets[i] + last_row * type->size;
+			type->move_construct(chunk.data + offsets[i] + row * type->size, src);
+			type->destroy(src);
+		}
+
+		Entity *moved = last_chunk.entities[last_row];
+		chunk.entities[row] = moved;
+		moved->archetype_chunk = chunk_index;
+		moved->archetype_row = row;
+	}
+
+	if (--last_chunk.count == 0)
+	{
+		Util::memalign_free(last_chunk.data);
+		chunks.pop_back();
+	}
+}
+
+EntityPool::EntityPool(EntityStorage storage_)
+	: storage(storage_)
+{
+}
+
+Archetype *EntityPool::get_archetype(const std::vector<const ComponentTypeInfo *> &types)
+{
+	Util::Hasher h;
+	for (auto *type : types)
+		h.u64(type->id);
+
+	auto *archetype = archetypes.find(h.get());
+	if (!archetype)
+		archetype = archetypes.emplace_yield(h.get(), types);
+	return archetype;
+}
+
+Archetype *EntityPool::get_archetype_with(Archetype *archetype, const ComponentTypeInfo *info)
+{
+	if (archetype)
+		if (auto *edge = archetype->add_edges.find(info->id))
+			return edge->get();
+
+	std::vector<const ComponentTypeInfo *> types;
+	if (archetype)
+		types = archetype->get_types();
+	auto itr = std::lower_bound(types.begin(), types.end(), info->id, [](const ComponentTypeInfo *a, ComponentType id) {
+		return a->id < id;
+	});
+	types.insert(itr, info);
+
+	auto *next = get_archetype(types);
+	if (archetype)
+		archetype->add_edges.emplace_replace(info->id, next);
+	return next;
+}
+
+Archetype *EntityPool::get_archetype_without(Archetype *archetype, ComponentType id)
+{
+	if (auto *edge = archetype->remove_edges.find(id))
+		return edge->get();
+
+	std::vector<const ComponentTypeInfo *> types;
+	for (auto *type : archetype->get_types())
+		if (type->id != id)
+			types.push_back(type);
+
+	// Entities without any components do not belong to an archetype.
+	Archetype *next = types.empty() ? nullptr : get_archetype(types);
+	archetype->remove_edges.emplace_replace(id, next);
+	return next;
+}
+
+void EntityPool::move_entity_to_archetype(Entity &entity, Archetype *archetype)
+{
+	auto *old_archetype = entity.archetype;
+	unsigned old_chunk = entity.archetype_chunk;
+	unsigned old_row = entity.archetype_row;
+
+	if (archetype)
+		archetype->allocate_row(entity);
+	else
+		entity.archetype = nullptr;
+
+	if (old_archetype)
+	{
+		// Move the components we keep, destroy the rest.
+		auto &old_types = old_archetype->get_types();
+		for (size_t i = 0; i < old_types.size(); i++)
+		{
+			auto *type = old_types[i];
+			void *src = old_archetype->get_component(unsigned(i), old_chunk, old_row);
+			int index = archetype ? archetype->find_component(type->id) : -1;
+			if (index >= 0)
+			{
+				type->move_construct(archetype->get_component(unsigned(index),
+				                                              entity.archetype_chunk,
+				                                              entity.archetype_row), src);
+			}
+			type->destroy(src);
+		}
+
+		old_archetype->free_row(old_chunk, old_row);
+	}
+
+	structure_version++;
+}
+
+void EntityPool::free_archetype_component(Entity &entity, ComponentType id)
+{
+	if (!entity.archetype || entity.archetype->find_component(id) < 0)
+		return;
+	move_entity_to_archetype(entity, get_archetype_without(entity.archetype, id));
+}
+
+void EntityPool::rebuild_group(EntityGroupBase &group)
+{
+	group.reset();
+	for (auto *entity : entities)
+		group.add_entity(*entity);
+	group.structure_version = structure_version;
+}
+
 Entity *EntityPool::create_entity()
 {
 	Util::Hasher hasher;
@@ -34,12 +239,18 @@ Entity *EntityPool::create_entity()
 	return entity;
 }
 
-void EntityPool::free_component(Entity &entity, ComponentType id, ComponentNode *component)
+void EntityPool::free_component_storage(ComponentType id, ComponentNode *component)
 {
 	auto *c = component_types.find(id);
 	assert(c);
 	c->free_component(component->get());
 	component_nodes.free(component);
+	structure_version++;
+}
+
+void EntityPool::free_component(Entity &entity, ComponentType id, ComponentNode *component)
+{
+	free_component_storage(id, component);
 
 	auto *component_groups = component_to_groups.find(id);
 	if (component_groups)
@@ -55,6 +266,16 @@ void EntityPool::free_component(Entity &entity, ComponentType id, ComponentNode
 
 void EntityPool::delete_entity(Entity *entity)
 {
+	if (entity->archetype)
+	{
+		auto *archetype = entity->archetype;
+		auto &types = archetype->get_types();
+		for (size_t i = 0; i < types.size(); i++)
+			types[i]->destroy(archetype->get_component(unsigned(i), entity->archetype_chunk, entity->archetype_row));
+		archetype->free_row(entity->archetype_chunk, entity->archetype_row);
+		structure_version++;
+	}
+
 	{
 		auto &components = entity->get_components();
 		auto &list = components.inner_list();
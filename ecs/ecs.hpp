@@ -26,6 +26,8 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <utility>
+#include <new>
 #include "object_pool.hpp"
 #include "intrusive.hpp"
 #include "intrusive_hash_map.hpp"
@@ -111,6 +113,109 @@ struct ComponentIDMapping
 	}
 };
 
+// Type-erased operations needed to move components between archetype chunks.
+struct ComponentTypeInfo
+{
+	ComponentType id;
+	size_t size;
+	size_t alignment;
+	void (*move_construct)(void *dst, void *src);
+	void (*destroy)(void *component);
+
+	template <typename T>
+	static const ComponentTypeInfo *get()
+	{
+		static const ComponentTypeInfo info = {
+			ComponentIDMapping::get_id<T>(), sizeof(T), alignof(T),
+			[](void *dst, void *src) { new (dst) T(std::move(*static_cast<T *>(src))); },
+			[](void *component) { static_cast<T *>(component)->~T(); },
+		};
+		return &info;
+	}
+};
+
+enum class EntityStorage
+{
+	// Every component is a separate pool allocation. Component pointers are stable for the lifetime of the component.
+	PerComponent,
+	// Entities with the same set of components share fixed size chunks with one contiguous array per component type.
+	// Adding or removing components moves the entity to another archetype, and deleting an entity moves another
+	// entity into its slot, so component pointers are only stable until the next structural change.
+	// Entity pointers are always stable.
+	Archetype
+};
+
+// All entities with one particular set of components.
+class Archetype : public Util::IntrusiveHashMapEnabled<Archetype>
+{
+public:
+	enum { ChunkSize = 16 * 1024 };
+
+	// types must be sorted by ID.
+	explicit Archetype(std::vector<const ComponentTypeInfo *> types);
+	~Archetype();
+
+	Archetype(const Archetype &) = delete;
+	void operator=(const Archetype &) = delete;
+
+	struct Chunk
+	{
+		uint8_t *data;
+		Entity **entities;
+		unsigned count;
+	};
+
+	int find_component(ComponentType id) const
+	{
+		for (size_t i = 0; i < types.size(); i++)
+			if (types[i]->id == id)
+				return int(i);
+		return -1;
+	}
+
+	void *get_component(unsigned index, unsigned chunk, unsigned row) const
+	{
+		return chunks[chunk].data + offsets[index] + row * types[index]->size;
+	}
+
+	void *get_component_array(unsigned index, const Chunk &chunk) const
+	{
+		return chunk.data + offsets[index];
+	}
+
+	const std::vector<const ComponentTypeInfo *> &get_types() const
+	{
+		return types;
+	}
+
+	const std::vector<Chunk> &get_chunks() const
+	{
+		return chunks;
+	}
+
+	unsigned get_chunk_capacity() const
+	{
+		return capacity;
+	}
+
+	// Appends a row for the entity. Component storage is left unconstructed.
+	void allocate_row(Entity &entity);
+	// Components in the row must already be destroyed or moved from. The last row is moved into its place.
+	void free_row(unsigned chunk, unsigned row);
+
+	// Caches archetype transitions when adding or removing a component type.
+	Util::IntrusiveHashMap<Util::IntrusivePODWrapper<Archetype *>> add_edges;
+	Util::IntrusiveHashMap<Util::IntrusivePODWrapper<Archetype *>> remove_edges;
+
+private:
+	std::vector<const ComponentTypeInfo *> types;
+	std::vector<size_t> offsets;
+	size_t entities_offset = 0;
+	size_t chunk_bytes = 0;
+	unsigned capacity = 0;
+	std::vector<Chunk> chunks;
+};
+
 class EntityGroupBase : public Util::IntrusiveHashMapEnabled<EntityGroupBase>
 {
 public:
@@ -118,9 +223,13 @@ public:
 	virtual void add_entity(Entity &entity) = 0;
 	virtual void remove_entity(const Entity &entity) = 0;
 	virtual void reset() = 0;
+
+	// With archetype storage, groups are rebuilt lazily when this does not match the pool.
+	uint64_t structure_version = 0;
 };
 
 class EntityPool;
+class EntityCommandBuffer;
 
 struct EntityDeleter
 {
@@ -131,6 +240,8 @@ class Entity : public Util::IntrusiveListEnabled<Entity>
 {
 public:
 	friend class EntityPool;
+	friend class Archetype;
+	friend class EntityCommandBuffer;
 
 	Entity(EntityPool *pool_, Util::Hash hash_)
 		: pool(pool_), hash(hash_)
@@ -139,6 +250,8 @@ public:
 
 	bool has_component(ComponentType id) const
 	{
+		if (archetype)
+			return archetype->find_component(id) >= 0;
 		auto itr = components.find(id);
 		return itr != nullptr;
 	}
@@ -152,6 +265,9 @@ public:
 	template <typename T>
 	T *get_component()
 	{
+		if (archetype)
+			return static_cast<T *>(get_archetype_component(ComponentIDMapping::get_id<T>()));
+
 		auto *t = components.find(ComponentIDMapping::get_id<T>());
 		if (t)
 			return static_cast<T *>(t->get());
@@ -162,6 +278,9 @@ public:
 	template <typename T>
 	const T *get_component() const
 	{
+		if (archetype)
+			return static_cast<const T *>(get_archetype_component(ComponentIDMapping::get_id<T>()));
+
 		auto *t = components.find(ComponentIDMapping::get_id<T>());
 		if (t)
 			return static_cast<const T *>(t->get());
@@ -203,6 +322,19 @@ private:
 	size_t pool_offset = 0;
 	ComponentHashMap components;
 	bool marked = false;
+	// Set while an EntityCommandBuffer plays back a destroy of this entity.
+	bool command_destroyed = false;
+
+	// Only used with archetype storage, null until the first component is allocated.
+	Archetype *archetype = nullptr;
+	unsigned archetype_chunk = 0;
+	unsigned archetype_row = 0;
+
+	void *get_archetype_component(ComponentType id) const
+	{
+		int index = archetype->find_component(id);
+		return index >= 0 ? archetype->get_component(unsigned(index), archetype_chunk, archetype_row) : nullptr;
+	}
 };
 
 template <typename... Ts>
@@ -309,12 +441,27 @@ public:
 	~EntityPool();
 
 	EntityPool() = default;
+	explicit EntityPool(EntityStorage storage);
 	void operator=(const EntityPool &) = delete;
 	EntityPool(const EntityPool &) = delete;
 
+	EntityStorage get_storage() const
+	{
+		return storage;
+	}
+
 	Entity *create_entity();
 	void delete_entity(Entity *entity);
 
+	// Changes whenever an entity gains or loses a component, or is deleted with components,
+	// with either storage. Caches of component pointers can compare against it to detect stale data.
+	uint64_t get_structure_version() const
+	{
+		return structure_version;
+	}
+
+	// With archetype storage, the returned group is only valid until the next structural change.
+	// Call get_component_group() again to refresh it.
 	template <typename... Ts>
 	EntityGroup<Ts...> *get_component_group_holder()
 	{
@@ -331,11 +478,48 @@ public:
 			auto *group = static_cast<EntityGroup<Ts...> *>(t);
 			for (auto &entity : entities)
 				group->add_entity(*entity);
+			group->structure_version = structure_version;
 		}
+		else if (storage == EntityStorage::Archetype && t->structure_version != structure_version)
+			rebuild_group(*t);
 
 		return static_cast<EntityGroup<Ts...> *>(t);
 	}
 
+	// Calls func(size_t count, Entity * const *entities, Ts *... components) for contiguous runs of entities
+	// which have all of Ts. With archetype storage, every run is one chunk.
+	// Per-component storage has no contiguous storage to expose, so every run is a single entity.
+	// Must not make structural changes to the pool while iterating.
+	template <typename... Ts, typename Func>
+	void for_each_chunk(Func &&func)
+	{
+		static_assert(sizeof...(Ts) > 0, "Need at least one component type.");
+
+		if (storage == EntityStorage::Archetype)
+		{
+			for (auto &archetype : archetypes)
+				for_each_archetype_chunk<Ts...>(archetype, func, std::index_sequence_for<Ts...>());
+		}
+		else
+		{
+			auto *group = get_component_group_holder<Ts...>();
+			auto &group_entities = group->get_entities();
+			auto &group_components = group->get_groups();
+			for (size_t i = 0, n = group_entities.size(); i < n; i++)
+				for_each_group_entry(group_entities.data() + i, group_components[i], func, std::index_sequence_for<Ts...>());
+		}
+	}
+
+	// Calls func(Ts &... components) for every entity which has all of Ts.
+	template <typename... Ts, typename Func>
+	void for_each(Func &&func)
+	{
+		for_each_chunk<Ts...>([&func](size_t count, Entity * const *, Ts *... components) {
+			for (size_t i = 0; i < count; i++)
+				func(components[i]...);
+		});
+	}
+
 	template <typename... Ts>
 	const ComponentGroupVector<Ts...> &get_component_group()
 	{
@@ -352,6 +536,58 @@ public:
 
 	template <typename T, typename... Ts>
 	T *allocate_component(Entity &entity, Ts&&... ts)
+	{
+		constexpr ComponentType id = ComponentIDMapping::get_id<T>();
+		if (storage == EntityStorage::Archetype)
+		{
+			if (entity.archetype)
+			{
+				if (auto *comp = static_cast<T *>(entity.get_archetype_component(id)))
+				{
+					comp->~T();
+					return new (comp) T(std::forward<Ts>(ts)...);
+				}
+			}
+
+			move_entity_to_archetype(entity, get_archetype_with(entity.archetype, ComponentTypeInfo::get<T>()));
+			return new (entity.get_archetype_component(id)) T(std::forward<Ts>(ts)...);
+		}
+
+		bool inserted;
+		auto *comp = allocate_component_storage<T>(entity, inserted, std::forward<Ts>(ts)...);
+		if (inserted)
+		{
+			auto *component_groups = component_to_groups.find(id);
+			if (component_groups)
+				for (auto &group : *component_groups)
+					groups.find(group.get_hash())->add_entity(entity);
+		}
+
+		return comp;
+	}
+
+	void free_component(Entity &entity, ComponentType id, ComponentNode *component);
+	void free_archetype_component(Entity &entity, ComponentType id);
+	void reset_groups();
+	void reset_groups_for_component_type(ComponentType id);
+
+private:
+	friend class EntityCommandBuffer;
+	EntityStorage storage = EntityStorage::PerComponent;
+	// Declared before entity_pool and groups so it is destroyed last.
+	Util::IntrusiveHashMap<Archetype> archetypes;
+	uint64_t structure_version = 0;
+
+	Archetype *get_archetype(const std::vector<const ComponentTypeInfo *> &types);
+	Archetype *get_archetype_with(Archetype *archetype, const ComponentTypeInfo *info);
+	Archetype *get_archetype_without(Archetype *archetype, ComponentType id);
+	void move_entity_to_archetype(Entity &entity, Archetype *archetype);
+	void rebuild_group(EntityGroupBase &group);
+
+	// Per-component storage without updating groups.
+	// inserted is set if the entity did not have the component before.
+	template <typename T, typename... Ts>
+	T *allocate_component_storage(Entity &entity, bool &inserted, Ts&&... ts)
 	{
 		constexpr ComponentType id = ComponentIDMapping::get_id<T>();
 		auto *t = component_types.find(id);
@@ -367,6 +603,7 @@ public:
 
 		if (existing)
 		{
+			inserted = false;
 			auto *comp = static_cast<T *>(existing->get());
 			// In-place modify. Destroy old data, and in-place construct.
 			// Do not need to fiddle with data structures internally.
@@ -375,25 +612,40 @@ public:
 		}
 		else
 		{
+			inserted = true;
 			auto *comp = allocator->pool.allocate(std::forward<Ts>(ts)...);
 			auto *node = component_nodes.allocate(comp);
 			node->set_hash(id);
 			entity.components.insert_replace(node);
+			structure_version++;
+			return comp;
+		}
+	}
 
-			auto *component_groups = component_to_groups.find(id);
-			if (component_groups)
-				for (auto &group : *component_groups)
-					groups.find(group.get_hash())->add_entity(entity);
+	void free_component_storage(ComponentType id, ComponentNode *component);
 
-			return comp;
+	template <typename... Ts, typename Func, size_t... Indices>
+	static void for_each_archetype_chunk(const Archetype &archetype, Func &func, std::index_sequence<Indices...>)
+	{
+		int indices[] = { archetype.find_component(ComponentIDMapping::get_id<Ts>())... };
+		for (int index : indices)
+			if (index < 0)
+				return;
+
+		for (auto &chunk : archetype.get_chunks())
+		{
+			func(size_t(chunk.count), static_cast<Entity * const *>(chunk.entities),
+			     static_cast<Ts *>(archetype.get_component_array(unsigned(indices[Indices]), chunk))...);
 		}
 	}
 
-	void free_component(Entity &entity, ComponentType id, ComponentNode *component);
-	void reset_groups();
-	void reset_groups_for_component_type(ComponentType id);
+	template <typename Func, typename Tuple, size_t... Indices>
+	static void for_each_group_entry(Entity * const *entity, const Tuple &components, Func &func,
+	                                 std::index_sequence<Indices...>)
+	{
+		func(size_t(1), entity, std::get<Indices>(components)...);
+	}
 
-private:
 	Util::ObjectPool<Entity> entity_pool;
 	Util::IntrusiveHashMapHolder<EntityGroupBase> groups;
 	Util::IntrusiveHashMapHolder<ComponentAllocatorBase> component_types;
@@ -445,6 +697,12 @@ template <typename T>
 void Entity::free_component()
 {
 	auto id = ComponentIDMapping::get_id<T>();
+	if (archetype)
+	{
+		pool->free_archetype_component(*this, id);
+		return;
+	}
+
 	auto *t = components.find(id);
 	if (t)
 	{
@@ -0,0 +1,337 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ecs_command_buffer.hpp"
+#include "aligned_alloc.hpp"
+#include "thread_id.hpp"
+#include <algorithm>
+
+namespace Granite
+{
+EntityCommandRecorder::EntityCommandRecorder(uint32_t index_)
+	: index(index_)
+{
+}
+
+EntityCommandRecorder::~EntityCommandRecorder()
+{
+	clear();
+	for (auto &block : blocks)
+		Util::memalign_free(block.data);
+}
+
+void *EntityCommandRecorder::allocate_payload(size_t size, size_t alignment)
+{
+	constexpr size_t BlockSize = 64 * 1024;
+
+	while (block_index < blocks.size())
+	{
+		auto &block = blocks[block_index];
+		size_t offset = (block_offset + alignment - 1) & ~(alignment - 1);
+		if (offset + size <= block.size)
+		{
+			block_offset = offset + size;
+			return block.data + offset;
+		}
+
+		block_index++;
+		block_offset = 0;
+	}
+
+	Block block = {};
+	block.size = std::max(BlockSize, size);
+	block.data = static_cast<uint8_t *>(Util::memalign_alloc(std::max<size_t>(alignment, 64), block.size));
+	if (!block.data)
+		throw std::bad_alloc();
+	blocks.push_back(block);
+
+	block_index = blocks.size() - 1;
+	block_offset = size;
+	return block.data;
+}
+
+void EntityCommandRecorder::clear()
+{
+	for (auto &command : commands)
+		if (command.payload)
+			command.info->type->destroy(command.payload);
+	commands.clear();
+	num_created = 0;
+	block_index = 0;
+	block_offset = 0;
+}
+
+EntityCommandBuffer::EntityCommandBuffer(unsigned num_recorders)
+{
+	recorders.reserve(num_recorders);
+	for (unsigned i = 0; i < num_recorders; i++)
+		recorders.emplace_back(new EntityCommandRecorder(i));
+}
+
+EntityCommandRecorder &EntityCommandBuffer::get_thread_recorder()
+{
+	unsigned index = Util::get_current_thread_index();
+	assert(index < recorders.size());
+	return *recorders[index];
+}
+
+void EntityCommandBuffer::collect_groups(EntityPool &pool, ComponentType id)
+{
+	auto *component_groups = pool.component_to_groups.find(id);
+	if (component_groups)
+		for (auto &group : *component_groups)
+			if (auto *g = pool.groups.find(group.get_hash()))
+				scratch_groups.push_back(g);
+}
+
+bool EntityCommandBuffer::match_signature(const SortedCommand *commands, size_t count)
+{
+	bool match = last_signature.size() == count;
+	for (size_t i = 0; match && i < count; i++)
+		match = last_signature[i].info == commands[i].command->info && last_signature[i].op == commands[i].command->op;
+
+	if (!match)
+	{
+		last_signature.clear();
+		for (size_t i = 0; i < count; i++)
+			last_signature.push_back({ commands[i].command->info, commands[i].command->op });
+	}
+
+	return match;
+}
+
+void EntityCommandBuffer::apply_archetype(EntityPool &pool, Entity &entity,
+                                          const SortedCommand *commands, size_t count)
+{
+	auto *old_archetype = entity.archetype;
+	scratch_types.clear();
+	if (old_archetype)
+		scratch_types = old_archetype->get_types();
+	scratch_sources.clear();
+	scratch_sources.resize(scratch_types.size());
+
+	// Work out the final component set first, so the entity moves at most once.
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &command = *commands[i].command;
+		auto *type = command.info->type;
+		auto itr = std::lower_bound(scratch_types.begin(), scratch_types.end(), type->id,
+		                            [](const ComponentTypeInfo *a, ComponentType id) { return a->id < id; });
+		size_t index = size_t(itr - scratch_types.begin());
+		bool found = itr != scratch_types.end() && (*itr)->id == type->id;
+
+		if (command.op == EntityCommandRecorder::Op::Add)
+		{
+			if (found)
+				scratch_sources[index] = command.payload;
+			else
+			{
+				scratch_types.insert(itr, type);
+				scratch_sources.insert(scratch_sources.begin() + index, command.payload);
+			}
+		}
+		else if (found)
+		{
+			scratch_types.erase(itr);
+			scratch_sources.erase(scratch_sources.begin() + index);
+		}
+	}
+
+	Archetype *archetype;
+	if (match_signature(commands, count) && old_archetype == last_old_archetype)
+		archetype = last_archetype;
+	else
+		archetype = scratch_types.empty() ? nullptr : pool.get_archetype(scratch_types);
+	last_old_archetype = old_archetype;
+	last_archetype = archetype;
+
+	if (archetype != old_archetype)
+		pool.move_entity_to_archetype(entity, archetype);
+
+	for (size_t i = 0; i < scratch_sources.size(); i++)
+	{
+		if (!scratch_sources[i])
+			continue;
+
+		auto *type = scratch_types[i];
+		void *dst = archetype->get_component(unsigned(i), entity.archetype_chunk, entity.archetype_row);
+		// Components which were kept from the old archetype are live and must be replaced.
+		if (old_archetype && old_archetype->find_component(type->id) >= 0)
+			type->destroy(dst);
+		type->move_construct(dst, scratch_sources[i]);
+	}
+}
+
+void EntityCommandBuffer::apply_per_component(EntityPool &pool, Entity &entity,
+                                              const SortedCommand *commands, size_t count)
+{
+	// Take the entity out of every affected group once, change all components, and add it back once,
+	// rather than updating groups for every single component.
+	if (!match_signature(commands, count))
+	{
+		scratch_groups.clear();
+		for (size_t i = 0; i < count; i++)
+			collect_groups(pool, commands[i].command->info->type->id);
+		std::sort(scratch_groups.begin(), scratch_groups.end());
+		scratch_groups.erase(std::unique(scratch_groups.begin(), scratch_groups.end()), scratch_groups.end());
+	}
+
+	if (!entity.components.inner_list().empty())
+		for (auto *group : scratch_groups)
+			group->remove_entity(entity);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		auto &command = *commands[i].command;
+		if (command.op == EntityCommandRecorder::Op::Add)
+			command.info->place(pool, entity, command.payload);
+		else
+		{
+			ComponentType id = command.info->type->id;
+			auto *node = entity.components.find(id);
+			if (node)
+			{
+				entity.components.erase(node);
+				pool.free_component_storage(id, node);
+			}
+		}
+	}
+
+	for (auto *group : scratch_groups)
+		group->add_entity(entity);
+}
+
+void EntityCommandBuffer::delete_entity(EntityPool &pool, Entity &entity)
+{
+	if (pool.storage == EntityStorage::Archetype)
+	{
+		pool.delete_entity(&entity);
+		return;
+	}
+
+	scratch_groups.clear();
+	for (auto &component : entity.components)
+		collect_groups(pool, component.get_hash());
+	std::sort(scratch_groups.begin(), scratch_groups.end());
+	scratch_groups.erase(std::unique(scratch_groups.begin(), scratch_groups.end()), scratch_groups.end());
+	for (auto *group : scratch_groups)
+		group->remove_entity(entity);
+
+	// Groups are already up to date, so the pool only has to release storage.
+	auto &list = entity.components.inner_list();
+	auto itr = list.begin();
+	while (itr != list.end())
+	{
+		auto *component = itr.get();
+		itr = list.erase(itr);
+		pool.free_component_storage(component->get_hash(), component);
+	}
+	entity.components.clear();
+
+	pool.delete_entity(&entity);
+}
+
+void EntityCommandBuffer::playback(EntityPool &pool, EntityCommandListener *listener)
+{
+	destroyed.clear();
+	for (auto &recorder : recorders)
+	{
+		for (auto &command : recorder->commands)
+		{
+			auto *entity = command.entity;
+			if (command.op == EntityCommandRecorder::Op::Destroy && !entity->command_destroyed &&
+			    (!listener || listener->on_entity_destroy(*entity)))
+			{
+				entity->command_destroyed = true;
+				destroyed.push_back(entity);
+			}
+		}
+	}
+
+	// Entities to create are not known yet, and are filled in below.
+	sorted.clear();
+	for (auto &recorder : recorders)
+	{
+		uint64_t sequence = uint64_t(recorder->index) << 32;
+		for (auto &command : recorder->commands)
+			if (command.op != EntityCommandRecorder::Op::Destroy && !(command.entity && command.entity->command_destroyed))
+				sorted.push_back({ 0, sequence++, command.entity, &command });
+	}
+
+	// Destroy before creating. Groups and chunks are compacted by moving the last entry into the hole,
+	// so removing entities before new ones are appended keeps those moves short.
+	for (auto *entity : destroyed)
+		delete_entity(pool, *entity);
+
+	size_t num_created = 0;
+	for (auto &recorder : recorders)
+		num_created += recorder->num_created;
+
+	pool.entities.reserve(pool.entities.size() + num_created);
+	for (auto &recorder : recorders)
+	{
+		recorder->created.resize(recorder->num_created);
+		for (auto &entity : recorder->created)
+		{
+			entity = pool.create_entity();
+			if (listener)
+				listener->on_entity_created(*entity);
+		}
+	}
+
+	for (auto &command : sorted)
+	{
+		if (!command.entity)
+			command.entity = recorders[command.sequence >> 32]->created[command.command->pending];
+		command.entity_offset = command.entity->pool_offset;
+	}
+
+	// Pool order keeps new entities in creation order, so they end up next to each other in groups and chunks.
+	// Recording a batch of spawns on each thread is already in that order.
+	auto compare = [](const SortedCommand &a, const SortedCommand &b) {
+		if (a.entity_offset != b.entity_offset)
+			return a.entity_offset < b.entity_offset;
+		return a.sequence < b.sequence;
+	};
+	if (!std::is_sorted(sorted.begin(), sorted.end(), compare))
+		std::sort(sorted.begin(), sorted.end(), compare);
+
+	last_signature.clear();
+	for (size_t i = 0, n = sorted.size(); i < n; )
+	{
+		Entity *entity = sorted[i].entity;
+		size_t count = 1;
+		while (i + count < n && sorted[i + count].entity == entity)
+			count++;
+
+		if (pool.storage == EntityStorage::Archetype)
+			apply_archetype(pool, *entity, &sorted[i], count);
+		else
+			apply_per_component(pool, *entity, &sorted[i], count);
+
+		i += count;
+	}
+
+	for (auto &recorder : recorders)
+		recorder->clear();
+}
+}
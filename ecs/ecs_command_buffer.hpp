@@ -0,0 +1,243 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "ecs.hpp"
+#include <vector>
+#include <memory>
+#include <utility>
+
+// Deferred structural changes for EntityPool.
+// Tasks record entity creation, destruction and component changes into their own recorder without touching the pool,
+// and the whole batch is applied on one thread at a sync point, e.g. between frames.
+
+namespace Granite
+{
+// An entity which is created by a recorder. It only turns into an Entity when the buffer is played back.
+struct PendingEntity
+{
+	uint32_t recorder;
+	uint32_t index;
+};
+
+namespace Internal
+{
+struct CommandComponentInfo
+{
+	const ComponentTypeInfo *type;
+	// Moves a recorded component into per-component storage. Does not update groups.
+	void (*place)(EntityPool &pool, Entity &entity, void *src);
+
+	template <typename T>
+	static const CommandComponentInfo *get();
+};
+}
+
+class EntityCommandRecorder
+{
+public:
+	EntityCommandRecorder(const EntityCommandRecorder &) = delete;
+	void operator=(const EntityCommandRecorder &) = delete;
+	~EntityCommandRecorder();
+
+	PendingEntity create_entity()
+	{
+		return { index, num_created++ };
+	}
+
+	void destroy_entity(Entity *entity)
+	{
+		commands.push_back({ entity, nullptr, nullptr, ~0u, Op::Destroy });
+	}
+
+	template <typename T, typename... Ts>
+	void add_component(Entity *entity, Ts&&... ts)
+	{
+		push_add<T>(entity, ~0u, std::forward<Ts>(ts)...);
+	}
+
+	template <typename T, typename... Ts>
+	void add_component(PendingEntity entity, Ts&&... ts)
+	{
+		assert(entity.recorder == index && entity.index < num_created);
+		push_add<T>(nullptr, entity.index, std::forward<Ts>(ts)...);
+	}
+
+	template <typename T>
+	void remove_component(Entity *entity)
+	{
+		commands.push_back({ entity, Internal::CommandComponentInfo::get<T>(), nullptr, ~0u, Op::Remove });
+	}
+
+	bool empty() const
+	{
+		return commands.empty() && num_created == 0;
+	}
+
+private:
+	friend class EntityCommandBuffer;
+	explicit EntityCommandRecorder(uint32_t index);
+
+	enum class Op : uint32_t
+	{
+		Destroy,
+		Add,
+		Remove
+	};
+
+	struct Command
+	{
+		Entity *entity;
+		const Internal::CommandComponentInfo *info;
+		void *payload;
+		// Index into created when entity is null.
+		uint32_t pending;
+		Op op;
+	};
+
+	struct Block
+	{
+		uint8_t *data;
+		size_t size;
+	};
+
+	uint32_t index;
+	uint32_t num_created = 0;
+	std::vector<Command> commands;
+	std::vector<Entity *> created;
+
+	// Recorded components live in blocks which are kept around between playbacks.
+	std::vector<Block> blocks;
+	size_t block_index = 0;
+	size_t block_offset = 0;
+
+	template <typename T, typename... Ts>
+	void push_add(Entity *entity, uint32_t pending, Ts&&... ts)
+	{
+		void *payload = allocate_payload(sizeof(T), alignof(T));
+		new (payload) T(std::forward<Ts>(ts)...);
+		commands.push_back({ entity, Internal::CommandComponentInfo::get<T>(), payload, pending, Op::Add });
+	}
+
+	void *allocate_payload(size_t size, size_t alignment);
+	void clear();
+};
+
+// Receives structural changes as they are played back, e.g. to keep a scene's entity list in sync.
+class EntityCommandListener
+{
+public:
+	virtual ~EntityCommandListener() = default;
+	virtual void on_entity_created(Entity &entity) = 0;
+	// Called before an entity is deleted. Return false to keep it alive.
+	virtual bool on_entity_destroy(Entity &entity) = 0;
+};
+
+class EntityCommandBuffer
+{
+public:
+	// With a ThreadGroup, use get_num_threads() + 1 recorders so every worker and the main thread gets its own.
+	explicit EntityCommandBuffer(unsigned num_recorders = 1);
+
+	EntityCommandBuffer(const EntityCommandBuffer &) = delete;
+	void operator=(const EntityCommandBuffer &) = delete;
+
+	unsigned get_num_recorders() const
+	{
+		return unsigned(recorders.size());
+	}
+
+	EntityCommandRecorder &get_recorder(unsigned index)
+	{
+		return *recorders[index];
+	}
+
+	// Picks the recorder for Util::get_current_thread_index().
+	EntityCommandRecorder &get_thread_recorder();
+
+	// Applies every recorded command in one pass and clears the recorders.
+	// Destroys are applied first. Remaining commands are sorted per entity,
+	// and every entity has its final set of components applied at once.
+	// For one entity, commands apply in recording order, and recorders in index order.
+	// Destroying an entity discards any component changes recorded for it.
+	// Must not be called while any recorder is in use.
+	void playback(EntityPool &pool, EntityCommandListener *listener = nullptr);
+
+	// Valid after playback until the recorder is played back again.
+	Entity *resolve(PendingEntity entity) const
+	{
+		return recorders[entity.recorder]->created[entity.index];
+	}
+
+private:
+	std::vector<std::unique_ptr<EntityCommandRecorder>> recorders;
+
+	struct SortedCommand
+	{
+		size_t entity_offset;
+		uint64_t sequence;
+		Entity *entity;
+		const EntityCommandRecorder::Command *command;
+	};
+	std::vector<SortedCommand> sorted;
+	std::vector<Entity *> destroyed;
+	std::vector<const ComponentTypeInfo *> scratch_types;
+	std::vector<void *> scratch_sources;
+	std::vector<EntityGroupBase *> scratch_groups;
+
+	// Entities tend to be spawned with the same set of components,
+	// so the groups or archetype from the previous entity can often be reused.
+	struct Signature
+	{
+		const Internal::CommandComponentInfo *info;
+		EntityCommandRecorder::Op op;
+	};
+	std::vector<Signature> last_signature;
+	const Archetype *last_old_archetype = nullptr;
+	Archetype *last_archetype = nullptr;
+
+	bool match_signature(const SortedCommand *commands, size_t count);
+	void apply_archetype(EntityPool &pool, Entity &entity, const SortedCommand *commands, size_t count);
+	void apply_per_component(EntityPool &pool, Entity &entity, const SortedCommand *commands, size_t count);
+	void collect_groups(EntityPool &pool, ComponentType id);
+	void delete_entity(EntityPool &pool, Entity &entity);
+
+	template <typename T>
+	static void place_component(EntityPool &pool, Entity &entity, void *src)
+	{
+		bool inserted;
+		pool.allocate_component_storage<T>(entity, inserted, std::move(*static_cast<T *>(src)));
+	}
+
+	friend struct Internal::CommandComponentInfo;
+};
+
+template <typename T>
+const Internal::CommandComponentInfo *Internal::CommandComponentInfo::get()
+{
+	static const CommandComponentInfo info = {
+		ComponentTypeInfo::get<T>(), EntityCommandBuffer::place_component<T>,
+	};
+	return &info;
+}
+}
@@ -0,0 +1,70 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ecs_parallel.hpp"
+
+namespace Granite
+{
+bool ComponentAccessTracker::conflicts(const Access *accesses, size_t count) const
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		auto id = accesses[i].id;
+		if (std::find(writes.begin(), writes.end(), id) != writes.end())
+			return true;
+		if (accesses[i].write && std::find(reads.begin(), reads.end(), id) != reads.end())
+			return true;
+	}
+
+	return false;
+}
+
+TaskGroup &ComponentAccessTracker::begin_system(TaskComposer &composer, const Access *accesses, size_t count)
+{
+	TaskGroup *stage;
+	if (!has_stage || conflicts(accesses, count))
+	{
+		reads.clear();
+		writes.clear();
+		has_stage = true;
+		stage = &composer.begin_pipeline_stage();
+	}
+	else
+		stage = &composer.get_group();
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (accesses[i].write)
+			writes.push_back(accesses[i].id);
+		else
+			reads.push_back(accesses[i].id);
+	}
+
+	return *stage;
+}
+
+void ComponentAccessTracker::reset()
+{
+	reads.clear();
+	writes.clear();
+	has_stage = false;
+}
+}
@@ -0,0 +1,150 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#pragma once
+
+#include "ecs.hpp"
+#include "task_composer.hpp"
+#include "parallel_for.hpp"
+#include <type_traits>
+
+// Data parallel iteration over entities on a ThreadGroup.
+// Component types which are const-qualified are only read, e.g. for_each_parallel<const A, B> writes B and reads A.
+
+namespace Granite
+{
+// Groups systems into TaskComposer pipeline stages based on which components they access.
+// Systems which only share read access run in the same stage, conflicting systems begin a new stage.
+class ComponentAccessTracker
+{
+public:
+	struct Access
+	{
+		ComponentType id;
+		bool write;
+	};
+
+	template <typename... Ts>
+	TaskGroup &begin_system(TaskComposer &composer)
+	{
+		const Access accesses[] = { { ComponentIDMapping::get_id<std::remove_const_t<Ts>>(), !std::is_const<Ts>::value }... };
+		return begin_system(composer, accesses, sizeof...(Ts));
+	}
+
+	TaskGroup &begin_system(TaskComposer &composer, const Access *accesses, size_t count);
+
+	// Forget systems in the current stage. The next system always begins a new stage.
+	void reset();
+
+private:
+	std::vector<ComponentType> reads;
+	std::vector<ComponentType> writes;
+	bool has_stage = false;
+
+	bool conflicts(const Access *accesses, size_t count) const;
+};
+
+namespace Internal
+{
+template <typename Func, typename Tuple, size_t... Indices>
+static inline void for_each_parallel_run(Func &func, const Tuple &arrays, size_t count, std::index_sequence<Indices...>)
+{
+	for (size_t i = 0; i < count; i++)
+		func(std::get<Indices>(arrays)[i]...);
+}
+
+template <typename Func, typename Tuple, size_t... Indices>
+static inline void for_each_parallel_entry(Func &func, const Tuple &components, std::index_sequence<Indices...>)
+{
+	func(*std::get<Indices>(components)...);
+}
+
+enum { EntityParallelCacheLineSize = 64 };
+}
+
+// Calls func(Ts &... components) for every entity which has all of Ts, split over the worker threads.
+// Work is recorded into a new pipeline stage of composer, or into a stage picked by tracker if provided.
+// The entity set is resolved when the stage executes, and the following stage will not begin until
+// every entity is processed. The pool must not be structurally modified while the stage executes,
+// and func must be safe to call concurrently for different entities.
+template <typename... Ts, typename Func>
+void for_each_parallel(EntityPool &pool, TaskComposer &composer, Func &&func,
+                       ComponentAccessTracker *tracker = nullptr)
+{
+	static_assert(sizeof...(Ts) > 0, "Need at least one component type.");
+
+	auto &stage = tracker ? tracker->begin_system<Ts...>(composer) : composer.begin_pipeline_stage();
+
+	// Systems sharing a stage run concurrently, and enqueue_task is not thread-safe on a single TaskGroup,
+	// so every system spawns its chunks into a group of its own which the following stage waits for.
+	auto &thread_group = composer.get_thread_group();
+	auto handle = thread_group.create_task();
+	handle->set_desc("ecs-for-each-parallel");
+	thread_group.add_dependency(*composer.get_deferred_enqueue_handle(), *handle);
+
+	using PlainFunc = std::decay_t<Func>;
+	auto shared_func = std::make_shared<PlainFunc>(std::forward<Func>(func));
+
+	if (pool.get_storage() == EntityStorage::Archetype)
+	{
+		// Every archetype chunk is already a contiguous, cache line aligned array per component,
+		// so dispatch whole chunks.
+		stage.enqueue_task([&pool, shared_func, handle]() mutable {
+			using Run = std::pair<size_t, std::tuple<Ts *...>>;
+			auto runs = std::make_shared<std::vector<Run>>();
+			pool.for_each_chunk<std::remove_const_t<Ts>...>([&](size_t count, Entity * const *, std::remove_const_t<Ts> *... arrays) {
+				runs->emplace_back(count, std::make_tuple(static_cast<Ts *>(arrays)...));
+			});
+
+			parallel_for_chunked(*handle, 0, runs->size(), 1, [shared_func, runs](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++)
+				{
+					auto &run = (*runs)[i];
+					Internal::for_each_parallel_run(*shared_func, run.second, run.first, std::index_sequence_for<Ts...>());
+				}
+			});
+			handle.reset();
+		});
+	}
+	else
+	{
+		// Resolve the group here, creating it on a worker thread could race with other systems.
+		auto *group = pool.get_component_group_holder<std::remove_const_t<Ts>...>();
+
+		stage.enqueue_task([group, shared_func, handle]() mutable {
+			auto &components = group->get_groups();
+			using Entry = typename std::remove_reference_t<decltype(components)>::value_type;
+
+			// Split on cache line boundaries so two workers never write to the same line of the group.
+			constexpr size_t EntriesPerLine = std::max<size_t>(1, Internal::EntityParallelCacheLineSize / sizeof(Entry));
+			size_t count = components.size();
+			size_t num_lines = (count + EntriesPerLine - 1) / EntriesPerLine;
+
+			parallel_for_chunked(*handle, 0, num_lines, 0, [shared_func, &components, count](size_t begin, size_t end) {
+				end = std::min(end * EntriesPerLine, count);
+				for (size_t i = begin * EntriesPerLine; i < end; i++)
+					Internal::for_each_parallel_entry(*shared_func, components[i], std::index_sequence_for<Ts...>());
+			});
+			handle.reset();
+		});
+	}
+}
+}
@@ -21,6 +21,7 @@
  */
 
 #include "event.hpp"
+#include "thread_group.hpp"
 #include <algorithm>
 #include <assert.h>
 
@@ -42,31 +43,156 @@ EventManager::~EventManager()
 
 void EventManager::dispatch()
 {
+	dispatch(nullptr);
+}
+
+bool EventManager::deliver_events(const Handler &handler, const std::vector<Event *> &queued_events)
+{
+	if (handler.batch_fn)
+		return handler.batch_fn(handler.handler, queued_events.data(), queued_events.size());
+
+	for (auto *event : queued_events)
+		if (!handler.mem_fn(handler.handler, *event))
+			return false;
+	return true;
+}
+
+void EventManager::dispatch(ThreadGroup *group)
+{
+	worker_deliveries.clear();
+
 	for (auto &event_type : events)
 	{
+		std::swap(event_type.queued_events, event_type.dispatch_events);
+		std::swap(event_type.arena, event_type.dispatch_arena);
+		auto &queued_events = event_type.dispatch_events;
+		if (queued_events.empty())
+			continue;
+
 		auto &handlers = event_type.handlers;
-		auto &queued_events = event_type.queued_events;
 		auto itr = remove_if(begin(handlers), end(handlers), [&](const Handler &handler) {
-			for (auto &event : queued_events)
+			if (group && handler.delivery == EventDelivery::Worker)
+			{
+				worker_deliveries.push_back({ &event_type, handler, true });
+				return false;
+			}
+
+			if (!deliver_events(handler, queued_events))
 			{
-				if (!handler.mem_fn(handler.handler, *event))
-				{
-					handler.unregister_key->release_manager_reference();
-					return true;
-				}
+				handler.unregister_key->release_manager_reference();
+				return true;
 			}
 			return false;
 		});
 
 		handlers.erase(itr, end(handlers));
-		queued_events.clear();
+	}
+
+	if (!worker_deliveries.empty())
+	{
+		auto task = group->create_task();
+		task->set_desc("event-dispatch");
+		for (auto &delivery : worker_deliveries)
+		{
+			task->enqueue_task([&delivery]() {
+				delivery.keep = deliver_events(delivery.handler, delivery.event_type->dispatch_events);
+			});
+		}
+		task->wait();
+
+		for (auto &delivery : worker_deliveries)
+		{
+			if (delivery.keep)
+				continue;
+
+			auto &handlers = delivery.event_type->handlers;
+			auto itr = std::find_if(begin(handlers), end(handlers), [&](const Handler &h) {
+				return h.handler == delivery.handler.handler &&
+				       h.mem_fn == delivery.handler.mem_fn &&
+				       h.batch_fn == delivery.handler.batch_fn;
+			});
+
+			if (itr != end(handlers))
+			{
+				itr->unregister_key->release_manager_reference();
+				handlers.erase(itr);
+			}
+		}
+	}
+
+	for (auto &event_type : events)
+	{
+		for (auto *event : event_type.dispatch_events)
+			event->~Event();
+		event_type.dispatch_events.clear();
+		event_type.dispatch_arena.reset();
 	}
 }
 
+void *EventManager::EventArena::allocate_block(size_t size)
+{
+	// The current block is full, move on to the next one which fits.
+	if (!blocks.empty())
+		block_index++;
+	while (block_index < blocks.size() && blocks[block_index].size < size)
+		block_index++;
+
+	if (block_index >= blocks.size())
+	{
+		size_t block_size = std::max<size_t>(BlockSize, size);
+		blocks.push_back({ std::unique_ptr<uint8_t[]>(new uint8_t[block_size]), block_size });
+		block_index = blocks.size() - 1;
+	}
+
+	offset = size;
+	return blocks[block_index].data.get();
+}
+
+void EventManager::EventArena::reset()
+{
+	block_index = 0;
+	offset = 0;
+}
+
+EventManager::EventTypeData::~EventTypeData()
+{
+	for (auto *event : queued_events)
+		event->~Event();
+	for (auto *event : dispatch_events)
+		event->~Event();
+}
+
+EventManager::EventStorage EventManager::LatchEventTypeData::allocate_storage(size_t size)
+{
+	if (!free_storage.empty() && free_storage.back().size >= size)
+	{
+		auto storage = std::move(free_storage.back());
+		free_storage.pop_back();
+		return storage;
+	}
+	else
+		return { std::unique_ptr<uint8_t[]>(new uint8_t[size]), size };
+}
+
+void EventManager::LatchEventTypeData::release(LatchedEvent &latched)
+{
+	latched.event->~Event();
+	latched.event = nullptr;
+	free_storage.push_back(std::move(latched.storage));
+}
+
+EventManager::LatchEventTypeData::~LatchEventTypeData()
+{
+	for (auto &latched : queued_events)
+		latched.event->~Event();
+}
+
 void EventManager::dispatch_event(std::vector<Handler> &handlers, const Event &e)
 {
 	auto itr = remove_if(begin(handlers), end(handlers), [&](const Handler &handler) -> bool {
-		bool to_remove = !handler.mem_fn(handler.handler, e);
+		const Event *event = &e;
+		bool to_remove = handler.batch_fn ? !handler.batch_fn(handler.handler, &event, 1) :
+		                 !handler.mem_fn(handler.handler, e);
 		if (to_remove)
 			handler.unregister_key->release_manager_reference();
 		return to_remove;
@@ -75,16 +201,16 @@ void EventManager::dispatch_event(std::vector<Handler> &handlers, const Event &e
 	handlers.erase(itr, end(handlers));
 }
 
-void EventManager::dispatch_up_events(std::vector<std::unique_ptr<Event>> &up_events, const LatchHandler &handler)
+void EventManager::dispatch_up_events(std::vector<LatchedEvent> &up_events, const LatchHandler &handler)
 {
-	for (auto &event : up_events)
-		handler.up_fn(handler.handler, *event);
+	for (auto &latched : up_events)
+		handler.up_fn(handler.handler, *latched.event);
 }
 
-void EventManager::dispatch_down_events(std::vector<std::unique_ptr<Event>> &down_events, const LatchHandler &handler)
+void EventManager::dispatch_down_events(std::vector<LatchedEvent> &down_events, const LatchHandler &handler)
 {
-	for (auto &event : down_events)
-		handler.down_fn(handler.handler, *event);
+	for (auto &latched : down_events)
+		handler.down_fn(handler.handler, *latched.event);
 }
 
 void EventManager::LatchEventTypeData::flush_recursive_handlers()
@@ -161,15 +287,25 @@ void EventManager::dequeue_latched(uint64_t cookie)
 			throw std::logic_error("Dequeueing latched while queueing events.");
 		event_type.enqueueing = true;
 
-		auto itr = remove_if(begin(queued_events), end(queued_events), [&](const std::unique_ptr<Event> &event) {
-			bool signal = event->get_cookie() == cookie;
-			if (signal)
-				dispatch_down_event(event_type, *event);
-			return signal;
-		});
+		size_t write_index = 0;
+		for (size_t i = 0; i < queued_events.size(); i++)
+		{
+			auto &latched = queued_events[i];
+			if (latched.event->get_cookie() == cookie)
+			{
+				dispatch_down_event(event_type, *latched.event);
+				event_type.release(latched);
+			}
+			else
+			{
+				if (write_index != i)
+					queued_events[write_index] = std::move(latched);
+				write_index++;
+			}
+		}
 
 		event_type.enqueueing = false;
-		queued_events.erase(itr, end(queued_events));
+		queued_events.resize(write_index);
 	}
 }
 
@@ -180,8 +316,11 @@ void EventManager::dequeue_all_latched(EventType type)
 		throw std::logic_error("Dequeueing latched while queueing events.");
 
 	event_type.enqueueing = true;
-	for (auto &event : event_type.queued_events)
-		dispatch_down_event(event_type, *event);
+	for (auto &latched : event_type.queued_events)
+	{
+		dispatch_down_event(event_type, *latched.event);
+		event_type.release(latched);
+	}
 	event_type.queued_events.clear();
 	event_type.enqueueing = false;
 }
@@ -24,8 +24,11 @@
 
 #include <vector>
 #include <memory>
+#include <new>
 #include <stdexcept>
 #include <utility>
+#include <stddef.h>
+#include <stdint.h>
 #include "compile_time_hash.hpp"
 #include "intrusive_hash_map.hpp"
 #include "global_managers.hpp"
@@ -38,6 +41,70 @@
 namespace Granite
 {
 class Event;
+class ThreadGroup;
+
+// All events of one type which were queued up since the last dispatch().
+template <typename EventType>
+class EventBatch
+{
+public:
+	EventBatch(const Event * const *events_, size_t count_)
+		: events(events_), count(count_)
+	{
+	}
+
+	class Iterator
+	{
+	public:
+		explicit Iterator(const Event * const *event_)
+			: event(event_)
+		{
+		}
+
+		const EventType &operator*() const
+		{
+			return static_cast<const EventType &>(**event);
+		}
+
+		Iterator &operator++()
+		{
+			++event;
+			return *this;
+		}
+
+		bool operator!=(const Iterator &other) const
+		{
+			return event != other.event;
+		}
+
+	private:
+		const Event * const *event;
+	};
+
+	const EventType &operator[](size_t index) const
+	{
+		return static_cast<const EventType &>(*events[index]);
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	Iterator begin() const
+	{
+		return Iterator(events);
+	}
+
+	Iterator end() const
+	{
+		return Iterator(events + count);
+	}
+
+private:
+	const Event * const *events;
+	size_t count;
+};
 
 template <typename Return, typename T, typename EventType, Return (T::*callback)(const EventType &e)>
 Return member_function_invoker(void *object, const Event &e)
@@ -45,6 +112,21 @@ Return member_function_invoker(void *object, const Event &e)
 	return (static_cast<T *>(object)->*callback)(static_cast<const EventType &>(e));
 }
 
+template <typename T, typename EventType, bool (T::*callback)(const EventBatch<EventType> &batch)>
+bool batch_member_function_invoker(void *object, const Event * const *events, size_t count)
+{
+	return (static_cast<T *>(object)->*callback)(EventBatch<EventType>(events, count));
+}
+
+enum class EventDelivery
+{
+	// Handler is called from the thread calling dispatch().
+	Inline,
+	// Handler may be called from a worker thread if dispatch() is given a thread group.
+	// Worker handlers run concurrently with each other, and must not call into the EventManager.
+	Worker
+};
+
 #define GRANITE_EVENT_TYPE_HASH(x) ::Util::compile_time_fnv1(#x)
 using EventType = uint64_t;
 
@@ -116,27 +198,28 @@ public:
 	void enqueue(P&&... p)
 	{
 		static constexpr auto type = T::get_type_id();
-		auto &l = events[type];
-
-		auto ptr = std::unique_ptr<Event>(new T(std::forward<P>(p)...));
-		l.queued_events.emplace_back(std::move(ptr));
+		static_assert(alignof(T) <= alignof(max_align_t), "Over-aligned events are not supported.");
+		auto &l = get_event_type(type);
+		void *storage = l.arena.allocate(sizeof(T));
+		l.queued_events.push_back(new (storage) T(std::forward<P>(p)...));
 	}
 
 	template<typename T, typename... P>
 	uint64_t enqueue_latched(P&&... p)
 	{
 		static constexpr auto type = T::get_type_id();
+		static_assert(alignof(T) <= alignof(max_align_t), "Over-aligned events are not supported.");
 		auto &l = latched_events[type];
-		auto ptr = std::unique_ptr<Event>(new T(std::forward<P>(p)...));
-		uint64_t cookie = ++cookie_counter;
-		ptr->set_cookie(cookie);
-
 		if (l.enqueueing)
 			throw std::logic_error("Cannot enqueue more latched events while handling events.");
-		l.enqueueing = true;
 
-		auto *event = ptr.get();
-		l.queued_events.emplace_back(std::move(ptr));
+		auto storage = l.allocate_storage(sizeof(T));
+		auto *event = new (storage.data.get()) T(std::forward<P>(p)...);
+		uint64_t cookie = ++cookie_counter;
+		event->set_cookie(cookie);
+
+		l.enqueueing = true;
+		l.queued_events.push_back({ event, std::move(storage) });
 		dispatch_up_event(l, *event);
 		l.enqueueing = false;
 		return cookie;
@@ -149,29 +232,38 @@ public:
 	void dispatch_inline(const T &t)
 	{
 		static constexpr auto type = T::get_type_id();
-		auto &l = events[type];
+		auto &l = get_event_type(type);
 		dispatch_event(l.handlers, t);
 	}
 
 	void dispatch_inline(const Event &e)
 	{
 		assert(e.get_type_id() != 0);
-		auto &l = events[e.get_type_id()];
+		auto &l = get_event_type(e.get_type_id());
 		dispatch_event(l.handlers, e);
 	}
 
+	// Events which are enqueued by handlers of the same type during dispatch are delivered on the next dispatch.
 	void dispatch();
 
+	// Handlers registered with EventDelivery::Worker are called from tasks on the thread group,
+	// after all inline handlers have run. Returns once every handler has been called.
+	void dispatch(ThreadGroup *group);
+
 	template<typename T, typename EventType, bool (T::*mem_fn)(const EventType &)>
-	void register_handler(T *handler)
+	void register_handler(T *handler, EventDelivery delivery = EventDelivery::Inline)
 	{
-		handler->add_manager_reference(this);
-		static constexpr auto type_id = EventType::get_type_id();
-		auto &l = events[type_id];
-		if (l.dispatching)
-			l.recursive_handlers.push_back({ member_function_invoker<bool, T, EventType, mem_fn>, handler, handler });
-		else
-			l.handlers.push_back({ member_function_invoker<bool, T, EventType, mem_fn>, handler, handler });
+		add_handler<EventType>({ member_function_invoker<bool, T, EventType, mem_fn>, nullptr,
+		                         handler, handler, delivery }, handler);
+	}
+
+	// Receives all events of a type which were queued since last dispatch in one call.
+	// Events dispatched inline are passed as a batch of one.
+	template<typename T, typename EventType, bool (T::*mem_fn)(const EventBatch<EventType> &)>
+	void register_batch_handler(T *handler, EventDelivery delivery = EventDelivery::Inline)
+	{
+		add_handler<EventType>({ nullptr, batch_member_function_invoker<T, EventType, mem_fn>,
+		                         handler, handler, delivery }, handler);
 	}
 
 	void unregister_handler(EventHandler *handler);
@@ -204,8 +296,10 @@ private:
 	struct Handler
 	{
 		bool (*mem_fn)(void *object, const Event &event);
+		bool (*batch_fn)(void *object, const Event * const *events, size_t count);
 		void *handler;
 		EventHandler *unregister_key;
+		EventDelivery delivery;
 	};
 
 	struct LatchHandler
@@ -216,9 +310,51 @@ private:
 		EventHandler *unregister_key;
 	};
 
+	struct EventStorage
+	{
+		std::unique_ptr<uint8_t[]> data;
+		size_t size;
+	};
+
+	// Queued events are placement-new'd into blocks which are recycled after every dispatch,
+	// so once the queues have grown to their steady state size, enqueueing does not allocate.
+	class EventArena
+	{
+	public:
+		void *allocate(size_t size)
+		{
+			static_assert(Alignment >= alignof(Event), "Arena alignment is too small.");
+			size = (size + Alignment - 1) & ~(Alignment - 1);
+			if (block_index < blocks.size() && offset + size <= blocks[block_index].size)
+			{
+				void *ptr = blocks[block_index].data.get() + offset;
+				offset += size;
+				return ptr;
+			}
+			else
+				return allocate_block(size);
+		}
+
+		void reset();
+
+	private:
+		enum { Alignment = alignof(max_align_t), BlockSize = 16 * 1024 };
+		std::vector<EventStorage> blocks;
+		size_t block_index = 0;
+		size_t offset = 0;
+		void *allocate_block(size_t size);
+	};
+
 	struct EventTypeData : Util::IntrusiveHashMapEnabled<EventTypeData>
 	{
-		std::vector<std::unique_ptr<Event>> queued_events;
+		~EventTypeData();
+
+		// Double buffered, so events enqueued while handlers are running go to the other queue.
+		std::vector<Event *> queued_events;
+		std::vector<Event *> dispatch_events;
+		EventArena arena;
+		EventArena dispatch_arena;
+
 		std::vector<Handler> handlers;
 		std::vector<Handler> recursive_handlers;
 		bool enqueueing = false;
@@ -227,25 +363,80 @@ private:
 		void flush_recursive_handlers();
 	};
 
+	struct LatchedEvent
+	{
+		Event *event;
+		EventStorage storage;
+	};
+
 	struct LatchEventTypeData : Util::IntrusiveHashMapEnabled<LatchEventTypeData>
 	{
-		std::vector<std::unique_ptr<Event>> queued_events;
+		~LatchEventTypeData();
+
+		std::vector<LatchedEvent> queued_events;
+		// Latched events live until they are dequeued, so their storage is recycled one by one.
+		std::vector<EventStorage> free_storage;
 		std::vector<LatchHandler> handlers;
 		std::vector<LatchHandler> recursive_handlers;
 		bool enqueueing = false;
 		bool dispatching = false;
 
 		void flush_recursive_handlers();
+		EventStorage allocate_storage(size_t size);
+		void release(LatchedEvent &event);
 	};
 
+	// Handlers which are called from worker threads in dispatch(ThreadGroup *).
+	struct WorkerDelivery
+	{
+		EventTypeData *event_type;
+		Handler handler;
+		bool keep;
+	};
+
+	// enqueue() is called a lot with the same few event types, so avoid going through the hash map every time.
+	struct EventTypeCacheEntry
+	{
+		EventType type;
+		EventTypeData *data;
+	};
+
+	enum { EventTypeCacheSize = 16 };
+	EventTypeCacheEntry event_type_cache[EventTypeCacheSize] = {};
+
+	EventTypeData &get_event_type(EventType type)
+	{
+		auto &entry = event_type_cache[type & (EventTypeCacheSize - 1)];
+		if (!entry.data || entry.type != type)
+		{
+			entry.type = type;
+			entry.data = &events[type];
+		}
+		return *entry.data;
+	}
+
+	template <typename EventType>
+	void add_handler(const Handler &h, EventHandler *handler)
+	{
+		handler->add_manager_reference(this);
+		static constexpr auto type_id = EventType::get_type_id();
+		auto &l = get_event_type(type_id);
+		if (l.dispatching)
+			l.recursive_handlers.push_back(h);
+		else
+			l.handlers.push_back(h);
+	}
+
+	static bool deliver_events(const Handler &handler, const std::vector<Event *> &events);
 	void dispatch_event(std::vector<Handler> &handlers, const Event &e);
-	void dispatch_up_events(std::vector<std::unique_ptr<Event>> &events, const LatchHandler &handler);
-	void dispatch_down_events(std::vector<std::unique_ptr<Event>> &events, const LatchHandler &handler);
+	void dispatch_up_events(std::vector<LatchedEvent> &events, const LatchHandler &handler);
+	void dispatch_down_events(std::vector<LatchedEvent> &events, const LatchHandler &handler);
 	void dispatch_up_event(LatchEventTypeData &event_type, const Event &event);
 	void dispatch_down_event(LatchEventTypeData &event_type, const Event &event);
 
 	Util::IntrusiveHashMap<EventTypeData> events;
 	Util::IntrusiveHashMap<LatchEventTypeData> latched_events;
+	std::vector<WorkerDelivery> worker_deliveries;
 	uint64_t cookie_counter = 0;
 };
 }
@@ -24,6 +24,8 @@
 #include "thread_group.hpp"
 #include <utility>
 #include <algorithm>
+#include <limits.h>
+#include <float.h>
 
 namespace Granite
 {
@@ -48,9 +50,10 @@ ImageAssetID AssetManager::register_image_resource_nolock(FileHandle file, Image
 	info->id.id = id_count++;
 	info->prio = prio;
 	info->image_class = image_class;
+	info->resident_link.info = info;
 	ImageAssetID ret = info->id;
 	asset_bank.push_back(info);
-	sorted_assets.reserve(asset_bank.size());
+	link_lru(info, false);
 	if (iface)
 	{
 		iface->set_id_bounds(id_count);
@@ -63,6 +66,26 @@ void AssetInstantiatorInterface::set_image_class(ImageAssetID, ImageClass)
 {
 }
 
+uint32_t AssetInstantiatorInterface::get_num_streaming_levels(ImageAssetID, File &)
+{
+	return 1;
+}
+
+uint64_t AssetInstantiatorInterface::estimate_cost_image_resource_levels(ImageAssetID id, File &mapping, uint32_t)
+{
+	return estimate_cost_image_resource(id, mapping);
+}
+
+void AssetInstantiatorInterface::instantiate_image_resource_levels(AssetManager &manager, TaskGroup *group,
+                                                                   ImageAssetID id, File &mapping, uint32_t)
+{
+	instantiate_image_resource(manager, group, id, mapping);
+}
+
+void AssetInstantiatorInterface::release_image_resource_levels(ImageAssetID, uint32_t)
+{
+}
+
 ImageAssetID AssetManager::register_image_resource(FileHandle file, ImageClass image_class, int prio)
 {
 	std::lock_guard<std::mutex> holder{asset_bank_lock};
@@ -103,13 +126,27 @@ void AssetManager::set_asset_instantiator_interface(AssetInstantiatorInterface *
 			iface->release_image_resource({ id });
 	}
 
+	for (auto &bucket : buckets)
+	{
+		bucket.resident.clear();
+		bucket.incomplete.clear();
+	}
+
 	for (auto *a : asset_bank)
 	{
 		a->consumed = 0;
 		a->pending_consumed = 0;
 		a->last_used = 0;
+		a->num_levels = 0;
+		a->resident_levels = 0;
+		a->pending_levels = 0;
+		a->resident_link.linked = false;
+		a->heap_index = UINT32_MAX;
+		link_lru(a, false);
 	}
 	total_consumed = 0;
+	completed_bytes = 0;
+	stats.pending_bytes = 0;
 
 	iface = iface_;
 	if (iface)
@@ -122,7 +159,12 @@ void AssetManager::set_asset_instantiator_interface(AssetInstantiatorInterface *
 
 void AssetManager::mark_used_resource(ImageAssetID id)
 {
-	lru_append.push(id);
+	lru_append.push(UsageUpdate{ id, 0.0f, UINT32_MAX });
+}
+
+void AssetManager::mark_used_resource(ImageAssetID id, float importance, uint32_t wanted_levels)
+{
+	lru_append.push(UsageUpdate{ id, importance, wanted_levels });
 }
 
 void AssetManager::set_image_budget(uint64_t cost)
@@ -135,12 +177,25 @@ void AssetManager::set_image_budget_per_iteration(uint64_t cost)
 	image_budget_per_iteration = cost;
 }
 
+void AssetManager::set_streaming_latency_target(uint32_t iterations)
+{
+	streaming_latency_target = iterations;
+}
+
 bool AssetManager::set_image_residency_priority(ImageAssetID id, int prio)
 {
 	std::lock_guard<std::mutex> holder{asset_bank_lock};
 	if (id.id >= asset_bank.size())
 		return false;
-	asset_bank[id.id]->prio = prio;
+
+	auto *a = asset_bank[id.id];
+	if (a->prio != prio)
+	{
+		unlink_lru(a);
+		a->prio = prio;
+		// Recently used resources go first in their new bucket, the rest go last.
+		link_lru(a, a->last_used + 1 >= timestamp);
+	}
 	return true;
 }
 
@@ -150,12 +205,20 @@ void AssetManager::adjust_update(const CostUpdate &update)
 	{
 		auto *a = asset_bank[update.id.id];
 		total_consumed += update.cost - (a->consumed + a->pending_consumed);
+		stats.pending_bytes -= a->pending_consumed;
+		completed_bytes += a->pending_consumed;
 		a->consumed = update.cost;
 		a->pending_consumed = 0;
 
+		// A failed instantiation is retried later, as if nothing was resident.
+		if (a->pending_levels)
+			a->resident_levels = update.cost ? a->pending_levels : 0;
+		a->pending_levels = 0;
+
 		// A recently paged in image shouldn't be paged out right away in a situation where we're thrashing,
 		// that'd be very dumb.
 		a->last_used = timestamp;
+		touch_lru(a);
 	}
 }
 
@@ -164,6 +227,260 @@ uint64_t AssetManager::get_current_total_consumed() const
 	return total_consumed;
 }
 
+ImageStreamingStats AssetManager::get_streaming_stats() const
+{
+	auto ret = stats;
+	ret.resident_bytes = total_consumed - stats.pending_bytes;
+	return ret;
+}
+
+AssetManager::Rank AssetManager::get_rank(const AssetInfo *a)
+{
+	return { a->prio, a->importance, a->last_used };
+}
+
+bool AssetManager::outranks(const Rank &a, const Rank &b)
+{
+	if (a.prio != b.prio)
+		return a.prio > b.prio;
+	else if (a.importance != b.importance)
+		return a.importance > b.importance;
+	else
+		return a.last_used > b.last_used;
+}
+
+bool AssetManager::ranks_before(const AssetInfo *a, const AssetInfo *b)
+{
+	// High prios come first since they will be activated.
+	// Within a prio, resources the renderer reported as important this frame come first.
+	// Then we sort by LRU.
+	// High consumption should be moved last, so they are candidates to be paged out if we're over budget.
+	// High pending consumption should be moved early since we don't want to page out resources that
+	// are in the middle of being loaded anyway.
+	// Finally, the ID is used as a tie breaker.
+
+	if (a->prio != b->prio)
+		return a->prio > b->prio;
+	else if (a->importance != b->importance)
+		return a->importance > b->importance;
+	else if (a->last_used != b->last_used)
+		return a->last_used > b->last_used;
+	else if (a->consumed != b->consumed)
+		return a->consumed < b->consumed;
+	else if (a->pending_consumed != b->pending_consumed)
+		return a->pending_consumed > b->pending_consumed;
+	else
+		return a->id.id < b->id.id;
+}
+
+bool AssetManager::heap_before(const AssetInfo *a, const AssetInfo *b)
+{
+	// Same as ranks_before() within a bucket. Importance only lasts a frame, so it is handled on the side.
+	if (a->last_used != b->last_used)
+		return a->last_used > b->last_used;
+	else if (a->consumed != b->consumed)
+		return a->consumed < b->consumed;
+	else
+		return a->id.id < b->id.id;
+}
+
+void AssetManager::heap_sift_up(std::vector<AssetInfo *> &heap, uint32_t index)
+{
+	auto *info = heap[index];
+	while (index)
+	{
+		uint32_t parent = (index - 1) / 4;
+		if (!heap_before(info, heap[parent]))
+			break;
+		heap[index] = heap[parent];
+		heap[index]->heap_index = index;
+		index = parent;
+	}
+	heap[index] = info;
+	info->heap_index = index;
+}
+
+void AssetManager::heap_sift_down(std::vector<AssetInfo *> &heap, uint32_t index)
+{
+	auto *info = heap[index];
+	auto count = uint32_t(heap.size());
+	for (;;)
+	{
+		uint32_t first_child = 4 * index + 1;
+		if (first_child >= count)
+			break;
+
+		uint32_t best = first_child;
+		uint32_t end_child = std::min(first_child + 4, count);
+		for (uint32_t child = first_child + 1; child < end_child; child++)
+			if (heap_before(heap[child], heap[best]))
+				best = child;
+
+		if (!heap_before(heap[best], info))
+			break;
+		heap[index] = heap[best];
+		heap[index]->heap_index = index;
+		index = best;
+	}
+	heap[index] = info;
+	info->heap_index = index;
+}
+
+void AssetManager::heap_push(std::vector<AssetInfo *> &heap, AssetInfo *info)
+{
+	heap.push_back(info);
+	heap_sift_up(heap, uint32_t(heap.size() - 1));
+}
+
+void AssetManager::heap_erase(std::vector<AssetInfo *> &heap, AssetInfo *info)
+{
+	uint32_t index = info->heap_index;
+	info->heap_index = UINT32_MAX;
+
+	auto *last = heap.back();
+	heap.pop_back();
+	if (last != info)
+	{
+		heap[index] = last;
+		last->heap_index = index;
+		heap_update(heap, last);
+	}
+}
+
+void AssetManager::heap_update(std::vector<AssetInfo *> &heap, AssetInfo *info)
+{
+	heap_sift_up(heap, info->heap_index);
+	heap_sift_down(heap, info->heap_index);
+}
+
+AssetManager::PrioBucket &AssetManager::get_bucket(int prio)
+{
+	auto itr = std::lower_bound(buckets.begin(), buckets.end(), prio, [](const PrioBucket &bucket, int p) {
+		return bucket.prio > p;
+	});
+
+	if (itr == buckets.end() || itr->prio != prio)
+		itr = buckets.insert(itr, { prio, {}, {} });
+	return *itr;
+}
+
+void AssetManager::link_lru(AssetInfo *info, bool front)
+{
+	// Nothing to decide for resources in flight, they are linked again once the cost update comes in.
+	if (info->pending_levels)
+		return;
+
+	auto &bucket = get_bucket(info->prio);
+	if (info->consumed && !info->resident_link.linked)
+	{
+		if (front)
+			bucket.resident.insert_front(&info->resident_link);
+		else
+			bucket.resident.insert_back(&info->resident_link);
+		info->resident_link.linked = true;
+	}
+
+	if ((!info->num_levels || info->resident_levels < info->num_levels) && info->heap_index == UINT32_MAX)
+		heap_push(bucket.incomplete, info);
+}
+
+void AssetManager::unlink_lru(AssetInfo *info)
+{
+	auto &bucket = get_bucket(info->prio);
+	if (info->resident_link.linked)
+	{
+		if (release_cursor == &info->resident_link)
+			pop_release_candidate();
+		bucket.resident.erase(&info->resident_link);
+		info->resident_link.linked = false;
+	}
+
+	if (info->heap_index != UINT32_MAX)
+		heap_erase(bucket.incomplete, info);
+}
+
+void AssetManager::touch_lru(AssetInfo *info)
+{
+	if (!info->lru_touched)
+	{
+		info->lru_touched = true;
+		touched_assets.push_back(info);
+	}
+}
+
+void AssetManager::update_lru_order()
+{
+	// Everything touched since last time has the newest timestamp, so it all goes to the front.
+	// Only the touched resources need sorting among themselves to break ties the same way a full sort would.
+	std::sort(touched_assets.begin(), touched_assets.end(), ranks_before);
+	for (auto itr = touched_assets.rbegin(); itr != touched_assets.rend(); ++itr)
+	{
+		auto *a = *itr;
+		unlink_lru(a);
+		link_lru(a, true);
+		a->lru_touched = false;
+	}
+	touched_assets.clear();
+}
+
+AssetManager::AssetInfo *AssetManager::peek_release_candidate()
+{
+	// Walks resident resources from the lowest ranked one and up.
+	while (!release_cursor && release_bucket)
+		release_cursor = buckets[--release_bucket].resident.rbegin().get();
+	return release_cursor ? release_cursor->info : nullptr;
+}
+
+void AssetManager::pop_release_candidate()
+{
+	release_cursor = static_cast<LRULink *>(release_cursor->prev);
+}
+
+void AssetManager::update_throughput()
+{
+	// Only measure while there is work in flight, otherwise idle iterations would drag the estimate down.
+	if (completed_bytes || stats.pending_bytes)
+		stats.throughput_per_iteration = (3 * stats.throughput_per_iteration + completed_bytes) / 4;
+	completed_bytes = 0;
+}
+
+uint64_t AssetManager::release_image(AssetInfo *info)
+{
+	uint64_t freed = info->consumed;
+	iface->release_image_resource(info->id);
+	total_consumed -= freed;
+	info->consumed = 0;
+	info->resident_levels = 0;
+	stats.evictions++;
+	stats.evicted_bytes += freed;
+
+	unlink_lru(info);
+	link_lru(info, false);
+	return freed;
+}
+
+uint64_t AssetManager::release_image_level(AssetInfo *info)
+{
+	uint32_t levels = info->resident_levels - 1;
+	uint64_t cost = iface->estimate_cost_image_resource_levels(info->id, *info->handle, levels);
+	cost = std::min(cost, info->consumed);
+	iface->release_image_resource_levels(info->id, levels);
+
+	uint64_t freed = info->consumed - cost;
+	total_consumed -= freed;
+	info->consumed = cost;
+	info->resident_levels = levels;
+	stats.evictions++;
+	stats.evicted_bytes += freed;
+
+	// Less consumption ranks it earlier among resources used at the same time.
+	if (info->heap_index != UINT32_MAX)
+		heap_update(get_bucket(info->prio).incomplete, info);
+	else
+		link_lru(info, false);
+	return freed;
+}
+
 void AssetManager::update_costs_locked_assets()
 {
 	{
@@ -178,10 +495,31 @@ void AssetManager::update_costs_locked_assets()
 
 void AssetManager::update_lru_locked_assets()
 {
-	lru_append.for_each_ranged([this](const ImageAssetID *id, size_t count) {
+	lru_append.for_each_ranged([this](const UsageUpdate *updates, size_t count) {
 		for (size_t i = 0; i < count; i++)
-			if (id[i].id < asset_bank.size())
-				asset_bank[id[i].id]->last_used = timestamp;
+		{
+			if (updates[i].id.id >= asset_bank.size())
+				continue;
+
+			auto *a = asset_bank[updates[i].id.id];
+			a->last_used = timestamp;
+			touch_lru(a);
+			if (updates[i].importance <= 0.0f)
+				continue;
+
+			// The most demanding use of a resource decides.
+			if (a->importance == 0.0f)
+			{
+				important_assets.push_back(a);
+				a->importance = updates[i].importance;
+				a->wanted_levels = updates[i].wanted_levels;
+			}
+			else
+			{
+				a->importance = std::max(a->importance, updates[i].importance);
+				a->wanted_levels = std::max(a->wanted_levels, updates[i].wanted_levels);
+			}
+		}
 	});
 	lru_append.clear();
 }
@@ -194,23 +532,36 @@ bool AssetManager::iterate_blocking(ThreadGroup &group, ImageAssetID id)
 	std::lock_guard<std::mutex> holder{asset_bank_lock};
 	update_costs_locked_assets();
 	update_lru_locked_assets();
+	update_lru_order();
 
 	if (id.id >= id_count)
 		return false;
 
 	auto *candidate = asset_bank[id.id];
-	if (candidate->consumed != 0 || candidate->pending_consumed != 0)
+	if (candidate->consumed != 0 || candidate->pending_levels != 0)
 		return true;
 
-	uint64_t estimate = iface->estimate_cost_image_resource(candidate->id, *candidate->handle);
+	// Someone is waiting, so bring in every level at once.
+	stats.stalls++;
+	if (!candidate->num_levels)
+		candidate->num_levels = std::max(1u, iface->get_num_streaming_levels(candidate->id, *candidate->handle));
+	uint32_t levels = candidate->num_levels;
+	uint64_t estimate = iface->estimate_cost_image_resource_levels(candidate->id, *candidate->handle, levels);
 	auto task = group.create_task();
 	task->set_task_class(TaskClass::Background);
+	// Someone is likely waiting for this particular resource.
+	task->set_priority(TaskPriority::High);
 	task->set_fence_counter_signal(signal.get());
 	task->set_desc("asset-manager-instantiate-single");
-	iface->instantiate_image_resource(*this, task.get(), candidate->id, *candidate->handle);
+	iface->instantiate_image_resource_levels(*this, task.get(), candidate->id, *candidate->handle, levels);
+	unlink_lru(candidate);
 	candidate->pending_consumed = estimate;
+	candidate->pending_levels = levels;
 	candidate->last_used = timestamp;
 	total_consumed += estimate;
+	stats.pending_bytes += estimate;
+	stats.activations++;
+	stats.activated_bytes += estimate;
 
 	// We cannot increment the timestamp here, remember this for later.
 	// We hold a lock on the asset bank here, so this is fine even if called concurrently.
@@ -232,6 +583,7 @@ void AssetManager::iterate(ThreadGroup *group)
 	if (current_count + 3 < timestamp)
 	{
 		iface->latch_handles();
+		stats.stalls++;
 		LOGI("Asset manager skipping iteration due to too much pending work.\n");
 		return;
 	}
@@ -243,6 +595,7 @@ void AssetManager::iterate(ThreadGroup *group)
 		task->set_desc("asset-manager-instantiate");
 		task->set_fence_counter_signal(signal.get());
 		task->set_task_class(TaskClass::Background);
+		task->set_priority(TaskPriority::Low);
 	}
 	else
 		signal->signal_increment();
@@ -250,120 +603,220 @@ void AssetManager::iterate(ThreadGroup *group)
 	std::lock_guard<std::mutex> holder{asset_bank_lock};
 	update_costs_locked_assets();
 	update_lru_locked_assets();
+	update_throughput();
 
-	sorted_assets = asset_bank;
-	std::sort(sorted_assets.begin(), sorted_assets.end(), [](const AssetInfo *a, const AssetInfo *b) -> bool {
-		// High prios come first since they will be activated.
-		// Then we sort by LRU.
-		// High consumption should be moved last, so they are candidates to be paged out if we're over budget.
-		// High pending consumption should be moved early since we don't want to page out resources that
-		// are in the middle of being loaded anyway.
-		// Finally, the ID is used as a tie breaker.
-
-		if (a->prio != b->prio)
-			return a->prio > b->prio;
-		else if (a->last_used != b->last_used)
-			return a->last_used > b->last_used;
-		else if (a->consumed != b->consumed)
-			return a->consumed < b->consumed;
-		else if (a->pending_consumed != b->pending_consumed)
-			return a->pending_consumed > b->pending_consumed;
-		else
-			return a->id.id < b->id.id;
-	});
+	update_lru_order();
+
+	// Only the resources reported as important this frame need an actual sort.
+	std::sort(important_assets.begin(), important_assets.end(), ranks_before);
 
-	size_t release_index = sorted_assets.size();
 	uint64_t activated_cost_this_iteration = 0;
 	unsigned activation_count = 0;
-	size_t activate_index = 0;
 
-	// Aim to activate resources as long as we're in budget.
-	// Activate in order from highest priority to lowest.
-	bool can_activate = true;
-	while (can_activate &&
-	       total_consumed < image_budget &&
-	       activated_cost_this_iteration < image_budget_per_iteration &&
-	       activate_index != release_index)
+	// Don't queue up more work than I/O is measured to complete within the latency target.
+	// With nothing in flight, let one activation through so there is something to measure.
+	uint64_t iteration_budget = image_budget_per_iteration;
+	if (streaming_latency_target)
 	{
-		auto *candidate = sorted_assets[activate_index];
-		if (candidate->prio <= 0)
-			break;
+		uint64_t in_flight_limit = stats.throughput_per_iteration * streaming_latency_target;
+		uint64_t io_budget = in_flight_limit > stats.pending_bytes ? in_flight_limit - stats.pending_bytes : 0;
+		if (stats.pending_bytes == 0)
+			io_budget = std::max<uint64_t>(io_budget, 1);
+		iteration_budget = std::min(iteration_budget, io_budget);
+	}
+
+	// Page-out walks up from the lowest ranked resident resource.
+	release_bucket = buckets.size();
+	release_cursor = nullptr;
+
+	// Where activation stopped. Resources ranked here or below may be paged out after activation.
+	// If activation got through everything, nothing is paged out.
+	Rank activation_frontier = { INT_MIN, 0.0f, 0 };
+	// The highest ranked resource paged out to make room so far.
+	Rank release_frontier = {};
+	bool has_released = false;
+	bool throttled = false;
+
+	// Returns false when activation should stop.
+	const auto try_activate = [&](AssetInfo *candidate) -> bool {
+		if (activated_cost_this_iteration >= iteration_budget)
+		{
+			activation_frontier = get_rank(candidate);
+			throttled = iteration_budget < image_budget_per_iteration;
+			return false;
+		}
+
+		// Page-out has already been through everything ranked this low, don't page it back in.
+		if (has_released && !outranks(get_rank(candidate), release_frontier))
+		{
+			activation_frontier = get_rank(candidate);
+			return false;
+		}
 
-		// This resource is already active.
-		if (candidate->consumed != 0 || candidate->pending_consumed != 0)
+		// Once we're at budget, only resources the renderer is asking for right now may page out others.
+		if (total_consumed >= image_budget && candidate->importance <= 0.0f)
 		{
-			activate_index++;
-			continue;
+			activation_frontier = get_rank(candidate);
+			return false;
 		}
 
-		uint64_t estimate = iface->estimate_cost_image_resource(candidate->id, *candidate->handle);
+		if (!candidate->num_levels)
+			candidate->num_levels = std::max(1u, iface->get_num_streaming_levels(candidate->id, *candidate->handle));
 
-		can_activate = (total_consumed + estimate <= image_budget) || (candidate->prio >= persistent_prio());
-		while (!can_activate && activate_index + 1 != release_index)
+		uint32_t max_levels = std::min(candidate->num_levels, std::max(candidate->wanted_levels, 1u));
+
+		// This resource is already active, or in the middle of being loaded.
+		if (candidate->resident_levels >= max_levels || candidate->pending_levels != 0)
+			return true;
+
+		uint32_t levels = candidate->resident_levels + 1;
+		uint64_t estimate = iface->estimate_cost_image_resource_levels(candidate->id, *candidate->handle, levels);
+		uint64_t delta = estimate > candidate->consumed ? estimate - candidate->consumed : 0;
+
+		bool can_activate = (total_consumed + delta <= image_budget) || (candidate->prio >= persistent_prio());
+		while (!can_activate)
 		{
-			auto *release_candidate = sorted_assets[--release_index];
-			if (release_candidate->consumed)
+			// Never page out something which ranks equal to what we're paging in, it would just thrash.
+			auto *release_candidate = peek_release_candidate();
+			if (!release_candidate || !outranks(get_rank(candidate), get_rank(release_candidate)))
+				break;
+
+			pop_release_candidate();
+			release_frontier = get_rank(release_candidate);
+			has_released = true;
+
+			if (release_candidate->resident_levels > 1)
+			{
+				LOGI("Releasing level %u of ID %u due to page-in pressure.\n",
+				     release_candidate->resident_levels - 1, release_candidate->id.id);
+				release_image_level(release_candidate);
+			}
+			else
 			{
 				LOGI("Releasing ID %u due to page-in pressure.\n", release_candidate->id.id);
-				iface->release_image_resource(release_candidate->id);
-				total_consumed -= release_candidate->consumed;
-				release_candidate->consumed = 0;
+				release_image(release_candidate);
 			}
-			can_activate = total_consumed + estimate <= image_budget;
+			can_activate = total_consumed + delta <= image_budget;
 		}
 
-		if (can_activate)
+		if (!can_activate)
 		{
-			// We're trivially in budget.
-			iface->instantiate_image_resource(*this, task.get(), candidate->id, *candidate->handle);
-			activation_count++;
-
-			candidate->pending_consumed = estimate;
-			total_consumed += estimate;
-			// Let this run over budget once.
-			// Ensures we can make forward progress no matter what the limit is.
-			activated_cost_this_iteration += estimate;
-			activate_index++;
+			activation_frontier = get_rank(candidate);
+			return false;
 		}
+
+		// We're trivially in budget.
+		iface->instantiate_image_resource_levels(*this, task.get(), candidate->id, *candidate->handle, levels);
+		unlink_lru(candidate);
+		activation_count++;
+
+		candidate->pending_consumed = delta;
+		candidate->pending_levels = levels;
+		total_consumed += delta;
+		stats.pending_bytes += delta;
+		stats.activations++;
+		stats.activated_bytes += delta;
+		// Let this run over budget once.
+		// Ensures we can make forward progress no matter what the limit is.
+		activated_cost_this_iteration += delta;
+		return true;
+	};
+
+	// Aim to activate resources as long as we're in budget.
+	// Activate in order from highest priority to lowest.
+	// Within a priority, important resources come first, then the rest in LRU order.
+	// Images with mip streaming gain one level per iteration, so every important image gets
+	// its low resolution levels before any image gets its full resolution.
+	size_t important_index = 0;
+	for (auto &bucket : buckets)
+	{
+		if (bucket.prio <= 0)
+		{
+			activation_frontier = { bucket.prio, FLT_MAX, UINT64_MAX };
+			break;
+		}
+
+		bool keep_going = true;
+		for (; keep_going && important_index < important_assets.size() &&
+		       important_assets[important_index]->prio == bucket.prio; important_index++)
+		{
+			keep_going = try_activate(important_assets[important_index]);
+		}
+
+		if (keep_going && total_consumed >= image_budget)
+		{
+			activation_frontier = { bucket.prio, 0.0f, UINT64_MAX };
+			keep_going = false;
+		}
+
+		// Candidates are taken off the heap while walking it. The ones which were not activated go back afterwards.
+		while (keep_going && !bucket.incomplete.empty())
+		{
+			auto *candidate = bucket.incomplete.front();
+			heap_erase(bucket.incomplete, candidate);
+			if (candidate->importance <= 0.0f)
+				keep_going = try_activate(candidate);
+			if (!candidate->pending_levels)
+				skipped_assets.push_back(candidate);
+		}
+
+		for (auto *a : skipped_assets)
+			link_lru(a, false);
+		skipped_assets.clear();
+
+		if (!keep_going)
+			break;
 	}
 
+	if (throttled)
+		stats.throttled_iterations++;
+
 	// If we're 75% of budget, start garbage collecting non-resident resources ahead of time.
 	const uint64_t low_image_budget = (image_budget * 3) / 4;
 
-	const auto should_release = [&]() -> bool {
-		if (release_index == activate_index)
+	const auto should_release = [&](const AssetInfo *candidate) -> bool {
+		if (!candidate)
+			return false;
+		if (candidate->prio == persistent_prio())
 			return false;
-		if (sorted_assets[release_index - 1]->prio == persistent_prio())
+		if (outranks(get_rank(candidate), activation_frontier))
 			return false;
 
 		if (total_consumed > image_budget)
 			return true;
-		else if (total_consumed > low_image_budget && sorted_assets[release_index - 1]->prio == 0)
+		else if (total_consumed > low_image_budget && candidate->prio == 0)
 			return true;
 
 		return false;
 	};
 
 	// If we're over budget, deactivate resources.
-	while (should_release())
+	AssetInfo *candidate;
+	while (should_release(candidate = peek_release_candidate()))
 	{
-		auto *candidate = sorted_assets[--release_index];
-		if (candidate->consumed)
-		{
-			LOGI("Releasing 0-prio ID %u due to page-in pressure.\n", candidate->id.id);
-			iface->release_image_resource(candidate->id);
-			total_consumed -= candidate->consumed;
-			candidate->consumed = 0;
-			candidate->last_used = 0;
-		}
+		pop_release_candidate();
+		LOGI("Releasing 0-prio ID %u due to page-in pressure.\n", candidate->id.id);
+		candidate->last_used = 0;
+		release_image(candidate);
 	}
 
+	release_bucket = 0;
+	release_cursor = nullptr;
+
 	if (activated_cost_this_iteration)
 	{
 		LOGI("Activated %u resources for %llu KiB.\n", activation_count,
 		     static_cast<unsigned long long>(activated_cost_this_iteration / 1024));
 	}
 
+	// Importance only applies to the frame it was reported in.
+	for (auto *a : important_assets)
+	{
+		a->importance = 0.0f;
+		a->wanted_levels = UINT32_MAX;
+	}
+	important_assets.clear();
+
 	iface->latch_handles();
 	timestamp++;
 }
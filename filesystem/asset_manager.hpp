@@ -26,9 +26,11 @@
 #include "filesystem.hpp"
 #include "object_pool.hpp"
 #include "intrusive_hash_map.hpp"
+#include "intrusive_list.hpp"
 #include <vector>
 #include <mutex>
 #include <memory>
+#include <stdint.h>
 
 namespace Granite
 {
@@ -78,10 +80,45 @@ public:
 	virtual void set_id_bounds(uint32_t bound) = 0;
 	virtual void set_image_class(ImageAssetID id, ImageClass image_class);
 
+	// Optional mip streaming.
+	// If an image has more than one streaming level, the manager pages it in one level at a time,
+	// where level count N means the N smallest mip levels are resident.
+	// It is paged out again from the largest mip level down.
+	virtual uint32_t get_num_streaming_levels(ImageAssetID id, File &mapping);
+	virtual uint64_t estimate_cost_image_resource_levels(ImageAssetID id, File &mapping, uint32_t levels);
+	// As instantiate_image_resource(), but only for the given number of levels.
+	// manager.update_cost() must be called with the cost of all resident levels.
+	virtual void instantiate_image_resource_levels(AssetManager &manager, TaskGroup *group, ImageAssetID id,
+	                                               File &mapping, uint32_t levels);
+	// Drops resident levels down to the given count, which is always at least 1.
+	// Fully releasing an image goes through release_image_resource().
+	virtual void release_image_resource_levels(ImageAssetID id, uint32_t levels);
+
 	// Called in AssetManager::iterate().
 	virtual void latch_handles() = 0;
 };
 
+// Counters are cumulative, except resident_bytes, pending_bytes and throughput_per_iteration.
+struct ImageStreamingStats
+{
+	// Cost of resources which have completed instantiation.
+	uint64_t resident_bytes = 0;
+	// Estimated cost of instantiations in flight.
+	uint64_t pending_bytes = 0;
+	// Bytes completed per iterate(), averaged over iterations with work in flight.
+	uint64_t throughput_per_iteration = 0;
+
+	uint64_t activations = 0;
+	uint64_t activated_bytes = 0;
+	// A full release or dropping a mip level both count as one eviction.
+	uint64_t evictions = 0;
+	uint64_t evicted_bytes = 0;
+	// Iterations skipped due to too much pending work, and blocking requests for a resource.
+	uint64_t stalls = 0;
+	// Iterations where the I/O throttle held back activations.
+	uint64_t throttled_iterations = 0;
+};
+
 class AssetManager final : public AssetManagerInterface
 {
 public:
@@ -95,6 +132,10 @@ public:
 	void set_image_budget(uint64_t cost);
 	void set_image_budget_per_iteration(uint64_t cost);
 
+	// Limits the amount of work in flight to what the measured I/O throughput can complete
+	// within the given number of iterations. 0 disables throttling.
+	void set_streaming_latency_target(uint32_t iterations);
+
 	// FileHandle is intended to be used with FileSlice or similar here so that we don't need
 	// a ton of open files at once.
 	ImageAssetID register_image_resource(FileHandle file, ImageClass image_class, int prio = 1);
@@ -119,7 +160,26 @@ public:
 	// When a resource is actually accessed, this is called.
 	void mark_used_resource(ImageAssetID id);
 
+	// As above, but also ranks the resource for streaming in the next iterate().
+	// Importance is supplied by the caller, e.g. the projected screen-space size of an object using the resource.
+	// Among resources with equal priority, more important ones are paged in first.
+	// With mip streaming, wanted_levels is the number of levels, counted from the smallest,
+	// which are worth paging in for this use.
+	// Both only last until the next iterate(), so they must be supplied every frame.
+	void mark_used_resource(ImageAssetID id, float importance, uint32_t wanted_levels = UINT32_MAX);
+
+	// May be called concurrently, except when calling iterate().
+	ImageStreamingStats get_streaming_stats() const;
+
 private:
+	struct AssetInfo;
+	struct LRULink : Util::IntrusiveListEnabled<LRULink>
+	{
+		AssetInfo *info = nullptr;
+		bool linked = false;
+	};
+	using LRUList = Util::IntrusiveList<LRULink>;
+
 	struct AssetInfo : Util::IntrusiveHashMapEnabled<AssetInfo>
 	{
 		uint64_t pending_consumed = 0;
@@ -129,13 +189,58 @@ private:
 		ImageAssetID id = {};
 		ImageClass image_class = ImageClass::Zeroable;
 		int prio = 0;
+		float importance = 0.0f;
+		uint32_t wanted_levels = UINT32_MAX;
+
+		// 0 until queried on first activation.
+		uint32_t num_levels = 0;
+		uint32_t resident_levels = 0;
+		// Non-zero while an instantiation is in flight.
+		uint32_t pending_levels = 0;
+
+		// Position in the priority bucket.
+		LRULink resident_link;
+		uint32_t heap_index = UINT32_MAX;
+		// Used this iteration, so it moves to the front of the LRU lists.
+		bool lru_touched = false;
+	};
+
+	// Ordering is kept up to date incrementally. Only resources which were used, completed or paged out
+	// since the last iteration move, so iterate() does not need to look at every resource.
+	struct PrioBucket
+	{
+		int prio;
+		// Resources with something resident which may be paged out, most recently used first.
+		LRUList resident;
+		// Resources which may page in more. A 4-ary heap with the most recently used one on top.
+		std::vector<AssetInfo *> incomplete;
+	};
+
+	struct Rank
+	{
+		int prio;
+		float importance;
+		uint64_t last_used;
 	};
 
-	std::vector<AssetInfo *> sorted_assets;
+	struct UsageUpdate
+	{
+		ImageAssetID id;
+		float importance;
+		uint32_t wanted_levels;
+	};
+
+	// Sorted from highest to lowest priority.
+	std::vector<PrioBucket> buckets;
+	std::vector<AssetInfo *> touched_assets;
+	std::vector<AssetInfo *> skipped_assets;
+	size_t release_bucket = 0;
+	LRULink *release_cursor = nullptr;
 	std::mutex asset_bank_lock;
 	std::vector<AssetInfo *> asset_bank;
 	Util::ObjectPool<AssetInfo> pool;
-	Util::AtomicAppendBuffer<ImageAssetID> lru_append;
+	Util::AtomicAppendBuffer<UsageUpdate> lru_append;
+	std::vector<AssetInfo *> important_assets;
 	Util::IntrusiveHashMapHolder<AssetInfo> file_to_assets;
 
 	AssetInstantiatorInterface *iface = nullptr;
@@ -143,6 +248,9 @@ private:
 	uint64_t total_consumed = 0;
 	uint64_t image_budget = 0;
 	uint64_t image_budget_per_iteration = 0;
+	uint32_t streaming_latency_target = 0;
+	uint64_t completed_bytes = 0;
+	ImageStreamingStats stats;
 	uint64_t timestamp = 1;
 	uint32_t blocking_signals = 0;
 
@@ -161,5 +269,26 @@ private:
 
 	void update_costs_locked_assets();
 	void update_lru_locked_assets();
+	void update_throughput();
+	static Rank get_rank(const AssetInfo *a);
+	static bool outranks(const Rank &a, const Rank &b);
+	static bool ranks_before(const AssetInfo *a, const AssetInfo *b);
+
+	static bool heap_before(const AssetInfo *a, const AssetInfo *b);
+	static void heap_push(std::vector<AssetInfo *> &heap, AssetInfo *info);
+	static void heap_erase(std::vector<AssetInfo *> &heap, AssetInfo *info);
+	static void heap_update(std::vector<AssetInfo *> &heap, AssetInfo *info);
+	static void heap_sift_up(std::vector<AssetInfo *> &heap, uint32_t index);
+	static void heap_sift_down(std::vector<AssetInfo *> &heap, uint32_t index);
+
+	PrioBucket &get_bucket(int prio);
+	void link_lru(AssetInfo *info, bool front);
+	void unlink_lru(AssetInfo *info);
+	void touch_lru(AssetInfo *info);
+	void update_lru_order();
+	AssetInfo *peek_release_candidate();
+	void pop_release_candidate();
+	uint64_t release_image_level(AssetInfo *info);
+	uint64_t release_image(AssetInfo *info);
 };
 }
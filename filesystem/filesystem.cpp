@@ -26,6 +26,7 @@
 #include "logging.hpp"
 #include "os_filesystem.hpp"
 #include "string_helpers.hpp"
+#include "thread_group.hpp"
 #include <algorithm>
 #include <stdlib.h>
 #include <string.h>
@@ -52,6 +53,18 @@ std::vector<ListEntry> FilesystemBackend::walk(const std::string &path)
 	return final_entries;
 }
 
+void FilesystemBackend::submit_reads(FileReadBatchHandle batch)
+{
+	auto &requests = batch->get_requests();
+	batch->begin_requests();
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		auto &req = requests[i];
+		batch->set_request_chunks(i, 1);
+		batch->complete_request_chunk(i, req.file->read(req.offset, req.data, req.size));
+	}
+}
+
 bool FilesystemBackend::remove(const std::string &)
 {
 	return false;
@@ -657,6 +670,127 @@ Util::IntrusivePtr<FileMapping> File::map()
 	return map_subset(0, get_size());
 }
 
+int64_t File::read(uint64_t offset, void *data, size_t range)
+{
+	uint64_t file_size = get_size();
+	if (offset >= file_size)
+		return offset == file_size ? 0 : -1;
+
+	range = size_t(std::min<uint64_t>(range, file_size - offset));
+	if (range == 0)
+		return 0;
+
+	auto mapping = map_subset(offset, range);
+	if (!mapping)
+		return -1;
+
+	memcpy(data, mapping->data(), range);
+	return int64_t(range);
+}
+
+FileReadBatch::~FileReadBatch()
+{
+}
+
+void FileReadBatch::add_read(FileHandle file, uint64_t offset, size_t size, void *data)
+{
+	requests.push_back({ std::move(file), offset, size, data, -1 });
+}
+
+void FileReadBatch::set_completion_signal(TaskSignal *signal_)
+{
+	signal = signal_;
+}
+
+void FileReadBatch::set_completion_task(Util::IntrusivePtr<TaskGroup> group)
+{
+	group->add_external_dependency();
+	completion_task = std::move(group);
+}
+
+void FileReadBatch::begin_requests()
+{
+	states.reset(new RequestState[requests.size()]);
+	for (size_t i = 0; i < requests.size(); i++)
+	{
+		states[i].pending_chunks.store(0, std::memory_order_relaxed);
+		states[i].bytes.store(0, std::memory_order_relaxed);
+		states[i].failed.store(false, std::memory_order_relaxed);
+	}
+
+	pending_requests.store(requests.size(), std::memory_order_relaxed);
+	if (requests.empty())
+		complete();
+}
+
+void FileReadBatch::set_request_chunks(size_t index, unsigned count)
+{
+	states[index].pending_chunks.store(count, std::memory_order_relaxed);
+	if (count == 0)
+		complete_request(index);
+}
+
+void FileReadBatch::complete_request_chunk(size_t index, int64_t bytes)
+{
+	auto &state = states[index];
+	if (bytes < 0)
+		state.failed.store(true, std::memory_order_relaxed);
+	else
+		state.bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+	if (state.pending_chunks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		complete_request(index);
+}
+
+void FileReadBatch::complete_request(size_t index)
+{
+	auto &state = states[index];
+	requests[index].result = state.failed.load(std::memory_order_relaxed) ?
+	                         -1 : state.bytes.load(std::memory_order_relaxed);
+
+	if (pending_requests.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		complete();
+}
+
+void FileReadBatch::complete()
+{
+	// Keep the batch alive until we are done, the last reference may be held by a waiter.
+	auto self = reference_from_this();
+
+	if (signal)
+		signal->signal_increment();
+
+	if (completion_task)
+	{
+		completion_task->release_external_dependency();
+		completion_task.reset();
+	}
+
+	std::lock_guard<std::mutex> holder{lock};
+	done = true;
+	cond.notify_all();
+}
+
+bool FileReadBatch::poll() const
+{
+	std::lock_guard<std::mutex> holder{lock};
+	return done;
+}
+
+void FileReadBatch::wait()
+{
+	std::unique_lock<std::mutex> holder{lock};
+	cond.wait(holder, [this]() { return done; });
+}
+
+bool FileReadBatch::succeeded() const
+{
+	for (auto &req : requests)
+		if (req.result < 0 || size_t(req.result) != req.size)
+			return false;
+	return true;
+}
+
 FileSlice::FileSlice(FileHandle handle_, uint64_t offset_, uint64_t range_)
 	: handle(std::move(handle_)), offset(offset_), range(range_)
 {
@@ -26,6 +26,9 @@
 #include <memory>
 #include <unordered_map>
 #include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <stdio.h>
 #include "global_managers.hpp"
 #include "intrusive.hpp"
@@ -33,6 +36,8 @@
 namespace Granite
 {
 class FileMapping;
+struct TaskGroup;
+struct TaskSignal;
 
 class File : public Util::ThreadSafeIntrusivePtrEnabled<File>
 {
@@ -45,6 +50,11 @@ public:
 	// Only called by FileMapping.
 	virtual void unmap(void *mapped, size_t range) = 0;
 
+	// Copies from the file without keeping a mapping around.
+	// Returns the number of bytes read, which is less than range at end of file, or -1 on error.
+	// The default implementation goes through map_subset().
+	virtual int64_t read(uint64_t offset, void *data, size_t range);
+
 	Util::IntrusivePtr<FileMapping> map();
 };
 using FileHandle = Util::IntrusivePtr<File>;
@@ -122,6 +132,80 @@ struct FileNotifyInfo
 	FileNotifyHandle handle;
 };
 
+struct FileReadRequest
+{
+	FileHandle file;
+	uint64_t offset;
+	size_t size;
+	void *data;
+	// Number of bytes read, or -1 on error. Valid once the batch has completed.
+	int64_t result;
+};
+
+// A set of reads into caller owned memory which are submitted and complete together.
+// Completion can be observed by polling or waiting on the batch, through a TaskSignal,
+// or by holding back a TaskGroup until the data has arrived.
+class FileReadBatch : public Util::ThreadSafeIntrusivePtrEnabled<FileReadBatch>
+{
+public:
+	~FileReadBatch();
+
+	// data must stay valid until the batch completes.
+	void add_read(FileHandle file, uint64_t offset, size_t size, void *data);
+
+	// Must be set before the batch is submitted.
+	// The signal is incremented once when every read has completed.
+	void set_completion_signal(TaskSignal *signal);
+	// Tasks in the group do not start before every read has completed. The group must not be flushed yet.
+	void set_completion_task(Util::IntrusivePtr<TaskGroup> group);
+
+	bool poll() const;
+	void wait();
+
+	// True if every read completed in full. Only meaningful after completion.
+	bool succeeded() const;
+
+	std::vector<FileReadRequest> &get_requests()
+	{
+		return requests;
+	}
+
+	const std::vector<FileReadRequest> &get_requests() const
+	{
+		return requests;
+	}
+
+	// For backends. A request may be split into several chunks which complete in any order on any thread.
+	// begin_requests() must be called before any chunk completes.
+	void begin_requests();
+	void set_request_chunks(size_t index, unsigned count);
+	// bytes is -1 on error.
+	void complete_request_chunk(size_t index, int64_t bytes);
+
+private:
+	std::vector<FileReadRequest> requests;
+
+	struct RequestState
+	{
+		std::atomic_uint pending_chunks;
+		std::atomic<int64_t> bytes;
+		std::atomic_bool failed;
+	};
+	std::unique_ptr<RequestState[]> states;
+	std::atomic<size_t> pending_requests;
+
+	TaskSignal *signal = nullptr;
+	Util::IntrusivePtr<TaskGroup> completion_task;
+
+	mutable std::mutex lock;
+	std::condition_variable cond;
+	bool done = false;
+
+	void complete_request(size_t index);
+	void complete();
+};
+using FileReadBatchHandle = Util::IntrusivePtr<FileReadBatch>;
+
 enum class FileMode
 {
 	ReadOnly,
@@ -155,6 +239,10 @@ public:
 		return "";
 	}
 
+	// Reads asynchronously. Every file in the batch must have been opened through this backend.
+	// The default implementation completes the batch synchronously with File::read().
+	virtual void submit_reads(FileReadBatchHandle batch);
+
 	void set_protocol(const std::string &proto)
 	{
 		protocol = proto;
@@ -23,8 +23,15 @@
 #include "os_filesystem.hpp"
 #include "path_utils.hpp"
 #include "logging.hpp"
+#include "object_pool.hpp"
+#include "thread_name.hpp"
 #include <algorithm>
 #include <stdexcept>
+#include <thread>
+#include <queue>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
 
 #include <errno.h>
 #include <sys/types.h>
@@ -39,6 +46,16 @@
 #include <sys/inotify.h>
 #endif
 
+#if defined(__linux__) && !defined(ANDROID) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#define GRANITE_HAVE_IO_URING
+#endif
+#endif
+
 namespace Granite
 {
 static bool ensure_directory_inner(const std::string &path)
@@ -214,6 +231,464 @@ MMapFile::~MMapFile()
 	}
 }
 
+int64_t MMapFile::read(uint64_t offset, void *data, size_t read_size)
+{
+	auto *dst = static_cast<uint8_t *>(data);
+	size_t total = 0;
+	while (total < read_size)
+	{
+		ssize_t ret = pread64(fd, dst + total, read_size - total, off64_t(offset + total));
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		else if (ret == 0)
+			break;
+		total += size_t(ret);
+	}
+	return int64_t(total);
+}
+
+// Large reads are split up so they can be serviced in parallel.
+static constexpr size_t AsyncReadChunkSize = 1024 * 1024;
+
+static unsigned get_async_read_chunk_count(size_t size)
+{
+	return unsigned((size + AsyncReadChunkSize - 1) / AsyncReadChunkSize);
+}
+
+class AsyncFileReader
+{
+public:
+	virtual ~AsyncFileReader() = default;
+	virtual void submit(FileReadBatchHandle batch) = 0;
+};
+
+class ThreadPoolFileReader final : public AsyncFileReader
+{
+public:
+	ThreadPoolFileReader()
+	{
+		for (auto &thread : threads)
+			thread = std::thread(&ThreadPoolFileReader::thread_loop, this);
+	}
+
+	~ThreadPoolFileReader() override
+	{
+		{
+			std::lock_guard<std::mutex> holder{lock};
+			dead = true;
+			cond.notify_all();
+		}
+
+		for (auto &thread : threads)
+			thread.join();
+	}
+
+	void submit(FileReadBatchHandle batch) override
+	{
+		auto &requests = batch->get_requests();
+		batch->begin_requests();
+
+		std::lock_guard<std::mutex> holder{lock};
+		for (size_t i = 0; i < requests.size(); i++)
+		{
+			auto &req = requests[i];
+			unsigned count = get_async_read_chunk_count(req.size);
+			batch->set_request_chunks(i, count);
+
+			for (unsigned chunk = 0; chunk < count; chunk++)
+			{
+				size_t offset = chunk * AsyncReadChunkSize;
+				chunks.push({ batch, i, req.offset + offset,
+				              std::min(AsyncReadChunkSize, req.size - offset),
+				              static_cast<uint8_t *>(req.data) + offset });
+			}
+		}
+		cond.notify_all();
+	}
+
+private:
+	// Blocking reads on cold data mostly wait for the device, so use more threads than a CPU bound pool would.
+	enum { NumThreads = 4 };
+	std::thread threads[NumThreads];
+
+	struct Chunk
+	{
+		FileReadBatchHandle batch;
+		size_t index;
+		uint64_t offset;
+		size_t size;
+		uint8_t *data;
+	};
+
+	std::mutex lock;
+	std::condition_variable cond;
+	std::queue<Chunk> chunks;
+	bool dead = false;
+
+	void thread_loop()
+	{
+		Util::set_current_thread_name("file-read");
+		for (;;)
+		{
+			Chunk chunk;
+			{
+				std::unique_lock<std::mutex> holder{lock};
+				cond.wait(holder, [this]() { return dead || !chunks.empty(); });
+				// Drain everything before exiting so no batch is left incomplete.
+				if (chunks.empty())
+					break;
+				chunk = std::move(chunks.front());
+				chunks.pop();
+			}
+
+			auto &req = chunk.batch->get_requests()[chunk.index];
+			chunk.batch->complete_request_chunk(chunk.index, req.file->read(chunk.offset, chunk.data, chunk.size));
+		}
+	}
+};
+
+#ifdef GRANITE_HAVE_IO_URING
+// Talks to the kernel through the raw syscalls, so there is no dependency on liburing.
+// One thread owns the ring. Submissions and completions are both signalled through eventfds it polls on.
+class IoUringFileReader final : public AsyncFileReader
+{
+public:
+	static std::unique_ptr<IoUringFileReader> create()
+	{
+		std::unique_ptr<IoUringFileReader> reader(new IoUringFileReader);
+		if (!reader->init())
+			return {};
+		reader->thread = std::thread(&IoUringFileReader::thread_loop, reader.get());
+		return reader;
+	}
+
+	~IoUringFileReader() override
+	{
+		if (thread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> holder{lock};
+				dead = true;
+			}
+			wake();
+			thread.join();
+		}
+
+		if (sq_ring && sq_ring != MAP_FAILED)
+			munmap(sq_ring, sq_ring_size);
+		if (sqes && sqes != MAP_FAILED)
+			munmap(sqes, sqes_size);
+		if (ring_fd >= 0)
+			close(ring_fd);
+		if (wake_fd >= 0)
+			close(wake_fd);
+		if (completion_fd >= 0)
+			close(completion_fd);
+	}
+
+	void submit(FileReadBatchHandle batch) override
+	{
+		{
+			std::lock_guard<std::mutex> holder{lock};
+			queued.push_back(std::move(batch));
+		}
+		wake();
+	}
+
+private:
+	enum { QueueDepth = 128 };
+
+	int ring_fd = -1;
+	int wake_fd = -1;
+	int completion_fd = -1;
+	void *sq_ring = nullptr;
+	size_t sq_ring_size = 0;
+	io_uring_sqe *sqes = nullptr;
+	size_t sqes_size = 0;
+
+	unsigned *sq_head = nullptr;
+	unsigned *sq_tail = nullptr;
+	unsigned *sq_mask = nullptr;
+	unsigned *sq_array = nullptr;
+	unsigned *cq_head = nullptr;
+	unsigned *cq_tail = nullptr;
+	unsigned *cq_mask = nullptr;
+	io_uring_cqe *cqes = nullptr;
+
+	std::thread thread;
+	std::mutex lock;
+	std::vector<FileReadBatchHandle> queued;
+	bool dead = false;
+
+	// Everything below is only touched by the ring thread.
+	struct Chunk
+	{
+		FileReadBatchHandle batch;
+		size_t index;
+		int fd;
+		uint64_t offset;
+		uint8_t *data;
+		size_t remaining;
+		int64_t bytes;
+	};
+	Util::ObjectPool<Chunk> chunk_pool;
+	std::deque<Chunk *> pending;
+	unsigned in_flight = 0;
+
+	bool init()
+	{
+		io_uring_params params = {};
+		ring_fd = int(syscall(__NR_io_uring_setup, QueueDepth, &params));
+		if (ring_fd < 0)
+			return false;
+
+		// IORING_OP_READ arrived in the same kernel as IORING_FEAT_RW_CUR_POS.
+		const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS;
+		if ((params.features & required) != required)
+			return false;
+
+		sq_ring_size = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+		                                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+		sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		               ring_fd, IORING_OFF_SQ_RING);
+		if (sq_ring == MAP_FAILED)
+			return false;
+
+		sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+		                                        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+		if (sqes == MAP_FAILED)
+			return false;
+
+		auto *ring = static_cast<uint8_t *>(sq_ring);
+		sq_head = reinterpret_cast<unsigned *>(ring + params.sq_off.head);
+		sq_tail = reinterpret_cast<unsigned *>(ring + params.sq_off.tail);
+		sq_mask = reinterpret_cast<unsigned *>(ring + params.sq_off.ring_mask);
+		sq_array = reinterpret_cast<unsigned *>(ring + params.sq_off.array);
+		cq_head = reinterpret_cast<unsigned *>(ring + params.cq_off.head);
+		cq_tail = reinterpret_cast<unsigned *>(ring + params.cq_off.tail);
+		cq_mask = reinterpret_cast<unsigned *>(ring + params.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe *>(ring + params.cq_off.cqes);
+
+		wake_fd = eventfd(0, EFD_CLOEXEC);
+		completion_fd = eventfd(0, EFD_CLOEXEC);
+		if (wake_fd < 0 || completion_fd < 0)
+			return false;
+
+		if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_EVENTFD, &completion_fd, 1) < 0)
+			return false;
+
+		return true;
+	}
+
+	void wake()
+	{
+		uint64_t one = 1;
+		while (::write(wake_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+		{
+		}
+	}
+
+	void split_batch(FileReadBatchHandle &batch)
+	{
+		auto &requests = batch->get_requests();
+		batch->begin_requests();
+
+		for (size_t i = 0; i < requests.size(); i++)
+		{
+			auto &req = requests[i];
+			auto *file = dynamic_cast<MMapFile *>(req.file.get());
+			if (!file)
+			{
+				// Not a plain file, e.g. a slice. Read synchronously.
+				batch->set_request_chunks(i, 1);
+				batch->complete_request_chunk(i, req.file->read(req.offset, req.data, req.size));
+				continue;
+			}
+
+			unsigned count = get_async_read_chunk_count(req.size);
+			batch->set_request_chunks(i, count);
+			for (unsigned chunk = 0; chunk < count; chunk++)
+			{
+				size_t offset = chunk * AsyncReadChunkSize;
+				pending.push_back(chunk_pool.allocate(Chunk{
+						batch, i, file->get_fd(), req.offset + offset,
+						static_cast<uint8_t *>(req.data) + offset,
+						std::min(AsyncReadChunkSize, req.size - offset), 0 }));
+			}
+		}
+	}
+
+	unsigned fill_submission_queue()
+	{
+		unsigned tail = *sq_tail;
+		unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+		unsigned mask = *sq_mask;
+		unsigned count = 0;
+
+		while (!pending.empty() && in_flight < QueueDepth && tail - head <= mask)
+		{
+			auto *chunk = pending.front();
+			pending.pop_front();
+
+			unsigned index = tail & mask;
+			auto &sqe = sqes[index];
+			memset(&sqe, 0, sizeof(sqe));
+			sqe.opcode = IORING_OP_READ;
+			sqe.fd = chunk->fd;
+			sqe.off = chunk->offset;
+			sqe.addr = reinterpret_cast<uintptr_t>(chunk->data);
+			sqe.len = unsigned(chunk->remaining);
+			sqe.user_data = reinterpret_cast<uintptr_t>(chunk);
+			sq_array[index] = index;
+
+			tail++;
+			count++;
+			in_flight++;
+		}
+
+		__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+		return count;
+	}
+
+	void reap_completions()
+	{
+		unsigned head = *cq_head;
+		unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		unsigned mask = *cq_mask;
+
+		while (head != tail)
+		{
+			auto &cqe = cqes[head & mask];
+			auto *chunk = reinterpret_cast<Chunk *>(uintptr_t(cqe.user_data));
+			int res = cqe.res;
+			head++;
+			in_flight--;
+
+			if (res == -EINTR || res == -EAGAIN)
+			{
+				pending.push_front(chunk);
+				continue;
+			}
+
+			if (res > 0 && size_t(res) < chunk->remaining)
+			{
+				// Short read, continue where it left off.
+				chunk->offset += res;
+				chunk->data += res;
+				chunk->remaining -= res;
+				chunk->bytes += res;
+				pending.push_front(chunk);
+				continue;
+			}
+
+			// A result of 0 means end of file.
+			int64_t bytes = res < 0 ? -1 : chunk->bytes + res;
+			chunk->batch->complete_request_chunk(chunk->index, bytes);
+			chunk_pool.free(chunk);
+		}
+
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	void thread_loop()
+	{
+		Util::set_current_thread_name("file-read-uring");
+		std::vector<FileReadBatchHandle> batches;
+
+		for (;;)
+		{
+			bool exit_requested;
+			{
+				std::lock_guard<std::mutex> holder{lock};
+				batches.swap(queued);
+				exit_requested = dead;
+			}
+
+			for (auto &batch : batches)
+				split_batch(batch);
+			batches.clear();
+
+			reap_completions();
+
+			unsigned to_submit = fill_submission_queue();
+			if (to_submit && syscall(__NR_io_uring_enter, ring_fd, to_submit, 0, 0, nullptr, 0) < 0)
+				LOGE("io_uring_enter failed: %s\n", strerror(errno));
+
+			// Drain everything before exiting so no batch is left incomplete.
+			if (exit_requested && pending.empty() && in_flight == 0)
+				break;
+
+			// Completions may have arrived in the meantime, which the completion eventfd would also tell us.
+			if (__atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) != *cq_head)
+				continue;
+
+			pollfd fds[2] = {};
+			fds[0].fd = wake_fd;
+			fds[0].events = POLLIN;
+			fds[1].fd = completion_fd;
+			fds[1].events = POLLIN;
+			if (poll(fds, 2, -1) < 0 && errno != EINTR)
+			{
+				LOGE("poll() failed: %s\n", strerror(errno));
+				break;
+			}
+
+			uint64_t value;
+			for (auto &fd : fds)
+				if (fd.revents & POLLIN)
+					while (::read(fd.fd, &value, sizeof(value)) < 0 && errno == EINTR)
+					{
+					}
+		}
+	}
+};
+#endif
+
+void OSFilesystem::set_async_read_backend(AsyncReadBackend backend)
+{
+	async_read_backend = backend;
+}
+
+void OSFilesystem::submit_reads(FileReadBatchHandle batch)
+{
+	std::lock_guard<std::mutex> holder{async_reader_lock};
+	if (!async_reader)
+	{
+		auto backend = async_read_backend;
+		if (const char *env = getenv("GRANITE_FILESYSTEM_ASYNC_READ"))
+		{
+			if (strcmp(env, "io_uring") == 0)
+				backend = AsyncReadBackend::IoUring;
+			else if (strcmp(env, "threads") == 0)
+				backend = AsyncReadBackend::ThreadPool;
+		}
+
+#ifdef GRANITE_HAVE_IO_URING
+		if (backend != AsyncReadBackend::ThreadPool)
+		{
+			async_reader = IoUringFileReader::create();
+			if (async_reader)
+				LOGI("OSFilesystem: using io_uring for async reads.\n");
+			else
+				LOGW("OSFilesystem: io_uring is not supported, falling back to a thread pool.\n");
+		}
+#else
+		if (backend == AsyncReadBackend::IoUring)
+			LOGW("OSFilesystem: io_uring is not supported, falling back to a thread pool.\n");
+#endif
+
+		if (!async_reader)
+			async_reader.reset(new ThreadPoolFileReader);
+	}
+
+	async_reader->submit(std::move(batch));
+}
+
 OSFilesystem::OSFilesystem(const std::string &base_)
 	: base(base_)
 {
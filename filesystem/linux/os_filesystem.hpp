@@ -23,6 +23,8 @@
 #pragma once
 #include "../filesystem.hpp"
 #include <unordered_map>
+#include <memory>
+#include <mutex>
 
 namespace Granite
 {
@@ -35,6 +37,12 @@ public:
 	FileMappingHandle map_write(size_t map_size) override;
 	void unmap(void *mapped, size_t size) override;
 	uint64_t get_size() override;
+	int64_t read(uint64_t offset, void *data, size_t size) override;
+
+	int get_fd() const
+	{
+		return fd;
+	}
 
 private:
 	bool init(const std::string &path, FileMode mode);
@@ -46,6 +54,17 @@ private:
 	std::string rename_to_on_close;
 };
 
+enum class AsyncReadBackend
+{
+	// io_uring where the kernel supports it, otherwise ThreadPool.
+	Auto,
+	IoUring,
+	// Blocking pread() on a small pool of I/O threads.
+	ThreadPool
+};
+
+class AsyncFileReader;
+
 class OSFilesystem : public FilesystemBackend
 {
 public:
@@ -67,9 +86,18 @@ public:
 	// If dst exists, nothing happens (and false is returned).
 	bool move_yield(const std::string &dst, const std::string &src) override;
 
+	void submit_reads(FileReadBatchHandle batch) override;
+	// Must be called before the first submit_reads().
+	// Can also be overridden with GRANITE_FILESYSTEM_ASYNC_READ=io_uring|threads.
+	void set_async_read_backend(AsyncReadBackend backend);
+
 private:
 	std::string base;
 
+	std::mutex async_reader_lock;
+	std::unique_ptr<AsyncFileReader> async_reader;
+	AsyncReadBackend async_read_backend = AsyncReadBackend::Auto;
+
 	struct VirtualHandler
 	{
 		std::string path;
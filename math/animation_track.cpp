@@ -0,0 +1,337 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "animation_track.hpp"
+#include "muglm/muglm_impl.hpp"
+#include "simd_headers.hpp"
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+namespace Granite
+{
+static constexpr float QuatComponentRange = 0.70710678f;
+static constexpr float QuatQuantizeScale = 32767.0f / (2.0f * QuatComponentRange);
+static constexpr float QuatDequantizeScale = (2.0f * QuatComponentRange) / 32767.0f;
+
+static bool within_tolerance(const vec3 &a, const vec3 &b, float tolerance)
+{
+	vec3 d = abs(a - b);
+	return d.x <= tolerance && d.y <= tolerance && d.z <= tolerance;
+}
+
+static bool within_tolerance(const vec4 &a, const vec4 &b, float tolerance)
+{
+	vec4 d = abs(a - b);
+	return d.x <= tolerance && d.y <= tolerance && d.z <= tolerance && d.w <= tolerance;
+}
+
+// Returns b negated if needed, so that a and b lie in the same hemisphere.
+static vec4 align_hemisphere(const vec4 &a, const vec4 &b)
+{
+	return dot(a, b) < 0.0f ? -b : b;
+}
+
+void AnimationTrackVec3::build(const vec3 *values, size_t count, float tolerance)
+{
+	quantized.clear();
+	raw.clear();
+
+	if (!count)
+	{
+		format = Format::Empty;
+		return;
+	}
+
+	if (std::all_of(values, values + count, [&](const vec3 &v) { return within_tolerance(v, values[0], tolerance); }))
+	{
+		format = Format::Constant;
+		base = values[0];
+		return;
+	}
+
+	vec3 lo = values[0];
+	vec3 hi = values[0];
+	for (size_t i = 1; i < count; i++)
+	{
+		lo = min(lo, values[i]);
+		hi = max(hi, values[i]);
+	}
+
+	base = lo;
+	scale = (hi - lo) / 65535.0f;
+	vec3 inv_scale = vec3(65535.0f) / max(hi - lo, vec3(std::numeric_limits<float>::min()));
+
+	quantized.resize(3 * count + 1);
+	bool fits = true;
+	for (size_t i = 0; i < count && fits; i++)
+	{
+		vec3 q = clamp(round((values[i] - lo) * inv_scale), vec3(0.0f), vec3(65535.0f));
+		for (unsigned c = 0; c < 3; c++)
+			quantized[3 * i + c] = uint16_t(q[c]);
+		fits = within_tolerance(base + q * scale, values[i], tolerance);
+	}
+
+	if (fits)
+	{
+		format = Format::Quantized;
+	}
+	else
+	{
+		format = Format::Raw;
+		quantized.clear();
+		raw.assign(values, values + count);
+	}
+}
+
+vec3 AnimationTrackVec3::get_key(unsigned index) const
+{
+	return sample(index, index, 0.0f);
+}
+
+vec3 AnimationTrackVec3::sample(unsigned lo, unsigned hi, float l) const
+{
+	switch (format)
+	{
+	case Format::Constant:
+		return base;
+
+	case Format::Raw:
+		return mix(raw[lo], raw[hi], l);
+
+	case Format::Quantized:
+	{
+		// Dequantization is affine, so interpolating in the quantized domain gives the same result.
+		const uint16_t *key_lo = quantized.data() + 3 * lo;
+		const uint16_t *key_hi = quantized.data() + 3 * hi;
+#if defined(__SSE2__)
+		__m128 q_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(key_lo)),
+		                                                 _mm_setzero_si128()));
+		__m128 q_hi = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(key_hi)),
+		                                                 _mm_setzero_si128()));
+		__m128 q = _mm_add_ps(q_lo, _mm_mul_ps(_mm_sub_ps(q_hi, q_lo), _mm_set1_ps(l)));
+		__m128 v = _mm_add_ps(_mm_setr_ps(base.x, base.y, base.z, 0.0f),
+		                      _mm_mul_ps(q, _mm_setr_ps(scale.x, scale.y, scale.z, 0.0f)));
+		alignas(16) float result[4];
+		_mm_store_ps(result, v);
+		return vec3(result[0], result[1], result[2]);
+#elif defined(__ARM_NEON)
+		float32x4_t q_lo = vcvtq_f32_u32(vmovl_u16(vld1_u16(key_lo)));
+		float32x4_t q_hi = vcvtq_f32_u32(vmovl_u16(vld1_u16(key_hi)));
+		float32x4_t q = vmlaq_n_f32(q_lo, vsubq_f32(q_hi, q_lo), l);
+		float32x4_t v = vmlaq_f32(vld1q_f32(vec4(base, 0.0f).data), q, vld1q_f32(vec4(scale, 0.0f).data));
+		vec4 result;
+		vst1q_f32(result.data, v);
+		return result.xyz();
+#else
+		vec3 q_lo(key_lo[0], key_lo[1], key_lo[2]);
+		vec3 q_hi(key_hi[0], key_hi[1], key_hi[2]);
+		return base + mix(q_lo, q_hi, l) * scale;
+#endif
+	}
+
+	default:
+		return vec3(0.0f);
+	}
+}
+
+size_t AnimationTrackVec3::get_memory_usage() const
+{
+	switch (format)
+	{
+	case Format::Constant:
+		return sizeof(vec3);
+	case Format::Quantized:
+		return quantized.size() * sizeof(uint16_t) + 2 * sizeof(vec3);
+	case Format::Raw:
+		return raw.size() * sizeof(vec3);
+	default:
+		return 0;
+	}
+}
+
+static void encode_quat(uint16_t *key, vec4 q)
+{
+	unsigned largest = 0;
+	for (unsigned c = 1; c < 4; c++)
+		if (muglm::abs(q[c]) > muglm::abs(q[largest]))
+			largest = c;
+
+	// q and -q are the same rotation, so the dropped component is always made positive.
+	if (q[largest] < 0.0f)
+		q = -q;
+
+	for (unsigned c = 0, i = 0; c < 4; c++)
+	{
+		if (c == largest)
+			continue;
+		float v = muglm::round((q[c] + QuatComponentRange) * QuatQuantizeScale);
+		key[i++] = uint16_t(muglm::clamp(v, 0.0f, 32767.0f));
+	}
+
+	// The index of the dropped component lives in the top bits of the first two components.
+	key[0] |= uint16_t((largest >> 1) << 15);
+	key[1] |= uint16_t((largest & 1) << 15);
+}
+
+static vec4 decode_quat(const uint16_t *key)
+{
+	unsigned largest = ((key[0] >> 15) << 1) | (key[1] >> 15);
+
+#if defined(__SSE2__)
+	__m128i k = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(key)), _mm_setzero_si128());
+	k = _mm_and_si128(k, _mm_set1_epi32(0x7fff));
+	__m128 v = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(k), _mm_set1_ps(QuatDequantizeScale)),
+	                      _mm_set1_ps(QuatComponentRange));
+	alignas(16) float small[4];
+	_mm_store_ps(small, v);
+#elif defined(__ARM_NEON)
+	uint32x4_t k = vandq_u32(vmovl_u16(vld1_u16(key)), vdupq_n_u32(0x7fff));
+	float32x4_t v = vmlaq_n_f32(vdupq_n_f32(-QuatComponentRange), vcvtq_f32_u32(k), QuatDequantizeScale);
+	float small[4];
+	vst1q_f32(small, v);
+#else
+	float small[3];
+	for (unsigned c = 0; c < 3; c++)
+		small[c] = float(key[c] & 0x7fff) * QuatDequantizeScale - QuatComponentRange;
+#endif
+
+	float dropped = muglm::sqrt(muglm::max(0.0f, 1.0f - (small[0] * small[0] + small[1] * small[1] + small[2] * small[2])));
+
+	vec4 q;
+	for (unsigned c = 0, i = 0; c < 4; c++)
+		q[c] = c == largest ? dropped : small[i++];
+	return q;
+}
+
+void AnimationTrackQuat::build(const quat *values, size_t count, float tolerance)
+{
+	quantized.clear();
+	raw.clear();
+
+	if (!count)
+	{
+		format = Format::Empty;
+		return;
+	}
+
+	auto &first = values[0].as_vec4();
+	if (std::all_of(values, values + count, [&](const quat &q) {
+		    return within_tolerance(align_hemisphere(first, q.as_vec4()), first, tolerance);
+	    }))
+	{
+		format = Format::Constant;
+		constant = values[0];
+		return;
+	}
+
+	// Keys carry one element of padding so the last key can be loaded with one 64-bit load.
+	quantized.resize(3 * count + 1);
+	bool fits = true;
+	for (size_t i = 0; i < count && fits; i++)
+	{
+		vec4 q = normalize(values[i].as_vec4());
+		encode_quat(&quantized[3 * i], q);
+		fits = within_tolerance(align_hemisphere(q, decode_quat(&quantized[3 * i])), q, tolerance);
+	}
+
+	if (fits)
+	{
+		format = Format::Quantized;
+	}
+	else
+	{
+		format = Format::Raw;
+		quantized.clear();
+		raw.assign(values, values + count);
+	}
+}
+
+quat AnimationTrackQuat::get_key(unsigned index) const
+{
+	switch (format)
+	{
+	case Format::Constant:
+		return constant;
+	case Format::Quantized:
+		return quat(decode_quat(&quantized[3 * index]));
+	case Format::Raw:
+		return raw[index];
+	default:
+		return quat(1.0f, 0.0f, 0.0f, 0.0f);
+	}
+}
+
+quat AnimationTrackQuat::sample(unsigned lo, unsigned hi, float l) const
+{
+	if (format == Format::Constant || format == Format::Empty)
+		return get_key(lo);
+
+	vec4 q_lo, q_hi;
+	if (format == Format::Quantized)
+	{
+		q_lo = decode_quat(&quantized[3 * lo]);
+		q_hi = decode_quat(&quantized[3 * hi]);
+	}
+	else
+	{
+		q_lo = raw[lo].as_vec4();
+		q_hi = raw[hi].as_vec4();
+	}
+
+#if defined(__SSE2__)
+	__m128 a = _mm_loadu_ps(q_lo.data);
+	__m128 b = _mm_loadu_ps(q_hi.data);
+	__m128 d = _mm_mul_ps(a, b);
+	d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+	d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 3, 2)));
+	// Flips the sign of b if the keys lie in opposite hemispheres.
+	b = _mm_xor_ps(b, _mm_and_ps(d, _mm_set1_ps(-0.0f)));
+	__m128 q = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(l)));
+	__m128 len2 = _mm_mul_ps(q, q);
+	len2 = _mm_add_ps(len2, _mm_shuffle_ps(len2, len2, _MM_SHUFFLE(2, 3, 0, 1)));
+	len2 = _mm_add_ps(len2, _mm_shuffle_ps(len2, len2, _MM_SHUFFLE(1, 0, 3, 2)));
+	q = _mm_div_ps(q, _mm_sqrt_ps(len2));
+	vec4 result;
+	_mm_storeu_ps(result.data, q);
+	return quat(result);
+#else
+	vec4 q = mix(q_lo, align_hemisphere(q_lo, q_hi), l);
+	return quat(normalize(q));
+#endif
+}
+
+size_t AnimationTrackQuat::get_memory_usage() const
+{
+	switch (format)
+	{
+	case Format::Constant:
+		return sizeof(quat);
+	case Format::Quantized:
+		return quantized.size() * sizeof(uint16_t);
+	case Format::Raw:
+		return raw.size() * sizeof(quat);
+	default:
+		return 0;
+	}
+}
+}
@@ -0,0 +1,102 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "math.hpp"
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Granite
+{
+// Key frames for one vec3 property (translation or scale) of an animation channel, sampled at a fixed rate.
+// build() picks the smallest format for which every component of every key stays within tolerance:
+// a single constant key, 16-bit keys quantized to the range of the track, or full precision floats.
+class AnimationTrackVec3
+{
+public:
+	enum class Format : uint8_t
+	{
+		Empty,
+		Constant,
+		Quantized,
+		Raw
+	};
+
+	void build(const vec3 *values, size_t count, float tolerance);
+
+	// Linearly interpolates between key lo and key hi.
+	vec3 sample(unsigned lo, unsigned hi, float l) const;
+	vec3 get_key(unsigned index) const;
+
+	Format get_format() const
+	{
+		return format;
+	}
+
+	// Bytes used for key storage.
+	size_t get_memory_usage() const;
+
+private:
+	Format format = Format::Empty;
+	vec3 base = vec3(0.0f);
+	vec3 scale = vec3(0.0f);
+	// Three components per key, plus one element of padding so keys can be loaded with one 64-bit load.
+	std::vector<uint16_t> quantized;
+	std::vector<vec3> raw;
+};
+
+// Key frames for a rotation. Quantized keys use the "smallest three" encoding,
+// where the largest component is dropped and reconstructed from the unit length constraint,
+// so each key takes 6 bytes rather than 16.
+class AnimationTrackQuat
+{
+public:
+	enum class Format : uint8_t
+	{
+		Empty,
+		Constant,
+		Quantized,
+		Raw
+	};
+
+	void build(const quat *values, size_t count, float tolerance);
+
+	// Normalized linear interpolation between key lo and key hi, along the shortest arc.
+	quat sample(unsigned lo, unsigned hi, float l) const;
+	quat get_key(unsigned index) const;
+
+	Format get_format() const
+	{
+		return format;
+	}
+
+	size_t get_memory_usage() const;
+
+private:
+	Format format = Format::Empty;
+	quat constant = quat(1.0f, 0.0f, 0.0f, 0.0f);
+	std::vector<uint16_t> quantized;
+	std::vector<quat> raw;
+};
+}
@@ -0,0 +1,360 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "dynamic_bvh.hpp"
+#include <algorithm>
+
+namespace Granite
+{
+static inline AABB merge_aabb(const AABB &a, const AABB &b)
+{
+	return AABB(min(a.get_minimum(), b.get_minimum()), max(a.get_maximum(), b.get_maximum()));
+}
+
+static inline float surface_area(const AABB &aabb)
+{
+	vec3 d = aabb.get_maximum() - aabb.get_minimum();
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static inline bool contains_aabb(const AABB &outer, const AABB &inner)
+{
+	return all(lessThanEqual(outer.get_minimum(), inner.get_minimum())) &&
+	       all(lessThanEqual(inner.get_maximum(), outer.get_maximum()));
+}
+
+DynamicBVH::DynamicBVH(float fat_margin_)
+	: fat_margin(fat_margin_)
+{
+}
+
+AABB DynamicBVH::fatten(const AABB &aabb) const
+{
+	vec3 pad = (aabb.get_maximum() - aabb.get_minimum()) * fat_margin;
+	return AABB(aabb.get_minimum() - pad, aabb.get_maximum() + pad);
+}
+
+uint32_t DynamicBVH::allocate_node()
+{
+	uint32_t node;
+	if (free_list != InvalidNode)
+	{
+		node = free_list;
+		free_list = nodes[node].parent;
+	}
+	else
+	{
+		node = uint32_t(nodes.size());
+		nodes.emplace_back();
+		leaf_aabbs.emplace_back();
+	}
+
+	auto &n = nodes[node];
+	n.parent = InvalidNode;
+	n.children[0] = InvalidNode;
+	n.children[1] = InvalidNode;
+	n.height = 0;
+	n.user_data = 0;
+	return node;
+}
+
+void DynamicBVH::free_node(uint32_t node)
+{
+	nodes[node].parent = free_list;
+	nodes[node].height = -1;
+	free_list = node;
+}
+
+void DynamicBVH::clear()
+{
+	nodes.clear();
+	leaf_aabbs.clear();
+	root = InvalidNode;
+	free_list = InvalidNode;
+	leaf_count = 0;
+}
+
+uint32_t DynamicBVH::insert(const AABB &aabb, uint32_t user_data)
+{
+	uint32_t leaf = allocate_node();
+	nodes[leaf].aabb = fatten(aabb);
+	nodes[leaf].user_data = user_data;
+	leaf_aabbs[leaf] = aabb;
+	insert_leaf(leaf);
+	leaf_count++;
+	return leaf;
+}
+
+void DynamicBVH::remove(uint32_t leaf)
+{
+	assert(is_leaf(leaf));
+	remove_leaf(leaf);
+	free_node(leaf);
+	leaf_count--;
+}
+
+bool DynamicBVH::move(uint32_t leaf, const AABB &aabb)
+{
+	assert(is_leaf(leaf));
+	vec3 displacement = aabb.get_center() - leaf_aabbs[leaf].get_center();
+	leaf_aabbs[leaf] = aabb;
+
+	// Objects which keep moving tend to move in the same direction,
+	// so stretch the fat AABB along the displacement to predict the next few moves.
+	AABB predicted = fatten(aabb);
+	vec3 stretch = displacement * DisplacementMultiplier;
+
+	auto &fat = nodes[leaf].aabb;
+	if (contains_aabb(fat, aabb))
+	{
+		// Reinsert anyway if the object shrank or stopped, so the fat AABB is mostly empty space.
+		vec3 fat_extent = fat.get_maximum() - fat.get_minimum();
+		vec3 new_extent = predicted.get_maximum() - predicted.get_minimum() + abs(stretch);
+		if (all(lessThanEqual(fat_extent, new_extent * 2.0f)))
+			return false;
+	}
+
+	predicted = AABB(predicted.get_minimum() + min(stretch, vec3(0.0f)),
+	                 predicted.get_maximum() + max(stretch, vec3(0.0f)));
+
+	remove_leaf(leaf);
+	nodes[leaf].aabb = predicted;
+	insert_leaf(leaf);
+	return true;
+}
+
+void DynamicBVH::insert_leaf(uint32_t leaf)
+{
+	if (root == InvalidNode)
+	{
+		root = leaf;
+		nodes[leaf].parent = InvalidNode;
+		return;
+	}
+
+	// Find the best sibling by descending towards the cheapest surface area increase.
+	AABB leaf_aabb = nodes[leaf].aabb;
+	uint32_t index = root;
+	while (nodes[index].height > 0)
+	{
+		auto &n = nodes[index];
+		float area = surface_area(n.aabb);
+		float combined_area = surface_area(merge_aabb(n.aabb, leaf_aabb));
+
+		// Cost of creating a new parent for this node and the new leaf.
+		float cost = 2.0f * combined_area;
+		// Minimum cost of pushing the leaf further down the tree.
+		float inheritance_cost = 2.0f * (combined_area - area);
+
+		float child_costs[2];
+		for (unsigned i = 0; i < 2; i++)
+		{
+			auto &child = nodes[n.children[i]];
+			float merged_area = surface_area(merge_aabb(child.aabb, leaf_aabb));
+			if (child.height == 0)
+				child_costs[i] = merged_area + inheritance_cost;
+			else
+				child_costs[i] = merged_area - surface_area(child.aabb) + inheritance_cost;
+		}
+
+		if (cost < child_costs[0] && cost < child_costs[1])
+			break;
+
+		index = child_costs[0] < child_costs[1] ? n.children[0] : n.children[1];
+	}
+
+	uint32_t sibling = index;
+	uint32_t old_parent = nodes[sibling].parent;
+	uint32_t new_parent = allocate_node();
+
+	auto &p = nodes[new_parent];
+	p.parent = old_parent;
+	p.aabb = merge_aabb(leaf_aabb, nodes[sibling].aabb);
+	p.height = nodes[sibling].height + 1;
+	p.children[0] = sibling;
+	p.children[1] = leaf;
+
+	if (old_parent != InvalidNode)
+	{
+		auto &op = nodes[old_parent];
+		if (op.children[0] == sibling)
+			op.children[0] = new_parent;
+		else
+			op.children[1] = new_parent;
+	}
+	else
+		root = new_parent;
+
+	nodes[sibling].parent = new_parent;
+	nodes[leaf].parent = new_parent;
+
+	refit_ancestors(new_parent);
+}
+
+void DynamicBVH::remove_leaf(uint32_t leaf)
+{
+	if (leaf == root)
+	{
+		root = InvalidNode;
+		return;
+	}
+
+	uint32_t parent = nodes[leaf].parent;
+	uint32_t grand_parent = nodes[parent].parent;
+	uint32_t sibling = nodes[parent].children[0] == leaf ? nodes[parent].children[1] : nodes[parent].children[0];
+
+	if (grand_parent != InvalidNode)
+	{
+		auto &gp = nodes[grand_parent];
+		if (gp.children[0] == parent)
+			gp.children[0] = sibling;
+		else
+			gp.children[1] = sibling;
+		nodes[sibling].parent = grand_parent;
+		free_node(parent);
+		refit_ancestors(grand_parent);
+	}
+	else
+	{
+		root = sibling;
+		nodes[sibling].parent = InvalidNode;
+		free_node(parent);
+	}
+}
+
+void DynamicBVH::refit_ancestors(uint32_t node)
+{
+	while (node != InvalidNode)
+	{
+		node = balance(node);
+
+		auto &n = nodes[node];
+		auto &a = nodes[n.children[0]];
+		auto &b = nodes[n.children[1]];
+		n.height = 1 + std::max(a.height, b.height);
+		n.aabb = merge_aabb(a.aabb, b.aabb);
+		node = n.parent;
+	}
+}
+
+// Performs a left or right rotation if the node is imbalanced. Returns the new subtree root.
+uint32_t DynamicBVH::balance(uint32_t ia)
+{
+	auto *a = &nodes[ia];
+	if (a->height < 2)
+		return ia;
+
+	uint32_t ib = a->children[0];
+	uint32_t ic = a->children[1];
+	auto *b = &nodes[ib];
+	auto *c = &nodes[ic];
+	int32_t balance_factor = c->height - b->height;
+
+	// Rotate C up, or B up, mirrored.
+	const auto rotate = [this](uint32_t ia_, uint32_t ilow, uint32_t ihigh, unsigned high_slot) -> uint32_t {
+		auto &a_ = nodes[ia_];
+		auto &high = nodes[ihigh];
+		uint32_t ih0 = high.children[0];
+		uint32_t ih1 = high.children[1];
+		auto &h0 = nodes[ih0];
+		auto &h1 = nodes[ih1];
+
+		// Swap A and the high child.
+		high.children[0] = ia_;
+		high.parent = a_.parent;
+		a_.parent = ihigh;
+
+		if (high.parent != InvalidNode)
+		{
+			auto &hp = nodes[high.parent];
+			if (hp.children[0] == ia_)
+				hp.children[0] = ihigh;
+			else
+				hp.children[1] = ihigh;
+		}
+		else
+			root = ihigh;
+
+		auto &low = nodes[ilow];
+
+		// Keep the taller grandchild under the promoted node.
+		uint32_t ikeep = h0.height > h1.height ? ih0 : ih1;
+		uint32_t imove = h0.height > h1.height ? ih1 : ih0;
+		auto &keep = nodes[ikeep];
+		auto &moved = nodes[imove];
+
+		high.children[1] = ikeep;
+		a_.children[high_slot] = imove;
+		moved.parent = ia_;
+
+		a_.aabb = merge_aabb(low.aabb, moved.aabb);
+		high.aabb = merge_aabb(a_.aabb, keep.aabb);
+		a_.height = 1 + std::max(low.height, moved.height);
+		high.height = 1 + std::max(a_.height, keep.height);
+		return ihigh;
+	};
+
+	if (balance_factor > 1)
+		return rotate(ia, ib, ic, 1);
+	else if (balance_factor < -1)
+		return rotate(ia, ic, ib, 0);
+	else
+		return ia;
+}
+
+unsigned DynamicBVH::get_height() const
+{
+	return root != InvalidNode ? unsigned(nodes[root].height) : 0u;
+}
+
+unsigned DynamicBVH::collect_subset_roots(uint32_t *subset_roots, unsigned num_indices) const
+{
+	// Expand the largest subtrees breadth-first until there is enough work to distribute.
+	// This is deterministic, so every task agrees on the split without synchronization.
+	unsigned target = std::min<unsigned>(MaxSubsetRoots, std::max(1u, num_indices) * 4u);
+	unsigned count = 0;
+	subset_roots[count++] = root;
+
+	while (count < target)
+	{
+		int32_t best_height = 0;
+		unsigned best = 0;
+		for (unsigned i = 0; i < count; i++)
+		{
+			if (nodes[subset_roots[i]].height > best_height)
+			{
+				best_height = nodes[subset_roots[i]].height;
+				best = i;
+			}
+		}
+
+		if (best_height == 0)
+			break;
+
+		auto &n = nodes[subset_roots[best]];
+		subset_roots[best] = n.children[0];
+		subset_roots[count++] = n.children[1];
+	}
+
+	return count;
+}
+}
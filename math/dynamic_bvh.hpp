@@ -0,0 +1,427 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "math.hpp"
+#include "aabb.hpp"
+#include "frustum.hpp"
+#include "simd.hpp"
+#include <vector>
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Granite
+{
+// Incrementally maintained AABB tree.
+// Leaves are stored with a fattened AABB, so small movements do not touch the tree,
+// and the tree is kept balanced with rotations as leaves are inserted and removed.
+// Leaf IDs remain stable until the leaf is removed.
+class DynamicBVH
+{
+public:
+	enum : uint32_t { InvalidNode = 0xffffffffu };
+
+	// fat_margin is the fraction of the AABB extent each leaf is padded with.
+	explicit DynamicBVH(float fat_margin = 0.1f);
+
+	uint32_t insert(const AABB &aabb, uint32_t user_data);
+	void remove(uint32_t leaf);
+
+	// Returns true if the leaf had to be reinserted into the tree.
+	bool move(uint32_t leaf, const AABB &aabb);
+	void clear();
+
+	bool is_leaf(uint32_t node) const
+	{
+		return node < nodes.size() && nodes[node].height == 0;
+	}
+
+	uint32_t get_user_data(uint32_t leaf) const
+	{
+		assert(is_leaf(leaf));
+		return nodes[leaf].user_data;
+	}
+
+	const AABB &get_aabb(uint32_t leaf) const
+	{
+		assert(is_leaf(leaf));
+		return leaf_aabbs[leaf];
+	}
+
+	size_t get_leaf_count() const
+	{
+		return leaf_count;
+	}
+
+	// Upper bound for node and leaf IDs.
+	size_t get_node_capacity() const
+	{
+		return nodes.size();
+	}
+
+	unsigned get_height() const;
+
+	// Visitors are called with the leaf ID of every leaf whose (tight) AABB passes the test.
+	template <typename Func>
+	void query_aabb(const AABB &aabb, const Func &func) const;
+
+	template <typename Func>
+	void query_sphere(const vec3 &center, float radius, const Func &func) const;
+
+	template <typename Func>
+	void query_frustum(const Frustum &frustum, const Func &func) const;
+
+	// Splits the query over independent subtrees so that num_indices tasks can query in parallel.
+	// Every leaf is visited by exactly one index.
+	template <typename Func>
+	void query_frustum_subset(const Frustum &frustum, unsigned index, unsigned num_indices, const Func &func) const;
+
+	// Walks the tree once for several frusta, e.g. cascades or cube faces.
+	// func(leaf, view_mask) is called once per leaf which is visible in at least one frustum,
+	// with bit N of view_mask set if the leaf is visible in frusta[N].
+	enum { MaxQueryFrusta = 32 };
+
+	template <typename Func>
+	void query_frusta(const Frustum *const *frusta, unsigned num_frusta, const Func &func) const;
+
+	template <typename Func>
+	void query_frusta_subset(const Frustum *const *frusta, unsigned num_frusta,
+	                         unsigned index, unsigned num_indices, const Func &func) const;
+
+private:
+	struct Node
+	{
+		AABB aabb;
+		uint32_t parent;
+		uint32_t children[2];
+		// 0 for leaves, -1 for free nodes.
+		int32_t height;
+		uint32_t user_data;
+	};
+
+	enum { MaxStackDepth = 256, MaxSubsetRoots = 64 };
+	static constexpr float DisplacementMultiplier = 4.0f;
+
+	std::vector<Node> nodes;
+	std::vector<AABB> leaf_aabbs;
+	uint32_t root = InvalidNode;
+	uint32_t free_list = InvalidNode;
+	size_t leaf_count = 0;
+	float fat_margin;
+
+	uint32_t allocate_node();
+	void free_node(uint32_t node);
+	void insert_leaf(uint32_t leaf);
+	void remove_leaf(uint32_t leaf);
+	void refit_ancestors(uint32_t node);
+	uint32_t balance(uint32_t node);
+	AABB fatten(const AABB &aabb) const;
+	unsigned collect_subset_roots(uint32_t *subset_roots, unsigned num_indices) const;
+
+	enum class Containment { Outside, Intersecting, Inside };
+
+	struct FrustumTest
+	{
+		// For each plane, the corner of an AABB which is furthest along the plane normal.
+		bool positive[6][3];
+		const vec4 *planes = nullptr;
+
+		FrustumTest() = default;
+		explicit FrustumTest(const Frustum &frustum)
+			: planes(frustum.get_planes())
+		{
+			for (unsigned i = 0; i < 6; i++)
+				for (unsigned c = 0; c < 3; c++)
+					positive[i][c] = planes[i][c] > 0.0f;
+		}
+
+		Containment classify(const AABB &aabb) const
+		{
+			auto &lo = aabb.get_minimum();
+			auto &hi = aabb.get_maximum();
+			Containment result = Containment::Inside;
+
+			for (unsigned i = 0; i < 6; i++)
+			{
+				auto &p = planes[i];
+				float far_x = positive[i][0] ? hi.x : lo.x;
+				float far_y = positive[i][1] ? hi.y : lo.y;
+				float far_z = positive[i][2] ? hi.z : lo.z;
+				float near_x = positive[i][0] ? lo.x : hi.x;
+				float near_y = positive[i][1] ? lo.y : hi.y;
+				float near_z = positive[i][2] ? lo.z : hi.z;
+
+				if (p.x * far_x + p.y * far_y + p.z * far_z + p.w < 0.0f)
+					return Containment::Outside;
+				if (p.x * near_x + p.y * near_y + p.z * near_z + p.w < 0.0f)
+					result = Containment::Intersecting;
+			}
+
+			return result;
+		}
+	};
+
+	template <typename Func>
+	void visit_all_leaves(uint32_t node, const Func &func) const;
+
+	template <typename Func>
+	void query_frustum_from(uint32_t start_node, const FrustumTest &test, const Func &func) const;
+
+	template <typename Func>
+	void query_frusta_from(uint32_t start_node, const FrustumTest *tests, unsigned num_tests, const Func &func) const;
+
+	template <typename NodeTest, typename LeafTest, typename Func>
+	void query_generic(const NodeTest &node_test, const LeafTest &leaf_test, const Func &func) const;
+};
+
+template <typename Func>
+void DynamicBVH::visit_all_leaves(uint32_t node, const Func &func) const
+{
+	uint32_t stack[MaxStackDepth];
+	unsigned stack_size = 0;
+	stack[stack_size++] = node;
+
+	while (stack_size)
+	{
+		auto &n = nodes[stack[--stack_size]];
+		if (n.height == 0)
+		{
+			func(uint32_t(&n - nodes.data()));
+		}
+		else
+		{
+			assert(stack_size + 2 <= MaxStackDepth);
+			stack[stack_size++] = n.children[1];
+			stack[stack_size++] = n.children[0];
+		}
+	}
+}
+
+template <typename Func>
+void DynamicBVH::query_frustum_from(uint32_t start_node, const FrustumTest &test, const Func &func) const
+{
+	uint32_t stack[MaxStackDepth];
+	unsigned stack_size = 0;
+	stack[stack_size++] = start_node;
+
+	while (stack_size)
+	{
+		uint32_t node = stack[--stack_size];
+		auto &n = nodes[node];
+
+		auto containment = test.classify(n.aabb);
+		if (containment == Containment::Outside)
+			continue;
+
+		if (n.height == 0)
+		{
+			// The fat AABB being inside implies the tight AABB is too.
+			if (containment == Containment::Inside || SIMD::frustum_cull(leaf_aabbs[node], test.planes))
+				func(node);
+		}
+		else if (containment == Containment::Inside)
+		{
+			visit_all_leaves(node, func);
+		}
+		else
+		{
+			assert(stack_size + 2 <= MaxStackDepth);
+			stack[stack_size++] = n.children[1];
+			stack[stack_size++] = n.children[0];
+		}
+	}
+}
+
+template <typename Func>
+void DynamicBVH::query_frustum(const Frustum &frustum, const Func &func) const
+{
+	if (root != InvalidNode)
+		query_frustum_from(root, FrustumTest(frustum), func);
+}
+
+template <typename Func>
+void DynamicBVH::query_frustum_subset(const Frustum &frustum, unsigned index, unsigned num_indices,
+                                      const Func &func) const
+{
+	if (root == InvalidNode)
+		return;
+
+	uint32_t subset_roots[MaxSubsetRoots];
+	unsigned num_roots = collect_subset_roots(subset_roots, num_indices);
+	FrustumTest test(frustum);
+	for (unsigned i = index; i < num_roots; i += num_indices)
+		query_frustum_from(subset_roots[i], test, func);
+}
+
+template <typename Func>
+void DynamicBVH::query_frusta_from(uint32_t start_node, const FrustumTest *tests, unsigned num_tests,
+                                   const Func &func) const
+{
+	// Views are dropped from active as soon as a node is outside them,
+	// and moved to inside once a node is fully contained so they are not tested again below it.
+	struct Entry
+	{
+		uint32_t node;
+		uint32_t active;
+		uint32_t inside;
+	};
+
+	Entry stack[MaxStackDepth];
+	unsigned stack_size = 0;
+	uint32_t all_views = num_tests == 32 ? ~0u : ((1u << num_tests) - 1u);
+	stack[stack_size++] = { start_node, all_views, 0 };
+
+	while (stack_size)
+	{
+		Entry entry = stack[--stack_size];
+		auto &n = nodes[entry.node];
+		uint32_t active = entry.active;
+		uint32_t inside = entry.inside;
+
+		for (unsigned view = 0; view < num_tests; view++)
+		{
+			uint32_t bit = 1u << view;
+			if ((active & ~inside & bit) == 0)
+				continue;
+
+			auto containment = tests[view].classify(n.aabb);
+			if (containment == Containment::Outside)
+				active &= ~bit;
+			else if (containment == Containment::Inside)
+				inside |= bit;
+		}
+
+		if (!active)
+			continue;
+
+		if (n.height == 0)
+		{
+			uint32_t mask = inside;
+			for (unsigned view = 0; view < num_tests; view++)
+			{
+				uint32_t bit = 1u << view;
+				if ((active & ~inside & bit) && SIMD::frustum_cull(leaf_aabbs[entry.node], tests[view].planes))
+					mask |= bit;
+			}
+
+			if (mask)
+				func(entry.node, mask);
+		}
+		else if (active == inside)
+		{
+			visit_all_leaves(entry.node, [&](uint32_t leaf) { func(leaf, inside); });
+		}
+		else
+		{
+			assert(stack_size + 2 <= MaxStackDepth);
+			stack[stack_size++] = { n.children[1], active, inside };
+			stack[stack_size++] = { n.children[0], active, inside };
+		}
+	}
+}
+
+template <typename Func>
+void DynamicBVH::query_frusta(const Frustum *const *frusta, unsigned num_frusta, const Func &func) const
+{
+	assert(num_frusta <= MaxQueryFrusta);
+	if (root == InvalidNode || num_frusta == 0)
+		return;
+
+	FrustumTest tests[MaxQueryFrusta];
+	for (unsigned i = 0; i < num_frusta; i++)
+		tests[i] = FrustumTest(*frusta[i]);
+	query_frusta_from(root, tests, num_frusta, func);
+}
+
+template <typename Func>
+void DynamicBVH::query_frusta_subset(const Frustum *const *frusta, unsigned num_frusta,
+                                     unsigned index, unsigned num_indices, const Func &func) const
+{
+	assert(num_frusta <= MaxQueryFrusta);
+	if (root == InvalidNode || num_frusta == 0)
+		return;
+
+	FrustumTest tests[MaxQueryFrusta];
+	for (unsigned i = 0; i < num_frusta; i++)
+		tests[i] = FrustumTest(*frusta[i]);
+
+	uint32_t subset_roots[MaxSubsetRoots];
+	unsigned num_roots = collect_subset_roots(subset_roots, num_indices);
+	for (unsigned i = index; i < num_roots; i += num_indices)
+		query_frusta_from(subset_roots[i], tests, num_frusta, func);
+}
+
+template <typename NodeTest, typename LeafTest, typename Func>
+void DynamicBVH::query_generic(const NodeTest &node_test, const LeafTest &leaf_test, const Func &func) const
+{
+	if (root == InvalidNode)
+		return;
+
+	uint32_t stack[MaxStackDepth];
+	unsigned stack_size = 0;
+	stack[stack_size++] = root;
+
+	while (stack_size)
+	{
+		uint32_t node = stack[--stack_size];
+		auto &n = nodes[node];
+		if (!node_test(n.aabb))
+			continue;
+
+		if (n.height == 0)
+		{
+			if (leaf_test(leaf_aabbs[node]))
+				func(node);
+		}
+		else
+		{
+			assert(stack_size + 2 <= MaxStackDepth);
+			stack[stack_size++] = n.children[1];
+			stack[stack_size++] = n.children[0];
+		}
+	}
+}
+
+template <typename Func>
+void DynamicBVH::query_aabb(const AABB &aabb, const Func &func) const
+{
+	auto overlaps = [&](const AABB &node_aabb) -> bool {
+		return all(lessThanEqual(node_aabb.get_minimum(), aabb.get_maximum())) &&
+		       all(lessThanEqual(aabb.get_minimum(), node_aabb.get_maximum()));
+	};
+	query_generic(overlaps, overlaps, func);
+}
+
+template <typename Func>
+void DynamicBVH::query_sphere(const vec3 &center, float radius, const Func &func) const
+{
+	float radius_sq = radius * radius;
+	auto overlaps = [&](const AABB &node_aabb) -> bool {
+		vec3 closest = clamp(center, node_aabb.get_minimum(), node_aabb.get_maximum());
+		vec3 delta = closest - center;
+		return dot(delta, delta) <= radius_sq;
+	};
+	query_generic(overlaps, overlaps, func);
+}
+}
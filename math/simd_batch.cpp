@@ -0,0 +1,205 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "simd_batch_kernels.hpp"
+#include <atomic>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Granite
+{
+namespace SIMD
+{
+namespace
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GRANITE_SIMD_BATCH_X86 1
+#endif
+
+static bool cpu_supports(BatchISA isa)
+{
+#if defined(GRANITE_SIMD_BATCH_X86) && defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 0);
+	int max_leaf = regs[0];
+	__cpuid(regs, 1);
+	bool fma = (regs[2] & (1 << 12)) != 0;
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	bool avx = (regs[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return isa == BatchISA::SSE2;
+
+	// The OS must save YMM state, and ZMM / opmask state for AVX-512.
+	uint64_t xcr0 = _xgetbv(0);
+	bool ymm = (xcr0 & 0x6) == 0x6;
+	bool zmm = (xcr0 & 0xe6) == 0xe6;
+	bool avx2 = false, avx512f = false;
+	if (max_leaf >= 7)
+	{
+		__cpuidex(regs, 7, 0);
+		avx2 = (regs[1] & (1 << 5)) != 0;
+		avx512f = (regs[1] & (1 << 16)) != 0;
+	}
+
+	switch (isa)
+	{
+	case BatchISA::SSE2:
+		return true;
+	case BatchISA::AVX:
+		return ymm;
+	case BatchISA::AVX2:
+		return ymm && avx2 && fma;
+	case BatchISA::AVX512:
+		return zmm && avx512f;
+	default:
+		return false;
+	}
+#elif defined(GRANITE_SIMD_BATCH_X86) && (defined(__GNUC__) || defined(__clang__))
+	// Also checks that the OS saves the wider register state.
+	switch (isa)
+	{
+	case BatchISA::SSE2:
+		return __builtin_cpu_supports("sse2");
+	case BatchISA::AVX:
+		return __builtin_cpu_supports("avx");
+	case BatchISA::AVX2:
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case BatchISA::AVX512:
+		return __builtin_cpu_supports("avx512f");
+	default:
+		return false;
+	}
+#else
+	// NEON is only used if the build targets it.
+	return isa == VectorOps::ISA;
+#endif
+}
+
+static const Internal::BatchKernels *get_kernels_for_isa(BatchISA isa)
+{
+	if (isa == BatchISA::Scalar)
+		return create_batch_kernels<ScalarOps>(BatchISA::Scalar);
+	else if (!cpu_supports(isa))
+		return nullptr;
+	else if (isa == VectorOps::ISA)
+		return create_batch_kernels<VectorOps>(VectorOps::ISA);
+	else if (isa == BatchISA::AVX2)
+		return Internal::get_batch_kernels_avx2();
+	else if (isa == BatchISA::AVX512)
+		return Internal::get_batch_kernels_avx512();
+	else
+		return nullptr;
+}
+
+static const Internal::BatchKernels *select_kernels()
+{
+	// Widest first. The baseline kernels are built for whatever the build targets, so they always run.
+	static const BatchISA candidates[] = { BatchISA::AVX512, BatchISA::AVX2 };
+	for (auto isa : candidates)
+	{
+		// Don't go narrower than the baseline.
+		if (isa == VectorOps::ISA)
+			break;
+		if (auto *kernels = get_kernels_for_isa(isa))
+			return kernels;
+	}
+
+	return create_batch_kernels<VectorOps>(VectorOps::ISA);
+}
+
+static std::atomic<const Internal::BatchKernels *> active_kernels;
+}
+
+const Internal::BatchKernels &Internal::get_batch_kernels()
+{
+	auto *kernels = active_kernels.load(std::memory_order_relaxed);
+	if (!kernels)
+	{
+		kernels = select_kernels();
+		active_kernels.store(kernels, std::memory_order_relaxed);
+	}
+	return *kernels;
+}
+
+const char *get_batch_isa_name(BatchISA isa)
+{
+	switch (isa)
+	{
+	case BatchISA::Scalar:
+		return "scalar";
+	case BatchISA::SSE2:
+		return "SSE2";
+	case BatchISA::AVX:
+		return "AVX";
+	case BatchISA::AVX2:
+		return "AVX2";
+	case BatchISA::AVX512:
+		return "AVX-512";
+	case BatchISA::NEON:
+		return "NEON";
+	default:
+		return "?";
+	}
+}
+
+BatchISA get_batch_isa()
+{
+	return Internal::get_batch_kernels().isa;
+}
+
+bool batch_isa_is_supported(BatchISA isa)
+{
+	return get_kernels_for_isa(isa) != nullptr;
+}
+
+bool set_batch_isa(BatchISA isa)
+{
+	auto *kernels = get_kernels_for_isa(isa);
+	if (!kernels)
+		return false;
+	active_kernels.store(kernels, std::memory_order_relaxed);
+	return true;
+}
+
+void mat4_multiply_batch(float *out, const float *a, const float *b, size_t stride, size_t count)
+{
+	Internal::get_batch_kernels().mat4_multiply(out, a, b, stride, count);
+}
+
+void vec3_normalize_batch(float *const *out, const float *const *in, size_t count)
+{
+	Internal::get_batch_kernels().vec3_normalize(out, in, count);
+}
+
+void quat_nlerp_batch(float *const *out, const float *const *a, const float *const *b, const float *t, size_t count)
+{
+	Internal::get_batch_kernels().quat_nlerp(out, a, b, t, count);
+}
+
+void quat_slerp_batch(float *const *out, const float *const *a, const float *const *b, const float *t, size_t count)
+{
+	Internal::get_batch_kernels().quat_slerp(out, a, b, t, count);
+}
+}
+}
@@ -0,0 +1,71 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+
+namespace Granite
+{
+namespace SIMD
+{
+// Instruction sets the batch kernels are built for. Kernels for wider x86 instruction sets are compiled separately
+// and selected at runtime based on what the CPU supports. The baseline is whatever the build targets.
+enum class BatchISA
+{
+	Scalar,
+	SSE2,
+	AVX,
+	AVX2,
+	AVX512,
+	NEON
+};
+
+const char *get_batch_isa_name(BatchISA isa);
+
+// The instruction set batch functions currently run with.
+BatchISA get_batch_isa();
+
+// Overrides the runtime selection, mostly useful for testing and benchmarking.
+// Returns false, and leaves the selection alone, if the instruction set is not supported by the build or the CPU.
+bool set_batch_isa(BatchISA isa);
+bool batch_isa_is_supported(BatchISA isa);
+
+// Batch functions operate on structure-of-arrays data.
+// Matrices are 16 float streams spaced stride floats apart in column-major order,
+// i.e. stream 4 * col + row, like TransformSoA. Vectors and quaternions are one stream per component,
+// and quaternions are stored as x, y, z, w. No padding is required.
+
+// out = a * b for count matrices. out may alias a or b.
+void mat4_multiply_batch(float *out, const float *a, const float *b, size_t stride, size_t count);
+
+// Normalizes count vectors. out may alias in.
+void vec3_normalize_batch(float *const *out, const float *const *in, size_t count);
+
+// Interpolates count quaternion pairs with weights t along the shortest path, like slerp().
+// nlerp renormalizes a linear blend, which is cheaper, but does not keep angular velocity constant.
+// Results are normalized. out may alias a or b.
+void quat_nlerp_batch(float *const *out, const float *const *a, const float *const *b, const float *t, size_t count);
+void quat_slerp_batch(float *const *out, const float *const *a, const float *const *b, const float *t, size_t count);
+}
+}
@@ -0,0 +1,540 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+
+// Kernels shared by the batch math translation units. Every translation unit which includes this header
+// instantiates the kernels for the instruction set it is compiled for, so everything except the kernel table
+// must have internal linkage.
+
+#include "simd_batch.hpp"
+#include "simd_transform.hpp"
+#include "simd_cull.hpp"
+#include "simd_headers.hpp"
+#include <math.h>
+#include <stdint.h>
+
+namespace Granite
+{
+namespace SIMD
+{
+namespace Internal
+{
+// Every function handles the full range, including the tail.
+struct BatchKernels
+{
+	BatchISA isa;
+	void (*compute_model_transform)(TransformSoA &transforms, size_t begin, size_t end);
+	void (*transform_aabb)(AABBSoA &output, const AABBSoA &boxes, const TransformSoA &transforms, size_t begin, size_t end);
+	void (*mat4_multiply)(float *out, const float *a, const float *b, size_t stride, size_t count);
+	void (*vec3_normalize)(float *const *out, const float *const *in, size_t count);
+	void (*quat_nlerp)(float *const *out, const float *const *a, const float *const *b, const float *t, size_t count);
+	void (*quat_slerp)(float *const *out, const float *const *a, const float *const *b, const float *t, size_t count);
+};
+
+// The kernels selected for the CPU, or by set_batch_isa().
+const BatchKernels &get_batch_kernels();
+
+// Return nullptr if the build did not compile kernels for the instruction set.
+const BatchKernels *get_batch_kernels_avx2();
+const BatchKernels *get_batch_kernels_avx512();
+}
+
+namespace
+{
+// Minimal vector abstraction so each kernel is only written once.
+// ScalarOps handles the tails, which keeps full batches from touching entries past the end.
+struct ScalarOps
+{
+	using V = float;
+	enum { Lanes = 1 };
+	static V load(const float *p) { return *p; }
+	static void store(float *p, V v) { *p = v; }
+	static V splat(float v) { return v; }
+	static V add(V a, V b) { return a + b; }
+	static V sub(V a, V b) { return a - b; }
+	static V mul(V a, V b) { return a * b; }
+	static V madd(V a, V b, V c) { return a * b + c; }
+	static V min(V a, V b) { return a < b ? a : b; }
+	static V max(V a, V b) { return a > b ? a : b; }
+	static V rsqrt(V v) { return 1.0f / sqrtf(v); }
+	static V copysign(V mag, V sign) { return copysignf(mag, sign); }
+};
+
+#if defined(__AVX512F__)
+struct VectorOps
+{
+	using V = __m512;
+	enum { Lanes = 16 };
+	static constexpr BatchISA ISA = BatchISA::AVX512;
+	static V load(const float *p) { return _mm512_loadu_ps(p); }
+	static void store(float *p, V v) { _mm512_storeu_ps(p, v); }
+	static V splat(float v) { return _mm512_set1_ps(v); }
+	static V add(V a, V b) { return _mm512_add_ps(a, b); }
+	static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+	static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+	static V madd(V a, V b, V c) { return _mm512_fmadd_ps(a, b, c); }
+	// GCC's unmasked min/max/sqrt/andnot pass an undefined source and trip -Wmaybe-uninitialized.
+	// The masked forms with every lane selected are the same instructions.
+	static V min(V a, V b) { return _mm512_mask_min_ps(a, 0xffff, a, b); }
+	static V max(V a, V b) { return _mm512_mask_max_ps(a, 0xffff, a, b); }
+	static V rsqrt(V v) { return _mm512_div_ps(_mm512_set1_ps(1.0f), _mm512_mask_sqrt_ps(v, 0xffff, v)); }
+
+	static V copysign(V mag, V sign)
+	{
+		// Float logic ops need AVX-512DQ, integer ones do not.
+		const __m512i mask = _mm512_set1_epi32(int(0x80000000u));
+		const __m512i m = _mm512_castps_si512(mag);
+		return _mm512_castsi512_ps(_mm512_or_si512(_mm512_mask_andnot_epi32(m, 0xffff, mask, m),
+		                                           _mm512_and_si512(mask, _mm512_castps_si512(sign))));
+	}
+};
+#elif defined(__AVX__)
+struct VectorOps
+{
+	using V = __m256;
+	enum { Lanes = 8 };
+#if defined(__AVX2__) && defined(__FMA__)
+	static constexpr BatchISA ISA = BatchISA::AVX2;
+	static V madd(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+	static constexpr BatchISA ISA = BatchISA::AVX;
+	static V madd(V a, V b, V c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+	static V load(const float *p) { return _mm256_loadu_ps(p); }
+	static void store(float *p, V v) { _mm256_storeu_ps(p, v); }
+	static V splat(float v) { return _mm256_set1_ps(v); }
+	static V add(V a, V b) { return _mm256_add_ps(a, b); }
+	static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+	static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+	static V min(V a, V b) { return _mm256_min_ps(a, b); }
+	static V max(V a, V b) { return _mm256_max_ps(a, b); }
+	static V rsqrt(V v) { return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(v)); }
+
+	static V copysign(V mag, V sign)
+	{
+		const V mask = _mm256_set1_ps(-0.0f);
+		return _mm256_or_ps(_mm256_andnot_ps(mask, mag), _mm256_and_ps(mask, sign));
+	}
+};
+#elif defined(__SSE2__)
+struct VectorOps
+{
+	using V = __m128;
+	enum { Lanes = 4 };
+	static constexpr BatchISA ISA = BatchISA::SSE2;
+	static V load(const float *p) { return _mm_loadu_ps(p); }
+	static void store(float *p, V v) { _mm_storeu_ps(p, v); }
+	static V splat(float v) { return _mm_set1_ps(v); }
+	static V add(V a, V b) { return _mm_add_ps(a, b); }
+	static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+	static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+	static V madd(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+	static V min(V a, V b) { return _mm_min_ps(a, b); }
+	static V max(V a, V b) { return _mm_max_ps(a, b); }
+	static V rsqrt(V v) { return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(v)); }
+
+	static V copysign(V mag, V sign)
+	{
+		const V mask = _mm_set1_ps(-0.0f);
+		return _mm_or_ps(_mm_andnot_ps(mask, mag), _mm_and_ps(mask, sign));
+	}
+};
+#elif defined(__ARM_NEON)
+struct VectorOps
+{
+	using V = float32x4_t;
+	enum { Lanes = 4 };
+	static constexpr BatchISA ISA = BatchISA::NEON;
+	static V load(const float *p) { return vld1q_f32(p); }
+	static void store(float *p, V v) { vst1q_f32(p, v); }
+	static V splat(float v) { return vdupq_n_f32(v); }
+	static V add(V a, V b) { return vaddq_f32(a, b); }
+	static V sub(V a, V b) { return vsubq_f32(a, b); }
+	static V mul(V a, V b) { return vmulq_f32(a, b); }
+	static V madd(V a, V b, V c) { return vmlaq_f32(c, a, b); }
+	static V min(V a, V b) { return vminq_f32(a, b); }
+	static V max(V a, V b) { return vmaxq_f32(a, b); }
+
+	static V rsqrt(V v)
+	{
+#if defined(__aarch64__)
+		return vdivq_f32(vdupq_n_f32(1.0f), vsqrtq_f32(v));
+#else
+		// No square root on ARMv7, refine the estimate instead.
+		V e = vrsqrteq_f32(v);
+		e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(v, e), e));
+		e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(v, e), e));
+		return e;
+#endif
+	}
+
+	static V copysign(V mag, V sign)
+	{
+		return vbslq_f32(vdupq_n_u32(0x80000000u), sign, mag);
+	}
+};
+#else
+struct VectorOps : ScalarOps
+{
+	static constexpr BatchISA ISA = BatchISA::Scalar;
+};
+#endif
+
+template <typename Ops>
+static size_t compute_model_transform_kernel(TransformSoA &transforms, size_t begin, size_t end)
+{
+	using V = typename Ops::V;
+	const float *scale[3], *rotation[4], *translation[3], *parent[16];
+	float *world[16];
+
+	for (unsigned i = 0; i < 3; i++)
+	{
+		scale[i] = transforms.get_stream(TransformSoA::ScaleX + i);
+		translation[i] = transforms.get_stream(TransformSoA::TranslationX + i);
+	}
+
+	for (unsigned i = 0; i < 4; i++)
+		rotation[i] = transforms.get_stream(TransformSoA::RotationX + i);
+
+	for (unsigned i = 0; i < 16; i++)
+	{
+		parent[i] = transforms.get_stream(TransformSoA::Parent + i);
+		world[i] = transforms.get_stream(TransformSoA::World + i);
+	}
+
+	const V one = Ops::splat(1.0f);
+	const V two = Ops::splat(2.0f);
+
+	size_t i;
+	for (i = begin; i + Ops::Lanes <= end; i += Ops::Lanes)
+	{
+		V x = Ops::load(rotation[0] + i);
+		V y = Ops::load(rotation[1] + i);
+		V z = Ops::load(rotation[2] + i);
+		V w = Ops::load(rotation[3] + i);
+
+		V x2 = Ops::mul(x, two);
+		V y2 = Ops::mul(y, two);
+		V z2 = Ops::mul(z, two);
+		V xx = Ops::mul(x, x2), yy = Ops::mul(y, y2), zz = Ops::mul(z, z2);
+		V xy = Ops::mul(x, y2), xz = Ops::mul(x, z2), yz = Ops::mul(y, z2);
+		V wx = Ops::mul(w, x2), wy = Ops::mul(w, y2), wz = Ops::mul(w, z2);
+
+		V sx = Ops::load(scale[0] + i);
+		V sy = Ops::load(scale[1] + i);
+		V sz = Ops::load(scale[2] + i);
+
+		// Upper 3x3 of the local transform, column-major.
+		V local[3][3] = {
+			{ Ops::mul(Ops::sub(one, Ops::add(yy, zz)), sx), Ops::mul(Ops::add(xy, wz), sx), Ops::mul(Ops::sub(xz, wy), sx) },
+			{ Ops::mul(Ops::sub(xy, wz), sy), Ops::mul(Ops::sub(one, Ops::add(xx, zz)), sy), Ops::mul(Ops::add(yz, wx), sy) },
+			{ Ops::mul(Ops::add(xz, wy), sz), Ops::mul(Ops::sub(yz, wx), sz), Ops::mul(Ops::sub(one, Ops::add(xx, yy)), sz) },
+		};
+
+		V t[3] = {
+			Ops::load(translation[0] + i),
+			Ops::load(translation[1] + i),
+			Ops::load(translation[2] + i),
+		};
+
+		for (unsigned row = 0; row < 4; row++)
+		{
+			V p0 = Ops::load(parent[0 + row] + i);
+			V p1 = Ops::load(parent[4 + row] + i);
+			V p2 = Ops::load(parent[8 + row] + i);
+			V p3 = Ops::load(parent[12 + row] + i);
+
+			for (unsigned col = 0; col < 3; col++)
+			{
+				V v = Ops::add(Ops::add(Ops::mul(p0, local[col][0]), Ops::mul(p1, local[col][1])),
+				               Ops::mul(p2, local[col][2]));
+				Ops::store(world[4 * col + row] + i, v);
+			}
+
+			V v = Ops::add(Ops::add(Ops::mul(p0, t[0]), Ops::mul(p1, t[1])),
+			               Ops::add(Ops::mul(p2, t[2]), p3));
+			Ops::store(world[12 + row] + i, v);
+		}
+	}
+
+	return i;
+}
+
+template <typename Ops>
+static size_t transform_aabb_kernel(AABBSoA &output, const AABBSoA &boxes, const TransformSoA &transforms,
+                                    size_t begin, size_t end)
+{
+	using V = typename Ops::V;
+	const float *lo[3] = { boxes.get_min_x(), boxes.get_min_y(), boxes.get_min_z() };
+	const float *hi[3] = { boxes.get_max_x(), boxes.get_max_y(), boxes.get_max_z() };
+	float *out_lo[3] = { output.get_min_x(), output.get_min_y(), output.get_min_z() };
+	float *out_hi[3] = { output.get_max_x(), output.get_max_y(), output.get_max_z() };
+	const float *m = transforms.get_stream(TransformSoA::World);
+	size_t stride = transforms.get_stride();
+
+	size_t i;
+	for (i = begin; i + Ops::Lanes <= end; i += Ops::Lanes)
+	{
+		V box_lo[3], box_hi[3];
+		for (unsigned axis = 0; axis < 3; axis++)
+		{
+			box_lo[axis] = Ops::load(lo[axis] + i);
+			box_hi[axis] = Ops::load(hi[axis] + i);
+		}
+
+		for (unsigned row = 0; row < 3; row++)
+		{
+			V result_lo = Ops::load(m + (12 + row) * stride + i);
+			V result_hi = result_lo;
+
+			for (unsigned col = 0; col < 3; col++)
+			{
+				V c = Ops::load(m + (4 * col + row) * stride + i);
+				V a = Ops::mul(c, box_lo[col]);
+				V b = Ops::mul(c, box_hi[col]);
+				result_lo = Ops::add(result_lo, Ops::min(a, b));
+				result_hi = Ops::add(result_hi, Ops::max(a, b));
+			}
+
+			Ops::store(out_lo[row] + i, result_lo);
+			Ops::store(out_hi[row] + i, result_hi);
+		}
+	}
+
+	return i;
+}
+
+template <typename Ops>
+static size_t mat4_multiply_kernel(float *out, const float *a, const float *b, size_t stride, size_t begin, size_t end)
+{
+	using V = typename Ops::V;
+
+	size_t i;
+	for (i = begin; i + Ops::Lanes <= end; i += Ops::Lanes)
+	{
+		// All of a is loaded up front, and a column of b is loaded before the column is written,
+		// so out may alias either input.
+		V ma[16];
+		for (unsigned k = 0; k < 16; k++)
+			ma[k] = Ops::load(a + k * stride + i);
+
+		for (unsigned col = 0; col < 4; col++)
+		{
+			V b0 = Ops::load(b + (4 * col + 0) * stride + i);
+			V b1 = Ops::load(b + (4 * col + 1) * stride + i);
+			V b2 = Ops::load(b + (4 * col + 2) * stride + i);
+			V b3 = Ops::load(b + (4 * col + 3) * stride + i);
+
+			V r[4];
+			for (unsigned row = 0; row < 4; row++)
+				r[row] = Ops::madd(ma[12 + row], b3, Ops::madd(ma[8 + row], b2, Ops::madd(ma[4 + row], b1, Ops::mul(ma[row], b0))));
+			for (unsigned row = 0; row < 4; row++)
+				Ops::store(out + (4 * col + row) * stride + i, r[row]);
+		}
+	}
+
+	return i;
+}
+
+template <typename Ops>
+static size_t vec3_normalize_kernel(float *const *out, const float *const *in, size_t begin, size_t end)
+{
+	using V = typename Ops::V;
+
+	size_t i;
+	for (i = begin; i + Ops::Lanes <= end; i += Ops::Lanes)
+	{
+		V x = Ops::load(in[0] + i);
+		V y = Ops::load(in[1] + i);
+		V z = Ops::load(in[2] + i);
+		V inv_length = Ops::rsqrt(Ops::madd(z, z, Ops::madd(y, y, Ops::mul(x, x))));
+		Ops::store(out[0] + i, Ops::mul(x, inv_length));
+		Ops::store(out[1] + i, Ops::mul(y, inv_length));
+		Ops::store(out[2] + i, Ops::mul(z, inv_length));
+	}
+
+	return i;
+}
+
+template <typename Ops>
+static inline typename Ops::V quat_dot(const typename Ops::V *a, const typename Ops::V *b)
+{
+	return Ops::madd(a[3], b[3], Ops::madd(a[2], b[2], Ops::madd(a[1], b[1], Ops::mul(a[0], b[0]))));
+}
+
+template <typename Ops>
+static size_t quat_nlerp_kernel(float *const *out, const float *const *a, const float *const *b, const float *t,
+                                size_t begin, size_t end)
+{
+	using V = typename Ops::V;
+	const V one = Ops::splat(1.0f);
+
+	size_t i;
+	for (i = begin; i + Ops::Lanes <= end; i += Ops::Lanes)
+	{
+		V qa[4], qb[4], r[4];
+		for (unsigned c = 0; c < 4; c++)
+		{
+			qa[c] = Ops::load(a[c] + i);
+			qb[c] = Ops::load(b[c] + i);
+		}
+
+		// Flip b into the same hemisphere as a, so we take the shortest path.
+		V l = Ops::load(t + i);
+		V lb = Ops::copysign(l, quat_dot<Ops>(qa, qb));
+		V la = Ops::sub(one, l);
+
+		for (unsigned c = 0; c < 4; c++)
+			r[c] = Ops::madd(qb[c], lb, Ops::mul(qa[c], la));
+
+		V inv_length = Ops::rsqrt(quat_dot<Ops>(r, r));
+		for (unsigned c = 0; c < 4; c++)
+			Ops::store(out[c] + i, Ops::mul(r[c], inv_length));
+	}
+
+	return i;
+}
+
+// Polynomial approximation of sin((1 - t) * theta) / sin(theta) and sin(t * theta) / sin(theta) in terms of
+// cos(theta), from "A Fast and Accurate Algorithm for Computing SLERP" by David Eberly.
+// This avoids acos() and sin(), and does not need the nlerp fallback for small angles.
+// u[i] = 1 / (i * (2i + 1)), v[i] = i / (2i + 1), with the last term scaled by mu to minimize the maximum error.
+// With 8 terms as in the paper, the error reaches 2e-5 for quaternions 90 degrees apart. 12 terms keep it below 1e-6.
+static constexpr unsigned SlerpTerms = 12;
+static constexpr float SlerpMu = 1.89372068f;
+static constexpr float SlerpU[SlerpTerms] = {
+	1.0f / (1 * 3), 1.0f / (2 * 5), 1.0f / (3 * 7), 1.0f / (4 * 9), 1.0f / (5 * 11), 1.0f / (6 * 13),
+	1.0f / (7 * 15), 1.0f / (8 * 17), 1.0f / (9 * 19), 1.0f / (10 * 21), 1.0f / (11 * 23), SlerpMu / (12 * 25),
+};
+static constexpr float SlerpV[SlerpTerms] = {
+	1.0f / 3, 2.0f / 5, 3.0f / 7, 4.0f / 9, 5.0f / 11, 6.0f / 13,
+	7.0f / 15, 8.0f / 17, 9.0f / 19, 10.0f / 21, 11.0f / 23, SlerpMu * 12 / 25,
+};
+
+template <typename Ops>
+static size_t quat_slerp_kernel(float *const *out, const float *const *a, const float *const *b, const float *t,
+                                size_t begin, size_t end)
+{
+	using V = typename Ops::V;
+	const V one = Ops::splat(1.0f);
+
+	size_t i;
+	for (i = begin; i + Ops::Lanes <= end; i += Ops::Lanes)
+	{
+		V qa[4], qb[4];
+		for (unsigned c = 0; c < 4; c++)
+		{
+			qa[c] = Ops::load(a[c] + i);
+			qb[c] = Ops::load(b[c] + i);
+		}
+
+		V cos_theta = quat_dot<Ops>(qa, qb);
+		V sign = Ops::copysign(one, cos_theta);
+		V xm1 = Ops::sub(Ops::mul(cos_theta, sign), one);
+
+		V lb = Ops::load(t + i);
+		V la = Ops::sub(one, lb);
+		V lb2 = Ops::mul(lb, lb);
+		V la2 = Ops::mul(la, la);
+
+		V cb = one;
+		V ca = one;
+		for (unsigned term = SlerpTerms; term; term--)
+		{
+			V u = Ops::splat(SlerpU[term - 1]);
+			V v = Ops::splat(SlerpV[term - 1]);
+			cb = Ops::madd(Ops::mul(Ops::sub(Ops::mul(u, lb2), v), xm1), cb, one);
+			ca = Ops::madd(Ops::mul(Ops::sub(Ops::mul(u, la2), v), xm1), ca, one);
+		}
+
+		cb = Ops::mul(Ops::mul(cb, lb), sign);
+		ca = Ops::mul(ca, la);
+
+		for (unsigned c = 0; c < 4; c++)
+			Ops::store(out[c] + i, Ops::madd(qb[c], cb, Ops::mul(qa[c], ca)));
+	}
+
+	return i;
+}
+
+template <typename Ops>
+static void compute_model_transform_range(TransformSoA &transforms, size_t begin, size_t end)
+{
+	begin = compute_model_transform_kernel<Ops>(transforms, begin, end);
+	compute_model_transform_kernel<ScalarOps>(transforms, begin, end);
+}
+
+template <typename Ops>
+static void transform_aabb_range(AABBSoA &output, const AABBSoA &boxes, const TransformSoA &transforms,
+                                 size_t begin, size_t end)
+{
+	begin = transform_aabb_kernel<Ops>(output, boxes, transforms, begin, end);
+	transform_aabb_kernel<ScalarOps>(output, boxes, transforms, begin, end);
+}
+
+template <typename Ops>
+static void mat4_multiply_range(float *out, const float *a, const float *b, size_t stride, size_t count)
+{
+	size_t i = mat4_multiply_kernel<Ops>(out, a, b, stride, 0, count);
+	mat4_multiply_kernel<ScalarOps>(out, a, b, stride, i, count);
+}
+
+template <typename Ops>
+static void vec3_normalize_range(float *const *out, const float *const *in, size_t count)
+{
+	size_t i = vec3_normalize_kernel<Ops>(out, in, 0, count);
+	vec3_normalize_kernel<ScalarOps>(out, in, i, count);
+}
+
+template <typename Ops>
+static void quat_nlerp_range(float *const *out, const float *const *a, const float *const *b, const float *t, size_t count)
+{
+	size_t i = quat_nlerp_kernel<Ops>(out, a, b, t, 0, count);
+	quat_nlerp_kernel<ScalarOps>(out, a, b, t, i, count);
+}
+
+template <typename Ops>
+static void quat_slerp_range(float *const *out, const float *const *a, const float *const *b, const float *t, size_t count)
+{
+	size_t i = quat_slerp_kernel<Ops>(out, a, b, t, 0, count);
+	quat_slerp_kernel<ScalarOps>(out, a, b, t, i, count);
+}
+
+template <typename Ops>
+static const Internal::BatchKernels *create_batch_kernels(BatchISA isa)
+{
+	static const Internal::BatchKernels kernels = {
+		isa,
+		compute_model_transform_range<Ops>,
+		transform_aabb_range<Ops>,
+		mat4_multiply_range<Ops>,
+		vec3_normalize_range<Ops>,
+		quat_nlerp_range<Ops>,
+		quat_slerp_range<Ops>,
+	};
+	return &kernels;
+}
+}
+}
+}
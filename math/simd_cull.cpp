@@ -0,0 +1,501 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "simd_cull.hpp"
+#include "simd_headers.hpp"
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+#include <algorithm>
+
+namespace Granite
+{
+void AABBSoA::resize_storage(size_t padded_count)
+{
+	min_x.resize(padded_count);
+	min_y.resize(padded_count);
+	min_z.resize(padded_count);
+	max_x.resize(padded_count);
+	max_y.resize(padded_count);
+	max_z.resize(padded_count);
+}
+
+void AABBSoA::reserve(size_t count_)
+{
+	min_x.reserve(count_ + BatchSize);
+	min_y.reserve(count_ + BatchSize);
+	min_z.reserve(count_ + BatchSize);
+	max_x.reserve(count_ + BatchSize);
+	max_y.reserve(count_ + BatchSize);
+	max_z.reserve(count_ + BatchSize);
+}
+
+void AABBSoA::resize(size_t count_)
+{
+	count = count_;
+	resize_storage(count + BatchSize);
+}
+
+void AABBSoA::clear()
+{
+	count = 0;
+	resize_storage(BatchSize);
+}
+
+void AABBSoA::push_back(const AABB &aabb)
+{
+	resize(count + 1);
+	set(count - 1, aabb);
+}
+
+void AABBSoA::set_unbounded(size_t index)
+{
+	// Every plane picks the extent which maximizes the plane distance,
+	// so products never become negative, and the sum cannot become NaN.
+	min_x[index] = -FLT_MAX;
+	min_y[index] = -FLT_MAX;
+	min_z[index] = -FLT_MAX;
+	max_x[index] = FLT_MAX;
+	max_y[index] = FLT_MAX;
+	max_z[index] = FLT_MAX;
+}
+
+namespace SIMD
+{
+namespace
+{
+// For every plane, the AABB corner furthest along the plane normal is fixed,
+// so the min/max selection is resolved once per plane rather than per box.
+struct CullPlane
+{
+	const float *x;
+	const float *y;
+	const float *z;
+	vec4 plane;
+};
+
+static void setup_cull_planes(CullPlane *cull_planes, const AABBSoA &boxes, const vec4 *planes)
+{
+	for (unsigned i = 0; i < 6; i++)
+	{
+		auto &p = planes[i];
+		cull_planes[i].x = p.x > 0.0f ? boxes.get_max_x() : boxes.get_min_x();
+		cull_planes[i].y = p.y > 0.0f ? boxes.get_max_y() : boxes.get_min_y();
+		cull_planes[i].z = p.z > 0.0f ? boxes.get_max_z() : boxes.get_min_z();
+		cull_planes[i].plane = p;
+	}
+}
+
+static inline size_t emit_visible(uint32_t *out_indices, size_t count, size_t base, uint32_t mask, unsigned lanes)
+{
+	// Branchless compaction. A slot is always written, but only kept if the box is visible.
+	// Slot count + i never exceeds base + i, so the caller's buffer bounds the writes.
+	for (unsigned i = 0; i < lanes; i++)
+	{
+		out_indices[count] = uint32_t(base + i);
+		count += (mask >> i) & 1u;
+	}
+	return count;
+}
+
+#if defined(__AVX512F__)
+static inline unsigned popcount16(uint32_t mask)
+{
+#ifdef _MSC_VER
+	return __popcnt(mask);
+#else
+	return unsigned(__builtin_popcount(mask));
+#endif
+}
+#endif
+
+static inline uint32_t tail_mask(size_t remaining, unsigned lanes)
+{
+	return remaining >= lanes ? ((1u << lanes) - 1u) : ((1u << remaining) - 1u);
+}
+
+// emit_visible() writes a slot for every lane, so the tail must only emit lanes which exist,
+// or a partial batch where every box is visible writes past the end of out_indices.
+static inline unsigned tail_lanes(size_t remaining, unsigned lanes)
+{
+	return unsigned(std::min<size_t>(remaining, lanes));
+}
+}
+
+size_t frustum_cull_batch_scalar(const AABBSoA &boxes, size_t begin, size_t end,
+                                 const vec4 *planes, uint32_t *out_indices)
+{
+	CullPlane cull_planes[6];
+	setup_cull_planes(cull_planes, boxes, planes);
+	size_t count = 0;
+
+	for (size_t i = begin; i < end; i++)
+	{
+		bool culled = false;
+		for (auto &p : cull_planes)
+		{
+			// Same summation order as frustum_cull() so both paths agree exactly.
+			float d = (p.plane.x * p.x[i] + p.plane.y * p.y[i]) + (p.plane.z * p.z[i] + p.plane.w);
+			culled = culled || signbit(d);
+		}
+
+		out_indices[count] = uint32_t(i - begin);
+		count += culled ? 0 : 1;
+	}
+
+	return count;
+}
+
+size_t frustum_cull_batch(const AABBSoA &boxes, size_t begin, size_t end,
+                          const vec4 *planes, uint32_t *out_indices)
+{
+	CullPlane cull_planes[6];
+	setup_cull_planes(cull_planes, boxes, planes);
+	size_t count = 0;
+
+#if defined(__AVX512F__)
+	__m512 nx[6], ny[6], nz[6], nw[6];
+	for (unsigned p = 0; p < 6; p++)
+	{
+		nx[p] = _mm512_set1_ps(cull_planes[p].plane.x);
+		ny[p] = _mm512_set1_ps(cull_planes[p].plane.y);
+		nz[p] = _mm512_set1_ps(cull_planes[p].plane.z);
+		nw[p] = _mm512_set1_ps(cull_planes[p].plane.w);
+	}
+
+	const __m512i iota = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+	// The padding in AABBSoA allows a full batch to be read for the tail.
+	for (size_t i = begin; i < end; i += 16)
+	{
+		__m512i culled = _mm512_setzero_si512();
+		for (unsigned p = 0; p < 6; p++)
+		{
+			__m512 d = _mm512_add_ps(
+					_mm512_add_ps(_mm512_mul_ps(nx[p], _mm512_loadu_ps(cull_planes[p].x + i)),
+					              _mm512_mul_ps(ny[p], _mm512_loadu_ps(cull_planes[p].y + i))),
+					_mm512_add_ps(_mm512_mul_ps(nz[p], _mm512_loadu_ps(cull_planes[p].z + i)), nw[p]));
+			culled = _mm512_or_si512(culled, _mm512_castps_si512(d));
+		}
+
+		__mmask16 visible = _mm512_cmpge_epi32_mask(culled, _mm512_setzero_si512()) & tail_mask(end - i, 16);
+		_mm512_mask_compressstoreu_epi32(out_indices + count, visible,
+		                                 _mm512_add_epi32(_mm512_set1_epi32(int(i - begin)), iota));
+		count += popcount16(visible);
+	}
+#elif defined(__AVX__)
+	__m256 nx[6], ny[6], nz[6], nw[6];
+	for (unsigned p = 0; p < 6; p++)
+	{
+		nx[p] = _mm256_set1_ps(cull_planes[p].plane.x);
+		ny[p] = _mm256_set1_ps(cull_planes[p].plane.y);
+		nz[p] = _mm256_set1_ps(cull_planes[p].plane.z);
+		nw[p] = _mm256_set1_ps(cull_planes[p].plane.w);
+	}
+
+	for (size_t i = begin; i < end; i += 8)
+	{
+		__m256 culled = _mm256_setzero_ps();
+		for (unsigned p = 0; p < 6; p++)
+		{
+			__m256 d = _mm256_add_ps(
+					_mm256_add_ps(_mm256_mul_ps(nx[p], _mm256_loadu_ps(cull_planes[p].x + i)),
+					              _mm256_mul_ps(ny[p], _mm256_loadu_ps(cull_planes[p].y + i))),
+					_mm256_add_ps(_mm256_mul_ps(nz[p], _mm256_loadu_ps(cull_planes[p].z + i)), nw[p]));
+			culled = _mm256_or_ps(culled, d);
+		}
+
+		// Sets bit if the sign bit is set.
+		uint32_t visible = ~uint32_t(_mm256_movemask_ps(culled)) & tail_mask(end - i, 8);
+		count = emit_visible(out_indices, count, i - begin, visible, tail_lanes(end - i, 8));
+	}
+#elif defined(__SSE2__)
+	__m128 nx[6], ny[6], nz[6], nw[6];
+	for (unsigned p = 0; p < 6; p++)
+	{
+		nx[p] = _mm_set1_ps(cull_planes[p].plane.x);
+		ny[p] = _mm_set1_ps(cull_planes[p].plane.y);
+		nz[p] = _mm_set1_ps(cull_planes[p].plane.z);
+		nw[p] = _mm_set1_ps(cull_planes[p].plane.w);
+	}
+
+	// Two registers per iteration to cover 8 boxes.
+	for (size_t i = begin; i < end; i += 8)
+	{
+		__m128 culled_lo = _mm_setzero_ps();
+		__m128 culled_hi = _mm_setzero_ps();
+		for (unsigned p = 0; p < 6; p++)
+		{
+			auto &c = cull_planes[p];
+			__m128 d_lo = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(nx[p], _mm_loadu_ps(c.x + i)), _mm_mul_ps(ny[p], _mm_loadu_ps(c.y + i))),
+					_mm_add_ps(_mm_mul_ps(nz[p], _mm_loadu_ps(c.z + i)), nw[p]));
+			__m128 d_hi = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(nx[p], _mm_loadu_ps(c.x + i + 4)), _mm_mul_ps(ny[p], _mm_loadu_ps(c.y + i + 4))),
+					_mm_add_ps(_mm_mul_ps(nz[p], _mm_loadu_ps(c.z + i + 4)), nw[p]));
+			culled_lo = _mm_or_ps(culled_lo, d_lo);
+			culled_hi = _mm_or_ps(culled_hi, d_hi);
+		}
+
+		uint32_t culled = uint32_t(_mm_movemask_ps(culled_lo)) | (uint32_t(_mm_movemask_ps(culled_hi)) << 4);
+		uint32_t visible = ~culled & tail_mask(end - i, 8);
+		count = emit_visible(out_indices, count, i - begin, visible, tail_lanes(end - i, 8));
+	}
+#elif defined(__ARM_NEON)
+	float32x4_t nx[6], ny[6], nz[6], nw[6];
+	for (unsigned p = 0; p < 6; p++)
+	{
+		nx[p] = vdupq_n_f32(cull_planes[p].plane.x);
+		ny[p] = vdupq_n_f32(cull_planes[p].plane.y);
+		nz[p] = vdupq_n_f32(cull_planes[p].plane.z);
+		nw[p] = vdupq_n_f32(cull_planes[p].plane.w);
+	}
+
+	static const uint32_t lane_bits_lo[4] = { 1, 2, 4, 8 };
+	static const uint32_t lane_bits_hi[4] = { 16, 32, 64, 128 };
+	const uint32x4_t bits_lo = vld1q_u32(lane_bits_lo);
+	const uint32x4_t bits_hi = vld1q_u32(lane_bits_hi);
+
+	for (size_t i = begin; i < end; i += 8)
+	{
+		uint32x4_t culled_lo = vdupq_n_u32(0);
+		uint32x4_t culled_hi = vdupq_n_u32(0);
+		for (unsigned p = 0; p < 6; p++)
+		{
+			auto &c = cull_planes[p];
+			float32x4_t d_lo = vaddq_f32(
+					vaddq_f32(vmulq_f32(nx[p], vld1q_f32(c.x + i)), vmulq_f32(ny[p], vld1q_f32(c.y + i))),
+					vaddq_f32(vmulq_f32(nz[p], vld1q_f32(c.z + i)), nw[p]));
+			float32x4_t d_hi = vaddq_f32(
+					vaddq_f32(vmulq_f32(nx[p], vld1q_f32(c.x + i + 4)), vmulq_f32(ny[p], vld1q_f32(c.y + i + 4))),
+					vaddq_f32(vmulq_f32(nz[p], vld1q_f32(c.z + i + 4)), nw[p]));
+			culled_lo = vorrq_u32(culled_lo, vreinterpretq_u32_f32(d_lo));
+			culled_hi = vorrq_u32(culled_hi, vreinterpretq_u32_f32(d_hi));
+		}
+
+		// Turn sign bits into an 8-bit lane mask.
+		uint32x4_t lanes = vorrq_u32(vandq_u32(vreinterpretq_u32_s32(vshrq_n_s32(vreinterpretq_s32_u32(culled_lo), 31)), bits_lo),
+		                             vandq_u32(vreinterpretq_u32_s32(vshrq_n_s32(vreinterpretq_s32_u32(culled_hi), 31)), bits_hi));
+		uint32x2_t folded = vorr_u32(vget_low_u32(lanes), vget_high_u32(lanes));
+		uint32_t culled = vget_lane_u32(folded, 0) | vget_lane_u32(folded, 1);
+		uint32_t visible = ~culled & tail_mask(end - i, 8);
+		count = emit_visible(out_indices, count, i - begin, visible, tail_lanes(end - i, 8));
+	}
+#else
+	count = frustum_cull_batch_scalar(boxes, begin, end, planes, out_indices);
+#endif
+
+	return count;
+}
+
+void frustum_cull_batch_multiview_scalar(const AABBSoA &boxes, size_t begin, size_t end,
+                                         const vec4 *const *view_planes, unsigned num_views,
+                                         uint32_t *out_view_masks)
+{
+	assert(num_views <= MaxCullViews);
+	for (size_t i = begin; i < end; i++)
+	{
+		float lo[3] = { boxes.get_min_x()[i], boxes.get_min_y()[i], boxes.get_min_z()[i] };
+		float hi[3] = { boxes.get_max_x()[i], boxes.get_max_y()[i], boxes.get_max_z()[i] };
+		uint32_t mask = 0;
+
+		for (unsigned view = 0; view < num_views; view++)
+		{
+			bool culled = false;
+			for (unsigned p = 0; p < 6; p++)
+			{
+				auto &plane = view_planes[view][p];
+				float x = plane.x > 0.0f ? hi[0] : lo[0];
+				float y = plane.y > 0.0f ? hi[1] : lo[1];
+				float z = plane.z > 0.0f ? hi[2] : lo[2];
+				float d = (plane.x * x + plane.y * y) + (plane.z * z + plane.w);
+				culled = culled || signbit(d);
+			}
+
+			mask |= culled ? 0u : (1u << view);
+		}
+
+		out_view_masks[i - begin] = mask;
+	}
+}
+
+namespace
+{
+// Minimal vector abstraction so the multiview kernel is only written once.
+// View masks are accumulated in-register: add_visible() ORs view_bit into every lane which is not culled.
+#if defined(__AVX512F__)
+struct CullOps
+{
+	using V = __m512;
+	using M = __m512i;
+	enum { Lanes = 16, Unroll = 1 };
+	static V load(const float *p) { return _mm512_loadu_ps(p); }
+	static V splat(float v) { return _mm512_set1_ps(v); }
+	static V zero() { return _mm512_setzero_ps(); }
+	static M zero_mask() { return _mm512_setzero_si512(); }
+	static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+	static V add(V a, V b) { return _mm512_add_ps(a, b); }
+	static V bit_or(V a, V b) { return _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(a), _mm512_castps_si512(b))); }
+	static M add_visible(M acc, V culled, uint32_t view_bit)
+	{
+		__mmask16 visible = _mm512_cmpge_epi32_mask(_mm512_castps_si512(culled), _mm512_setzero_si512());
+		return _mm512_mask_or_epi32(acc, visible, acc, _mm512_set1_epi32(int(view_bit)));
+	}
+	static void store(uint32_t *p, M m) { _mm512_storeu_si512(p, m); }
+};
+#elif defined(__AVX__)
+struct CullOps
+{
+	using V = __m256;
+	using M = __m256;
+	enum { Lanes = 8, Unroll = 1 };
+	static V load(const float *p) { return _mm256_loadu_ps(p); }
+	static V splat(float v) { return _mm256_set1_ps(v); }
+	static V zero() { return _mm256_setzero_ps(); }
+	static M zero_mask() { return _mm256_setzero_ps(); }
+	static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+	static V add(V a, V b) { return _mm256_add_ps(a, b); }
+	static V bit_or(V a, V b) { return _mm256_or_ps(a, b); }
+	static M add_visible(M acc, V culled, uint32_t view_bit)
+	{
+		// Selects zero for lanes with the sign bit set. AVX1 has no 256-bit integer shifts.
+		V bit = _mm256_castsi256_ps(_mm256_set1_epi32(int(view_bit)));
+		return _mm256_or_ps(acc, _mm256_blendv_ps(bit, _mm256_setzero_ps(), culled));
+	}
+	static void store(uint32_t *p, M m) { _mm256_storeu_ps(reinterpret_cast<float *>(p), m); }
+};
+#elif defined(__SSE2__)
+struct CullOps
+{
+	using V = __m128;
+	using M = __m128i;
+	enum { Lanes = 4, Unroll = 2 };
+	static V load(const float *p) { return _mm_loadu_ps(p); }
+	static V splat(float v) { return _mm_set1_ps(v); }
+	static V zero() { return _mm_setzero_ps(); }
+	static M zero_mask() { return _mm_setzero_si128(); }
+	static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+	static V add(V a, V b) { return _mm_add_ps(a, b); }
+	static V bit_or(V a, V b) { return _mm_or_ps(a, b); }
+	static M add_visible(M acc, V culled, uint32_t view_bit)
+	{
+		__m128i culled_mask = _mm_srai_epi32(_mm_castps_si128(culled), 31);
+		return _mm_or_si128(acc, _mm_andnot_si128(culled_mask, _mm_set1_epi32(int(view_bit))));
+	}
+	static void store(uint32_t *p, M m) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), m); }
+};
+#elif defined(__ARM_NEON)
+struct CullOps
+{
+	using V = float32x4_t;
+	using M = uint32x4_t;
+	enum { Lanes = 4, Unroll = 2 };
+	static V load(const float *p) { return vld1q_f32(p); }
+	static V splat(float v) { return vdupq_n_f32(v); }
+	static V zero() { return vdupq_n_f32(0.0f); }
+	static M zero_mask() { return vdupq_n_u32(0); }
+	static V mul(V a, V b) { return vmulq_f32(a, b); }
+	static V add(V a, V b) { return vaddq_f32(a, b); }
+	static V bit_or(V a, V b) { return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b))); }
+	static M add_visible(M acc, V culled, uint32_t view_bit)
+	{
+		uint32x4_t culled_mask = vreinterpretq_u32_s32(vshrq_n_s32(vreinterpretq_s32_f32(culled), 31));
+		return vorrq_u32(acc, vbicq_u32(vdupq_n_u32(view_bit), culled_mask));
+	}
+	static void store(uint32_t *p, M m) { vst1q_u32(p, m); }
+};
+#endif
+}
+
+void frustum_cull_batch_multiview(const AABBSoA &boxes, size_t begin, size_t end,
+                                  const vec4 *const *view_planes, unsigned num_views,
+                                  uint32_t *out_view_masks)
+{
+	assert(num_views <= MaxCullViews);
+
+#if defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__) || defined(__ARM_NEON)
+	using V = CullOps::V;
+	using M = CullOps::M;
+	constexpr unsigned Lanes = CullOps::Lanes;
+	constexpr unsigned Unroll = CullOps::Unroll;
+	constexpr unsigned BatchSize = Lanes * Unroll;
+
+	// Extents are picked per plane up front, like frustum_cull_batch(). After the first view,
+	// the loads for a batch all hit L1.
+	CullPlane cull_planes[MaxCullViews][6];
+	for (unsigned view = 0; view < num_views; view++)
+		setup_cull_planes(cull_planes[view], boxes, view_planes[view]);
+
+	for (size_t i = begin; i < end; i += BatchSize)
+	{
+		M masks[Unroll];
+		for (unsigned u = 0; u < Unroll; u++)
+			masks[u] = CullOps::zero_mask();
+
+		for (unsigned view = 0; view < num_views; view++)
+		{
+			V culled[Unroll];
+			for (unsigned u = 0; u < Unroll; u++)
+				culled[u] = CullOps::zero();
+
+			for (auto &c : cull_planes[view])
+			{
+				V px = CullOps::splat(c.plane.x);
+				V py = CullOps::splat(c.plane.y);
+				V pz = CullOps::splat(c.plane.z);
+				V pw = CullOps::splat(c.plane.w);
+
+				for (unsigned u = 0; u < Unroll; u++)
+				{
+					size_t base = i + u * Lanes;
+					V d = CullOps::add(CullOps::add(CullOps::mul(px, CullOps::load(c.x + base)),
+					                                CullOps::mul(py, CullOps::load(c.y + base))),
+					                   CullOps::add(CullOps::mul(pz, CullOps::load(c.z + base)), pw));
+					culled[u] = CullOps::bit_or(culled[u], d);
+				}
+			}
+
+			for (unsigned u = 0; u < Unroll; u++)
+				masks[u] = CullOps::add_visible(masks[u], culled[u], 1u << view);
+		}
+
+		if (i + BatchSize <= end)
+		{
+			for (unsigned u = 0; u < Unroll; u++)
+				CullOps::store(out_view_masks + (i - begin) + u * Lanes, masks[u]);
+		}
+		else
+		{
+			// Lanes past the end read padding, and are dropped here.
+			uint32_t tail[BatchSize];
+			for (unsigned u = 0; u < Unroll; u++)
+				CullOps::store(tail + u * Lanes, masks[u]);
+			for (size_t lane = 0; lane < end - i; lane++)
+				out_view_masks[i - begin + lane] = tail[lane];
+		}
+	}
+#else
+	frustum_cull_batch_multiview_scalar(boxes, begin, end, view_planes, num_views, out_view_masks);
+#endif
+}
+}
+}
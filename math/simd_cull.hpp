@@ -0,0 +1,120 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "math.hpp"
+#include "aabb.hpp"
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Granite
+{
+// Structure-of-arrays copy of AABBs for batched culling.
+// Each component array is padded so that SIMD kernels may read a full batch past the last box.
+class AABBSoA
+{
+public:
+	enum { BatchSize = 16 };
+
+	void reserve(size_t count);
+	void resize(size_t count);
+	void clear();
+	void push_back(const AABB &aabb);
+
+	void set(size_t index, const AABB &aabb)
+	{
+		auto &lo = aabb.get_minimum();
+		auto &hi = aabb.get_maximum();
+		min_x[index] = lo.x;
+		min_y[index] = lo.y;
+		min_z[index] = lo.z;
+		max_x[index] = hi.x;
+		max_y[index] = hi.y;
+		max_z[index] = hi.z;
+	}
+
+	AABB get(size_t index) const
+	{
+		return AABB(vec3(min_x[index], min_y[index], min_z[index]),
+		            vec3(max_x[index], max_y[index], max_z[index]));
+	}
+
+	// Box which passes every frustum test.
+	void set_unbounded(size_t index);
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	const float *get_min_x() const { return min_x.data(); }
+	const float *get_min_y() const { return min_y.data(); }
+	const float *get_min_z() const { return min_z.data(); }
+	const float *get_max_x() const { return max_x.data(); }
+	const float *get_max_y() const { return max_y.data(); }
+	const float *get_max_z() const { return max_z.data(); }
+
+	float *get_min_x() { return min_x.data(); }
+	float *get_min_y() { return min_y.data(); }
+	float *get_min_z() { return min_z.data(); }
+	float *get_max_x() { return max_x.data(); }
+	float *get_max_y() { return max_y.data(); }
+	float *get_max_z() { return max_z.data(); }
+
+private:
+	std::vector<float> min_x, min_y, min_z;
+	std::vector<float> max_x, max_y, max_z;
+	size_t count = 0;
+	void resize_storage(size_t padded_count);
+};
+
+namespace SIMD
+{
+// Outputs of the batch functions are relative to begin, i.e. box i is reported as i - begin.
+
+// Tests boxes [begin, end) against the six planes of a Frustum.
+// Writes indices of boxes which are not culled to out_indices in increasing order,
+// and returns the number of indices written. out_indices must have room for (end - begin) entries.
+// Results match frustum_cull() for every box.
+size_t frustum_cull_batch(const AABBSoA &boxes, size_t begin, size_t end,
+                          const vec4 *planes, uint32_t *out_indices);
+
+// Portable reference path, used for tails and validation.
+size_t frustum_cull_batch_scalar(const AABBSoA &boxes, size_t begin, size_t end,
+                                 const vec4 *planes, uint32_t *out_indices);
+
+enum { MaxCullViews = 32 };
+
+// Tests boxes [begin, end) against num_views frusta in one pass, so each box is only loaded once.
+// out_view_masks[i - begin] receives a bitmask of the views box i is visible in.
+// Bit N matches frustum_cull() against view_planes[N].
+void frustum_cull_batch_multiview(const AABBSoA &boxes, size_t begin, size_t end,
+                                  const vec4 *const *view_planes, unsigned num_views,
+                                  uint32_t *out_view_masks);
+
+void frustum_cull_batch_multiview_scalar(const AABBSoA &boxes, size_t begin, size_t end,
+                                         const vec4 *const *view_planes, unsigned num_views,
+                                         uint32_t *out_view_masks);
+}
+}
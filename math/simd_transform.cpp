@@ -0,0 +1,159 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "simd_transform.hpp"
+#include "simd_batch_kernels.hpp"
+#include <algorithm>
+
+namespace Granite
+{
+void TransformSoA::resize(size_t count_)
+{
+	count = count_;
+	stride = count + BatchSize;
+	data.resize(stride * StreamCount);
+}
+
+static void load_matrix_columns(float *dst, size_t stride, const mat4 *const *matrices, size_t count)
+{
+	size_t i = 0;
+#if defined(__SSE__)
+	for (; i + 4 <= count; i += 4)
+	{
+		for (unsigned col = 0; col < 4; col++)
+		{
+			__m128 r0 = _mm_loadu_ps((*matrices[i + 0])[col].data);
+			__m128 r1 = _mm_loadu_ps((*matrices[i + 1])[col].data);
+			__m128 r2 = _mm_loadu_ps((*matrices[i + 2])[col].data);
+			__m128 r3 = _mm_loadu_ps((*matrices[i + 3])[col].data);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps(dst + (4 * col + 0) * stride + i, r0);
+			_mm_storeu_ps(dst + (4 * col + 1) * stride + i, r1);
+			_mm_storeu_ps(dst + (4 * col + 2) * stride + i, r2);
+			_mm_storeu_ps(dst + (4 * col + 3) * stride + i, r3);
+		}
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 4 <= count; i += 4)
+	{
+		for (unsigned col = 0; col < 4; col++)
+		{
+			float32x4x2_t t0 = vzipq_f32(vld1q_f32((*matrices[i + 0])[col].data), vld1q_f32((*matrices[i + 2])[col].data));
+			float32x4x2_t t1 = vzipq_f32(vld1q_f32((*matrices[i + 1])[col].data), vld1q_f32((*matrices[i + 3])[col].data));
+			float32x4x2_t r01 = vzipq_f32(t0.val[0], t1.val[0]);
+			float32x4x2_t r23 = vzipq_f32(t0.val[1], t1.val[1]);
+			vst1q_f32(dst + (4 * col + 0) * stride + i, r01.val[0]);
+			vst1q_f32(dst + (4 * col + 1) * stride + i, r01.val[1]);
+			vst1q_f32(dst + (4 * col + 2) * stride + i, r23.val[0]);
+			vst1q_f32(dst + (4 * col + 3) * stride + i, r23.val[1]);
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+		for (unsigned col = 0; col < 4; col++)
+			for (unsigned row = 0; row < 4; row++)
+				dst[(4 * col + row) * stride + i] = (*matrices[i])[col][row];
+}
+
+static void store_matrix_columns(mat4 *const *matrices, const float *src, size_t stride, size_t count)
+{
+	size_t i = 0;
+#if defined(__SSE__)
+	for (; i + 4 <= count; i += 4)
+	{
+		for (unsigned col = 0; col < 4; col++)
+		{
+			__m128 r0 = _mm_loadu_ps(src + (4 * col + 0) * stride + i);
+			__m128 r1 = _mm_loadu_ps(src + (4 * col + 1) * stride + i);
+			__m128 r2 = _mm_loadu_ps(src + (4 * col + 2) * stride + i);
+			__m128 r3 = _mm_loadu_ps(src + (4 * col + 3) * stride + i);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps((*matrices[i + 0])[col].data, r0);
+			_mm_storeu_ps((*matrices[i + 1])[col].data, r1);
+			_mm_storeu_ps((*matrices[i + 2])[col].data, r2);
+			_mm_storeu_ps((*matrices[i + 3])[col].data, r3);
+		}
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 4 <= count; i += 4)
+	{
+		for (unsigned col = 0; col < 4; col++)
+		{
+			float32x4x2_t t0 = vzipq_f32(vld1q_f32(src + (4 * col + 0) * stride + i), vld1q_f32(src + (4 * col + 2) * stride + i));
+			float32x4x2_t t1 = vzipq_f32(vld1q_f32(src + (4 * col + 1) * stride + i), vld1q_f32(src + (4 * col + 3) * stride + i));
+			float32x4x2_t r01 = vzipq_f32(t0.val[0], t1.val[0]);
+			float32x4x2_t r23 = vzipq_f32(t0.val[1], t1.val[1]);
+			vst1q_f32((*matrices[i + 0])[col].data, r01.val[0]);
+			vst1q_f32((*matrices[i + 1])[col].data, r01.val[1]);
+			vst1q_f32((*matrices[i + 2])[col].data, r23.val[0]);
+			vst1q_f32((*matrices[i + 3])[col].data, r23.val[1]);
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+		for (unsigned col = 0; col < 4; col++)
+			for (unsigned row = 0; row < 4; row++)
+				(*matrices[i])[col][row] = src[(4 * col + row) * stride + i];
+}
+
+void TransformSoA::set_parents(size_t index, const mat4 *const *matrices, size_t count_)
+{
+	load_matrix_columns(get_stream(Parent) + index, stride, matrices, count_);
+}
+
+void TransformSoA::set_worlds(size_t index, const mat4 *const *matrices, size_t count_)
+{
+	load_matrix_columns(get_stream(World) + index, stride, matrices, count_);
+}
+
+void TransformSoA::get_worlds(size_t index, mat4 *const *matrices, size_t count_) const
+{
+	store_matrix_columns(matrices, get_stream(World) + index, stride, count_);
+}
+
+namespace SIMD
+{
+void compute_model_transform_batch_scalar(TransformSoA &transforms, size_t begin, size_t end)
+{
+	compute_model_transform_kernel<ScalarOps>(transforms, begin, end);
+}
+
+void compute_model_transform_batch(TransformSoA &transforms, size_t begin, size_t end)
+{
+	Internal::get_batch_kernels().compute_model_transform(transforms, begin, end);
+}
+
+void transform_aabb_batch_scalar(AABBSoA &output, const AABBSoA &boxes, const TransformSoA &transforms,
+                                 size_t begin, size_t end)
+{
+	transform_aabb_kernel<ScalarOps>(output, boxes, transforms, begin, end);
+}
+
+void transform_aabb_batch(AABBSoA &output, const AABBSoA &boxes, const TransformSoA &transforms,
+                          size_t begin, size_t end)
+{
+	Internal::get_batch_kernels().transform_aabb(output, boxes, transforms, begin, end);
+}
+}
+}
@@ -0,0 +1,143 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "math.hpp"
+#include "simd_cull.hpp"
+#include <vector>
+#include <stddef.h>
+
+namespace Granite
+{
+// Structure-of-arrays staging for batched node transform updates.
+// Local scale, rotation and translation are packed together with the parent world transform,
+// and compute_model_transform_batch() writes world transforms back to the World streams.
+// Matrices are stored as 16 streams in column-major order, i.e. stream Parent + 4 * col + row.
+// Each stream is padded so that SIMD kernels may process a full batch past the last entry.
+class TransformSoA
+{
+public:
+	enum { BatchSize = 16 };
+
+	enum Stream
+	{
+		ScaleX, ScaleY, ScaleZ,
+		RotationX, RotationY, RotationZ, RotationW,
+		TranslationX, TranslationY, TranslationZ,
+		Parent,
+		World = Parent + 16,
+		StreamCount = World + 16
+	};
+
+	// Contents are not preserved when the size changes.
+	void resize(size_t count);
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	void set_local(size_t index, const vec3 &scale, const quat &rotation, const vec3 &translation)
+	{
+		float *s = data.data() + index;
+		s[ScaleX * stride] = scale.x;
+		s[ScaleY * stride] = scale.y;
+		s[ScaleZ * stride] = scale.z;
+		s[RotationX * stride] = rotation.x;
+		s[RotationY * stride] = rotation.y;
+		s[RotationZ * stride] = rotation.z;
+		s[RotationW * stride] = rotation.w;
+		s[TranslationX * stride] = translation.x;
+		s[TranslationY * stride] = translation.y;
+		s[TranslationZ * stride] = translation.z;
+	}
+
+	void set_parent(size_t index, const mat4 &m)
+	{
+		set_matrix(Parent, index, m);
+	}
+
+	void set_world(size_t index, const mat4 &m)
+	{
+		set_matrix(World, index, m);
+	}
+
+	// Bulk variants of set_parent(), set_world() and get_world() for count entries starting at index.
+	// These transpose four matrices at a time, which is considerably cheaper than strided scalar access.
+	void set_parents(size_t index, const mat4 *const *matrices, size_t count);
+	void set_worlds(size_t index, const mat4 *const *matrices, size_t count);
+	void get_worlds(size_t index, mat4 *const *matrices, size_t count) const;
+
+	void get_world(size_t index, mat4 &m) const
+	{
+		const float *s = data.data() + World * stride + index;
+		for (unsigned col = 0; col < 4; col++)
+			for (unsigned row = 0; row < 4; row++)
+				m[col][row] = s[(4 * col + row) * stride];
+	}
+
+	// Distance in floats between consecutive streams.
+	size_t get_stride() const
+	{
+		return stride;
+	}
+
+	float *get_stream(unsigned stream)
+	{
+		return data.data() + stream * stride;
+	}
+
+	const float *get_stream(unsigned stream) const
+	{
+		return data.data() + stream * stride;
+	}
+
+private:
+	std::vector<float> data;
+	size_t count = 0;
+	size_t stride = 0;
+
+	void set_matrix(unsigned stream, size_t index, const mat4 &m)
+	{
+		float *s = data.data() + stream * stride + index;
+		for (unsigned col = 0; col < 4; col++)
+			for (unsigned row = 0; row < 4; row++)
+				s[(4 * col + row) * stride] = m[col][row];
+	}
+};
+
+namespace SIMD
+{
+// For entries [begin, end), computes World = Parent * translate(T) * mat4_cast(R) * scale(S).
+// Results match compute_model_transform() up to floating point rounding.
+void compute_model_transform_batch(TransformSoA &transforms, size_t begin, size_t end);
+void compute_model_transform_batch_scalar(TransformSoA &transforms, size_t begin, size_t end);
+
+// For entries [begin, end), transforms boxes by the affine World streams of transforms,
+// and writes the resulting bounds to output. Results match transform_aabb().
+void transform_aabb_batch(AABBSoA &output, const AABBSoA &boxes, const TransformSoA &transforms,
+                          size_t begin, size_t end);
+void transform_aabb_batch_scalar(AABBSoA &output, const AABBSoA &boxes, const TransformSoA &transforms,
+                                 size_t begin, size_t end);
+}
+}
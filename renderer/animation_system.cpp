@@ -22,19 +22,220 @@
 
 #include "animation_system.hpp"
 #include "task_composer.hpp"
+#include <algorithm>
 
 namespace Granite
 {
+void AnimationPose::resize(unsigned count_)
+{
+	count = count_;
+	// Keep every stream 16 byte aligned relative to the first.
+	stride = (count + 3) & ~3u;
+	data.resize(size_t(stride) * StreamCount);
+}
+
+void AnimationPose::copy(const AnimationPose &pose)
+{
+	count = pose.count;
+	stride = pose.stride;
+	data = pose.data;
+}
+
+void AnimationPose::set_scale(unsigned index, const vec3 &scale)
+{
+	get_stream(ScaleX)[index] = scale.x;
+	get_stream(ScaleY)[index] = scale.y;
+	get_stream(ScaleZ)[index] = scale.z;
+}
+
+void AnimationPose::set_rotation(unsigned index, const quat &rotation)
+{
+	get_stream(RotationX)[index] = rotation.x;
+	get_stream(RotationY)[index] = rotation.y;
+	get_stream(RotationZ)[index] = rotation.z;
+	get_stream(RotationW)[index] = rotation.w;
+}
+
+void AnimationPose::set_translation(unsigned index, const vec3 &translation)
+{
+	get_stream(TranslationX)[index] = translation.x;
+	get_stream(TranslationY)[index] = translation.y;
+	get_stream(TranslationZ)[index] = translation.z;
+}
+
+Transform AnimationPose::get(unsigned index) const
+{
+	Transform t;
+	t.scale = vec3(get_stream(ScaleX)[index], get_stream(ScaleY)[index], get_stream(ScaleZ)[index]);
+	t.rotation = quat(get_stream(RotationW)[index], get_stream(RotationX)[index],
+	                  get_stream(RotationY)[index], get_stream(RotationZ)[index]);
+	t.translation = vec3(get_stream(TranslationX)[index], get_stream(TranslationY)[index],
+	                     get_stream(TranslationZ)[index]);
+	return t;
+}
+
+void AnimationPose::load(const Transform * const *transforms, unsigned count_)
+{
+	resize(count_);
+	for (unsigned i = 0; i < count; i++)
+	{
+		set_scale(i, transforms[i]->scale);
+		set_rotation(i, transforms[i]->rotation);
+		set_translation(i, transforms[i]->translation);
+	}
+}
+
+void AnimationPose::store(Transform * const *transforms) const
+{
+	for (unsigned i = 0; i < count; i++)
+		*transforms[i] = get(i);
+}
+
+void AnimationPose::set_weighted(const AnimationPose &pose, float weight)
+{
+	resize(pose.count);
+	for (unsigned stream = 0; stream < StreamCount; stream++)
+	{
+		auto *dst = get_stream(Stream(stream));
+		auto *src = pose.get_stream(Stream(stream));
+		for (unsigned i = 0; i < count; i++)
+			dst[i] = weight * src[i];
+	}
+}
+
+void AnimationPose::accumulate(const AnimationPose &pose, float weight)
+{
+	assert(pose.count == count);
+
+	for (unsigned stream : { ScaleX, ScaleY, ScaleZ, TranslationX, TranslationY, TranslationZ })
+	{
+		auto *dst = get_stream(Stream(stream));
+		auto *src = pose.get_stream(Stream(stream));
+		for (unsigned i = 0; i < count; i++)
+			dst[i] += weight * src[i];
+	}
+
+	auto *dst_x = get_stream(RotationX);
+	auto *dst_y = get_stream(RotationY);
+	auto *dst_z = get_stream(RotationZ);
+	auto *dst_w = get_stream(RotationW);
+	auto *src_x = pose.get_stream(RotationX);
+	auto *src_y = pose.get_stream(RotationY);
+	auto *src_z = pose.get_stream(RotationZ);
+	auto *src_w = pose.get_stream(RotationW);
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		float d = dst_x[i] * src_x[i] + dst_y[i] * src_y[i] + dst_z[i] * src_z[i] + dst_w[i] * src_w[i];
+		float w = d < 0.0f ? -weight : weight;
+		dst_x[i] += w * src_x[i];
+		dst_y[i] += w * src_y[i];
+		dst_z[i] += w * src_z[i];
+		dst_w[i] += w * src_w[i];
+	}
+}
+
+void AnimationPose::normalize(float total_weight)
+{
+	float inv_weight = 1.0f / total_weight;
+	for (unsigned stream : { ScaleX, ScaleY, ScaleZ, TranslationX, TranslationY, TranslationZ })
+	{
+		auto *dst = get_stream(Stream(stream));
+		for (unsigned i = 0; i < count; i++)
+			dst[i] *= inv_weight;
+	}
+
+	auto *x = get_stream(RotationX);
+	auto *y = get_stream(RotationY);
+	auto *z = get_stream(RotationZ);
+	auto *w = get_stream(RotationW);
+	for (unsigned i = 0; i < count; i++)
+	{
+		float inv_len = 1.0f / muglm::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i] + w[i] * w[i]);
+		x[i] *= inv_len;
+		y[i] *= inv_len;
+		z[i] *= inv_len;
+		w[i] *= inv_len;
+	}
+}
+
+void AnimationPose::add_additive(const AnimationPose &pose, const AnimationPose &reference, float weight)
+{
+	assert(pose.count == count && reference.count == count);
+
+	for (unsigned stream : { TranslationX, TranslationY, TranslationZ })
+	{
+		auto *dst = get_stream(Stream(stream));
+		auto *src = pose.get_stream(Stream(stream));
+		auto *ref = reference.get_stream(Stream(stream));
+		for (unsigned i = 0; i < count; i++)
+			dst[i] += weight * (src[i] - ref[i]);
+	}
+
+	for (unsigned stream : { ScaleX, ScaleY, ScaleZ })
+	{
+		auto *dst = get_stream(Stream(stream));
+		auto *src = pose.get_stream(Stream(stream));
+		auto *ref = reference.get_stream(Stream(stream));
+		for (unsigned i = 0; i < count; i++)
+		{
+			float ratio = ref[i] != 0.0f ? src[i] / ref[i] : 1.0f;
+			dst[i] *= 1.0f + weight * (ratio - 1.0f);
+		}
+	}
+
+	auto *dst_x = get_stream(RotationX);
+	auto *dst_y = get_stream(RotationY);
+	auto *dst_z = get_stream(RotationZ);
+	auto *dst_w = get_stream(RotationW);
+	auto *src_x = pose.get_stream(RotationX);
+	auto *src_y = pose.get_stream(RotationY);
+	auto *src_z = pose.get_stream(RotationZ);
+	auto *src_w = pose.get_stream(RotationW);
+	auto *ref_x = reference.get_stream(RotationX);
+	auto *ref_y = reference.get_stream(RotationY);
+	auto *ref_z = reference.get_stream(RotationZ);
+	auto *ref_w = reference.get_stream(RotationW);
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		// delta = pose * conjugate(reference), so that pose = delta * reference.
+		float dx = -src_w[i] * ref_x[i] + src_x[i] * ref_w[i] - src_y[i] * ref_z[i] + src_z[i] * ref_y[i];
+		float dy = -src_w[i] * ref_y[i] + src_x[i] * ref_z[i] + src_y[i] * ref_w[i] - src_z[i] * ref_x[i];
+		float dz = -src_w[i] * ref_z[i] - src_x[i] * ref_y[i] + src_y[i] * ref_x[i] + src_z[i] * ref_w[i];
+		float dw = src_w[i] * ref_w[i] + src_x[i] * ref_x[i] + src_y[i] * ref_y[i] + src_z[i] * ref_z[i];
+
+		// nlerp from identity along the shortest arc.
+		float w = dw < 0.0f ? -weight : weight;
+		dx *= w;
+		dy *= w;
+		dz *= w;
+		dw = (1.0f - weight) + w * dw;
+		float inv_len = 1.0f / muglm::sqrt(dx * dx + dy * dy + dz * dz + dw * dw);
+		dx *= inv_len;
+		dy *= inv_len;
+		dz *= inv_len;
+		dw *= inv_len;
+
+		float x = dst_x[i], y = dst_y[i], z = dst_z[i], qw = dst_w[i];
+		dst_x[i] = dw * x + dx * qw + dy * z - dz * y;
+		dst_y[i] = dw * y - dx * z + dy * qw + dz * x;
+		dst_z[i] = dw * z + dx * y - dy * x + dz * qw;
+		dst_w[i] = dw * qw - dx * x - dy * y - dz * z;
+	}
+}
+
 template <typename T, typename Op>
 static void resample_channel(T *resampled, size_t count, const SceneFormats::AnimationChannel &channel, const Op &op, float inv_frame_rate)
 {
+	unsigned cursor = 0;
 	for (size_t i = 0; i < count; i++)
 	{
 		float t = float(i) * inv_frame_rate;
 		unsigned index;
 		float phase;
 		float dt;
-		channel.get_index_phase(t, index, phase, dt);
+		channel.get_index_phase(t, cursor, index, phase, dt);
 		resampled[i] = op(index, phase, dt);
 	}
 }
@@ -79,6 +280,18 @@ float AnimationUnrolled::get_length() const
 	return length;
 }
 
+size_t AnimationUnrolled::get_memory_usage() const
+{
+	size_t size = 0;
+	for (auto &track : key_frames_rotation)
+		size += track.get_memory_usage();
+	for (auto &track : key_frames_translation)
+		size += track.get_memory_usage();
+	for (auto &track : key_frames_scale)
+		size += track.get_memory_usage();
+	return size;
+}
+
 bool AnimationUnrolled::is_skinned() const
 {
 	return skinning;
@@ -94,11 +307,9 @@ void AnimationUnrolled::animate(Transform *const *transforms, unsigned num_trans
 	if (num_transforms != get_num_channels())
 		throw std::logic_error("Incorrect number of transforms.");
 
-	float sample = offset_time * frame_rate;
-	float low_sample = muglm::floor(sample);
-	int lo = clamp(int(low_sample), 0, int(num_samples) - 1);
-	int hi = muglm::min(lo + 1, int(num_samples) - 1);
-	float l = sample - low_sample;
+	int lo, hi;
+	float l;
+	get_sample_range(offset_time, lo, hi, l);
 
 	for (unsigned i = 0; i < num_transforms; i++)
 	{
@@ -107,27 +318,58 @@ void AnimationUnrolled::animate(Transform *const *transforms, unsigned num_trans
 	}
 }
 
+void AnimationUnrolled::get_sample_range(float offset_time, int &lo, int &hi, float &l) const
+{
+	float sample = offset_time * frame_rate;
+	float low_sample = muglm::floor(sample);
+	lo = clamp(int(low_sample), 0, int(num_samples) - 1);
+	hi = muglm::min(lo + 1, int(num_samples) - 1);
+	l = sample - low_sample;
+}
+
+void AnimationUnrolled::sample(AnimationPose &pose, float offset_time) const
+{
+	assert(pose.size() >= get_num_channels());
+
+	int lo, hi;
+	float l;
+	get_sample_range(offset_time, lo, hi, l);
+
+	unsigned num_channels = get_num_channels();
+	for (unsigned i = 0; i < num_channels; i++)
+	{
+		auto mask = channel_mask[i];
+		if (mask & ROTATION_BIT)
+			pose.set_rotation(i, key_frames_rotation[i].sample(lo, hi, l));
+		if (mask & TRANSLATION_BIT)
+			pose.set_translation(i, key_frames_translation[i].sample(lo, hi, l));
+		if (mask & SCALE_BIT)
+			pose.set_scale(i, key_frames_scale[i].sample(lo, hi, l));
+	}
+}
+
 void AnimationUnrolled::animate_single(Transform &t, unsigned channel, int lo, int hi, float l) const
 {
 	// The animations should be resampled at such a high rate in runtime (e.g. 60 fps)
 	// that doing slerp for rotation is irrelevant.
 	auto mask = channel_mask[channel];
 	if (mask & ROTATION_BIT)
-		t.rotation = normalize(quat(mix(key_frames_rotation[channel][lo].as_vec4(), key_frames_rotation[channel][hi].as_vec4(), l)));
+		t.rotation = key_frames_rotation[channel].sample(lo, hi, l);
 	if (mask & TRANSLATION_BIT)
-		t.translation = mix(key_frames_translation[channel][lo], key_frames_translation[channel][hi], l);
+		t.translation = key_frames_translation[channel].sample(lo, hi, l);
 	if (mask & SCALE_BIT)
-		t.scale = mix(key_frames_scale[channel][lo], key_frames_scale[channel][hi], l);
+		t.scale = key_frames_scale[channel].sample(lo, hi, l);
 }
 
-AnimationUnrolled::AnimationUnrolled(const SceneFormats::Animation &animation, float key_frame_rate)
+AnimationUnrolled::AnimationUnrolled(const SceneFormats::Animation &animation, float key_frame_rate,
+                                     const AnimationCompressionOptions &options)
 {
 	frame_rate = key_frame_rate;
 	inv_frame_rate = 1.0f / key_frame_rate;
 	size_t size = animation.channels.size();
 	key_frames_rotation.reserve(size);
 	key_frames_translation.reserve(size);
-	key_frames_translation.reserve(size);
+	key_frames_scale.reserve(size);
 	multi_node_indices.reserve(size);
 	channel_mask.resize(size);
 
@@ -141,6 +383,10 @@ AnimationUnrolled::AnimationUnrolled(const SceneFormats::Animation &animation, f
 	skinning = animation.skinning;
 	skin_compat = animation.skin_compat;
 
+	// Channels are resampled at full precision first, then packed into their final track format.
+	std::vector<quat> resampled_rotation(num_samples);
+	std::vector<vec3> resampled_vec3(num_samples);
+
 	for (auto &c : animation.channels)
 	{
 		unsigned index;
@@ -162,65 +408,65 @@ AnimationUnrolled::AnimationUnrolled(const SceneFormats::Animation &animation, f
 		switch (c.type)
 		{
 		case SceneFormats::AnimationChannel::Type::CubicScale:
-			key_frames_scale[index].resize(num_samples);
-			resample_channel(key_frames_scale[index].data(), num_samples, c,
+			resample_channel(resampled_vec3.data(), num_samples, c,
 			                 [&c](unsigned i, float t, float dt) {
 				                 return c.positional.sample_spline(i, t, dt);
 			                 }, inv_frame_rate);
+			key_frames_scale[index].build(resampled_vec3.data(), num_samples, options.scale_tolerance);
 			channel_mask[index] |= SCALE_BIT;
 			break;
 
 		case SceneFormats::AnimationChannel::Type::Scale:
-			key_frames_scale[index].resize(num_samples);
-			resample_channel(key_frames_scale[index].data(), num_samples, c,
+			resample_channel(resampled_vec3.data(), num_samples, c,
 			                 [&c](unsigned i, float t, float) {
 				                 return c.positional.sample(i, t);
 			                 }, inv_frame_rate);
+			key_frames_scale[index].build(resampled_vec3.data(), num_samples, options.scale_tolerance);
 			channel_mask[index] |= SCALE_BIT;
 			break;
 
 		case SceneFormats::AnimationChannel::Type::CubicTranslation:
-			key_frames_translation[index].resize(num_samples);
-			resample_channel(key_frames_translation[index].data(), num_samples, c,
+			resample_channel(resampled_vec3.data(), num_samples, c,
 			                 [&c](unsigned i, float t, float dt) {
 				                 return c.positional.sample_spline(i, t, dt);
 			                 }, inv_frame_rate);
+			key_frames_translation[index].build(resampled_vec3.data(), num_samples, options.translation_tolerance);
 			channel_mask[index] |= TRANSLATION_BIT;
 			break;
 
 		case SceneFormats::AnimationChannel::Type::Translation:
-			key_frames_translation[index].resize(num_samples);
-			resample_channel(key_frames_translation[index].data(), num_samples, c,
+			resample_channel(resampled_vec3.data(), num_samples, c,
 			                 [&c](unsigned i, float t, float) {
 				                 return c.positional.sample(i, t);
 			                 }, inv_frame_rate);
+			key_frames_translation[index].build(resampled_vec3.data(), num_samples, options.translation_tolerance);
 			channel_mask[index] |= TRANSLATION_BIT;
 			break;
 
 		case SceneFormats::AnimationChannel::Type::CubicRotation:
-			key_frames_rotation[index].resize(num_samples);
-			resample_channel(key_frames_rotation[index].data(), num_samples, c,
+			resample_channel(resampled_rotation.data(), num_samples, c,
 			                 [&c](unsigned i, float t, float dt) {
 				                 return c.spherical.sample_spline(i, t, dt);
 			                 }, inv_frame_rate);
+			key_frames_rotation[index].build(resampled_rotation.data(), num_samples, options.rotation_tolerance);
 			channel_mask[index] |= ROTATION_BIT;
 			break;
 
 		case SceneFormats::AnimationChannel::Type::Squad:
-			key_frames_rotation[index].resize(num_samples);
-			resample_channel(key_frames_rotation[index].data(), num_samples, c,
+			resample_channel(resampled_rotation.data(), num_samples, c,
 			                 [&c](unsigned i, float t, float) {
 				                 return c.spherical.sample_squad(i, t);
 			                 }, inv_frame_rate);
+			key_frames_rotation[index].build(resampled_rotation.data(), num_samples, options.rotation_tolerance);
 			channel_mask[index] |= ROTATION_BIT;
 			break;
 
 		case SceneFormats::AnimationChannel::Type::Rotation:
-			key_frames_rotation[index].resize(num_samples);
-			resample_channel(key_frames_rotation[index].data(), num_samples, c,
+			resample_channel(resampled_rotation.data(), num_samples, c,
 			                 [&c](unsigned i, float t, float) {
 				                 return c.spherical.sample(i, t);
 			                 }, inv_frame_rate);
+			key_frames_rotation[index].build(resampled_rotation.data(), num_samples, options.rotation_tolerance);
 			channel_mask[index] |= ROTATION_BIT;
 			break;
 		}
@@ -260,7 +506,7 @@ void AnimationSystem::stop_animation(AnimationStateID id)
 	if (!state)
 		return;
 
-	active_animation.erase(state);
+	remove_from_batch(state);
 	if (state->cb)
 		state->cb();
 	animation_state_pool.remove(id);
@@ -269,7 +515,12 @@ void AnimationSystem::stop_animation(AnimationStateID id)
 AnimationID AnimationSystem::register_animation(const std::string &name,
                                                 const SceneFormats::Animation &animation, float key_frame_rate)
 {
-	return register_animation(name, AnimationUnrolled(animation, key_frame_rate));
+	return register_animation(name, AnimationUnrolled(animation, key_frame_rate, compression_options));
+}
+
+void AnimationSystem::set_compression_options(const AnimationCompressionOptions &options)
+{
+	compression_options = options;
 }
 
 AnimationStateID AnimationSystem::start_animation(Node &node, Granite::AnimationID animation_id,
@@ -309,7 +560,7 @@ AnimationStateID AnimationSystem::start_animation(Node &node, Granite::Animation
 
 	auto *state = &animation_state_pool.get(id);
 	state->id = id;
-	active_animation.add(state);
+	add_to_batch(state, &node);
 	return id;
 }
 
@@ -423,10 +674,59 @@ AnimationStateID AnimationSystem::start_animation_multi(NodeHandle *nodes, unsig
 	auto id = animation_state_pool.emplace(*animation, std::move(target_transforms), std::move(target_nodes), start_time);
 	auto *state = &animation_state_pool.get(id);
 	state->id = id;
-	active_animation.add(state);
+	add_to_batch(state, nullptr);
 	return id;
 }
 
+void AnimationSystem::add_to_batch(AnimationState *state, Node *target)
+{
+	AnimationBatch *batch = nullptr;
+	Util::Hash hash = 0;
+
+	if (target)
+	{
+		// A skinned animation drives the bones, not the node itself, so keep those apart.
+		Util::Hasher hasher;
+		hasher.pointer(target);
+		hasher.u32(uint32_t(state->animation.is_skinned()));
+		hash = hasher.get();
+		batch = animation_batch_map.find(hash);
+	}
+
+	if (!batch)
+	{
+		if (target)
+		{
+			batch = animation_batch_map.emplace_yield(hash);
+			batch->target = target;
+		}
+		else
+			batch = animation_batch_map.allocate();
+
+		active_batches.add(batch);
+	}
+
+	batch->layers.push_back(state);
+	state->batch = batch;
+}
+
+void AnimationSystem::remove_from_batch(AnimationState *state)
+{
+	auto *batch = state->batch;
+	auto itr = std::find(batch->layers.begin(), batch->layers.end(), state);
+	if (itr != batch->layers.end())
+		batch->layers.erase(itr);
+
+	if (batch->layers.empty())
+	{
+		active_batches.erase(batch);
+		if (batch->target)
+			animation_batch_map.erase(batch);
+		else
+			animation_batch_map.free(batch);
+	}
+}
+
 void AnimationSystem::set_completion_callback(AnimationStateID id, std::function<void()> cb)
 {
 	auto *state = animation_state_pool.maybe_get(id);
@@ -441,6 +741,20 @@ void AnimationSystem::set_repeating(Granite::AnimationStateID id, bool repeat)
 		state->repeating = repeat;
 }
 
+void AnimationSystem::set_blend_weight(AnimationStateID id, float weight)
+{
+	auto *state = animation_state_pool.maybe_get(id);
+	if (state)
+		state->weight = weight;
+}
+
+void AnimationSystem::set_layer_mode(AnimationStateID id, AnimationLayerMode mode)
+{
+	auto *state = animation_state_pool.maybe_get(id);
+	if (state)
+		state->mode = mode;
+}
+
 void AnimationSystem::set_relative_timing(Granite::AnimationStateID id, bool enable)
 {
 	auto *state = animation_state_pool.maybe_get(id);
@@ -448,10 +762,8 @@ void AnimationSystem::set_relative_timing(Granite::AnimationStateID id, bool ena
 		state->relative_timing = enable;
 }
 
-void AnimationSystem::update(AnimationState *anim, double frame_time, double elapsed_time)
+float AnimationSystem::update_offset(AnimationState *anim, double frame_time, double elapsed_time)
 {
-	bool complete = false;
-
 	double offset;
 	if (anim->relative_timing)
 	{
@@ -464,26 +776,98 @@ void AnimationSystem::update(AnimationState *anim, double frame_time, double ela
 	}
 
 	if (!anim->repeating && offset >= anim->animation.get_length())
-		complete = true;
+		garbage_collect_animations.push(anim);
 
 	if (anim->repeating)
 		offset = mod(offset, double(anim->animation.get_length()));
 
-	if (anim->animation.is_skinned())
+	return float(offset);
+}
+
+struct AnimationBlendScratch
+{
+	AnimationPose base;
+	AnimationPose pose;
+	AnimationPose reference;
+	AnimationPose blended;
+	std::vector<float> offsets;
+};
+static thread_local AnimationBlendScratch animation_blend_scratch;
+
+void AnimationSystem::update(AnimationBatch *batch, double frame_time, double elapsed_time)
+{
+	auto *first = batch->layers.front();
+	Transform * const *transforms;
+	unsigned num_transforms;
+
+	if (first->animation.is_skinned())
 	{
-		auto *node = anim->skinned_node;
-		anim->animation.animate(node->get_skin()->skin.data(), node->get_skin()->skin.size(), float(offset));
-		node->invalidate_cached_transform();
+		auto &skin = first->skinned_node->get_skin()->skin;
+		transforms = skin.data();
+		num_transforms = unsigned(skin.size());
 	}
 	else
 	{
-		anim->animation.animate(anim->channel_transforms.data(), anim->channel_transforms.size(), float(offset));
-		for (auto *node : anim->channel_nodes)
-			node->invalidate_cached_transform();
+		transforms = first->channel_transforms.data();
+		num_transforms = unsigned(first->channel_transforms.size());
 	}
 
-	if (complete)
-		garbage_collect_animations.push(anim);
+	if (batch->layers.size() == 1 && first->mode == AnimationLayerMode::Blend && first->weight > 0.0f)
+	{
+		// Nothing to blend, sample straight into the transforms.
+		first->animation.animate(transforms, num_transforms, update_offset(first, frame_time, elapsed_time));
+	}
+	else
+	{
+		// Channels which a layer does not animate keep their current value.
+		auto &scratch = animation_blend_scratch;
+		scratch.base.load(transforms, num_transforms);
+		scratch.offsets.clear();
+		for (auto *layer : batch->layers)
+			scratch.offsets.push_back(update_offset(layer, frame_time, elapsed_time));
+
+		float total_weight = 0.0f;
+		for (size_t i = 0, n = batch->layers.size(); i < n; i++)
+		{
+			auto *layer = batch->layers[i];
+			if (layer->mode != AnimationLayerMode::Blend || layer->weight <= 0.0f)
+				continue;
+
+			scratch.pose.copy(scratch.base);
+			layer->animation.sample(scratch.pose, scratch.offsets[i]);
+			if (total_weight == 0.0f)
+				scratch.blended.set_weighted(scratch.pose, layer->weight);
+			else
+				scratch.blended.accumulate(scratch.pose, layer->weight);
+			total_weight += layer->weight;
+		}
+
+		if (total_weight > 0.0f)
+			scratch.blended.normalize(total_weight);
+		else
+			scratch.blended.copy(scratch.base);
+
+		for (size_t i = 0, n = batch->layers.size(); i < n; i++)
+		{
+			auto *layer = batch->layers[i];
+			if (layer->mode != AnimationLayerMode::Additive || layer->weight <= 0.0f)
+				continue;
+
+			scratch.pose.copy(scratch.base);
+			scratch.reference.copy(scratch.base);
+			layer->animation.sample(scratch.pose, scratch.offsets[i]);
+			layer->animation.sample(scratch.reference, 0.0f);
+			scratch.blended.add_additive(scratch.pose, scratch.reference, layer->weight);
+		}
+
+		scratch.blended.store(transforms);
+	}
+
+	if (first->animation.is_skinned())
+		first->skinned_node->invalidate_cached_transform();
+	else
+		for (auto *node : first->channel_nodes)
+			node->invalidate_cached_transform();
 }
 
 void AnimationSystem::garbage_collect()
@@ -495,7 +879,7 @@ void AnimationSystem::garbage_collect()
 			auto *state = states[i];
 			if (state->cb)
 				state->cb();
-			active_animation.erase(state);
+			remove_from_batch(state);
 			animation_state_pool.remove(state->id);
 		}
 	});
@@ -504,9 +888,8 @@ void AnimationSystem::garbage_collect()
 
 void AnimationSystem::animate(double frame_time, double elapsed_time)
 {
-	// TODO: Run multithreaded.
-	for (auto *anim : active_animation)
-		update(anim, frame_time, elapsed_time);
+	for (auto *batch : active_batches)
+		update(batch, frame_time, elapsed_time);
 
 	garbage_collect();
 }
@@ -515,12 +898,12 @@ void AnimationSystem::animate(TaskComposer &composer, double frame_time, double
 {
 	auto &group = composer.begin_pipeline_stage();
 	group.set_desc("animation-update");
-	size_t count = active_animation.size();
+	size_t count = active_batches.size();
 	constexpr size_t per_batch = 32;
 	for (size_t i = 0; i < count; i += per_batch)
 	{
 		group.enqueue_task([=]() {
-			auto itr = active_animation.begin() + i;
+			auto itr = active_batches.begin() + i;
 			auto end_itr = itr + std::min(per_batch, count - i);
 			while (itr != end_itr)
 			{
@@ -29,15 +29,89 @@
 #include "unordered_array.hpp"
 #include "small_vector.hpp"
 #include "atomic_append_buffer.hpp"
+#include "animation_track.hpp"
 #include <vector>
 
 namespace Granite
 {
+// Maximum error allowed per key frame component when storing resampled key frames.
+// With a tolerance of 0, storage is lossless and only tracks which never change are collapsed.
+struct AnimationCompressionOptions
+{
+	float rotation_tolerance = 0.0f;
+	float translation_tolerance = 0.0f;
+	float scale_tolerance = 0.0f;
+};
+
+// Local transforms for every channel of an animation, stored as one stream per component,
+// so poses can be blended with straight loops over all channels.
+class AnimationPose
+{
+public:
+	enum Stream
+	{
+		ScaleX,
+		ScaleY,
+		ScaleZ,
+		RotationX,
+		RotationY,
+		RotationZ,
+		RotationW,
+		TranslationX,
+		TranslationY,
+		TranslationZ,
+		StreamCount
+	};
+
+	void resize(unsigned count);
+
+	unsigned size() const
+	{
+		return count;
+	}
+
+	void load(const Transform * const *transforms, unsigned count);
+	void store(Transform * const *transforms) const;
+	void copy(const AnimationPose &pose);
+
+	void set_scale(unsigned index, const vec3 &scale);
+	void set_rotation(unsigned index, const quat &rotation);
+	void set_translation(unsigned index, const vec3 &translation);
+	Transform get(unsigned index) const;
+
+	// this = weight * pose.
+	void set_weighted(const AnimationPose &pose, float weight);
+	// this += weight * pose. Rotations are flipped to the hemisphere of the accumulated rotation.
+	void accumulate(const AnimationPose &pose, float weight);
+	// Resolves accumulated poses. Rotations are renormalized.
+	void normalize(float total_weight);
+	// Applies the difference between pose and reference on top of this pose, scaled by weight.
+	void add_additive(const AnimationPose &pose, const AnimationPose &reference, float weight);
+
+	float *get_stream(Stream stream)
+	{
+		return data.data() + stream * stride;
+	}
+
+	const float *get_stream(Stream stream) const
+	{
+		return data.data() + stream * stride;
+	}
+
+private:
+	std::vector<float> data;
+	unsigned count = 0;
+	unsigned stride = 0;
+};
+
 class AnimationUnrolled : public Util::IntrusiveHashMapEnabled<AnimationUnrolled>
 {
 public:
-	AnimationUnrolled(const SceneFormats::Animation &animation, float key_frame_rate);
+	AnimationUnrolled(const SceneFormats::Animation &animation, float key_frame_rate,
+	                  const AnimationCompressionOptions &options = {});
 	void animate(Transform * const *transforms, unsigned num_transforms, float offset_time) const;
+	// Samples every channel into pose. Channels this animation does not touch are left as-is.
+	void sample(AnimationPose &pose, float offset_time) const;
 
 	unsigned get_num_channels() const;
 
@@ -47,6 +121,9 @@ public:
 
 	float get_length() const;
 
+	// Bytes used for key frame storage.
+	size_t get_memory_usage() const;
+
 private:
 	enum ChannelMask
 	{
@@ -55,9 +132,9 @@ private:
 		SCALE_BIT = 1 << 2
 	};
 
-	std::vector<std::vector<quat>> key_frames_rotation;
-	std::vector<std::vector<vec3>> key_frames_translation;
-	std::vector<std::vector<vec3>> key_frames_scale;
+	std::vector<AnimationTrackQuat> key_frames_rotation;
+	std::vector<AnimationTrackVec3> key_frames_translation;
+	std::vector<AnimationTrackVec3> key_frames_scale;
 	std::vector<uint8_t> channel_mask;
 
 	std::vector<uint32_t> multi_node_indices;
@@ -74,11 +151,20 @@ private:
 	unsigned find_or_allocate_index(uint32_t node_index);
 
 	void animate_single(Transform &transform, unsigned channel, int lo, int hi, float l) const;
+	void get_sample_range(float offset_time, int &lo, int &hi, float &l) const;
 };
 
 using AnimationID = Util::GenerationalHandleID;
 using AnimationStateID = Util::GenerationalHandleID;
 
+enum class AnimationLayerMode
+{
+	// Layers targeting the same node or skeleton are blended by their normalized weights.
+	Blend,
+	// Adds the difference from the first frame of the animation on top of the blended result.
+	Additive
+};
+
 class AnimationSystem
 {
 public:
@@ -91,6 +177,9 @@ public:
 	AnimationID register_animation(const std::string &name, AnimationUnrolled animation);
 	AnimationID get_animation_id_from_name(const std::string &name) const;
 
+	// Applies to animations registered from SceneFormats::Animation after this call.
+	void set_compression_options(const AnimationCompressionOptions &options);
+
 	AnimationStateID start_animation(Node &node, AnimationID id, double start_time);
 	AnimationStateID start_animation_multi(NodeHandle *nodes, unsigned num_nodes, AnimationID id, double start_time);
 	void stop_animation(AnimationStateID id);
@@ -101,8 +190,15 @@ public:
 
 	void set_completion_callback(AnimationStateID id, std::function<void ()> cb);
 
+	// Animations started on the same node or skinned node are evaluated together as layers.
+	// Layers start with a weight of 1, so starting several clips on one target plays an equal blend of them.
+	// Set the weight to 0 for clips which should not contribute yet.
+	void set_blend_weight(AnimationStateID id, float weight);
+	void set_layer_mode(AnimationStateID id, AnimationLayerMode mode);
+
 private:
-	struct AnimationState : Util::IntrusiveUnorderedArrayEnabled
+	struct AnimationBatch;
+	struct AnimationState
 	{
 		AnimationState(const AnimationUnrolled &anim,
 		               Util::SmallVector<Transform *> channel_transforms_,
@@ -114,6 +210,7 @@ private:
 		               double start_time_);
 
 		Node *skinned_node = nullptr;
+		AnimationBatch *batch = nullptr;
 		AnimationStateID id = 0;
 		Util::SmallVector<Transform *> channel_transforms;
 		Util::SmallVector<Node *> channel_nodes;
@@ -121,17 +218,33 @@ private:
 		double start_time = 0.0;
 		bool repeating = false;
 		bool relative_timing = false;
+		AnimationLayerMode mode = AnimationLayerMode::Blend;
+		float weight = 1.0f;
 
 		std::function<void ()> cb;
 	};
 
+	// All layers animating one target, which are sampled, blended and written back by one task.
+	struct AnimationBatch : Util::IntrusiveUnorderedArrayEnabled,
+	                        Util::IntrusiveHashMapEnabled<AnimationBatch>
+	{
+		// Only set when the batch can be shared with later animations on the same node.
+		Node *target = nullptr;
+		Util::SmallVector<AnimationState *> layers;
+	};
+
 	Util::GenerationalHandlePool<AnimationUnrolled> animation_pool;
 	Util::IntrusiveHashMap<Util::IntrusivePODWrapper<AnimationID>> animation_map;
 	Util::GenerationalHandlePool<AnimationState> animation_state_pool;
-	Util::IntrusiveUnorderedArray<AnimationState> active_animation;
+	Util::IntrusiveHashMap<AnimationBatch> animation_batch_map;
+	Util::IntrusiveUnorderedArray<AnimationBatch> active_batches;
 	Util::AtomicAppendBuffer<AnimationState *> garbage_collect_animations;
+	AnimationCompressionOptions compression_options;
 
-	void update(AnimationState *state, double frame_time, double elapsed_time);
+	float update_offset(AnimationState *state, double frame_time, double elapsed_time);
+	void update(AnimationBatch *batch, double frame_time, double elapsed_time);
+	void add_to_batch(AnimationState *state, Node *target);
+	void remove_from_batch(AnimationState *state);
 	void garbage_collect();
 };
 }
\ No newline at end of file
@@ -707,12 +707,13 @@ static SceneFormats::AnimationChannel build_smooth_rail_animation_positional(
 	new_linear_timestamps = build_smooth_rail_animation_timestamps(channel.timestamps, sharpness);
 	new_linear_values.reserve(new_linear_timestamps.size());
 
+	unsigned cursor = 0;
 	for (auto t : new_linear_timestamps)
 	{
 		unsigned index;
 		float phase;
 		float dt;
-		channel.get_index_phase(t, index, phase, dt);
+		channel.get_index_phase(t, cursor, index, phase, dt);
 		new_linear_values.push_back(channel.positional.sample(index, phase));
 	}
 
@@ -774,12 +775,13 @@ static AnimationChannel build_smooth_rail_animation_spherical(const AnimationCha
 	new_linear_timestamps = build_smooth_rail_animation_timestamps(channel.timestamps, sharpness);
 	new_linear_values.reserve(new_linear_timestamps.size());
 
+	unsigned cursor = 0;
 	for (auto t : new_linear_timestamps)
 	{
 		unsigned index;
 		float phase;
 		float dt;
-		channel.get_index_phase(t, index, phase, dt);
+		channel.get_index_phase(t, cursor, index, phase, dt);
 		new_linear_values.push_back(channel.spherical.sample(index, phase));
 	}
 
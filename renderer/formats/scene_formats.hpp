@@ -24,6 +24,7 @@
 
 #include <vector>
 #include <unordered_set>
+#include <algorithm>
 #include <stdint.h>
 #include "mesh.hpp"
 #include "material.hpp"
@@ -70,6 +71,15 @@ struct AnimationChannel
 	}
 
 	void get_index_phase(float t, unsigned &index, float &phase, float &dt) const
+	{
+		unsigned cursor = 0;
+		get_index_phase(t, cursor, index, phase, dt);
+	}
+
+	// Variant for callers which sample the channel with monotonically increasing t.
+	// cursor holds the segment found by the previous call, which is checked along with the next segment
+	// before falling back to a binary search, so a sweep over the channel is linear rather than quadratic.
+	void get_index_phase(float t, unsigned &cursor, unsigned &index, float &phase, float &dt) const
 	{
 		if (t < timestamps.front() || timestamps.size() == 1)
 		{
@@ -86,11 +96,23 @@ struct AnimationChannel
 		}
 		else
 		{
-			unsigned end_target = 0;
-			while (t >= timestamps[end_target])
+			// Find end_target such that timestamps[end_target - 1] <= t < timestamps[end_target].
+			unsigned end_target = cursor + 1;
+			if (end_target < timestamps.size() && timestamps[cursor] <= t && t < timestamps[end_target])
+			{
+				// Same segment as last time.
+			}
+			else if (end_target + 1 < timestamps.size() && timestamps[end_target] <= t && t < timestamps[end_target + 1])
+			{
 				end_target++;
+			}
+			else
+			{
+				end_target = unsigned(std::upper_bound(timestamps.begin(), timestamps.end(), t) - timestamps.begin());
+			}
 
 			index = end_target - 1;
+			cursor = index;
 			phase = (t - timestamps[index]) / (timestamps[end_target] - timestamps[index]);
 			dt = timestamps[index + 1] - timestamps[index];
 		}
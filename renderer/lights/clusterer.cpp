@@ -880,19 +880,14 @@ LightClusterer::gather_bindless_point_shadow_renderables(unsigned index, TaskCom
 
 	if (requires_rendering)
 	{
-		auto &per_face_stage = composer.begin_pipeline_stage();
-
+		// All six faces are culled in one pass, so the scene is only walked once per light.
+		const Frustum *frusta[6];
 		for (unsigned face = 0; face < 6; face++)
-		{
-			TaskComposer face_composer(composer.get_thread_group());
-			face_composer.set_incoming_task(composer.get_pipeline_stage_dependency());
+			frusta[face] = &data->depth_context[face].get_visibility_frustum();
 
-			Threaded::scene_gather_static_shadow_renderables(*scene, face_composer,
-			                                                 data->depth_context[face].get_visibility_frustum(),
-			                                                 data->visibility[face], data->hashes[face], MaxTasks);
-
-			composer.get_thread_group().add_dependency(per_face_stage, *face_composer.get_outgoing_task());
-		}
+		Threaded::scene_gather_static_shadow_renderables_multiview(*scene, composer, frusta, 6,
+		                                                           &data->visibility[0][0], &data->hashes[0][0],
+		                                                           MaxTasks);
 	}
 
 	return data;
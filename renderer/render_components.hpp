@@ -196,6 +196,20 @@ struct CachedTransformComponent : ComponentBase
 	CachedTransform *transform = nullptr;
 };
 
+// Component groups which Scene can mirror in a spatial index.
+enum class SpatialIndexType : unsigned
+{
+	Opaque,
+	Transparent,
+	StaticShadow,
+	DynamicShadow,
+	PositionalLight,
+	VolumetricDiffuseLight,
+	VolumetricDecal,
+	VolumetricFogRegion,
+	Count
+};
+
 struct CachedSpatialTransformTimestampComponent : ComponentBase
 {
 	GRANITE_COMPONENT_TYPE_DECL(CachedSpatialTransformTimestampComponent)
@@ -203,6 +217,9 @@ struct CachedSpatialTransformTimestampComponent : ComponentBase
 	Util::Hash timestamp_hash = 0;
 	const uint32_t *current_timestamp = nullptr;
 	uint32_t last_timestamp = ~0u;
+
+	// Leaf ID + 1 in each of Scene's spatial indices, 0 if not indexed. Owned by SceneSpatialIndex.
+	uint32_t spatial_index_leaves[unsigned(SpatialIndexType::Count)] = {};
 };
 
 struct OpaqueComponent : ComponentBase
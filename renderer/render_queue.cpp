@@ -114,7 +114,7 @@ void RenderQueue::enqueue_queue_data(Queue queue_type, const RenderQueueData &re
 	queues[ecast(queue_type)].raw_input.push_back(render_info);
 }
 
-Util::ThreadSafeObjectPool<RenderQueue::Block> RenderQueue::allocator_pool;
+Util::ThreadCachedObjectPool<RenderQueue::Block> RenderQueue::allocator_pool;
 
 RenderQueue::Block *RenderQueue::insert_block()
 {
@@ -299,7 +299,7 @@ private:
 		}
 	};
 
-	static Util::ThreadSafeObjectPool<Block> allocator_pool;
+	static Util::ThreadCachedObjectPool<Block> allocator_pool;
 
 	static void *allocate_from_block(Block &block, size_t size, size_t alignment);
 	Block *insert_block();
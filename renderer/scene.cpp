@@ -24,8 +24,12 @@
 #include "transforms.hpp"
 #include "lights/lights.hpp"
 #include "simd.hpp"
+#include "simd_cull.hpp"
+#include "simd_transform.hpp"
 #include "task_composer.hpp"
+#include "bitops.hpp"
 #include <limits>
+#include <algorithm>
 
 namespace Granite
 {
@@ -47,6 +51,14 @@ Scene::Scene()
 	  volumetric_decals(pool.get_component_group<VolumetricDecalComponent, CachedSpatialTransformTimestampComponent, RenderInfoComponent>()),
 	  per_frame_updates(pool.get_component_group<PerFrameUpdateComponent>()),
 	  per_frame_update_transforms(pool.get_component_group<PerFrameUpdateTransformComponent, RenderInfoComponent>()),
+	  opaque_index(SpatialIndexType::Opaque),
+	  transparent_index(SpatialIndexType::Transparent),
+	  static_shadowing_index(SpatialIndexType::StaticShadow),
+	  dynamic_shadowing_index(SpatialIndexType::DynamicShadow),
+	  positional_lights_index(SpatialIndexType::PositionalLight),
+	  volumetric_diffuse_lights_index(SpatialIndexType::VolumetricDiffuseLight),
+	  volumetric_decals_index(SpatialIndexType::VolumetricDecal),
+	  volumetric_fog_regions_index(SpatialIndexType::VolumetricFogRegion),
 	  environments(pool.get_component_group<EnvironmentComponent>()),
 	  render_pass_sinks(pool.get_component_group<RenderPassSinkComponent, RenderableComponent, CullPlaneComponent>()),
 	  render_pass_creators(pool.get_component_group<RenderPassComponent>())
@@ -66,39 +78,144 @@ Scene::~Scene()
 }
 
 //wq Ѽɼrenderable
+// World AABBs are packed into SoA form in blocks small enough to stay in L1,
+// then culled in one batch against planes which are only splatted once per block.
+static constexpr size_t GatherCullBlockSize = 256;
+
+struct GatherCullScratch
+{
+	AABBSoA boxes;
+	uint32_t candidates[GatherCullBlockSize];
+	uint32_t visible[GatherCullBlockSize];
+	uint32_t view_masks[GatherCullBlockSize];
+};
+static thread_local GatherCullScratch gather_cull_scratch;
+
 template <typename T, typename Func>
-static void gather_visible_renderables(const Frustum &frustum, VisibilityList &list, const T &objects,
-                                       size_t begin_index, size_t end_index, const Func &filter_func)
+static size_t pack_gather_block(GatherCullScratch &scratch, const T &objects,
+                                size_t block_begin, size_t block_end, const Func &filter_func)
 {
-	for (size_t i = begin_index; i < end_index; i++)
+	if (scratch.boxes.size() < GatherCullBlockSize)
+		scratch.boxes.resize(GatherCullBlockSize);
+
+	size_t num_candidates = 0;
+	for (size_t i = block_begin; i < block_end; i++)
 	{
 		auto &o = objects[i];
 		auto *transform = get_component<RenderInfoComponent>(o);
-
-		auto *renderable = get_component<RenderableComponent>(o);
-		auto flags = renderable->renderable->flags;
+		auto flags = get_component<RenderableComponent>(o)->renderable->flags;
 		if (!filter_func(transform, flags))
 			continue;
 
-		auto *timestamp = get_component<CachedSpatialTransformTimestampComponent>(o);
+		// Objects without a node, or which are forced visible, always pass.
+		if (transform->has_scene_node() && (flags & RENDERABLE_FORCE_VISIBLE_BIT) == 0)
+			scratch.boxes.set(num_candidates, transform->world_aabb);
+		else
+			scratch.boxes.set_unbounded(num_candidates);
+		scratch.candidates[num_candidates++] = uint32_t(i - block_begin);
+	}
 
-		Util::Hasher h;
-		h.u64(timestamp->cookie);
-		h.u32(timestamp->last_timestamp);
+	return num_candidates;
+}
 
-		if (transform->has_scene_node())
+template <typename Tuple>
+static RenderableInfo make_renderable_info(const Tuple &o)
+{
+	auto *transform = get_component<RenderInfoComponent>(o);
+	auto *renderable = get_component<RenderableComponent>(o);
+	auto *timestamp = get_component<CachedSpatialTransformTimestampComponent>(o);
+
+	Util::Hasher h;
+	h.u64(timestamp->cookie);
+	h.u32(timestamp->last_timestamp);
+
+	return { renderable->renderable.get(), transform->has_scene_node() ? transform : nullptr, h.get() };
+}
+
+template <typename T, typename Func>
+static void gather_visible_renderables(const Frustum &frustum, VisibilityList &list, const T &objects,
+                                       size_t begin_index, size_t end_index, const Func &filter_func)
+{
+	auto &scratch = gather_cull_scratch;
+
+	for (size_t block_begin = begin_index; block_begin < end_index; block_begin += GatherCullBlockSize)
+	{
+		size_t block_end = std::min(block_begin + GatherCullBlockSize, end_index);
+		size_t num_candidates = pack_gather_block(scratch, objects, block_begin, block_end, filter_func);
+		size_t num_visible = SIMD::frustum_cull_batch(scratch.boxes, 0, num_candidates,
+		                                              frustum.get_planes(), scratch.visible);
+
+		for (size_t i = 0; i < num_visible; i++)
+			list.push_back(make_renderable_info(objects[block_begin + scratch.candidates[scratch.visible[i]]]));
+	}
+}
+
+// Culls every object once against all views, and appends it to the list of each view it is visible in.
+// The render info (and its hash) is computed once per object rather than once per view.
+template <typename T, typename Func>
+static void gather_visible_renderables_multiview(const Frustum *const *frusta, VisibilityList *const *lists,
+                                                 unsigned num_views, const T &objects,
+                                                 size_t begin_index, size_t end_index, const Func &filter_func)
+{
+	assert(num_views <= SIMD::MaxCullViews);
+	const vec4 *view_planes[SIMD::MaxCullViews];
+	for (unsigned view = 0; view < num_views; view++)
+		view_planes[view] = frusta[view]->get_planes();
+
+	auto &scratch = gather_cull_scratch;
+
+	for (size_t block_begin = begin_index; block_begin < end_index; block_begin += GatherCullBlockSize)
+	{
+		size_t block_end = std::min(block_begin + GatherCullBlockSize, end_index);
+		size_t num_candidates = pack_gather_block(scratch, objects, block_begin, block_end, filter_func);
+		SIMD::frustum_cull_batch_multiview(scratch.boxes, 0, num_candidates,
+		                                   view_planes, num_views, scratch.view_masks);
+
+		for (size_t i = 0; i < num_candidates; i++)
 		{
-			if ((flags & RENDERABLE_FORCE_VISIBLE_BIT) != 0 ||
-			    SIMD::frustum_cull(transform->world_aabb, frustum.get_planes()))
-			{
-				list.push_back({ renderable->renderable.get(), transform, h.get() });
-			}
+			uint32_t mask = scratch.view_masks[i];
+			if (!mask)
+				continue;
+
+			auto info = make_renderable_info(objects[block_begin + scratch.candidates[i]]);
+			Util::for_each_bit(mask, [&](unsigned view) {
+				lists[view]->push_back(info);
+			});
 		}
-		else
-			list.push_back({ renderable->renderable.get(), nullptr, h.get() });
 	}
 }
 
+template <typename Index, typename Func>
+static void gather_indexed_renderables(const Frustum &frustum, VisibilityList &list, const Index &index,
+                                       unsigned subset, unsigned num_subsets, const Func &filter_func)
+{
+	index.gather(frustum, subset, num_subsets, [&](const typename Index::Tuple &o) {
+		auto *transform = get_component<RenderInfoComponent>(o);
+		auto *renderable = get_component<RenderableComponent>(o);
+		if (filter_func(transform, renderable->renderable->flags))
+			list.push_back(make_renderable_info(o));
+	});
+}
+
+template <typename Index, typename Func>
+static void gather_indexed_renderables_multiview(const Frustum *const *frusta, VisibilityList *const *lists,
+                                                 unsigned num_views, const Index &index,
+                                                 unsigned subset, unsigned num_subsets, const Func &filter_func)
+{
+	index.gather_multiview(frusta, num_views, subset, num_subsets,
+	                       [&](const typename Index::Tuple &o, uint32_t view_mask) {
+		auto *transform = get_component<RenderInfoComponent>(o);
+		auto *renderable = get_component<RenderableComponent>(o);
+		if (!filter_func(transform, renderable->renderable->flags))
+			return;
+
+		auto info = make_renderable_info(o);
+		Util::for_each_bit(view_mask, [&](unsigned view) {
+			lists[view]->push_back(info);
+		});
+	});
+}
+
 void Scene::add_render_passes(RenderGraph &graph)
 {
 	for (auto &pass : render_pass_creators)
@@ -244,23 +361,36 @@ static bool filter_true(const RenderInfoComponent *, RenderableFlags)
 	return true;
 }
 
+static bool filter_motion_vectors(const RenderInfoComponent *info, RenderableFlags flags)
+{
+	return (flags & RENDERABLE_IMPLICIT_MOTION_BIT) == 0 && info->requires_motion_vectors;
+}
+
 void Scene::gather_visible_opaque_renderables(const Frustum &frustum, VisibilityList &list) const
 {
-	gather_visible_renderables(frustum, list, opaque, 0, opaque.size(), filter_true);
+	if (spatial_indices_current())
+		gather_indexed_renderables(frustum, list, opaque_index, 0, 1, filter_true);
+	else
+		gather_visible_renderables(frustum, list, opaque, 0, opaque.size(), filter_true);
 }
 
 void Scene::gather_visible_motion_vector_renderables(const Frustum &frustum, VisibilityList &list) const
 {
-	gather_visible_renderables(frustum, list, opaque, 0, opaque.size(),
-	                           [](const RenderInfoComponent *info, RenderableFlags flags) {
-		                           return (flags & RENDERABLE_IMPLICIT_MOTION_BIT) == 0 &&
-		                                  info->requires_motion_vectors;
-	                           });
+	if (spatial_indices_current())
+		gather_indexed_renderables(frustum, list, opaque_index, 0, 1, filter_motion_vectors);
+	else
+		gather_visible_renderables(frustum, list, opaque, 0, opaque.size(), filter_motion_vectors);
 }
 
 void Scene::gather_visible_opaque_renderables_subset(const Frustum &frustum, VisibilityList &list,
                                                      unsigned index, unsigned num_indices) const
 {
+	if (spatial_indices_current())
+	{
+		gather_indexed_renderables(frustum, list, opaque_index, index, num_indices, filter_true);
+		return;
+	}
+
 	size_t start_index = (index * opaque.size()) / num_indices;
 	size_t end_index = ((index + 1) * opaque.size()) / num_indices;
 	gather_visible_renderables(frustum, list, opaque, start_index, end_index, filter_true);
@@ -269,28 +399,42 @@ void Scene::gather_visible_opaque_renderables_subset(const Frustum &frustum, Vis
 void Scene::gather_visible_motion_vector_renderables_subset(const Frustum &frustum, VisibilityList &list,
                                                             unsigned index, unsigned num_indices) const
 {
+	if (spatial_indices_current())
+	{
+		gather_indexed_renderables(frustum, list, opaque_index, index, num_indices, filter_motion_vectors);
+		return;
+	}
+
 	size_t start_index = (index * opaque.size()) / num_indices;
 	size_t end_index = ((index + 1) * opaque.size()) / num_indices;
-	gather_visible_renderables(frustum, list, opaque, start_index, end_index,
-	                           [](const RenderInfoComponent *info, RenderableFlags flags) {
-		                           return (flags & RENDERABLE_IMPLICIT_MOTION_BIT) == 0 &&
-		                                  info->requires_motion_vectors;
-	                           });
+	gather_visible_renderables(frustum, list, opaque, start_index, end_index, filter_motion_vectors);
 }
 
 void Scene::gather_visible_transparent_renderables(const Frustum &frustum, VisibilityList &list) const
 {
-	gather_visible_renderables(frustum, list, transparent, 0, transparent.size(), filter_true);
+	if (spatial_indices_current())
+		gather_indexed_renderables(frustum, list, transparent_index, 0, 1, filter_true);
+	else
+		gather_visible_renderables(frustum, list, transparent, 0, transparent.size(), filter_true);
 }
 
 void Scene::gather_visible_static_shadow_renderables(const Frustum &frustum, VisibilityList &list) const
 {
-	gather_visible_renderables(frustum, list, static_shadowing, 0, static_shadowing.size(), filter_true);
+	if (spatial_indices_current())
+		gather_indexed_renderables(frustum, list, static_shadowing_index, 0, 1, filter_true);
+	else
+		gather_visible_renderables(frustum, list, static_shadowing, 0, static_shadowing.size(), filter_true);
 }
 
 void Scene::gather_visible_transparent_renderables_subset(const Frustum &frustum, VisibilityList &list,
                                                           unsigned index, unsigned num_indices) const
 {
+	if (spatial_indices_current())
+	{
+		gather_indexed_renderables(frustum, list, transparent_index, index, num_indices, filter_true);
+		return;
+	}
+
 	size_t start_index = (index * transparent.size()) / num_indices;
 	size_t end_index = ((index + 1) * transparent.size()) / num_indices;
 	gather_visible_renderables(frustum, list, transparent, start_index, end_index, filter_true);
@@ -299,6 +443,12 @@ void Scene::gather_visible_transparent_renderables_subset(const Frustum &frustum
 void Scene::gather_visible_static_shadow_renderables_subset(const Frustum &frustum, VisibilityList &list,
                                                             unsigned index, unsigned num_indices) const
 {
+	if (spatial_indices_current())
+	{
+		gather_indexed_renderables(frustum, list, static_shadowing_index, index, num_indices, filter_true);
+		return;
+	}
+
 	size_t start_index = (index * static_shadowing.size()) / num_indices;
 	size_t end_index = ((index + 1) * static_shadowing.size()) / num_indices;
 	gather_visible_renderables(frustum, list, static_shadowing, start_index, end_index, filter_true);
@@ -306,7 +456,11 @@ void Scene::gather_visible_static_shadow_renderables_subset(const Frustum &frust
 
 void Scene::gather_visible_dynamic_shadow_renderables(const Frustum &frustum, VisibilityList &list) const
 {
-	gather_visible_renderables(frustum, list, dynamic_shadowing, 0, dynamic_shadowing.size(), filter_true);
+	if (spatial_indices_current())
+		gather_indexed_renderables(frustum, list, dynamic_shadowing_index, 0, 1, filter_true);
+	else
+		gather_visible_renderables(frustum, list, dynamic_shadowing, 0, dynamic_shadowing.size(), filter_true);
+
 	for (auto &object : render_pass_shadowing)
 		list.push_back({ get_component<RenderableComponent>(object)->renderable.get(), nullptr });
 }
@@ -314,15 +468,116 @@ void Scene::gather_visible_dynamic_shadow_renderables(const Frustum &frustum, Vi
 void Scene::gather_visible_dynamic_shadow_renderables_subset(const Frustum &frustum, VisibilityList &list,
                                                              unsigned index, unsigned num_indices) const
 {
-	size_t start_index = (index * dynamic_shadowing.size()) / num_indices;
-	size_t end_index = ((index + 1) * dynamic_shadowing.size()) / num_indices;
-	gather_visible_renderables(frustum, list, dynamic_shadowing, start_index, end_index, filter_true);
+	if (spatial_indices_current())
+	{
+		gather_indexed_renderables(frustum, list, dynamic_shadowing_index, index, num_indices, filter_true);
+	}
+	else
+	{
+		size_t start_index = (index * dynamic_shadowing.size()) / num_indices;
+		size_t end_index = ((index + 1) * dynamic_shadowing.size()) / num_indices;
+		gather_visible_renderables(frustum, list, dynamic_shadowing, start_index, end_index, filter_true);
+	}
 
 	if (index == 0)
 		for (auto &object : render_pass_shadowing)
 			list.push_back({ get_component<RenderableComponent>(object)->renderable.get(), nullptr });
 }
 
+void Scene::gather_visible_opaque_renderables_multiview(const Frustum *const *frusta, VisibilityList *const *lists,
+                                                        unsigned num_views) const
+{
+	gather_visible_opaque_renderables_multiview_subset(frusta, lists, num_views, 0, 1);
+}
+
+void Scene::gather_visible_transparent_renderables_multiview(const Frustum *const *frusta, VisibilityList *const *lists,
+                                                             unsigned num_views) const
+{
+	gather_visible_transparent_renderables_multiview_subset(frusta, lists, num_views, 0, 1);
+}
+
+void Scene::gather_visible_static_shadow_renderables_multiview(const Frustum *const *frusta, VisibilityList *const *lists,
+                                                               unsigned num_views) const
+{
+	gather_visible_static_shadow_renderables_multiview_subset(frusta, lists, num_views, 0, 1);
+}
+
+void Scene::gather_visible_dynamic_shadow_renderables_multiview(const Frustum *const *frusta, VisibilityList *const *lists,
+                                                                unsigned num_views) const
+{
+	gather_visible_dynamic_shadow_renderables_multiview_subset(frusta, lists, num_views, 0, 1);
+}
+
+void Scene::gather_visible_opaque_renderables_multiview_subset(const Frustum *const *frusta, VisibilityList *const *lists,
+                                                               unsigned num_views,
+                                                               unsigned index, unsigned num_indices) const
+{
+	if (spatial_indices_current())
+	{
+		gather_indexed_renderables_multiview(frusta, lists, num_views, opaque_index, index, num_indices, filter_true);
+		return;
+	}
+
+	size_t start_index = (index * opaque.size()) / num_indices;
+	size_t end_index = ((index + 1) * opaque.size()) / num_indices;
+	gather_visible_renderables_multiview(frusta, lists, num_views, opaque, start_index, end_index, filter_true);
+}
+
+void Scene::gather_visible_transparent_renderables_multiview_subset(const Frustum *const *frusta, VisibilityList *const *lists,
+                                                                    unsigned num_views,
+                                                                    unsigned index, unsigned num_indices) const
+{
+	if (spatial_indices_current())
+	{
+		gather_indexed_renderables_multiview(frusta, lists, num_views, transparent_index, index, num_indices, filter_true);
+		return;
+	}
+
+	size_t start_index = (index * transparent.size()) / num_indices;
+	size_t end_index = ((index + 1) * transparent.size()) / num_indices;
+	gather_visible_renderables_multiview(frusta, lists, num_views, transparent, start_index, end_index, filter_true);
+}
+
+void Scene::gather_visible_static_shadow_renderables_multiview_subset(const Frustum *const *frusta, VisibilityList *const *lists,
+                                                                      unsigned num_views,
+                                                                      unsigned index, unsigned num_indices) const
+{
+	if (spatial_indices_current())
+	{
+		gather_indexed_renderables_multiview(frusta, lists, num_views, static_shadowing_index,
+		                                     index, num_indices, filter_true);
+		return;
+	}
+
+	size_t start_index = (index * static_shadowing.size()) / num_indices;
+	size_t end_index = ((index + 1) * static_shadowing.size()) / num_indices;
+	gather_visible_renderables_multiview(frusta, lists, num_views, static_shadowing,
+	                                     start_index, end_index, filter_true);
+}
+
+void Scene::gather_visible_dynamic_shadow_renderables_multiview_subset(const Frustum *const *frusta, VisibilityList *const *lists,
+                                                                       unsigned num_views,
+                                                                       unsigned index, unsigned num_indices) const
+{
+	if (spatial_indices_current())
+	{
+		gather_indexed_renderables_multiview(frusta, lists, num_views, dynamic_shadowing_index,
+		                                     index, num_indices, filter_true);
+	}
+	else
+	{
+		size_t start_index = (index * dynamic_shadowing.size()) / num_indices;
+		size_t end_index = ((index + 1) * dynamic_shadowing.size()) / num_indices;
+		gather_visible_renderables_multiview(frusta, lists, num_views, dynamic_shadowing,
+		                                     start_index, end_index, filter_true);
+	}
+
+	if (index == 0)
+		for (unsigned view = 0; view < num_views; view++)
+			for (auto &object : render_pass_shadowing)
+				lists[view]->push_back({ get_component<RenderableComponent>(object)->renderable.get(), nullptr });
+}
+
 static void gather_positional_lights(const Frustum &frustum, VisibilityList &list,
                                      const ComponentGroupVector<
 		                                     RenderInfoComponent,
@@ -380,9 +635,46 @@ static void gather_positional_lights(const Frustum &frustum, PositionalLightList
 	}
 }
 
+template <typename Index>
+static void gather_indexed_positional_lights(const Frustum &frustum, VisibilityList &list, const Index &index,
+                                             unsigned subset, unsigned num_subsets)
+{
+	index.gather(frustum, subset, num_subsets, [&](const typename Index::Tuple &o) {
+		auto *transform = get_component<RenderInfoComponent>(o);
+		auto *renderable = get_component<RenderableComponent>(o);
+		auto *timestamp = get_component<CachedSpatialTransformTimestampComponent>(o);
+
+		Util::Hasher h;
+		h.u64(timestamp->cookie);
+		h.u32(timestamp->last_timestamp);
+		list.push_back({ renderable->renderable.get(),
+		                 transform->has_scene_node() ? transform : nullptr,
+		                 h.get() });
+	});
+}
+
+template <typename Index>
+static void gather_indexed_positional_lights(const Frustum &frustum, PositionalLightList &list, const Index &index,
+                                             unsigned subset, unsigned num_subsets)
+{
+	index.gather(frustum, subset, num_subsets, [&](const typename Index::Tuple &o) {
+		auto *transform = get_component<RenderInfoComponent>(o);
+		auto *light = get_component<PositionalLightComponent>(o)->light;
+		auto *timestamp = get_component<CachedSpatialTransformTimestampComponent>(o);
+
+		Util::Hasher h;
+		h.u64(timestamp->cookie);
+		h.u32(timestamp->last_timestamp);
+		list.push_back({ light, transform, h.get() });
+	});
+}
+
 void Scene::gather_visible_positional_lights(const Frustum &frustum, VisibilityList &list) const
 {
-	gather_positional_lights(frustum, list, positional_lights, 0, positional_lights.size());
+	if (spatial_indices_current())
+		gather_indexed_positional_lights(frustum, list, positional_lights_index, 0, 1);
+	else
+		gather_positional_lights(frustum, list, positional_lights, 0, positional_lights.size());
 }
 
 void Scene::gather_irradiance_affecting_positional_lights(PositionalLightList &list) const
@@ -402,11 +694,24 @@ void Scene::gather_irradiance_affecting_positional_lights(PositionalLightList &l
 
 void Scene::gather_visible_positional_lights(const Frustum &frustum, PositionalLightList &list) const
 {
-	gather_positional_lights(frustum, list, positional_lights, 0, positional_lights.size());
+	if (spatial_indices_current())
+		gather_indexed_positional_lights(frustum, list, positional_lights_index, 0, 1);
+	else
+		gather_positional_lights(frustum, list, positional_lights, 0, positional_lights.size());
 }
 
 void Scene::gather_visible_volumetric_diffuse_lights(const Frustum &frustum, VolumetricDiffuseLightList &list) const
 {
+	if (spatial_indices_current())
+	{
+		volumetric_diffuse_lights_index.gather(frustum, 0, 1, [&](const auto &o) {
+			auto *light = get_component<VolumetricDiffuseLightComponent>(o);
+			if (light->light.get_volume_view())
+				list.push_back({ light, get_component<RenderInfoComponent>(o) });
+		});
+		return;
+	}
+
 	for (auto &o : volumetric_diffuse_lights)
 	{
 		auto *transform = get_component<RenderInfoComponent>(o);
@@ -427,6 +732,16 @@ void Scene::gather_visible_volumetric_diffuse_lights(const Frustum &frustum, Vol
 
 void Scene::gather_visible_volumetric_decals(const Frustum &frustum, VolumetricDecalList &list) const
 {
+	if (spatial_indices_current())
+	{
+		volumetric_decals_index.gather(frustum, 0, 1, [&](const auto &o) {
+			auto *decal = get_component<VolumetricDecalComponent>(o);
+			if (decal->decal.has_decal_view())
+				list.push_back({ decal, get_component<RenderInfoComponent>(o) });
+		});
+		return;
+	}
+
 	for (auto &o : volumetric_decals)
 	{
 		auto *transform = get_component<RenderInfoComponent>(o);
@@ -447,6 +762,16 @@ void Scene::gather_visible_volumetric_decals(const Frustum &frustum, VolumetricD
 
 void Scene::gather_visible_volumetric_fog_regions(const Frustum &frustum, VolumetricFogRegionList &list) const
 {
+	if (spatial_indices_current())
+	{
+		volumetric_fog_regions_index.gather(frustum, 0, 1, [&](const auto &o) {
+			auto *region = get_component<VolumetricFogRegionComponent>(o);
+			if (region->region.get_volume_view())
+				list.push_back({ region, get_component<RenderInfoComponent>(o) });
+		});
+		return;
+	}
+
 	for (auto &o : volumetric_fog_regions)
 	{
 		auto *transform = get_component<RenderInfoComponent>(o);
@@ -468,6 +793,12 @@ void Scene::gather_visible_volumetric_fog_regions(const Frustum &frustum, Volume
 void Scene::gather_visible_positional_lights_subset(const Frustum &frustum, VisibilityList &list,
                                                     unsigned index, unsigned num_indices) const
 {
+	if (spatial_indices_current())
+	{
+		gather_indexed_positional_lights(frustum, list, positional_lights_index, index, num_indices);
+		return;
+	}
+
 	size_t start_index = (index * positional_lights.size()) / num_indices;
 	size_t end_index = ((index + 1) * positional_lights.size()) / num_indices;
 	gather_positional_lights(frustum, list, positional_lights, start_index, end_index);
@@ -476,6 +807,12 @@ void Scene::gather_visible_positional_lights_subset(const Frustum &frustum, Visi
 void Scene::gather_visible_positional_lights_subset(const Frustum &frustum, PositionalLightList &list,
                                                     unsigned index, unsigned num_indices) const
 {
+	if (spatial_indices_current())
+	{
+		gather_indexed_positional_lights(frustum, list, positional_lights_index, index, num_indices);
+		return;
+	}
+
 	size_t start_index = (index * positional_lights.size()) / num_indices;
 	size_t end_index = ((index + 1) * positional_lights.size()) / num_indices;
 	gather_positional_lights(frustum, list, positional_lights, start_index, end_index);
@@ -574,6 +911,120 @@ void Scene::update_all_transforms()
 	update_transform_tree();
 	update_transform_listener_components();
 	update_cached_transforms_range(0, spatials.size());
+	update_spatial_indices();
+}
+
+void Scene::set_spatial_index_enabled(bool enable)
+{
+	spatial_index_enabled = enable;
+
+	// Disabling frees the indices.
+	if (!enable)
+	{
+		spatial_indices_valid = false;
+		opaque_index.clear();
+		transparent_index.clear();
+		static_shadowing_index.clear();
+		dynamic_shadowing_index.clear();
+		positional_lights_index.clear();
+		volumetric_diffuse_lights_index.clear();
+		volumetric_decals_index.clear();
+		volumetric_fog_regions_index.clear();
+	}
+}
+
+bool Scene::get_spatial_index_enabled() const
+{
+	return spatial_index_enabled;
+}
+
+void Scene::update_spatial_index(SpatialIndexType type)
+{
+	// Objects without a node, or which are forced visible, always pass culling.
+	const auto unbounded_renderable = [](const auto &o) {
+		return !get_component<RenderInfoComponent>(o)->has_scene_node() ||
+		       (get_component<RenderableComponent>(o)->renderable->flags & RENDERABLE_FORCE_VISIBLE_BIT) != 0;
+	};
+
+	const auto unbounded_volume = [](const auto &o) {
+		return !get_component<RenderInfoComponent>(o)->has_scene_node();
+	};
+
+	switch (type)
+	{
+	case SpatialIndexType::Opaque:
+		opaque_index.update(opaque, unbounded_renderable);
+		break;
+	case SpatialIndexType::Transparent:
+		transparent_index.update(transparent, unbounded_renderable);
+		break;
+	case SpatialIndexType::StaticShadow:
+		static_shadowing_index.update(static_shadowing, unbounded_renderable);
+		break;
+	case SpatialIndexType::DynamicShadow:
+		dynamic_shadowing_index.update(dynamic_shadowing, unbounded_renderable);
+		break;
+	case SpatialIndexType::PositionalLight:
+		positional_lights_index.update(positional_lights, unbounded_volume);
+		break;
+	case SpatialIndexType::VolumetricDiffuseLight:
+		volumetric_diffuse_lights_index.update(volumetric_diffuse_lights, unbounded_volume);
+		break;
+	case SpatialIndexType::VolumetricDecal:
+		volumetric_decals_index.update(volumetric_decals, unbounded_volume);
+		break;
+	case SpatialIndexType::VolumetricFogRegion:
+		volumetric_fog_regions_index.update(volumetric_fog_regions, unbounded_volume);
+		break;
+	default:
+		break;
+	}
+}
+
+void Scene::update_spatial_indices()
+{
+	if (!spatial_index_enabled)
+		return;
+
+	spatial_index_structure_version = pool.get_structure_version();
+	for (unsigned i = 0; i < unsigned(SpatialIndexType::Count); i++)
+		update_spatial_index(SpatialIndexType(i));
+	spatial_indices_valid = true;
+}
+
+void Scene::update_spatial_indices(TaskComposer &composer)
+{
+	if (!spatial_index_enabled)
+		return;
+
+	// Gathers fall back to linear scans until every index has been rebuilt.
+	spatial_indices_valid = false;
+	spatial_index_structure_version = pool.get_structure_version();
+	pending_spatial_index_updates = unsigned(SpatialIndexType::Count);
+
+	// Every index only touches its own BVH and its own slot in CachedSpatialTransformTimestampComponent.
+	auto &group = composer.begin_pipeline_stage();
+	group.set_desc("update-spatial-indices");
+	for (unsigned i = 0; i < unsigned(SpatialIndexType::Count); i++)
+	{
+		group.enqueue_task([this, i]() {
+			update_spatial_index(SpatialIndexType(i));
+			if (pending_spatial_index_updates.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				spatial_indices_valid = true;
+		});
+	}
+}
+
+void Scene::invalidate_spatial_indices()
+{
+	spatial_indices_valid = false;
+}
+
+bool Scene::spatial_indices_current() const
+{
+	// Components added or removed behind the Scene's back, e.g. through Entity::free_component(),
+	// leave dangling pointers in the indices, so check the pool as well.
+	return spatial_indices_valid && pool.get_structure_version() == spatial_index_structure_version;
 }
 
 static void perform_update_skinning(Node * const *updates, size_t count)
@@ -877,26 +1328,50 @@ void Scene::distribute_per_level_updates(TaskGroup *group)
 	}
 }
 
-static void update_transform_tree_node(Node &node, const mat4 &transform)
-{
-	node.prev_cached_transform = node.cached_transform;
-	compute_model_transform(node.cached_transform.world_transform,
-	                        node.transform.scale, node.transform.rotation, node.transform.translation,
-	                        transform);
+// Nodes in a level are independent, so they are packed into SoA blocks and transformed in SIMD.
+// Blocks are kept small enough that the packed data stays in L1 between packing and unpacking.
+static constexpr size_t TransformUpdateBlockSize = 64;
 
-	//compute_normal_transform(node.cached_transform.normal_transform, node.cached_transform.world_transform);
-	node.update_timestamp();
-	node.clear_pending_update_no_atomic();
-}
+struct TransformUpdateScratch
+{
+	TransformSoA transforms;
+	const mat4 *parents[TransformUpdateBlockSize];
+	mat4 *worlds[TransformUpdateBlockSize];
+};
+static thread_local TransformUpdateScratch transform_update_scratch;
 
 static void perform_updates(Node * const *updates, size_t count)
 {
-	for (size_t i = 0; i < count; i++)
+	auto &scratch = transform_update_scratch;
+	if (scratch.transforms.size() < TransformUpdateBlockSize)
+		scratch.transforms.resize(TransformUpdateBlockSize);
+
+	for (size_t block_begin = 0; block_begin < count; block_begin += TransformUpdateBlockSize)
 	{
-		auto *update = updates[i];
-		auto *parent = update->get_parent();
-		auto &transform = parent ? parent->cached_transform.world_transform : identity_transform;
-		update_transform_tree_node(*update, transform);
+		size_t block_count = std::min(TransformUpdateBlockSize, count - block_begin);
+		auto *block = updates + block_begin;
+
+		for (size_t i = 0; i < block_count; i++)
+		{
+			auto &node = *block[i];
+			auto *parent = node.get_parent();
+			scratch.transforms.set_local(i, node.transform.scale, node.transform.rotation, node.transform.translation);
+			scratch.parents[i] = parent ? &parent->cached_transform.world_transform : &identity_transform;
+			scratch.worlds[i] = &node.cached_transform.world_transform;
+			node.prev_cached_transform = node.cached_transform;
+		}
+
+		scratch.transforms.set_parents(0, scratch.parents, block_count);
+		SIMD::compute_model_transform_batch(scratch.transforms, 0, block_count);
+		scratch.transforms.get_worlds(0, scratch.worlds, block_count);
+
+		for (size_t i = 0; i < block_count; i++)
+		{
+			auto &node = *block[i];
+			//compute_normal_transform(node.cached_transform.normal_transform, node.cached_transform.world_transform);
+			node.update_timestamp();
+			node.clear_pending_update_no_atomic();
+		}
 	}
 }
 
@@ -981,6 +1456,7 @@ Entity *Scene::create_entity()
 {
 	Entity *entity = pool.create_entity();
 	entities.insert_front(entity);
+	invalidate_spatial_indices();
 	return entity;
 }
 
@@ -990,6 +1466,7 @@ Entity *Scene::create_volumetric_diffuse_light(uvec3 resolution, Node *node)
 {
 	Entity *entity = pool.create_entity();
 	entities.insert_front(entity);
+	invalidate_spatial_indices();
 
 	auto *light = entity->allocate_component<VolumetricDiffuseLightComponent>();
 	light->light.set_resolution(resolution);
@@ -1013,6 +1490,7 @@ Entity *Scene::create_volumetric_fog_region(Node *node)
 {
 	Entity *entity = pool.create_entity();
 	entities.insert_front(entity);
+	invalidate_spatial_indices();
 
 	entity->allocate_component<VolumetricFogRegionComponent>();
 	auto *transform = entity->allocate_component<RenderInfoComponent>();
@@ -1035,6 +1513,7 @@ Entity *Scene::create_volumetric_decal(Node *node)
 {
 	Entity *entity = pool.create_entity();
 	entities.insert_front(entity);
+	invalidate_spatial_indices();
 
 	entity->allocate_component<VolumetricDecalComponent>();
 	auto *transform = entity->allocate_component<RenderInfoComponent>();
@@ -1057,6 +1536,7 @@ Entity *Scene::create_light(const SceneFormats::LightInfo &light, Node *node)
 {
 	Entity *entity = pool.create_entity();
 	entities.insert_front(entity);
+	invalidate_spatial_indices();
 
 	switch (light.type)
 	{
@@ -1112,6 +1592,7 @@ Entity *Scene::create_renderable(AbstractRenderableHandle renderable, Node *node
 {
 	Entity *entity = pool.create_entity();
 	entities.insert_front(entity);
+	invalidate_spatial_indices();
 
 	if (renderable->has_static_aabb())
 	{
@@ -1155,6 +1636,9 @@ Entity *Scene::create_renderable(AbstractRenderableHandle renderable, Node *node
 
 void Scene::destroy_entities(Util::IntrusiveList<Entity> &entity_list)
 {
+	if (!entity_list.empty())
+		invalidate_spatial_indices();
+
 	auto itr = entity_list.begin();
 	while (itr != entity_list.end())
 	{
@@ -1169,6 +1653,7 @@ void Scene::remove_entities_with_component(ComponentType id)
 	// We know ahead of time we're going to delete everything,
 	// so reduce a lot of overhead by deleting right away.
 	pool.reset_groups_for_component_type(id);
+	invalidate_spatial_indices();
 
 	auto itr = entities.begin();
 	while (itr != entities.end())
@@ -1193,11 +1678,42 @@ void Scene::destroy_entity(Entity *entity)
 {
 	if (entity)
 	{
+		invalidate_spatial_indices();
 		entities.erase(entity);
 		entity->get_pool()->delete_entity(entity);
 	}
 }
 
+void Scene::playback_entity_commands(EntityCommandBuffer &buffer)
+{
+	struct Listener : EntityCommandListener
+	{
+		explicit Listener(Scene &scene_)
+			: scene(scene_)
+		{
+		}
+
+		void on_entity_created(Entity &entity) override
+		{
+			scene.entities.insert_front(&entity);
+		}
+
+		bool on_entity_destroy(Entity &entity) override
+		{
+			if (!entity.mark_for_destruction())
+				return false;
+			scene.entities.erase(&entity);
+			return true;
+		}
+
+		Scene &scene;
+	};
+
+	Listener listener(*this);
+	invalidate_spatial_indices();
+	buffer.playback(pool, &listener);
+}
+
 void Scene::queue_destroy_entity(Entity *entity)
 {
 	if (entity->mark_for_destruction())
@@ -23,12 +23,14 @@
 #pragma once
 
 #include "ecs.hpp"
+#include "ecs_command_buffer.hpp"
 #include "render_components.hpp"
 #include "frustum.hpp"
 #include "scene_formats.hpp"
 #include "no_init_pod.hpp"
 #include "thread_group.hpp"
 #include "atomic_append_buffer.hpp"
+#include "scene_spatial_index.hpp"
 #include <atomic>
 
 namespace Granite
@@ -57,8 +59,18 @@ public:
 	void update_transform_tree(TaskComposer &composer);
 	void update_transform_listener_components();
 	void update_cached_transforms_subset(unsigned index, unsigned num_indices);
+	void update_cached_transforms_range(size_t start_index, size_t end_index);
 	size_t get_cached_transforms_count() const;
 
+	// When enabled, gather_visible_* queries go through a BVH per component group instead of a linear scan.
+	// The indices are synchronized by update_spatial_indices(), which must run after cached transforms are updated.
+	// Any structural change to the entity pool, through the Scene or directly on an Entity,
+	// falls back to linear scans until the indices are rebuilt.
+	void set_spatial_index_enabled(bool enable);
+	bool get_spatial_index_enabled() const;
+	void update_spatial_indices();
+	void update_spatial_indices(TaskComposer &composer);
+
 	void gather_visible_opaque_renderables(const Frustum &frustum, VisibilityList &list) const;
 	void gather_visible_motion_vector_renderables(const Frustum &frustum, VisibilityList &list) const;
 	void gather_visible_transparent_renderables(const Frustum &frustum, VisibilityList &list) const;
@@ -86,6 +98,31 @@ public:
 	void gather_visible_positional_lights_subset(const Frustum &frustum, PositionalLightList &list,
 	                                             unsigned index, unsigned num_indices) const;
 
+	// Culls against num_views frusta (at most SIMD::MaxCullViews) in a single walk over the scene,
+	// e.g. for shadow cascades or point light cube faces.
+	// Objects visible in frusta[N] are appended to *lists[N].
+	void gather_visible_opaque_renderables_multiview(const Frustum *const *frusta, VisibilityList *const *lists,
+	                                                 unsigned num_views) const;
+	void gather_visible_transparent_renderables_multiview(const Frustum *const *frusta, VisibilityList *const *lists,
+	                                                      unsigned num_views) const;
+	void gather_visible_static_shadow_renderables_multiview(const Frustum *const *frusta, VisibilityList *const *lists,
+	                                                        unsigned num_views) const;
+	void gather_visible_dynamic_shadow_renderables_multiview(const Frustum *const *frusta, VisibilityList *const *lists,
+	                                                         unsigned num_views) const;
+
+	void gather_visible_opaque_renderables_multiview_subset(const Frustum *const *frusta, VisibilityList *const *lists,
+	                                                        unsigned num_views,
+	                                                        unsigned index, unsigned num_indices) const;
+	void gather_visible_transparent_renderables_multiview_subset(const Frustum *const *frusta, VisibilityList *const *lists,
+	                                                             unsigned num_views,
+	                                                             unsigned index, unsigned num_indices) const;
+	void gather_visible_static_shadow_renderables_multiview_subset(const Frustum *const *frusta, VisibilityList *const *lists,
+	                                                               unsigned num_views,
+	                                                               unsigned index, unsigned num_indices) const;
+	void gather_visible_dynamic_shadow_renderables_multiview_subset(const Frustum *const *frusta, VisibilityList *const *lists,
+	                                                                unsigned num_views,
+	                                                                unsigned index, unsigned num_indices) const;
+
 	size_t get_opaque_renderables_count() const;
 	size_t get_motion_vector_renderables_count() const;
 	size_t get_transparent_renderables_count() const;
@@ -134,6 +171,10 @@ public:
 	void queue_destroy_entity(Entity *entity);
 	void destroy_queued_entities();
 
+	// Applies structural changes which tasks recorded into the buffer, e.g. when spawning from gameplay or streaming.
+	// Destroyed entities are handled like destroy_entity(). Entities which are already queued for destruction are left alone.
+	void playback_entity_commands(EntityCommandBuffer &buffer);
+
 	template <typename T>
 	void remove_entities_with_component()
 	{
@@ -222,6 +263,32 @@ private:
 	ComponentGroupVector<PerFrameUpdateTransformComponent,
 			RenderInfoComponent> per_frame_update_transforms_sorted;
 
+	SceneSpatialIndex<RenderInfoComponent, RenderableComponent,
+			CachedSpatialTransformTimestampComponent, OpaqueComponent> opaque_index;
+	SceneSpatialIndex<RenderInfoComponent, RenderableComponent,
+			CachedSpatialTransformTimestampComponent, TransparentComponent> transparent_index;
+	SceneSpatialIndex<RenderInfoComponent, RenderableComponent,
+			CachedSpatialTransformTimestampComponent, CastsStaticShadowComponent> static_shadowing_index;
+	SceneSpatialIndex<RenderInfoComponent, RenderableComponent,
+			CachedSpatialTransformTimestampComponent, CastsDynamicShadowComponent> dynamic_shadowing_index;
+	SceneSpatialIndex<RenderInfoComponent, RenderableComponent,
+			CachedSpatialTransformTimestampComponent, PositionalLightComponent> positional_lights_index;
+	SceneSpatialIndex<VolumetricDiffuseLightComponent,
+			CachedSpatialTransformTimestampComponent, RenderInfoComponent> volumetric_diffuse_lights_index;
+	SceneSpatialIndex<VolumetricDecalComponent,
+			CachedSpatialTransformTimestampComponent, RenderInfoComponent> volumetric_decals_index;
+	SceneSpatialIndex<VolumetricFogRegionComponent,
+			CachedSpatialTransformTimestampComponent, RenderInfoComponent> volumetric_fog_regions_index;
+	bool spatial_index_enabled = false;
+	// The indices hold component pointers until they are rebuilt. Structural changes made through the Scene
+	// clear the flag, and other changes are caught by comparing the pool's structure version.
+	std::atomic_bool spatial_indices_valid{false};
+	std::atomic_uint pending_spatial_index_updates{0};
+	uint64_t spatial_index_structure_version = 0;
+	void update_spatial_index(SpatialIndexType type);
+	void invalidate_spatial_indices();
+	bool spatial_indices_current() const;
+
 	const ComponentGroupVector<EnvironmentComponent> &environments;
 	const ComponentGroupVector<RenderPassSinkComponent,
 			RenderableComponent,
@@ -231,8 +298,6 @@ private:
 	Util::IntrusiveList<Entity> queued_entities;
 	void destroy_entities(Util::IntrusiveList<Entity> &entity_list);
 
-	void update_cached_transforms_range(size_t start_index, size_t end_index);
-
 	// New transform update system:
 	enum { MaxNodeHierarchyLevels = 32 };
 	void push_pending_node_update(Node *node);
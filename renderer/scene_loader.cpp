@@ -94,6 +94,7 @@ NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subscene)
 
 #if 1
 				auto skin_compat = parser.get_skins()[node.skin].skin_compat;
+				bool first_clip = true;
 				for (auto &animation : parser.get_animations())
 				{
 					if (animation.skin_compat == skin_compat)
@@ -101,6 +102,11 @@ NodeHandle SceneLoader::build_tree_for_subscene(const SubsceneData &subscene)
 						auto animation_id = animation_system->register_animation(animation.name, animation);
 						auto state_id = animation_system->start_animation(*nodeptr, animation_id, 0.0);
 						animation_system->set_repeating(state_id, true);
+						// Clips on the same skeleton are layers of one blend, only the first one drives it.
+						// The others run in lockstep, ready to be faded in with set_blend_weight().
+						if (!first_clip)
+							animation_system->set_blend_weight(state_id, 0.0f);
+						first_clip = false;
 					}
 				}
 #endif
@@ -0,0 +1,164 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "dynamic_bvh.hpp"
+#include "ecs.hpp"
+#include "render_components.hpp"
+#include <vector>
+
+namespace Granite
+{
+// Mirrors a component group in a DynamicBVH, so visibility queries do not have to scan the whole group.
+// The index is synchronized once per frame, after world AABBs have been updated.
+// Objects are tracked through CachedSpatialTransformTimestampComponent:
+// new objects are inserted, objects with a new transform timestamp are moved,
+// and objects which left the group are swept out.
+template <typename... Ts>
+class SceneSpatialIndex
+{
+public:
+	using Tuple = std::tuple<Ts *...>;
+
+	explicit SceneSpatialIndex(SpatialIndexType type_)
+		: type(type_)
+	{
+	}
+
+	// Objects for which is_unbounded(tuple) returns true bypass the BVH and are always gathered.
+	template <typename Func>
+	void update(const ComponentGroupVector<Ts...> &group, const Func &is_unbounded);
+
+	void clear()
+	{
+		bvh.clear();
+		leaves.clear();
+		unbounded.clear();
+	}
+
+	// Calls func(tuple) for every object which intersects the frustum, and every unbounded object.
+	// The work is split over num_indices independent calls, see DynamicBVH::query_frustum_subset.
+	template <typename Func>
+	void gather(const Frustum &frustum, unsigned index, unsigned num_indices, const Func &func) const
+	{
+		if (index == 0)
+			for (auto &tuple : unbounded)
+				func(tuple);
+
+		bvh.query_frustum_subset(frustum, index, num_indices, [&](uint32_t leaf) {
+			func(leaves[leaf].tuple);
+		});
+	}
+
+	// Multi-view variant of gather(). func(tuple, view_mask) is called once per object
+	// visible in at least one of the frusta. Unbounded objects are visible in all views.
+	template <typename Func>
+	void gather_multiview(const Frustum *const *frusta, unsigned num_views, unsigned index, unsigned num_indices,
+	                      const Func &func) const
+	{
+		if (index == 0 && num_views != 0)
+		{
+			uint32_t all_views = num_views == 32 ? ~0u : ((1u << num_views) - 1u);
+			for (auto &tuple : unbounded)
+				func(tuple, all_views);
+		}
+
+		bvh.query_frusta_subset(frusta, num_views, index, num_indices, [&](uint32_t leaf, uint32_t view_mask) {
+			func(leaves[leaf].tuple, view_mask);
+		});
+	}
+
+	const DynamicBVH &get_bvh() const
+	{
+		return bvh;
+	}
+
+private:
+	struct Leaf
+	{
+		Tuple tuple;
+		uint32_t last_timestamp;
+		uint32_t stamp;
+	};
+
+	DynamicBVH bvh;
+	// Indexed by BVH leaf ID.
+	std::vector<Leaf> leaves;
+	std::vector<Tuple> unbounded;
+	uint32_t stamp = 0;
+	SpatialIndexType type;
+};
+
+template <typename... Ts>
+template <typename Func>
+void SceneSpatialIndex<Ts...>::update(const ComponentGroupVector<Ts...> &group, const Func &is_unbounded)
+{
+	stamp++;
+	unbounded.clear();
+	size_t num_indexed = 0;
+	auto slot = unsigned(type);
+
+	for (auto &tuple : group)
+	{
+		if (is_unbounded(tuple))
+		{
+			unbounded.push_back(tuple);
+			continue;
+		}
+
+		auto *timestamp = get_component<CachedSpatialTransformTimestampComponent>(tuple);
+		auto *transform = get_component<RenderInfoComponent>(tuple);
+		uint32_t leaf = timestamp->spatial_index_leaves[slot] - 1;
+
+		// The leaf ID stored in the component may be stale if the object left the group at some point,
+		// so it is only trusted if the leaf still belongs to this component.
+		if (!bvh.is_leaf(leaf) ||
+		    get_component<CachedSpatialTransformTimestampComponent>(leaves[leaf].tuple) != timestamp)
+		{
+			leaf = bvh.insert(transform->world_aabb, 0);
+			if (leaves.size() < bvh.get_node_capacity())
+				leaves.resize(bvh.get_node_capacity());
+			timestamp->spatial_index_leaves[slot] = leaf + 1;
+			leaves[leaf].last_timestamp = timestamp->last_timestamp;
+		}
+		else if (leaves[leaf].last_timestamp != timestamp->last_timestamp)
+		{
+			bvh.move(leaf, transform->world_aabb);
+			leaves[leaf].last_timestamp = timestamp->last_timestamp;
+		}
+
+		leaves[leaf].tuple = tuple;
+		leaves[leaf].stamp = stamp;
+		num_indexed++;
+	}
+
+	// Anything not seen this update has been removed from the group or destroyed.
+	// Components of destroyed entities must not be dereferenced here.
+	if (num_indexed != bvh.get_leaf_count())
+	{
+		for (uint32_t leaf = 0; leaf < uint32_t(leaves.size()); leaf++)
+			if (bvh.is_leaf(leaf) && leaves[leaf].stamp != stamp)
+				bvh.remove(leaf);
+	}
+}
+}
@@ -22,7 +22,11 @@
 
 #include "threaded_scene.hpp"
 #include "render_context.hpp"
+#include "parallel_for.hpp"
+#include "simd_cull.hpp"
 #include <algorithm>
+#include <array>
+#include <assert.h>
 
 namespace Granite
 {
@@ -110,6 +114,64 @@ void scene_gather_dynamic_shadow_renderables(const Scene &scene, TaskComposer &c
 	}
 }
 
+using MultiviewGatherFunc = void (Scene::*)(const Frustum *const *, VisibilityList *const *, unsigned,
+                                            unsigned, unsigned) const;
+
+static void scene_gather_shadow_renderables_multiview(const Scene &scene, TaskComposer &composer, const char *desc,
+                                                      MultiviewGatherFunc gather_func,
+                                                      const Frustum *const *frusta, unsigned num_views,
+                                                      VisibilityList *lists, Util::Hash *transform_hashes,
+                                                      unsigned num_tasks)
+{
+	assert(num_views <= SIMD::MaxCullViews);
+	std::array<const Frustum *, SIMD::MaxCullViews> view_frusta = {};
+	std::copy(frusta, frusta + num_views, view_frusta.begin());
+
+	auto &group = composer.begin_pipeline_stage();
+	group.set_desc(desc);
+	for (unsigned i = 0; i < num_tasks; i++)
+	{
+		group.enqueue_task([view_frusta, num_views, lists, &scene, i, num_tasks, transform_hashes, gather_func]() {
+			VisibilityList *task_lists[SIMD::MaxCullViews];
+			for (unsigned view = 0; view < num_views; view++)
+				task_lists[view] = &lists[view * num_tasks + i];
+
+			(scene.*gather_func)(view_frusta.data(), task_lists, num_views, i, num_tasks);
+
+			if (transform_hashes)
+			{
+				for (unsigned view = 0; view < num_views; view++)
+				{
+					auto &hash = transform_hashes[view * num_tasks + i];
+					hash = 0;
+					for (auto &v : *task_lists[view])
+						hash ^= v.transform_hash;
+				}
+			}
+		});
+	}
+}
+
+void scene_gather_static_shadow_renderables_multiview(const Scene &scene, TaskComposer &composer,
+                                                      const Frustum *const *frusta, unsigned num_views,
+                                                      VisibilityList *lists, Util::Hash *transform_hashes,
+                                                      unsigned num_tasks)
+{
+	scene_gather_shadow_renderables_multiview(scene, composer, "gather-static-shadow-renderables-multiview",
+	                                          &Scene::gather_visible_static_shadow_renderables_multiview_subset,
+	                                          frusta, num_views, lists, transform_hashes, num_tasks);
+}
+
+void scene_gather_dynamic_shadow_renderables_multiview(const Scene &scene, TaskComposer &composer,
+                                                       const Frustum *const *frusta, unsigned num_views,
+                                                       VisibilityList *lists, Util::Hash *transform_hashes,
+                                                       unsigned num_tasks)
+{
+	scene_gather_shadow_renderables_multiview(scene, composer, "gather-dynamic-shadow-renderables-multiview",
+	                                          &Scene::gather_visible_dynamic_shadow_renderables_multiview_subset,
+	                                          frusta, num_views, lists, transform_hashes, num_tasks);
+}
+
 void scene_gather_positional_light_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
                                                VisibilityList *lists, unsigned num_tasks)
 {
@@ -207,22 +269,24 @@ void compose_parallel_push_renderables(TaskComposer &composer, const RenderConte
 	}
 }
 
-void scene_update_cached_transforms(Scene &scene, TaskComposer &composer, unsigned num_tasks)
+void scene_update_cached_transforms(Scene &scene, TaskComposer &composer)
 {
 	auto &group = composer.begin_pipeline_stage();
 	group.set_desc("parallel-update-cached-transforms");
-	for (unsigned i = 0; i < num_tasks; i++)
-	{
-		group.enqueue_task([&scene, num_tasks, i]() {
-			scene.update_cached_transforms_subset(i, num_tasks);
+	// Split at execution time so the range reflects the current spatial count.
+	group.enqueue_task([&scene, h = composer.get_deferred_enqueue_handle()]() mutable {
+		parallel_for_chunked(*h, 0, scene.get_cached_transforms_count(), 0, [&scene](size_t begin, size_t end) {
+			scene.update_cached_transforms_range(begin, end);
 		});
-	}
+	});
 
 	auto &listener_group = composer.begin_pipeline_stage();
 	listener_group.set_desc("parallel-update-transform-listeners");
 	listener_group.enqueue_task([&scene]() {
 		scene.update_transform_listener_components();
 	});
+
+	scene.update_spatial_indices(composer);
 }
 }
 }
@@ -45,6 +45,18 @@ void scene_gather_static_shadow_renderables(const Scene &scene, TaskComposer &co
 void scene_gather_dynamic_shadow_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
                                              VisibilityList *lists, Util::Hash *transform_hashes,
                                              unsigned num_tasks);
+
+// Gathers against several frusta (e.g. cube faces or cascades) in one pass over the scene.
+// lists and transform_hashes are laid out as [num_views][num_tasks].
+void scene_gather_static_shadow_renderables_multiview(const Scene &scene, TaskComposer &composer,
+                                                      const Frustum *const *frusta, unsigned num_views,
+                                                      VisibilityList *lists, Util::Hash *transform_hashes,
+                                                      unsigned num_tasks);
+void scene_gather_dynamic_shadow_renderables_multiview(const Scene &scene, TaskComposer &composer,
+                                                       const Frustum *const *frusta, unsigned num_views,
+                                                       VisibilityList *lists, Util::Hash *transform_hashes,
+                                                       unsigned num_tasks);
+
 void scene_gather_positional_light_renderables(const Scene &scene, TaskComposer &composer, const Frustum &frustum,
                                                VisibilityList *lists, unsigned num_tasks);
 void scene_gather_positional_light_renderables_sorted(const Scene &scene, TaskComposer &composer, const RenderContext &context,
@@ -60,6 +72,6 @@ void compose_parallel_push_renderables(TaskComposer &composer, const RenderConte
                                        RenderQueue *queues, VisibilityList *visibility, unsigned count,
                                        PushType type);
 
-void scene_update_cached_transforms(Scene &scene, TaskComposer &composer, unsigned num_tasks);
+void scene_update_cached_transforms(Scene &scene, TaskComposer &composer);
 }
 }
\ No newline at end of file
@@ -24,6 +24,7 @@
 #include "texture_compression.hpp"
 #include "texture_files.hpp"
 #include "format.hpp"
+#include "parallel_for.hpp"
 #include "muglm/muglm_impl.hpp"
 #include <vector>
 #include <string.h>
@@ -505,100 +506,97 @@ void CompressorState::enqueue_compression_block_rgtc(TaskGroupHandle &group, uns
 	int width = input->get_layout().get_width(level);
 	int height = input->get_layout().get_height(level);
 	int blocks_x = (width + block_size_x - 1) / block_size_x;
-
-	for (int y = 0; y < height; y += block_size_y)
-	{
-		for (int x = 0; x < width; x += block_size_x)
+	int blocks_y = (height + block_size_y - 1) / block_size_y;
+
+	parallel_for(*group, 0, size_t(blocks_x) * size_t(blocks_y), 0, [=, format = args.format](size_t block_index) {
+		int x = int(block_index % blocks_x) * block_size_x;
+		int y = int(block_index / blocks_x) * block_size_y;
+		auto &layout = input->get_layout();
+		uint8_t padded_red[4 * 4];
+		uint8_t padded_green[4 * 4];
+		auto *src = static_cast<const uint8_t *>(layout.data(layer, level));
+		unsigned pixel_stride = layout.get_block_stride();
+
+		const auto get_block_data = [&](int block_size) -> uint8_t * {
+			auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
+			dst += (x / block_size_x) * block_size;
+			dst += (y / block_size_y) * blocks_x * block_size;
+			return dst;
+		};
+
+		const auto get_encode_data = [&](int block_size) -> uint8_t * {
+			return get_block_data(block_size);
+		};
+
+		const auto get_component = [&](int sx, int sy, int c) -> uint8_t {
+			sx = std::min(sx, width - 1);
+			sy = std::min(sy, height - 1);
+			return src[pixel_stride * (sy * width + sx) + c];
+		};
+
+		for (int sy = 0; sy < 4; sy++)
 		{
-			group->enqueue_task([=, format = args.format]() {
-				auto &layout = input->get_layout();
-				uint8_t padded_red[4 * 4];
-				uint8_t padded_green[4 * 4];
-				auto *src = static_cast<const uint8_t *>(layout.data(layer, level));
-				unsigned pixel_stride = layout.get_block_stride();
-
-				const auto get_block_data = [&](int block_size) -> uint8_t * {
-					auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
-					dst += (x / block_size_x) * block_size;
-					dst += (y / block_size_y) * blocks_x * block_size;
-					return dst;
-				};
-
-				const auto get_encode_data = [&](int block_size) -> uint8_t * {
-					return get_block_data(block_size);
-				};
-
-				const auto get_component = [&](int sx, int sy, int c) -> uint8_t {
-					sx = std::min(sx, width - 1);
-					sy = std::min(sy, height - 1);
-					return src[pixel_stride * (sy * width + sx) + c];
-				};
-
-				for (int sy = 0; sy < 4; sy++)
-				{
-					for (int sx = 0; sx < 4; sx++)
-					{
-						padded_red[sy * 4 + sx] = get_component(x + sx, y + sy, 0);
-						if (pixel_stride > 1)
-							padded_green[sy * 4 + sx] = get_component(x + sx, y + sy, 1);
-					}
-				}
+			for (int sx = 0; sx < 4; sx++)
+			{
+				padded_red[sy * 4 + sx] = get_component(x + sx, y + sy, 0);
+				if (pixel_stride > 1)
+					padded_green[sy * 4 + sx] = get_component(x + sx, y + sy, 1);
+			}
+		}
 
-				switch (format)
-				{
-				case VK_FORMAT_BC4_UNORM_BLOCK:
-				{
-					compress_rgtc_red_block(get_encode_data(8), padded_red);
+		switch (format)
+		{
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+		{
+			compress_rgtc_red_block(get_encode_data(8), padded_red);
 
 #ifdef RGTC_DEBUG
-					if (level == 0 && layer == 0)
-					{
-						uint8_t decoded_red[16];
-						decompress_rgtc_red_block(decoded_red, get_encode_data(8));
-						double error = 0.0;
-						for (int i = 0; i < 16; i++)
-							error += double((decoded_red[i] - padded_red[i]) * (decoded_red[i] - padded_red[i])) / (width * height);
-
-						std::lock_guard<std::mutex> l{lock};
-						total_error[0] += error;
-					}
+			if (level == 0 && layer == 0)
+			{
+				uint8_t decoded_red[16];
+				decompress_rgtc_red_block(decoded_red, get_encode_data(8));
+				double error = 0.0;
+				for (int i = 0; i < 16; i++)
+					error += double((decoded_red[i] - padded_red[i]) * (decoded_red[i] - padded_red[i])) / (width * height);
+
+				std::lock_guard<std::mutex> l{lock};
+				total_error[0] += error;
+			}
 #endif
-					break;
-				}
+			break;
+		}
 
-				case VK_FORMAT_BC5_UNORM_BLOCK:
-				{
-					compress_rgtc_red_green_block(get_encode_data(16), padded_red, padded_green);
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+		{
+			compress_rgtc_red_green_block(get_encode_data(16), padded_red, padded_green);
 
 #ifdef RGTC_DEBUG
-					if (level == 0 && layer == 0)
-					{
-						uint8_t decoded_red[16];
-						uint8_t decoded_green[16];
-						decompress_rgtc_red_block(decoded_red, get_encode_data(16));
-						decompress_rgtc_red_block(decoded_green, get_encode_data(16) + 8);
-
-						double error_red = 0.0;
-						double error_green = 0.0;
-						for (int i = 0; i < 16; i++)
-							error_red += double((decoded_red[i] - padded_red[i]) * (decoded_red[i] - padded_red[i])) / (width * height);
-						for (int i = 0; i < 16; i++)
-							error_green += double((decoded_green[i] - padded_green[i]) * (decoded_green[i] - padded_green[i])) / (width * height);
-
-						std::lock_guard<std::mutex> l{lock};
-						total_error[0] += error_red;
-						total_error[1] += error_green;
-					}
+			if (level == 0 && layer == 0)
+			{
+				uint8_t decoded_red[16];
+				uint8_t decoded_green[16];
+				decompress_rgtc_red_block(decoded_red, get_encode_data(16));
+				decompress_rgtc_red_block(decoded_green, get_encode_data(16) + 8);
+
+				double error_red = 0.0;
+				double error_green = 0.0;
+				for (int i = 0; i < 16; i++)
+					error_red += double((decoded_red[i] - padded_red[i]) * (decoded_red[i] - padded_red[i])) / (width * height);
+				for (int i = 0; i < 16; i++)
+					error_green += double((decoded_green[i] - padded_green[i]) * (decoded_green[i] - padded_green[i])) / (width * height);
+
+				std::lock_guard<std::mutex> l{lock};
+				total_error[0] += error_red;
+				total_error[1] += error_green;
+			}
 #endif
-					break;
-				}
+			break;
+		}
 
-				default:
-					break;
-				}
-			});
+		default:
+			break;
 		}
-	}
+	});
 }
 
 #ifdef HAVE_ISPC
@@ -608,121 +606,120 @@ void CompressorState::enqueue_compression_block_ispc(TaskGroupHandle &group, uns
 	int height = input->get_layout().get_height(level);
 	int grid_stride_x = (32 / block_size_x) * block_size_x;
 	int grid_stride_y = (32 / block_size_y) * block_size_y;
+	int grid_x = (width + grid_stride_x - 1) / grid_stride_x;
+	int grid_y = (height + grid_stride_y - 1) / grid_stride_y;
 
-	for (int y = 0; y < height; y += grid_stride_y)
-	{
-		for (int x = 0; x < width; x += grid_stride_x)
-		{
-			group->enqueue_task([=, format = args.format]() {
-				auto &layout = input->get_layout();
-				uint8_t padded_buffer[32 * 32 * 8];
+	// Every grid cell is a decent chunk of work, so allow one cell per task.
+	parallel_for(*group, 0, size_t(grid_x) * size_t(grid_y), 1, [=, format = args.format](size_t cell_index) {
+		int x = int(cell_index % grid_x) * grid_stride_x;
+		int y = int(cell_index / grid_x) * grid_stride_y;
+		auto &layout = input->get_layout();
+		uint8_t padded_buffer[32 * 32 * 8];
 
-				union
-				{
-					u8vec4 splat_buffer8[32 * 32];
-					u16vec4 splat_buffer16[32 * 32];
-				};
-
-				uint8_t encode_buffer[16 * 8 * 8];
-				rgba_surface surface = {};
-
-				assert(layout.get_block_stride() == output_format_to_input_stride(format));
-				surface.ptr = const_cast<uint8_t *>(static_cast<const uint8_t *>(layout.data(layer, level)));
-				surface.width = std::min(width - x, grid_stride_x);
-				surface.height = std::min(height - y, grid_stride_y);
-				surface.stride = width * output_format_to_input_stride(format);
-				surface.ptr += y * surface.stride + x * output_format_to_input_stride(format);
-
-				rgba_surface padded_surface = {};
-
-				int num_blocks_x = (surface.width + block_size_x - 1) / block_size_x;
-				int num_blocks_y = (surface.height + block_size_y - 1) / block_size_y;
-				int blocks_x = (width + block_size_x - 1) / block_size_x;
-
-				const auto get_block_data = [&](int bx, int by, int block_size) -> uint8_t * {
-					auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
-					dst += ((x / block_size_x) + bx) * block_size;
-					dst += ((y / block_size_y) + by) * blocks_x * block_size;
-					return dst;
-				};
-
-				const auto write_encode_data = [&](int block_size) {
-					for (int by = 0; by < num_blocks_y; by++)
-					{
-						for (int bx = 0; bx < num_blocks_x; bx++)
-						{
-							auto *dst = get_block_data(bx, by, block_size);
-							memcpy(dst, &encode_buffer[(by * num_blocks_x + bx) * block_size], block_size);
-						}
-					}
-				};
-
-				if ((surface.width % block_size_x) || (surface.height % block_size_y))
+		union
+		{
+			u8vec4 splat_buffer8[32 * 32];
+			u16vec4 splat_buffer16[32 * 32];
+		};
+
+		uint8_t encode_buffer[16 * 8 * 8];
+		rgba_surface surface = {};
+
+		assert(layout.get_block_stride() == output_format_to_input_stride(format));
+		surface.ptr = const_cast<uint8_t *>(static_cast<const uint8_t *>(layout.data(layer, level)));
+		surface.width = std::min(width - x, grid_stride_x);
+		surface.height = std::min(height - y, grid_stride_y);
+		surface.stride = width * output_format_to_input_stride(format);
+		surface.ptr += y * surface.stride + x * output_format_to_input_stride(format);
+
+		rgba_surface padded_surface = {};
+
+		int num_blocks_x = (surface.width + block_size_x - 1) / block_size_x;
+		int num_blocks_y = (surface.height + block_size_y - 1) / block_size_y;
+		int blocks_x = (width + block_size_x - 1) / block_size_x;
+
+		const auto get_block_data = [&](int bx, int by, int block_size) -> uint8_t * {
+			auto *dst = static_cast<uint8_t *>(output->get_layout().data(layer, level));
+			dst += ((x / block_size_x) + bx) * block_size;
+			dst += ((y / block_size_y) + by) * blocks_x * block_size;
+			return dst;
+		};
+
+		const auto write_encode_data = [&](int block_size) {
+			for (int by = 0; by < num_blocks_y; by++)
+			{
+				for (int bx = 0; bx < num_blocks_x; bx++)
 				{
-					padded_surface.width = num_blocks_x * block_size_x;
-					padded_surface.height = num_blocks_y * block_size_y;
-					padded_surface.stride = padded_surface.width * output_format_to_input_stride(format);
-					padded_surface.ptr = padded_buffer;
-					ReplicateBorders(&padded_surface, &surface, 0, 0, output_format_to_input_stride(format) * 8);
+					auto *dst = get_block_data(bx, by, block_size);
+					memcpy(dst, &encode_buffer[(by * num_blocks_x + bx) * block_size], block_size);
 				}
-				else
-					padded_surface = surface;
+			}
+		};
 
-				switch (format)
-				{
-				case VK_FORMAT_BC6H_UFLOAT_BLOCK:
-				{
-					CompressBlocksBC6H(&padded_surface, encode_buffer, &bc6);
-					write_encode_data(16);
-					break;
-				}
+		if ((surface.width % block_size_x) || (surface.height % block_size_y))
+		{
+			padded_surface.width = num_blocks_x * block_size_x;
+			padded_surface.height = num_blocks_y * block_size_y;
+			padded_surface.stride = padded_surface.width * output_format_to_input_stride(format);
+			padded_surface.ptr = padded_buffer;
+			ReplicateBorders(&padded_surface, &surface, 0, 0, output_format_to_input_stride(format) * 8);
+		}
+		else
+			padded_surface = surface;
 
-				case VK_FORMAT_BC7_SRGB_BLOCK:
-				case VK_FORMAT_BC7_UNORM_BLOCK:
-				{
-					CompressBlocksBC7(&padded_surface, encode_buffer, &bc7);
-					write_encode_data(16);
-					break;
-				}
+		switch (format)
+		{
+		case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+		{
+			CompressBlocksBC6H(&padded_surface, encode_buffer, &bc6);
+			write_encode_data(16);
+			break;
+		}
 
-				case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
-				case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
-				case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
-				case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
-				{
-					CompressBlocksBC1(&padded_surface, encode_buffer);
-					write_encode_data(8);
-					break;
-				}
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+		{
+			CompressBlocksBC7(&padded_surface, encode_buffer, &bc7);
+			write_encode_data(16);
+			break;
+		}
 
-				case VK_FORMAT_BC3_SRGB_BLOCK:
-				case VK_FORMAT_BC3_UNORM_BLOCK:
-				{
-					CompressBlocksBC3(&padded_surface, encode_buffer);
-					write_encode_data(16);
-					break;
-				}
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		{
+			CompressBlocksBC1(&padded_surface, encode_buffer);
+			write_encode_data(8);
+			break;
+		}
 
-				case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
-				case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
-				case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
-				case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
-				case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
-				case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
-				case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
-				case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
-				{
-					CompressBlocksASTC(&padded_surface, encode_buffer, &astc);
-					write_encode_data(16);
-					break;
-				}
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+		{
+			CompressBlocksBC3(&padded_surface, encode_buffer);
+			write_encode_data(16);
+			break;
+		}
 
-				default:
-					break;
-				}
-			});
+		case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+		case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+		case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
+		case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
+		case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+		case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+		case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+		case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+		{
+			CompressBlocksASTC(&padded_surface, encode_buffer, &astc);
+			write_encode_data(16);
+			break;
 		}
-	}
+
+		default:
+			break;
+		}
+	});
 }
 #endif
 
@@ -0,0 +1,210 @@
+#include "animation_system.hpp"
+#include "scene_formats.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include "muglm/muglm_impl.hpp"
+#include <random>
+#include <vector>
+#include <stdlib.h>
+
+using namespace Granite;
+
+// A long motion capture style clip: every node has a rotation, translation and scale channel,
+// with key frames at a jittered, variable rate. Some of the channels do not move at all,
+// which is common for scale and for translation of most joints.
+static SceneFormats::Animation build_animation(unsigned num_nodes, unsigned num_keys, float length)
+{
+	SceneFormats::Animation animation;
+	std::mt19937 rnd(1337);
+	std::uniform_real_distribution<float> uni(-1.0f, 1.0f);
+
+	std::vector<float> timestamps(num_keys);
+	for (unsigned i = 0; i < num_keys; i++)
+		timestamps[i] = length * (float(i) + 0.4f * uni(rnd) * float(i != 0 && i + 1 != num_keys)) / float(num_keys - 1);
+
+	for (unsigned node = 0; node < num_nodes; node++)
+	{
+		float freq = 0.5f + 0.5f * uni(rnd);
+		vec3 axis = normalize(vec3(uni(rnd), uni(rnd), 1.0f));
+		vec3 offset = 10.0f * vec3(uni(rnd), uni(rnd), uni(rnd));
+
+		SceneFormats::AnimationChannel rotation;
+		rotation.node_index = node;
+		rotation.type = SceneFormats::AnimationChannel::Type::Rotation;
+		rotation.timestamps = timestamps;
+		for (auto t : timestamps)
+			rotation.spherical.values.push_back(angleAxis(2.0f * muglm::sin(freq * t), axis).as_vec4());
+		animation.channels.push_back(std::move(rotation));
+
+		SceneFormats::AnimationChannel translation;
+		translation.node_index = node;
+		translation.type = SceneFormats::AnimationChannel::Type::Translation;
+		translation.timestamps = timestamps;
+		for (auto t : timestamps)
+			translation.positional.values.push_back(node & 3 ? offset : offset + vec3(muglm::sin(freq * t), 0.0f, 0.0f));
+		animation.channels.push_back(std::move(translation));
+
+		SceneFormats::AnimationChannel scale;
+		scale.node_index = node;
+		scale.type = SceneFormats::AnimationChannel::Type::Scale;
+		scale.timestamps = timestamps;
+		scale.positional.values.resize(timestamps.size(), vec3(1.0f));
+		animation.channels.push_back(std::move(scale));
+	}
+
+	return animation;
+}
+
+// What get_index_phase() used to do for every sample.
+static unsigned linear_scan_index(const std::vector<float> &timestamps, float t)
+{
+	unsigned end_target = 0;
+	while (t >= timestamps[end_target])
+		end_target++;
+	return end_target - 1;
+}
+
+static void bench_key_lookup(const SceneFormats::AnimationChannel &channel, float frame_rate)
+{
+	unsigned count = unsigned(channel.get_length() * frame_rate);
+	uint64_t checksum[3] = {};
+	double times[3];
+
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned i = 0; i < count; i++)
+	{
+		float t = float(i) / frame_rate;
+		if (t >= channel.timestamps.front() && t < channel.timestamps.back())
+			checksum[0] += linear_scan_index(channel.timestamps, t);
+	}
+	auto end = Util::get_current_time_nsecs();
+	times[0] = 1e-6 * double(end - start);
+
+	start = Util::get_current_time_nsecs();
+	for (unsigned i = 0; i < count; i++)
+	{
+		float t = float(i) / frame_rate;
+		unsigned index;
+		float phase, dt;
+		channel.get_index_phase(t, index, phase, dt);
+		if (t >= channel.timestamps.front() && t < channel.timestamps.back())
+			checksum[1] += index;
+	}
+	end = Util::get_current_time_nsecs();
+	times[1] = 1e-6 * double(end - start);
+
+	start = Util::get_current_time_nsecs();
+	unsigned cursor = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		float t = float(i) / frame_rate;
+		unsigned index;
+		float phase, dt;
+		channel.get_index_phase(t, cursor, index, phase, dt);
+		if (t >= channel.timestamps.front() && t < channel.timestamps.back())
+			checksum[2] += index;
+	}
+	end = Util::get_current_time_nsecs();
+	times[2] = 1e-6 * double(end - start);
+
+	if (checksum[0] != checksum[1] || checksum[0] != checksum[2])
+	{
+		LOGE("Key frame lookup mismatch.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	LOGI("Key lookup, %u keys, %u samples:\n", unsigned(channel.timestamps.size()), count);
+	LOGI("  linear scan:    %8.3f ms\n", times[0]);
+	LOGI("  binary search:  %8.3f ms\n", times[1]);
+	LOGI("  cached cursor:  %8.3f ms\n", times[2]);
+}
+
+static double bench_animate(const AnimationUnrolled &anim, std::vector<Transform> &transforms, unsigned iterations)
+{
+	std::vector<Transform *> ptrs;
+	for (auto &t : transforms)
+		ptrs.push_back(&t);
+
+	std::mt19937 rnd(42);
+	std::uniform_real_distribution<float> uni(0.0f, anim.get_length());
+
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned i = 0; i < iterations; i++)
+		anim.animate(ptrs.data(), unsigned(ptrs.size()), uni(rnd));
+	auto end = Util::get_current_time_nsecs();
+	return 1e-9 * double(end - start);
+}
+
+int main(int argc, char **argv)
+{
+	constexpr float FrameRate = 60.0f;
+	constexpr unsigned Iterations = 20000;
+	unsigned num_nodes = argc >= 2 ? unsigned(strtoul(argv[1], nullptr, 0)) : 64u;
+	float length = argc >= 3 ? float(strtod(argv[2], nullptr)) : 300.0f;
+
+	auto animation = build_animation(num_nodes, unsigned(length * 30.0f), length);
+	bench_key_lookup(animation.channels.front(), FrameRate);
+
+	AnimationCompressionOptions compressed;
+	compressed.rotation_tolerance = 0.0005f;
+	compressed.translation_tolerance = 0.001f;
+	compressed.scale_tolerance = 0.0001f;
+
+	struct Config
+	{
+		const char *desc;
+		AnimationCompressionOptions options;
+	};
+
+	const Config configs[] = {
+		{ "lossless:  ", {} },
+		{ "compressed:", compressed },
+	};
+
+	std::vector<Transform> reference(num_nodes);
+	std::vector<Transform> transforms(num_nodes);
+	std::vector<AnimationUnrolled> unrolled;
+
+	LOGI("%u nodes, %.1f s clip resampled at %.0f fps.\n", num_nodes, length, FrameRate);
+	for (auto &config : configs)
+	{
+		auto start = Util::get_current_time_nsecs();
+		unrolled.emplace_back(animation, FrameRate, config.options);
+		auto end = Util::get_current_time_nsecs();
+
+		auto &anim = unrolled.back();
+		double seconds = bench_animate(anim, transforms, Iterations);
+		double samples = double(Iterations) * double(num_nodes);
+		LOGI("  %s build %8.3f ms, %8.3f MiB, %8.3f M channel samples / s\n", config.desc,
+		     1e-6 * double(end - start), double(anim.get_memory_usage()) / double(1024 * 1024),
+		     1e-6 * samples / seconds);
+	}
+
+	// Compare the two at times in-between key frames.
+	std::vector<Transform *> reference_ptrs, transform_ptrs;
+	for (unsigned i = 0; i < num_nodes; i++)
+	{
+		reference_ptrs.push_back(&reference[i]);
+		transform_ptrs.push_back(&transforms[i]);
+	}
+
+	float max_rotation_error = 0.0f;
+	float max_translation_error = 0.0f;
+	float max_scale_error = 0.0f;
+	for (float t = 0.0f; t < length; t += 0.0371f)
+	{
+		unrolled[0].animate(reference_ptrs.data(), num_nodes, t);
+		unrolled[1].animate(transform_ptrs.data(), num_nodes, t);
+		for (unsigned i = 0; i < num_nodes; i++)
+		{
+			// q and -q are the same rotation.
+			float cos_half_angle = muglm::min(muglm::abs(dot(reference[i].rotation.as_vec4(), transforms[i].rotation.as_vec4())), 1.0f);
+			max_rotation_error = muglm::max(max_rotation_error, 2.0f * muglm::acos(cos_half_angle));
+			max_translation_error = muglm::max(max_translation_error, distance(reference[i].translation, transforms[i].translation));
+			max_scale_error = muglm::max(max_scale_error, distance(reference[i].scale, transforms[i].scale));
+		}
+	}
+
+	LOGI("  max error: rotation %.6f rad, translation %.6f, scale %.6f\n",
+	     max_rotation_error, max_translation_error, max_scale_error);
+}
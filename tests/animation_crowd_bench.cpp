@@ -0,0 +1,376 @@
+#include "animation_system.hpp"
+#include "scene.hpp"
+#include "scene_formats.hpp"
+#include "task_composer.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include "muglm/muglm_impl.hpp"
+#include <random>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <stdlib.h>
+
+using namespace Granite;
+
+static constexpr Util::Hash SkinCompat = 0x1234;
+
+static SceneFormats::Skin build_skin(unsigned num_bones)
+{
+	SceneFormats::Skin skin;
+	skin.skin_compat = SkinCompat;
+	skin.inverse_bind_pose.resize(num_bones, mat4(1.0f));
+	skin.joint_transforms.resize(num_bones);
+	for (unsigned i = 0; i < num_bones; i++)
+		skin.joint_transforms[i].translation = vec3(0.0f, 0.1f, 0.0f);
+
+	// Bone i is a child of bone (i - 1) / 2.
+	std::vector<SceneFormats::Skin::Bone> bones(num_bones);
+	for (unsigned i = 0; i < num_bones; i++)
+		bones[i].index = i;
+	for (unsigned i = num_bones - 1; i > 0; i--)
+		bones[(i - 1) / 2].children.insert(bones[(i - 1) / 2].children.begin(), std::move(bones[i]));
+	skin.skeletons.push_back(std::move(bones[0]));
+	return skin;
+}
+
+static SceneFormats::Animation build_clip(unsigned num_bones, float speed, float amplitude, unsigned seed)
+{
+	constexpr unsigned NumKeys = 31;
+	constexpr float Length = 1.0f;
+	SceneFormats::Animation animation;
+	animation.skinning = true;
+	animation.skin_compat = SkinCompat;
+
+	std::mt19937 rnd(seed);
+	std::uniform_real_distribution<float> uni(-1.0f, 1.0f);
+
+	for (unsigned bone = 0; bone < num_bones; bone++)
+	{
+		vec3 axis = normalize(vec3(uni(rnd), uni(rnd), 1.0f));
+		float phase = uni(rnd);
+
+		SceneFormats::AnimationChannel rotation;
+		rotation.joint = true;
+		rotation.joint_index = bone;
+		rotation.type = SceneFormats::AnimationChannel::Type::Rotation;
+
+		SceneFormats::AnimationChannel translation;
+		translation.joint = true;
+		translation.joint_index = bone;
+		translation.type = SceneFormats::AnimationChannel::Type::Translation;
+
+		for (unsigned key = 0; key < NumKeys; key++)
+		{
+			float t = Length * float(key) / float(NumKeys - 1);
+			float angle = amplitude * muglm::sin(6.2831853f * (speed * t + phase));
+			rotation.timestamps.push_back(t);
+			rotation.spherical.values.push_back(angleAxis(angle, axis).as_vec4());
+			translation.timestamps.push_back(t);
+			translation.positional.values.push_back(vec3(0.0f, 0.1f + 0.01f * angle, 0.0f));
+		}
+
+		animation.channels.push_back(std::move(rotation));
+		animation.channels.push_back(std::move(translation));
+	}
+
+	return animation;
+}
+
+struct Timings
+{
+	double animate = 0.0;
+	double transform_tree = 0.0;
+};
+
+static Timings run_frames(Scene &scene, AnimationSystem &system, ThreadGroup *group, unsigned num_frames)
+{
+	constexpr double FrameTime = 1.0 / 60.0;
+	Timings timings;
+
+	for (unsigned frame = 0; frame < num_frames; frame++)
+	{
+		double elapsed = FrameTime * frame;
+		auto start = Util::get_current_time_nsecs();
+		if (group)
+		{
+			TaskComposer composer(*group);
+			system.animate(composer, FrameTime, elapsed);
+			composer.get_outgoing_task()->wait();
+		}
+		else
+			system.animate(FrameTime, elapsed);
+		auto mid = Util::get_current_time_nsecs();
+
+		// Computes the skinning palettes as well.
+		if (group)
+		{
+			TaskComposer composer(*group);
+			scene.update_transform_tree(composer);
+			composer.get_outgoing_task()->wait();
+		}
+		else
+			scene.update_transform_tree();
+		auto end = Util::get_current_time_nsecs();
+
+		timings.animate += 1e-6 * double(mid - start);
+		timings.transform_tree += 1e-6 * double(end - mid);
+	}
+
+	timings.animate /= num_frames;
+	timings.transform_tree /= num_frames;
+	return timings;
+}
+
+// A blend where the second layer has no weight must match the first clip sampled on its own.
+static bool verify_blend(Node &character, const SceneFormats::Animation &clip, float offset)
+{
+	AnimationUnrolled unrolled(clip, 60.0f);
+	auto &skin = character.get_skin()->skin;
+	std::vector<Transform> expected(skin.size());
+	std::vector<Transform *> expected_ptrs;
+	for (auto &t : expected)
+		expected_ptrs.push_back(&t);
+	unrolled.animate(expected_ptrs.data(), unsigned(expected_ptrs.size()), offset);
+
+	for (size_t i = 0; i < skin.size(); i++)
+	{
+		if (distance(expected[i].translation, skin[i]->translation) > 0.0001f ||
+		    muglm::abs(dot(expected[i].rotation.as_vec4(), skin[i]->rotation.as_vec4())) < 0.9999f)
+		{
+			LOGE("Blended pose mismatch for bone %u.\n", unsigned(i));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct BoneKeys
+{
+	quat rotation[2];
+	vec3 translation[2];
+};
+
+// One key at t = 0 and one at t = 1 per bone.
+static SceneFormats::Animation build_key_clip(const std::vector<BoneKeys> &bones)
+{
+	SceneFormats::Animation animation;
+	animation.skinning = true;
+	animation.skin_compat = SkinCompat;
+
+	for (unsigned bone = 0; bone < bones.size(); bone++)
+	{
+		SceneFormats::AnimationChannel rotation;
+		rotation.joint = true;
+		rotation.joint_index = bone;
+		rotation.type = SceneFormats::AnimationChannel::Type::Rotation;
+
+		SceneFormats::AnimationChannel translation;
+		translation.joint = true;
+		translation.joint_index = bone;
+		translation.type = SceneFormats::AnimationChannel::Type::Translation;
+
+		for (unsigned key = 0; key < 2; key++)
+		{
+			rotation.timestamps.push_back(float(key));
+			rotation.spherical.values.push_back(bones[bone].rotation[key].as_vec4());
+			translation.timestamps.push_back(float(key));
+			translation.positional.values.push_back(bones[bone].translation[key]);
+		}
+
+		animation.channels.push_back(std::move(rotation));
+		animation.channels.push_back(std::move(translation));
+	}
+
+	return animation;
+}
+
+static bool check_bone(const char *desc, const Transform &transform, unsigned bone,
+                       const vec3 &translation, const quat &rotation)
+{
+	if (distance(translation, transform.translation) > 0.0001f ||
+	    muglm::abs(dot(rotation.as_vec4(), transform.rotation.as_vec4())) < 0.9999f)
+	{
+		LOGE("%s: bone %u is T (%.4f, %.4f, %.4f) R (%.4f, %.4f, %.4f, %.4f), "
+		     "expected T (%.4f, %.4f, %.4f) R (%.4f, %.4f, %.4f, %.4f).\n", desc, bone,
+		     transform.translation.x, transform.translation.y, transform.translation.z,
+		     transform.rotation.x, transform.rotation.y, transform.rotation.z, transform.rotation.w,
+		     translation.x, translation.y, translation.z,
+		     rotation.x, rotation.y, rotation.z, rotation.w);
+		return false;
+	}
+
+	return true;
+}
+
+// Checks blending and additive layers against poses worked out by hand on a two bone skeleton.
+static bool verify_layer_math()
+{
+	Scene scene;
+	auto character = scene.create_skinned_node(build_skin(2));
+	auto &skin = character->get_skin()->skin;
+	AnimationSystem system;
+
+	const auto deg = [](float degrees) { return degrees * pi<float>() / 180.0f; };
+	const vec3 x_axis(1.0f, 0.0f, 0.0f);
+	const vec3 z_axis(0.0f, 0.0f, 1.0f);
+	const quat identity(1.0f, 0.0f, 0.0f, 0.0f);
+	const quat rot_z_90 = angleAxis(half_pi<float>(), z_axis);
+	// Same rotation as +60 degrees around Z, but in the opposite hemisphere of identity,
+	// so it must be flipped before it is accumulated.
+	const quat rot_z_60 = angleAxis(pi<float>() / 3.0f, z_axis);
+	const quat rot_z_60_flipped(-rot_z_60.w, -rot_z_60.x, -rot_z_60.y, -rot_z_60.z);
+
+	auto a = system.register_animation("layer-a", build_key_clip({
+		{ { identity, identity }, { vec3(1.0f, 0.0f, 0.0f), vec3(1.0f, 0.0f, 0.0f) } },
+		{ { rot_z_90, rot_z_90 }, { vec3(0.0f), vec3(0.0f) } },
+	}));
+	auto b = system.register_animation("layer-b", build_key_clip({
+		{ { rot_z_60_flipped, rot_z_60_flipped }, { vec3(0.0f, 2.0f, 0.0f), vec3(0.0f, 2.0f, 0.0f) } },
+		{ { identity, identity }, { vec3(0.0f, 0.0f, 4.0f), vec3(0.0f, 0.0f, 4.0f) } },
+	}));
+	// The first frame is not the rest pose, so deltas must be taken relative to it.
+	auto c = system.register_animation("layer-c", build_key_clip({
+		{ { angleAxis(deg(30.0f), x_axis), angleAxis(deg(90.0f), x_axis) },
+		  { vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, 3.0f) } },
+		{ { identity, angleAxis(deg(90.0f), x_axis) }, { vec3(0.0f), vec3(0.0f) } },
+	}));
+
+	// 0.25 * a + 0.75 * b.
+	auto a_id = system.start_animation(*character, a, 0.0);
+	auto b_id = system.start_animation(*character, b, 0.0);
+	system.set_blend_weight(a_id, 0.25f);
+	system.set_blend_weight(b_id, 0.75f);
+	system.animate(0.0, 0.5);
+
+	// Bone 0: 0.25 * (0, 0, 0, 1) + 0.75 * (0, 0, sin 30, cos 30), renormalized.
+	// Bone 1: 0.25 * (0, 0, sin 45, cos 45) + 0.75 * (0, 0, 0, 1), renormalized.
+	quat blend0(normalize(vec4(0.0f, 0.0f, 0.75f * 0.5f, 0.25f + 0.75f * 0.8660254f)));
+	quat blend1(normalize(vec4(0.0f, 0.0f, 0.25f * 0.7071068f, 0.25f * 0.7071068f + 0.75f)));
+	if (!check_bone("2-way blend", *skin[0], 0, vec3(0.25f, 1.5f, 0.0f), blend0) ||
+	    !check_bone("2-way blend", *skin[1], 1, vec3(0.0f, 0.0f, 3.0f), blend1))
+	{
+		return false;
+	}
+
+	system.stop_animation(b_id);
+	system.stop_animation(a_id);
+
+	// a + 0.5 * (c(t) - c(0)). At t = 0.5, c is 60 degrees around X on bone 0, 30 degrees more than its first frame,
+	// and 45 degrees on bone 1. Half of those deltas is 15 and 22.5 degrees, applied before the blended rotation.
+	a_id = system.start_animation(*character, a, 0.0);
+	auto c_id = system.start_animation(*character, c, 0.0);
+	system.set_layer_mode(c_id, AnimationLayerMode::Additive);
+	system.set_blend_weight(c_id, 0.5f);
+	system.animate(0.0, 0.5);
+
+	bool ok = check_bone("additive", *skin[0], 0, vec3(1.0f, 0.0f, 0.5f), angleAxis(deg(15.0f), x_axis)) &&
+	          check_bone("additive", *skin[1], 1, vec3(0.0f), angleAxis(deg(22.5f), x_axis) * rot_z_90);
+
+	system.stop_animation(c_id);
+	system.stop_animation(a_id);
+	if (ok)
+		LOGI("Blend and additive layers match hand-computed poses.\n");
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	constexpr unsigned NumFrames = 60;
+	unsigned num_characters = argc >= 2 ? unsigned(strtoul(argv[1], nullptr, 0)) : 5000u;
+	unsigned num_bones = argc >= 3 ? unsigned(strtoul(argv[2], nullptr, 0)) : 60u;
+
+	if (!verify_layer_math())
+		return EXIT_FAILURE;
+
+	ThreadGroup group;
+	group.start(std::max(1u, std::thread::hardware_concurrency()), 0, {});
+
+	Scene scene;
+	auto skin = build_skin(num_bones);
+	std::vector<NodeHandle> characters;
+	for (unsigned i = 0; i < num_characters; i++)
+		characters.push_back(scene.create_skinned_node(skin));
+
+	auto walk_clip = build_clip(num_bones, 1.0f, 0.3f, 1);
+	auto run_clip = build_clip(num_bones, 2.0f, 0.6f, 2);
+	auto lean_clip = build_clip(num_bones, 0.5f, 0.2f, 3);
+
+	AnimationSystem system;
+	auto walk = system.register_animation("walk", walk_clip);
+	auto run = system.register_animation("run", run_clip);
+	auto lean = system.register_animation("lean", lean_clip);
+
+	std::mt19937 rnd(42);
+	std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+
+	struct Config
+	{
+		const char *desc;
+		bool blend;
+		bool additive;
+	};
+
+	const Config configs[] = {
+		{ "single clip:               ", false, false },
+		{ "2-way blend:               ", true, false },
+		{ "2-way blend + additive:    ", true, true },
+	};
+
+	LOGI("%u characters, %u bones, %u threads.\n", num_characters, num_bones, group.get_num_threads());
+
+	for (auto &config : configs)
+	{
+		std::vector<AnimationStateID> states;
+		for (unsigned i = 0; i < num_characters; i++)
+		{
+			auto &node = *characters[i];
+			auto id = system.start_animation(node, walk, -uni(rnd));
+			system.set_repeating(id, true);
+			states.push_back(id);
+
+			if (config.blend)
+			{
+				id = system.start_animation(node, run, -uni(rnd));
+				system.set_repeating(id, true);
+				system.set_blend_weight(id, i == 0 ? 0.0f : uni(rnd));
+				states.push_back(id);
+			}
+
+			if (config.additive)
+			{
+				id = system.start_animation(node, lean, -uni(rnd));
+				system.set_repeating(id, true);
+				system.set_layer_mode(id, AnimationLayerMode::Additive);
+				system.set_blend_weight(id, 0.5f);
+				states.push_back(id);
+			}
+		}
+
+		auto serial = run_frames(scene, system, nullptr, NumFrames);
+		auto threaded = run_frames(scene, system, &group, NumFrames);
+
+		LOGI("  %s animate %8.3f ms (serial) %8.3f ms (threaded), transforms + palettes %8.3f ms (threaded)\n",
+		     config.desc, serial.animate, threaded.animate, threaded.transform_tree);
+
+		if (config.blend && !config.additive)
+		{
+			// Pose character 0 at a known time, run weight is 0 there.
+			system.stop_animation(states[1]);
+			system.stop_animation(states[0]);
+			auto id = system.start_animation(*characters[0], walk, 0.0);
+			auto run_id = system.start_animation(*characters[0], run, 0.0);
+			system.set_blend_weight(run_id, 0.0f);
+			system.animate(0.0, 0.25);
+			if (!verify_blend(*characters[0], walk_clip, 0.25f))
+				return EXIT_FAILURE;
+			states[0] = id;
+			states[1] = run_id;
+		}
+
+		for (auto id : states)
+			system.stop_animation(id);
+	}
+}
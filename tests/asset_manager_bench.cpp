@@ -0,0 +1,194 @@
+#include "asset_manager.hpp"
+#include "filesystem.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace Granite;
+
+// Measures the CPU cost of AssetManager::iterate() with a large number of registered images,
+// where only a small fraction is used every frame. Instantiation completes right away.
+
+struct InstantInterface final : AssetInstantiatorInterface
+{
+	uint64_t estimate_cost_image_resource(ImageAssetID id, File &) override
+	{
+		return cost_for_id(id);
+	}
+
+	void instantiate_image_resource(AssetManager &manager, TaskGroup *, ImageAssetID id, File &) override
+	{
+		manager.update_cost(id, cost_for_id(id));
+	}
+
+	void release_image_resource(ImageAssetID) override
+	{
+	}
+
+	void set_id_bounds(uint32_t) override
+	{
+	}
+
+	void latch_handles() override
+	{
+	}
+
+	static uint64_t cost_for_id(ImageAssetID id)
+	{
+		return 64 * 1024 << (id.id & 3);
+	}
+};
+
+struct QuietLogger final : Util::LoggingInterface
+{
+	bool log(const char *tag, const char *, va_list) override
+	{
+		return strcmp(tag, "[INFO]: ") == 0;
+	}
+};
+
+// What iterate() used to do every frame, regardless of how much changed.
+struct SortEntry
+{
+	uint64_t pending_consumed;
+	uint64_t consumed;
+	uint64_t last_used;
+	int prio;
+	float importance;
+	uint32_t id;
+};
+
+static double run_full_sort_reference(unsigned num_assets, unsigned iterations)
+{
+	std::mt19937 rnd(1337);
+	std::vector<SortEntry> entries(num_assets);
+	for (unsigned i = 0; i < num_assets; i++)
+		entries[i] = { 0, InstantInterface::cost_for_id({ i }), rnd() % 1000u, 1, 0.0f, i };
+
+	std::vector<SortEntry *> sorted;
+	double total = 0.0;
+	for (unsigned iter = 0; iter < iterations; iter++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		sorted.clear();
+		for (auto &e : entries)
+			sorted.push_back(&e);
+		std::sort(sorted.begin(), sorted.end(), [](const SortEntry *a, const SortEntry *b) -> bool {
+			if (a->prio != b->prio)
+				return a->prio > b->prio;
+			else if (a->importance != b->importance)
+				return a->importance > b->importance;
+			else if (a->last_used != b->last_used)
+				return a->last_used > b->last_used;
+			else if (a->consumed != b->consumed)
+				return a->consumed < b->consumed;
+			else if (a->pending_consumed != b->pending_consumed)
+				return a->pending_consumed > b->pending_consumed;
+			else
+				return a->id < b->id;
+		});
+		auto end = Util::get_current_time_nsecs();
+		total += 1e-6 * double(end - start);
+
+		// A few entries change between frames.
+		for (unsigned i = 0; i < 100; i++)
+			entries[rnd() % num_assets].last_used = 1000 + iter;
+	}
+
+	return total / iterations;
+}
+
+struct Result
+{
+	double avg_ms;
+	double max_ms;
+	uint64_t activations;
+	uint64_t evictions;
+};
+
+static Result run_touch_rate(unsigned num_assets, unsigned touches_per_frame, unsigned num_frames, FileHandle file)
+{
+	AssetManager manager;
+	InstantInterface iface;
+	for (unsigned i = 0; i < num_assets; i++)
+		manager.register_image_resource(file, ImageClass::Color);
+	manager.set_asset_instantiator_interface(&iface);
+
+	// About half of everything fits.
+	manager.set_image_budget(uint64_t(num_assets) * 120 * 1024);
+	manager.set_image_budget_per_iteration(64 * 1024 * 1024);
+
+	// Let everything that fits page in before measuring.
+	uint64_t activations;
+	do
+	{
+		activations = manager.get_streaming_stats().activations;
+		manager.iterate(nullptr);
+	} while (manager.get_streaming_stats().activations != activations);
+
+	std::mt19937 rnd(42);
+	Result result = {};
+	auto start_stats = manager.get_streaming_stats();
+
+	// The working set is a window which slides over the ID space, like a camera moving through a level,
+	// plus a few random uses. Some of the uses come with importance.
+	unsigned window = std::max(1u, touches_per_frame);
+	for (unsigned frame = 0; frame < num_frames; frame++)
+	{
+		unsigned base = (frame * std::max(1u, window / 64)) % num_assets;
+		for (unsigned i = 0; i < touches_per_frame; i++)
+		{
+			ImageAssetID id = { (i & 7) == 0 ? unsigned(rnd() % num_assets) : (base + i) % num_assets };
+			if ((i & 3) == 0)
+				manager.mark_used_resource(id, 1.0f / float(1 + (i & 63)));
+			else
+				manager.mark_used_resource(id);
+		}
+
+		auto start = Util::get_current_time_nsecs();
+		manager.iterate(nullptr);
+		auto end = Util::get_current_time_nsecs();
+		double ms = 1e-6 * double(end - start);
+		result.avg_ms += ms;
+		result.max_ms = std::max(result.max_ms, ms);
+	}
+
+	auto stats = manager.get_streaming_stats();
+	result.avg_ms /= num_frames;
+	result.activations = stats.activations - start_stats.activations;
+	result.evictions = stats.evictions - start_stats.evictions;
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	constexpr unsigned NumFrames = 500;
+	unsigned num_assets = argc >= 2 ? unsigned(strtoul(argv[1], nullptr, 0)) : 200000u;
+
+	// Files are not read, they only need to exist.
+	Filesystem fs;
+	fs.register_protocol("tmp", std::make_unique<ScratchFilesystem>());
+	{ auto f = fs.open_writeonly_mapping("tmp://texture", 1); }
+	auto file = fs.open("tmp://texture");
+
+	LOGI("%u registered images, %u frames.\n", num_assets, NumFrames);
+	LOGI("  full sort per iterate (reference): %8.3f ms\n", run_full_sort_reference(num_assets, 20));
+
+	const unsigned touch_rates[] = { 0, 100, 1000, 10000, 50000 };
+	for (auto touches : touch_rates)
+	{
+		// The manager logs every activation and release.
+		QuietLogger quiet;
+		Util::set_thread_logging_interface(&quiet);
+		auto result = run_touch_rate(num_assets, touches, NumFrames, file);
+		Util::set_thread_logging_interface(nullptr);
+
+		LOGI("  %6u uses / frame: iterate avg %8.3f ms, max %8.3f ms, %7.1f activations / frame, %7.1f evictions / frame\n",
+		     touches, result.avg_ms, result.max_ms,
+		     double(result.activations) / NumFrames, double(result.evictions) / NumFrames);
+	}
+}
@@ -0,0 +1,298 @@
+#include "asset_manager.hpp"
+#include "filesystem.hpp"
+#include "logging.hpp"
+#include "math.hpp"
+#include "muglm/muglm_impl.hpp"
+#include <deque>
+#include <random>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Granite;
+
+// Replays a camera path against the asset manager without a GPU.
+// Textures are owned by objects scattered over a plane, and the "renderer" reports every object in the view cone
+// with its projected size as importance. I/O is simulated as a FIFO queue which completes a fixed number of bytes per frame.
+
+static constexpr uint64_t BytesPerTexel = 1;
+static constexpr float ScreenHeight = 1080.0f;
+static constexpr float ViewDistance = 200.0f;
+static constexpr float CosHalfFov = 0.7f;
+
+struct SimObject
+{
+	vec3 position;
+	float radius;
+	uint32_t num_levels;
+};
+
+static uint64_t level_cost(uint32_t levels)
+{
+	// Level 0 here is the 1x1 mip, level N is 2^N x 2^N.
+	uint64_t cost = 0;
+	for (uint32_t i = 0; i < levels; i++)
+		cost += (uint64_t(1) << (2 * i)) * BytesPerTexel;
+	return cost;
+}
+
+struct SimulatedInstantiator final : AssetInstantiatorInterface
+{
+	struct Request
+	{
+		ImageAssetID id;
+		uint32_t levels;
+		uint64_t remaining;
+	};
+
+	explicit SimulatedInstantiator(const std::vector<SimObject> &objects_, bool mip_streaming_, uint64_t bandwidth_)
+		: objects(objects_), resident(objects_.size()), mip_streaming(mip_streaming_), bandwidth(bandwidth_)
+	{
+	}
+
+	uint64_t estimate_cost_image_resource(ImageAssetID id, File &) override
+	{
+		return level_cost(objects[id.id].num_levels);
+	}
+
+	uint32_t get_num_streaming_levels(ImageAssetID id, File &) override
+	{
+		return mip_streaming ? objects[id.id].num_levels : 1;
+	}
+
+	uint64_t estimate_cost_image_resource_levels(ImageAssetID id, File &file, uint32_t levels) override
+	{
+		return mip_streaming ? level_cost(levels) : estimate_cost_image_resource(id, file);
+	}
+
+	void instantiate_image_resource(AssetManager &, TaskGroup *, ImageAssetID id, File &) override
+	{
+		uint32_t levels = objects[id.id].num_levels;
+		queue.push_back({ id, levels, level_cost(levels) - level_cost(resident[id.id]) });
+	}
+
+	void instantiate_image_resource_levels(AssetManager &manager, TaskGroup *group, ImageAssetID id,
+	                                       File &file, uint32_t levels) override
+	{
+		if (!mip_streaming)
+		{
+			instantiate_image_resource(manager, group, id, file);
+			return;
+		}
+
+		// Only the new level has to be read, the smaller ones are already resident.
+		queue.push_back({ id, levels, level_cost(levels) - level_cost(resident[id.id]) });
+	}
+
+	void release_image_resource(ImageAssetID id) override
+	{
+		resident[id.id] = 0;
+	}
+
+	void release_image_resource_levels(ImageAssetID id, uint32_t levels) override
+	{
+		resident[id.id] = levels;
+	}
+
+	void set_id_bounds(uint32_t) override
+	{
+	}
+
+	void latch_handles() override
+	{
+	}
+
+	// Completes one frame worth of I/O.
+	void pump(AssetManager &manager)
+	{
+		uint64_t budget = bandwidth;
+		while (!queue.empty() && budget)
+		{
+			auto &req = queue.front();
+			uint64_t consumed = std::min(budget, req.remaining);
+			req.remaining -= consumed;
+			budget -= consumed;
+
+			if (!req.remaining)
+			{
+				resident[req.id.id] = req.levels;
+				manager.update_cost(req.id, level_cost(req.levels));
+				queue.pop_front();
+			}
+		}
+	}
+
+	const std::vector<SimObject> &objects;
+	std::vector<uint32_t> resident;
+	std::deque<Request> queue;
+	bool mip_streaming;
+	uint64_t bandwidth;
+};
+
+struct QuietLogger final : Util::LoggingInterface
+{
+	bool log(const char *tag, const char *, va_list) override
+	{
+		return strcmp(tag, "[INFO]: ") == 0;
+	}
+};
+
+static std::vector<vec3> load_camera_path(const char *path)
+{
+	std::vector<vec3> positions;
+	FILE *file = fopen(path, "r");
+	if (!file)
+	{
+		LOGE("Failed to open camera path %s.\n", path);
+		return positions;
+	}
+
+	vec3 p;
+	while (fscanf(file, "%f %f %f", &p.x, &p.y, &p.z) == 3)
+		positions.push_back(p);
+	fclose(file);
+	return positions;
+}
+
+static std::vector<vec3> build_camera_path(unsigned num_frames, float world_size)
+{
+	// A slow figure eight across the world, with a couple of fast turns.
+	std::vector<vec3> positions;
+	for (unsigned i = 0; i < num_frames; i++)
+	{
+		float t = 6.2831853f * float(i) / float(num_frames);
+		positions.push_back(vec3(0.4f * world_size * muglm::sin(t), 2.0f, 0.4f * world_size * muglm::sin(2.0f * t)));
+	}
+	return positions;
+}
+
+struct Config
+{
+	const char *desc;
+	bool importance;
+	bool mip_streaming;
+	uint32_t latency_target;
+};
+
+static void run_config(const Config &config, const std::vector<SimObject> &objects,
+                       const std::vector<vec3> &path, FileHandle file)
+{
+	constexpr uint64_t Budget = 256 * 1024 * 1024;
+	constexpr uint64_t BudgetPerIteration = 32 * 1024 * 1024;
+	constexpr uint64_t Bandwidth = 8 * 1024 * 1024;
+
+	AssetManager manager;
+	SimulatedInstantiator iface(objects, config.mip_streaming, Bandwidth);
+	for (size_t i = 0; i < objects.size(); i++)
+		manager.register_image_resource(file, ImageClass::Color);
+	manager.set_asset_instantiator_interface(&iface);
+	manager.set_image_budget(Budget);
+	manager.set_image_budget_per_iteration(BudgetPerIteration);
+	manager.set_streaming_latency_target(config.latency_target);
+
+	double missing_levels = 0.0;
+	double total_importance = 0.0;
+	double resolved_importance = 0.0;
+	uint64_t visible_count = 0;
+	uint64_t resolved_count = 0;
+	uint64_t peak_pending = 0;
+
+	// The manager logs every activation and release.
+	QuietLogger quiet;
+	Util::set_thread_logging_interface(&quiet);
+
+	for (size_t frame = 0; frame < path.size(); frame++)
+	{
+		iface.pump(manager);
+
+		vec3 pos = path[frame];
+		vec3 dir = normalize(path[frame + 1 < path.size() ? frame + 1 : 0] - pos + vec3(0.0f, 0.0f, 1e-6f));
+
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			auto &o = objects[i];
+			vec3 to_object = o.position - pos;
+			float dist = length(to_object);
+			if (dist > ViewDistance || dot(to_object, dir) < CosHalfFov * dist)
+				continue;
+
+			float importance = o.radius / muglm::max(dist, 1.0f);
+
+			// The mip level which matches the projected size is what we'd want resident.
+			float projected = importance * ScreenHeight;
+			auto wanted = uint32_t(muglm::clamp(muglm::ceil(muglm::log2(muglm::max(projected, 1.0f))) + 1.0f,
+			                                    1.0f, float(o.num_levels)));
+
+			ImageAssetID id = { uint32_t(i) };
+			if (config.importance)
+				manager.mark_used_resource(id, importance, wanted);
+			else
+				manager.mark_used_resource(id);
+
+			uint32_t have = iface.resident[i];
+			missing_levels += wanted > have ? wanted - have : 0;
+			resolved_count += have >= wanted;
+			visible_count++;
+			total_importance += importance;
+			if (have >= wanted)
+				resolved_importance += importance;
+		}
+
+		manager.iterate(nullptr);
+		peak_pending = std::max(peak_pending, manager.get_streaming_stats().pending_bytes);
+	}
+
+	Util::set_thread_logging_interface(nullptr);
+
+	auto stats = manager.get_streaming_stats();
+	LOGI("%s\n", config.desc);
+	LOGI("  visible textures at wanted resolution: %6.2f %% (%6.2f %% weighted by importance)\n",
+	     100.0 * double(resolved_count) / double(std::max<uint64_t>(visible_count, 1)),
+	     100.0 * resolved_importance / muglm::max(total_importance, 1e-6));
+	LOGI("  missing levels per visible texture: %.3f\n", missing_levels / double(std::max<uint64_t>(visible_count, 1)));
+	LOGI("  resident %7.1f MiB, peak pending %7.1f MiB, activated %8.1f MiB in %u activations\n",
+	     double(stats.resident_bytes) / (1024.0 * 1024.0), double(peak_pending) / (1024.0 * 1024.0),
+	     double(stats.activated_bytes) / (1024.0 * 1024.0), unsigned(stats.activations));
+	LOGI("  evictions %u (%.1f MiB), stalls %u, throttled iterations %u, throughput %.2f MiB / iteration\n",
+	     unsigned(stats.evictions), double(stats.evicted_bytes) / (1024.0 * 1024.0), unsigned(stats.stalls),
+	     unsigned(stats.throttled_iterations), double(stats.throughput_per_iteration) / (1024.0 * 1024.0));
+}
+
+int main(int argc, char **argv)
+{
+	constexpr unsigned NumObjects = 4096;
+	constexpr float WorldSize = 1000.0f;
+
+	// The camera path is one "x y z" position per frame.
+	auto path = argc >= 2 ? load_camera_path(argv[1]) : build_camera_path(3600, WorldSize);
+	if (path.empty())
+		return EXIT_FAILURE;
+
+	std::mt19937 rnd(1337);
+	std::uniform_real_distribution<float> uni(-0.5f, 0.5f);
+	std::vector<SimObject> objects(NumObjects);
+	for (auto &o : objects)
+	{
+		o.position = vec3(WorldSize * uni(rnd), 0.0f, WorldSize * uni(rnd));
+		o.radius = 3.0f + 5.0f * uni(rnd);
+		o.num_levels = 9 + rnd() % 5;
+	}
+
+	// The simulated instantiator does not read files, they only need to exist.
+	Filesystem fs;
+	fs.register_protocol("tmp", std::make_unique<ScratchFilesystem>());
+	{ auto f = fs.open_writeonly_mapping("tmp://texture", 1); }
+	auto file = fs.open("tmp://texture");
+
+	const Config configs[] = {
+		{ "LRU, whole images:", false, false, 0 },
+		{ "importance, whole images:", true, false, 0 },
+		{ "importance, mip streaming:", true, true, 0 },
+		{ "importance, mip streaming, I/O throttle:", true, true, 4 },
+	};
+
+	LOGI("%u textures, %u frames.\n", NumObjects, unsigned(path.size()));
+	for (auto &config : configs)
+		run_config(config, objects, path, file);
+}
@@ -0,0 +1,181 @@
+#include "filesystem.hpp"
+#include "os_filesystem.hpp"
+#include "thread_group.hpp"
+#include "path_utils.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+using namespace Granite;
+
+// Loads every file in a directory, e.g. a glTF scene with its buffers and textures.
+// Without a directory argument, a synthetic scene is generated: one large geometry buffer and many textures.
+// Page cache is dropped for every file before each run, so all runs start cold.
+
+struct SceneFile
+{
+	std::string path;
+	size_t size;
+};
+
+static void drop_page_cache(const std::string &dir, const std::vector<SceneFile> &files)
+{
+	for (auto &file : files)
+	{
+		int fd = ::open(Path::join(dir, file.path).c_str(), O_RDONLY);
+		if (fd < 0)
+			continue;
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		::close(fd);
+	}
+}
+
+static bool generate_scene(OSFilesystem &fs)
+{
+	auto write_file = [&](const std::string &path, size_t size) -> bool {
+		auto file = fs.open(path, FileMode::WriteOnly);
+		if (!file)
+			return false;
+		auto mapping = file->map_write(size);
+		if (!mapping)
+			return false;
+		auto *data = mapping->mutable_data<uint32_t>();
+		for (size_t i = 0; i < size / sizeof(uint32_t); i++)
+			data[i] = uint32_t(i * 2654435761u);
+		return true;
+	};
+
+	if (!write_file("scene.bin", 64 * 1024 * 1024))
+		return false;
+	for (unsigned i = 0; i < 48; i++)
+		if (!write_file("textures/texture" + std::to_string(i) + ".ktx", (1024 + 64 * i) * 1024))
+			return false;
+	return true;
+}
+
+// What asset streaming does today: a task per file which maps it and consumes the data, faulting pages in as it goes.
+static void load_mmap(OSFilesystem &fs, ThreadGroup &group, const std::vector<SceneFile> &files,
+                      std::vector<std::vector<uint8_t>> &buffers)
+{
+	auto task = group.create_task();
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		task->enqueue_task([&, i]() {
+			auto file = fs.open(files[i].path, FileMode::ReadOnly);
+			auto mapping = file ? file->map() : FileMappingHandle{};
+			if (mapping)
+				memcpy(buffers[i].data(), mapping->data(), files[i].size);
+		});
+	}
+	task->wait();
+}
+
+static bool load_async(OSFilesystem &fs, const std::vector<SceneFile> &files,
+                       std::vector<std::vector<uint8_t>> &buffers)
+{
+	auto batch = Util::make_handle<FileReadBatch>();
+	for (size_t i = 0; i < files.size(); i++)
+		batch->add_read(fs.open(files[i].path, FileMode::ReadOnly), 0, files[i].size, buffers[i].data());
+	fs.submit_reads(batch);
+	batch->wait();
+	return batch->succeeded();
+}
+
+int main(int argc, char *argv[])
+{
+	std::string dir;
+	char dir_template[] = "/tmp/granite-async-read-bench-XXXXXX";
+	bool generated = argc < 2;
+
+	if (generated)
+	{
+		const char *tmp = mkdtemp(dir_template);
+		if (!tmp)
+			return EXIT_FAILURE;
+		dir = tmp;
+		OSFilesystem fs(dir);
+		if (!generate_scene(fs))
+		{
+			LOGE("Failed to generate scene.\n");
+			return EXIT_FAILURE;
+		}
+	}
+	else
+		dir = argv[1];
+
+	std::vector<SceneFile> files;
+	uint64_t total_size = 0;
+	{
+		OSFilesystem fs(dir);
+		for (auto &entry : fs.walk(""))
+		{
+			FileStat s;
+			if (entry.type == PathType::File && fs.stat(entry.path, s) && s.size)
+			{
+				files.push_back({ entry.path, size_t(s.size) });
+				total_size += s.size;
+			}
+		}
+	}
+
+	LOGI("Loading %zu files, %.1f MiB total.\n", files.size(), double(total_size) / (1024.0 * 1024.0));
+
+	std::vector<std::vector<uint8_t>> buffers(files.size());
+	for (size_t i = 0; i < files.size(); i++)
+		buffers[i].resize(files[i].size);
+
+	ThreadGroup group;
+	group.start(std::max(1u, std::thread::hardware_concurrency()), 0, {});
+
+	constexpr unsigned Iterations = 5;
+	struct Mode
+	{
+		const char *name;
+		AsyncReadBackend backend;
+		bool mmap;
+	};
+	const Mode modes[] = {
+		{ "mmap tasks", AsyncReadBackend::Auto, true },
+		{ "async io_uring", AsyncReadBackend::IoUring, false },
+		{ "async thread pool", AsyncReadBackend::ThreadPool, false },
+	};
+
+	for (auto &mode : modes)
+	{
+		OSFilesystem fs(dir);
+		fs.set_async_read_backend(mode.backend);
+
+		double total_time = 0.0;
+		for (unsigned i = 0; i < Iterations; i++)
+		{
+			drop_page_cache(dir, files);
+			auto start = Util::get_current_time_nsecs();
+			if (mode.mmap)
+				load_mmap(fs, group, files, buffers);
+			else if (!load_async(fs, files, buffers))
+				LOGE("Async read failed.\n");
+			total_time += double(Util::get_current_time_nsecs() - start) * 1e-9;
+		}
+
+		double avg = total_time / Iterations;
+		LOGI("%18s | %8.2f ms | %8.1f MiB/s\n", mode.name, avg * 1e3,
+		     double(total_size) / (1024.0 * 1024.0) / avg);
+	}
+
+	if (generated)
+	{
+		OSFilesystem fs(dir);
+		for (auto &file : files)
+			fs.remove(file.path);
+		rmdir(Path::join(dir, "textures").c_str());
+		rmdir(dir.c_str());
+	}
+}
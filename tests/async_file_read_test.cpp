@@ -0,0 +1,169 @@
+#include "filesystem.hpp"
+#include "os_filesystem.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include <string>
+
+using namespace Granite;
+
+static bool check(bool cond, const char *what)
+{
+	if (!cond)
+		LOGE("Check failed: %s\n", what);
+	return cond;
+}
+
+static uint8_t pattern(size_t file_index, uint64_t offset)
+{
+	return uint8_t((offset * 31 + file_index * 7) ^ (offset >> 11));
+}
+
+static const size_t file_sizes[] = { 0, 100, 4096, 3 * 1024 * 1024 + 17 };
+
+static bool write_test_files(FilesystemBackend &backend)
+{
+	for (size_t i = 0; i < sizeof(file_sizes) / sizeof(file_sizes[0]); i++)
+	{
+		auto file = backend.open("file" + std::to_string(i), FileMode::WriteOnly);
+		if (!file)
+			return false;
+		if (file_sizes[i] == 0)
+			continue;
+
+		auto mapping = file->map_write(file_sizes[i]);
+		if (!mapping)
+			return false;
+		auto *data = mapping->mutable_data<uint8_t>();
+		for (size_t j = 0; j < file_sizes[i]; j++)
+			data[j] = pattern(i, j);
+	}
+
+	return true;
+}
+
+static bool verify(const uint8_t *data, size_t file_index, uint64_t offset, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+		if (data[i] != pattern(file_index, offset + i))
+			return false;
+	return true;
+}
+
+static bool run_read_test(FilesystemBackend &backend, const char *tag)
+{
+	bool ok = true;
+	const size_t num_files = sizeof(file_sizes) / sizeof(file_sizes[0]);
+
+	FileHandle files[num_files];
+	for (size_t i = 0; i < num_files; i++)
+	{
+		files[i] = backend.open("file" + std::to_string(i), FileMode::ReadOnly);
+		if (!check(bool(files[i]), "open file"))
+			return false;
+	}
+
+	// Whole files, an unaligned window in the large file, and a read running past the end.
+	struct Expected
+	{
+		size_t file;
+		uint64_t offset;
+		size_t size;
+		int64_t result;
+	};
+	std::vector<Expected> expected;
+	for (size_t i = 0; i < num_files; i++)
+		expected.push_back({ i, 0, file_sizes[i], int64_t(file_sizes[i]) });
+	expected.push_back({ 3, 1000001, 2 * 1024 * 1024, 2 * 1024 * 1024 });
+	expected.push_back({ 2, 4000, 1000, 96 });
+	for (uint64_t offset = 0; offset < 64 * 1024; offset += 4096 + 3)
+		expected.push_back({ 3, offset, 513, 513 });
+
+	std::vector<std::vector<uint8_t>> buffers(expected.size());
+	auto batch = Util::make_handle<FileReadBatch>();
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		buffers[i].resize(expected[i].size);
+		batch->add_read(files[expected[i].file], expected[i].offset, expected[i].size, buffers[i].data());
+	}
+
+	TaskSignal signal;
+	batch->set_completion_signal(&signal);
+	backend.submit_reads(batch);
+	batch->wait();
+
+	ok &= check(batch->poll(), "batch complete after wait");
+	ok &= check(signal.get_count() == 1, "signal incremented once");
+	ok &= check(!batch->succeeded(), "short read is not success");
+
+	auto &requests = batch->get_requests();
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		auto &e = expected[i];
+		ok &= check(requests[i].result == e.result, "read result");
+		if (requests[i].result > 0)
+			ok &= check(verify(buffers[i].data(), e.file, e.offset, size_t(requests[i].result)), "read data");
+	}
+
+	// Tasks can be held back until the data has arrived.
+	ThreadGroup group;
+	group.start(2, 0, {});
+
+	std::vector<uint8_t> large(file_sizes[3]);
+	bool task_saw_data = false;
+	auto consumer = group.create_task([&]() {
+		task_saw_data = verify(large.data(), 3, 0, large.size());
+	});
+
+	batch = Util::make_handle<FileReadBatch>();
+	batch->add_read(files[3], 0, large.size(), large.data());
+	batch->set_completion_task(consumer);
+	consumer->flush();
+	backend.submit_reads(batch);
+	consumer->wait();
+
+	ok &= check(task_saw_data, "task ran after reads completed");
+	ok &= check(batch->succeeded(), "full read succeeded");
+
+	// Empty batches complete right away.
+	batch = Util::make_handle<FileReadBatch>();
+	backend.submit_reads(batch);
+	batch->wait();
+
+	if (ok)
+		LOGI("Async reads OK (%s).\n", tag);
+	return ok;
+}
+
+int main()
+{
+	char dir_template[] = "/tmp/granite-async-read-XXXXXX";
+	const char *dir = mkdtemp(dir_template);
+	if (!dir)
+		return EXIT_FAILURE;
+
+	bool ok = true;
+	{
+		OSFilesystem writer(dir);
+		ok &= write_test_files(writer);
+	}
+
+	for (auto backend : { AsyncReadBackend::IoUring, AsyncReadBackend::ThreadPool })
+	{
+		OSFilesystem fs(dir);
+		fs.set_async_read_backend(backend);
+		ok &= run_read_test(fs, backend == AsyncReadBackend::IoUring ? "io_uring" : "thread pool");
+	}
+
+	ScratchFilesystem scratch;
+	ok &= write_test_files(scratch);
+	ok &= run_read_test(scratch, "default backend");
+
+	for (size_t i = 0; i < sizeof(file_sizes) / sizeof(file_sizes[0]); i++)
+		unlink((std::string(dir) + "/file" + std::to_string(i)).c_str());
+	rmdir(dir);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
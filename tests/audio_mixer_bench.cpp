@@ -0,0 +1,797 @@
+#include "audio_mixer.hpp"
+#include "audio_interface.hpp"
+#include "audio_resampler.hpp"
+#include "vorbis_stream.hpp"
+#include "dsp/dsp.hpp"
+#include "dsp/tone_filter_stream.hpp"
+#include "global_managers_init.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+// Drives Mixer::mix_samples through DumpBackend at real-time block cadences without an audio device.
+// CPU time per block is measured for real, while the device clock is simulated:
+// block N is requested at N * period and has to be mixed before the device runs out at (N + 1) * period.
+// If mixing falls behind, the next block cannot start until the previous one is done, so a slow block
+// can cause misses for the blocks after it as well.
+
+static constexpr float MixerRate = 48000.0f;
+static constexpr unsigned MixerChannels = 2;
+static constexpr unsigned WarmupBlocks = 16;
+
+// How often ToneStreams were rendered and skipped, and how many exist.
+// Buses render on mixer threads, so the counters are atomic.
+static std::atomic_uint tone_render_count;
+static std::atomic_uint tone_skip_count;
+static unsigned live_tone_streams;
+
+// A cheap sine oscillator, which mixes like a decoded mono stream would.
+// With a length, it is a one-shot which ends after that many frames.
+class ToneStream final : public MixerStream
+{
+public:
+	ToneStream(float sample_rate_, float frequency, float phase, size_t length_ = 0)
+		: sample_rate(sample_rate_), length(length_)
+	{
+		omega = 2.0 * 3.14159265358979323846 * frequency / sample_rate;
+		rot_cos = float(std::cos(omega));
+		rot_sin = float(std::sin(omega));
+		phase_cos = std::cos(phase);
+		phase_sin = std::sin(phase);
+		live_tone_streams++;
+	}
+
+	~ToneStream()
+	{
+		live_tone_streams--;
+	}
+
+	bool setup(float, unsigned mixer_channels, size_t max_num_frames) override
+	{
+		num_channels = mixer_channels;
+		mono.resize(max_num_frames);
+		return true;
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override
+	{
+		tone_render_count.fetch_add(1, std::memory_order_relaxed);
+		num_frames = get_frames_to_play(num_frames);
+
+		// Catch up with the frames which were skipped, in one go.
+		if (skipped_frames)
+		{
+			double angle = omega * double(skipped_frames);
+			float c = float(std::cos(angle));
+			float s = float(std::sin(angle));
+			float new_cos = phase_cos * c - phase_sin * s;
+			phase_sin = phase_cos * s + phase_sin * c;
+			phase_cos = new_cos;
+			skipped_frames = 0;
+		}
+
+		for (size_t i = 0; i < num_frames; i++)
+		{
+			mono[i] = phase_sin;
+			float c = phase_cos * rot_cos - phase_sin * rot_sin;
+			float s = phase_cos * rot_sin + phase_sin * rot_cos;
+			phase_cos = c;
+			phase_sin = s;
+		}
+
+		// Keep the amplitude from drifting.
+		float norm = 1.0f / std::sqrt(phase_cos * phase_cos + phase_sin * phase_sin);
+		phase_cos *= norm;
+		phase_sin *= norm;
+
+		for (unsigned c = 0; c < num_channels; c++)
+			DSP::accumulate_channel(channels[c], mono.data(), gains[c], num_frames);
+		played_frames += num_frames;
+		return num_frames;
+	}
+
+	size_t skip_frames(float * const *, size_t num_frames) noexcept override
+	{
+		tone_skip_count.fetch_add(1, std::memory_order_relaxed);
+		num_frames = get_frames_to_play(num_frames);
+		skipped_frames += num_frames;
+		played_frames += num_frames;
+		return num_frames;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return num_channels;
+	}
+
+	float get_sample_rate() const override
+	{
+		return sample_rate;
+	}
+
+private:
+	std::vector<float> mono;
+	float sample_rate;
+	double omega;
+	float rot_cos, rot_sin;
+	float phase_cos, phase_sin;
+	size_t length;
+	size_t played_frames = 0;
+	size_t skipped_frames = 0;
+	unsigned num_channels = 0;
+
+	size_t get_frames_to_play(size_t num_frames) const
+	{
+		return length ? std::min(num_frames, length - played_frames) : num_frames;
+	}
+};
+
+// Times every accumulate_samples() call of the wrapped stream, including resampling.
+// The resampler is injected here rather than by the Mixer, so its cost is attributed to the stream.
+class TimedStream final : public MixerStream
+{
+public:
+	TimedStream(MixerStream *source_, std::vector<uint32_t> *costs_)
+		: source(source_), costs(costs_)
+	{
+	}
+
+	~TimedStream()
+	{
+		if (source)
+			source->dispose();
+	}
+
+	bool setup(float mixer_output_rate, unsigned mixer_channels, size_t max_num_frames) override
+	{
+		if (!source->setup(mixer_output_rate, mixer_channels, max_num_frames))
+			return false;
+
+		if (source->get_sample_rate() != mixer_output_rate)
+		{
+			source = new ResampledStream(source);
+			if (!source->setup(mixer_output_rate, mixer_channels, max_num_frames))
+				return false;
+		}
+
+		return true;
+	}
+
+	void install_message_queue(StreamID id, Util::LockFreeMessageQueue *queue) override
+	{
+		MixerStream::install_message_queue(id, queue);
+		source->install_message_queue(id, queue);
+	}
+
+	size_t skip_frames(float * const *scratch, size_t num_frames) noexcept override
+	{
+		return source->skip_frames(scratch, num_frames);
+	}
+
+	size_t accumulate_samples(float * const *channels, const float *gains, size_t num_frames) noexcept override
+	{
+		auto start = Util::get_current_time_nsecs();
+		size_t ret = source->accumulate_samples(channels, gains, num_frames);
+		auto end = Util::get_current_time_nsecs();
+		if (costs->size() < costs->capacity())
+			costs->push_back(uint32_t(end - start));
+		return ret;
+	}
+
+	unsigned get_num_channels() const override
+	{
+		return source->get_num_channels();
+	}
+
+	float get_sample_rate() const override
+	{
+		return source->get_sample_rate();
+	}
+
+private:
+	MixerStream *source;
+	std::vector<uint32_t> *costs;
+};
+
+enum class StreamMix
+{
+	Synthetic,
+	Resampled,
+	Vorbis
+};
+
+static const char *get_mix_name(StreamMix mix)
+{
+	switch (mix)
+	{
+	case StreamMix::Synthetic:
+		return "synthetic";
+	case StreamMix::Resampled:
+		return "resampled";
+	case StreamMix::Vorbis:
+		return "vorbis";
+	default:
+		return "?";
+	}
+}
+
+static MixerStream *create_stream(StreamMix mix, unsigned index, const std::string &vorbis_path)
+{
+	// Spread out phases so the sources do not all peak at the same time.
+	float frequency = 110.0f * std::pow(2.0f, float(index % 48) / 12.0f);
+	float phase = 2.39996323f * float(index);
+	switch (mix)
+	{
+	case StreamMix::Synthetic:
+		return new ToneStream(MixerRate, frequency, phase);
+	case StreamMix::Resampled:
+		return new ToneStream(44100.0f, frequency, phase);
+	case StreamMix::Vorbis:
+		return create_vorbis_stream(vorbis_path, true);
+	default:
+		return nullptr;
+	}
+}
+
+struct Options
+{
+	double seconds = 5.0;
+	double budget = 1.0;
+	std::string vorbis_path;
+	std::string wav_prefix;
+};
+
+struct Result
+{
+	double realtime_factor;
+	double block_p50_us, block_p99_us, block_max_us;
+	double stream_p50_us, stream_p99_us, stream_p999_us, stream_max_us;
+	double worst_slack_ms;
+	unsigned blocks;
+	unsigned misses;
+};
+
+template <typename T>
+static double percentile(std::vector<T> &values, double p)
+{
+	if (values.empty())
+		return 0.0;
+	size_t index = std::min(values.size() - 1, size_t(p * double(values.size())));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return double(values[index]);
+}
+
+// Simulated device clock. A block can start when it is requested, or once the previous one is done.
+struct DeadlineClock
+{
+	DeadlineClock(unsigned frames_per_block, double budget, unsigned num_blocks)
+	{
+		period_ns = int64_t(1e9 * double(frames_per_block) / MixerRate);
+		budget_ns = int64_t(budget * double(period_ns));
+		costs.reserve(num_blocks);
+	}
+
+	void add_block(int64_t cost)
+	{
+		int64_t requested = int64_t(costs.size()) * period_ns;
+		int64_t finished = std::max(requested, busy_until) + cost;
+		busy_until = finished;
+		int64_t slack = requested + budget_ns - finished;
+		worst_slack = std::min(worst_slack, slack);
+		if (slack < 0)
+			misses++;
+
+		total_ns += cost;
+		costs.push_back(cost);
+	}
+
+	void summarize(Result &result)
+	{
+		result.blocks = unsigned(costs.size());
+		result.misses = misses;
+		result.realtime_factor = (double(costs.size()) * double(period_ns)) / double(std::max<int64_t>(total_ns, 1));
+		result.block_p50_us = 1e-3 * percentile(costs, 0.5);
+		result.block_p99_us = 1e-3 * percentile(costs, 0.99);
+		result.block_max_us = 1e-3 * percentile(costs, 1.0);
+		result.worst_slack_ms = 1e-6 * double(worst_slack);
+	}
+
+	std::vector<int64_t> costs;
+	int64_t period_ns;
+	int64_t budget_ns;
+	int64_t busy_until = 0;
+	int64_t total_ns = 0;
+	int64_t worst_slack = INT64_MAX;
+	unsigned misses = 0;
+};
+
+static bool write_wav(const std::string &path, const std::vector<int16_t> &samples, unsigned channels, unsigned rate)
+{
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	auto data_size = uint32_t(samples.size() * sizeof(int16_t));
+	uint8_t header[44];
+	auto write_u32 = [&](unsigned offset, uint32_t v) {
+		for (unsigned i = 0; i < 4; i++)
+			header[offset + i] = uint8_t(v >> (8 * i));
+	};
+	auto write_u16 = [&](unsigned offset, uint16_t v) {
+		header[offset + 0] = uint8_t(v);
+		header[offset + 1] = uint8_t(v >> 8);
+	};
+
+	memcpy(header + 0, "RIFF", 4);
+	write_u32(4, 36 + data_size);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	write_u32(16, 16);
+	write_u16(20, 1);
+	write_u16(22, uint16_t(channels));
+	write_u32(24, rate);
+	write_u32(28, rate * channels * sizeof(int16_t));
+	write_u16(32, uint16_t(channels * sizeof(int16_t)));
+	write_u16(34, 16);
+	memcpy(header + 36, "data", 4);
+	write_u32(40, data_size);
+
+	// Samples are written in host order, which is little-endian on everything we run on.
+	bool ok = fwrite(header, sizeof(header), 1, file) == 1 &&
+	          fwrite(samples.data(), sizeof(int16_t), samples.size(), file) == samples.size();
+	fclose(file);
+	if (!ok)
+		LOGE("Failed to write %s.\n", path.c_str());
+	return ok;
+}
+
+static bool run_config(const Options &options, StreamMix mix, unsigned num_sources, double block_ms, Result &result)
+{
+	auto frames_per_block = unsigned(MixerRate * block_ms * 1e-3 + 0.5);
+	auto num_blocks = unsigned(options.seconds * 1000.0 / block_ms);
+
+	auto mixer = std::make_unique<Mixer>();
+	DumpBackend backend(mixer.get(), MixerRate, MixerChannels, frames_per_block);
+
+	// The sum of all sources cannot clip.
+	float gain_db = -20.0f * std::log10(float(num_sources));
+
+	std::vector<std::vector<uint32_t>> stream_costs(num_sources);
+	for (unsigned i = 0; i < num_sources; i++)
+	{
+		auto *source = create_stream(mix, i, options.vorbis_path);
+		if (!source)
+		{
+			LOGE("Failed to create %s stream.\n", get_mix_name(mix));
+			return false;
+		}
+
+		stream_costs[i].reserve(WarmupBlocks + num_blocks);
+		float pan = float(int(i % 9) - 4) / 4.0f;
+		if (!mixer->add_mixer_stream(new TimedStream(source, &stream_costs[i]), true, gain_db, pan))
+		{
+			LOGE("Failed to add stream %u to the mixer.\n", i);
+			return false;
+		}
+	}
+
+	std::vector<int16_t> block(frames_per_block * MixerChannels);
+	std::vector<int16_t> recording;
+	if (!options.wav_prefix.empty())
+		recording.reserve(size_t(num_blocks) * block.size());
+
+	DeadlineClock clock(frames_per_block, options.budget, num_blocks);
+	backend.start();
+
+	// First-touch page faults and cold caches are not what we are measuring.
+	for (unsigned i = 0; i < WarmupBlocks; i++)
+		backend.drain_interleaved_s16(block.data(), frames_per_block);
+	for (auto &costs : stream_costs)
+		costs.clear();
+
+	for (unsigned i = 0; i < num_blocks; i++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		backend.drain_interleaved_s16(block.data(), frames_per_block);
+		clock.add_block(Util::get_current_time_nsecs() - start);
+
+		if (!options.wav_prefix.empty())
+			recording.insert(recording.end(), block.begin(), block.end());
+	}
+	backend.stop();
+
+	std::vector<uint32_t> all_stream_costs;
+	all_stream_costs.reserve(size_t(num_sources) * num_blocks);
+	for (auto &costs : stream_costs)
+		all_stream_costs.insert(all_stream_costs.end(), costs.begin(), costs.end());
+
+	clock.summarize(result);
+	result.stream_p50_us = 1e-3 * percentile(all_stream_costs, 0.5);
+	result.stream_p99_us = 1e-3 * percentile(all_stream_costs, 0.99);
+	result.stream_p999_us = 1e-3 * percentile(all_stream_costs, 0.999);
+	result.stream_max_us = 1e-3 * percentile(all_stream_costs, 1.0);
+
+	if (!options.wav_prefix.empty())
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "-%s-%u-%.1fms.wav", get_mix_name(mix), num_sources, block_ms);
+		if (!write_wav(options.wav_prefix + path, recording, MixerChannels, unsigned(MixerRate)))
+			return false;
+	}
+
+	return true;
+}
+
+// A constant signal which loses its voice to a silent, higher priority stream and gets it back.
+// Stealing without a fade would show up as a full scale step in the output.
+static bool verify_voice_stealing()
+{
+	constexpr unsigned FramesPerBlock = 240;
+	constexpr float HalfPi = 1.57079632679f;
+	auto mixer = std::make_unique<Mixer>();
+	DumpBackend backend(mixer.get(), MixerRate, MixerChannels, FramesPerBlock);
+	mixer->set_max_real_voices(1);
+
+	std::vector<int16_t> output;
+	std::vector<int16_t> block(FramesPerBlock * MixerChannels);
+	auto render_blocks = [&](unsigned count) {
+		for (unsigned i = 0; i < count; i++)
+		{
+			backend.drain_interleaved_s16(block.data(), FramesPerBlock);
+			output.insert(output.end(), block.begin(), block.end());
+		}
+	};
+
+	backend.start();
+	mixer->add_mixer_stream(new ToneStream(MixerRate, 0.0f, HalfPi));
+	render_blocks(4);
+	auto thief = mixer->add_mixer_stream(new ToneStream(MixerRate, 0.0f, 0.0f), true, 0.0f, 0.0f, 1);
+	render_blocks(4);
+	bool silenced = block.front() == 0 && block.back() == 0;
+	mixer->kill_stream(thief);
+	render_blocks(4);
+	bool restored = block.front() > 32000 && block.back() > 32000;
+	backend.stop();
+
+	int max_step = 0;
+	for (size_t i = MixerChannels; i < output.size(); i++)
+		max_step = std::max(max_step, std::abs(int(output[i]) - int(output[i - MixerChannels])));
+
+	// A one block linear fade moves 32767 / FramesPerBlock per frame.
+	if (!silenced || !restored || max_step > 2 * 32767 / int(FramesPerBlock))
+	{
+		LOGE("Voice stealing is not click-free, largest step %d, silenced %d, restored %d.\n",
+		     max_step, int(silenced), int(restored));
+		return false;
+	}
+
+	LOGI("Voice stealing: largest step between frames %d / 32767.\n", max_step);
+	return true;
+}
+
+// What the application does every frame, so the audio thread does not run out of event payloads.
+static void pump_mixer_events(Mixer &mixer)
+{
+	auto &queue = mixer.get_message_queue();
+	Util::MessageQueuePayload payload;
+	while ((payload = queue.read_message()))
+		queue.recycle_payload(std::move(payload));
+	mixer.dispose_dead_streams();
+}
+
+struct VoiceResult
+{
+	Result timing;
+	double rendered_per_block;
+	double skipped_per_block;
+	double spawned_per_block;
+};
+
+// Thousands of one-shots, most of them too quiet or too low priority to be mixed.
+// Voices which end are replaced right away, so the number of logical voices stays constant.
+static void run_virtual_voices(const Options &options, unsigned num_voices, unsigned max_real_voices, VoiceResult &result)
+{
+	constexpr double BlockMs = 5.0;
+	auto frames_per_block = unsigned(MixerRate * BlockMs * 1e-3 + 0.5);
+	auto num_blocks = unsigned(options.seconds * 1000.0 / BlockMs);
+
+	auto mixer = std::make_unique<Mixer>();
+	DumpBackend backend(mixer.get(), MixerRate, MixerChannels, frames_per_block);
+	mixer->set_max_real_voices(max_real_voices);
+
+	std::mt19937 rnd(1337);
+	std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+	unsigned spawned = 0;
+
+	auto spawn = [&](bool already_playing) {
+		auto length = size_t(MixerRate * (0.25f + 2.75f * uni(rnd)));
+		if (already_playing)
+			length = 1 + rnd() % length;
+
+		// Levels spread evenly over 100 dB, a few voices are important.
+		float frequency = 100.0f + 1900.0f * uni(rnd);
+		float gain_db = -100.0f * uni(rnd);
+		float pan = 2.0f * uni(rnd) - 1.0f;
+		unsigned priority = rnd() % 16 == 0 ? 1 : 0;
+		mixer->add_mixer_stream(new ToneStream(MixerRate, frequency, 6.2831853f * uni(rnd), length),
+		                        true, gain_db, pan, priority);
+		spawned++;
+	};
+
+	unsigned base_live = live_tone_streams;
+	for (unsigned i = 0; i < num_voices; i++)
+		spawn(true);
+
+	std::vector<int16_t> block(frames_per_block * MixerChannels);
+	DeadlineClock clock(frames_per_block, options.budget, num_blocks);
+	uint64_t rendered = 0, skipped = 0;
+	backend.start();
+
+	for (unsigned i = 0; i < WarmupBlocks + num_blocks; i++)
+	{
+		if (i == WarmupBlocks)
+		{
+			rendered = 0;
+			skipped = 0;
+			spawned = 0;
+		}
+
+		tone_render_count = 0;
+		tone_skip_count = 0;
+		auto start = Util::get_current_time_nsecs();
+		backend.drain_interleaved_s16(block.data(), frames_per_block);
+		auto cost = Util::get_current_time_nsecs() - start;
+
+		if (i >= WarmupBlocks)
+			clock.add_block(cost);
+		rendered += tone_render_count;
+		skipped += tone_skip_count;
+
+		pump_mixer_events(*mixer);
+		while (live_tone_streams - base_live < num_voices)
+			spawn(false);
+	}
+	backend.stop();
+
+	clock.summarize(result.timing);
+	result.rendered_per_block = double(rendered) / num_blocks;
+	result.skipped_per_block = double(skipped) / num_blocks;
+	result.spawned_per_block = double(spawned) / num_blocks;
+}
+
+// Plain buses only change the order in which streams are summed, so they must sound like mixing every stream directly,
+// no matter which mixer thread rendered which bus.
+static bool verify_bus_mix()
+{
+	constexpr unsigned FramesPerBlock = 120;
+	constexpr unsigned NumBlocks = 400;
+	constexpr unsigned NumStreams = 64;
+	constexpr unsigned NumBuses = 8;
+
+	auto render = [&](bool use_buses, std::vector<int16_t> &output) {
+		auto mixer = std::make_unique<Mixer>();
+		DumpBackend backend(mixer.get(), MixerRate, MixerChannels, FramesPerBlock);
+
+		std::vector<BusID> buses(NumBuses);
+		if (use_buses)
+		{
+			mixer->set_num_mixer_threads(3);
+			for (auto &bus : buses)
+				bus = mixer->add_mixer_bus();
+		}
+
+		float gain_db = -20.0f * std::log10(float(NumStreams));
+		for (unsigned i = 0; i < NumStreams; i++)
+		{
+			float pan = float(int(i % 9) - 4) / 4.0f;
+			mixer->add_mixer_stream(create_stream(StreamMix::Synthetic, i, {}), true, gain_db, pan, 0,
+			                        buses[i % NumBuses]);
+		}
+
+		std::vector<int16_t> block(FramesPerBlock * MixerChannels);
+		backend.start();
+		for (unsigned i = 0; i < NumBlocks; i++)
+		{
+			backend.drain_interleaved_s16(block.data(), FramesPerBlock);
+			output.insert(output.end(), block.begin(), block.end());
+		}
+		backend.stop();
+	};
+
+	std::vector<int16_t> direct, bused;
+	render(false, direct);
+	render(true, bused);
+
+	int max_diff = 0, peak = 0;
+	for (size_t i = 0; i < direct.size(); i++)
+	{
+		max_diff = std::max(max_diff, std::abs(int(direct[i]) - int(bused[i])));
+		peak = std::max(peak, std::abs(int(direct[i])));
+	}
+
+	// Rounding may differ in the last bit.
+	if (max_diff > 1 || peak < 1000)
+	{
+		LOGE("Bus mix does not match direct mix, largest difference %d, peak %d.\n", max_diff, peak);
+		return false;
+	}
+
+	LOGI("Bus mix: largest difference to direct mix %d / 32767.\n", max_diff);
+	return true;
+}
+
+// Resampled voices spread over buses with a tone filter each.
+// Serially, this takes up about half of a block period on a desktop core.
+static void run_buses(const Options &options, double block_ms, unsigned num_buses, unsigned voices_per_bus,
+                      unsigned num_threads, Result &result)
+{
+	auto frames_per_block = unsigned(MixerRate * block_ms * 1e-3 + 0.5);
+	auto num_blocks = unsigned(options.seconds * 1000.0 / block_ms);
+
+	auto mixer = std::make_unique<Mixer>();
+	DumpBackend backend(mixer.get(), MixerRate, MixerChannels, frames_per_block);
+	mixer->set_num_mixer_threads(num_threads);
+	mixer->set_max_real_voices(num_buses * voices_per_bus);
+
+	float gain_db = -20.0f * std::log10(float(num_buses * voices_per_bus));
+	for (unsigned bus_index = 0; bus_index < num_buses; bus_index++)
+	{
+		auto bus = mixer->add_mixer_bus([](MixerStream *input) {
+			return DSP::create_tone_filter_stream(input);
+		});
+
+		for (unsigned i = 0; i < voices_per_bus; i++)
+		{
+			unsigned index = bus_index * voices_per_bus + i;
+			mixer->add_mixer_stream(create_stream(StreamMix::Resampled, index, {}), true, gain_db, 0.0f, 0, bus);
+		}
+	}
+
+	std::vector<int16_t> block(frames_per_block * MixerChannels);
+	DeadlineClock clock(frames_per_block, options.budget, num_blocks);
+	backend.start();
+
+	for (unsigned i = 0; i < WarmupBlocks; i++)
+		backend.drain_interleaved_s16(block.data(), frames_per_block);
+
+	for (unsigned i = 0; i < num_blocks; i++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		backend.drain_interleaved_s16(block.data(), frames_per_block);
+		clock.add_block(Util::get_current_time_nsecs() - start);
+	}
+	backend.stop();
+
+	clock.summarize(result);
+}
+
+static void print_help()
+{
+	LOGI("Usage: audio-mixer-bench [--seconds <audio seconds per run>] [--budget <fraction of block period>]\n"
+	     "                         [--vorbis <file.ogg>] [--wav <output prefix>]\n");
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+			options.seconds = strtod(argv[++i], nullptr);
+		else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+			options.budget = strtod(argv[++i], nullptr);
+		else if (strcmp(argv[i], "--vorbis") == 0 && i + 1 < argc)
+			options.vorbis_path = argv[++i];
+		else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc)
+			options.wav_prefix = argv[++i];
+		else
+		{
+			print_help();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (options.seconds <= 0.0 || options.budget <= 0.0)
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT);
+
+	std::vector<StreamMix> mixes = { StreamMix::Synthetic, StreamMix::Resampled };
+	if (!options.vorbis_path.empty())
+		mixes.push_back(StreamMix::Vorbis);
+
+	const unsigned source_counts[] = { 16, 64, 128 };
+	const double block_sizes_ms[] = { 2.5, 5.0, 10.0 };
+
+	LOGI("%.0f Hz, %u channels, %.1f s of audio per run, deadline at %.0f %% of the block period.\n",
+	     MixerRate, MixerChannels, options.seconds, 100.0 * options.budget);
+
+	bool failed = false;
+	for (auto mix : mixes)
+	{
+		LOGI("%s streams:\n", get_mix_name(mix));
+		for (auto sources : source_counts)
+		{
+			for (auto block_ms : block_sizes_ms)
+			{
+				Result result = {};
+				if (!run_config(options, mix, sources, block_ms, result))
+				{
+					failed = true;
+					continue;
+				}
+
+				LOGI("  %3u sources, %4.1f ms blocks: %7.1fx real-time, block p50 %7.1f us, p99 %7.1f us, max %7.1f us, "
+				     "%u / %u deadline misses, worst slack %6.3f ms\n",
+				     sources, block_ms, result.realtime_factor,
+				     result.block_p50_us, result.block_p99_us, result.block_max_us,
+				     result.misses, result.blocks, result.worst_slack_ms);
+				LOGI("                                per stream: p50 %6.2f us, p99 %6.2f us, p99.9 %6.2f us, max %7.2f us\n",
+				     result.stream_p50_us, result.stream_p99_us, result.stream_p999_us, result.stream_max_us);
+			}
+		}
+	}
+
+	if (!verify_voice_stealing())
+		failed = true;
+
+	if (!verify_bus_mix())
+		failed = true;
+
+	constexpr unsigned NumBuses = 8;
+	constexpr unsigned VoicesPerBus = 8;
+	const unsigned thread_counts[] = { 0, 1, 3 };
+	const double bus_block_sizes_ms[] = { 2.5, 10.0 };
+	LOGI("%u filtered buses with %u resampled voices each, %u hardware threads:\n",
+	     NumBuses, VoicesPerBus, std::thread::hardware_concurrency());
+	for (auto block_ms : bus_block_sizes_ms)
+	{
+		for (auto threads : thread_counts)
+		{
+			Result result = {};
+			run_buses(options, block_ms, NumBuses, VoicesPerBus, threads, result);
+			LOGI("  %4.1f ms blocks, %u mixer threads: %7.1fx real-time, block p50 %7.1f us, p99 %7.1f us, max %7.1f us, "
+			     "%u / %u deadline misses, worst slack %6.3f ms\n",
+			     block_ms, threads, result.realtime_factor,
+			     result.block_p50_us, result.block_p99_us, result.block_max_us,
+			     result.misses, result.blocks, result.worst_slack_ms);
+		}
+	}
+
+	constexpr unsigned NumVoices = 10000;
+	const unsigned real_voice_counts[] = { 32, Mixer::DefaultMaxRealVoices, Mixer::MaxSources };
+	LOGI("%u logical voices, 5 ms blocks:\n", NumVoices);
+	for (auto max_real : real_voice_counts)
+	{
+		VoiceResult result = {};
+		run_virtual_voices(options, NumVoices, max_real, result);
+		LOGI("  %5u real voices: %7.1fx real-time, block p50 %7.1f us, p99 %7.1f us, max %7.1f us, "
+		     "%u / %u deadline misses\n",
+		     max_real, result.timing.realtime_factor,
+		     result.timing.block_p50_us, result.timing.block_p99_us, result.timing.block_max_us,
+		     result.timing.misses, result.timing.blocks);
+		LOGI("                     rendered %7.1f, skipped %7.1f, started %5.1f voices / block\n",
+		     result.rendered_per_block, result.skipped_per_block, result.spawned_per_block);
+	}
+
+	Global::deinit();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,188 @@
+#include "dynamic_bvh.hpp"
+#include "frustum.hpp"
+#include "transforms.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <functional>
+#include <stdlib.h>
+
+using namespace Granite;
+
+struct Object
+{
+	AABB aabb;
+	uint32_t leaf;
+	bool alive;
+};
+
+static bool aabb_overlaps(const AABB &a, const AABB &b)
+{
+	return all(lessThanEqual(a.get_minimum(), b.get_maximum())) &&
+	       all(lessThanEqual(b.get_minimum(), a.get_maximum()));
+}
+
+static bool sphere_overlaps(const AABB &a, const vec3 &center, float radius)
+{
+	vec3 delta = clamp(center, a.get_minimum(), a.get_maximum()) - center;
+	return dot(delta, delta) <= radius * radius;
+}
+
+template <typename Query, typename Reference>
+static void verify(const char *tag, const DynamicBVH &bvh, const std::vector<Object> &objects,
+                   const Query &query, const Reference &reference)
+{
+	std::vector<uint32_t> got;
+	query([&](uint32_t leaf) { got.push_back(bvh.get_user_data(leaf)); });
+	std::sort(got.begin(), got.end());
+
+	std::vector<uint32_t> expected;
+	for (uint32_t i = 0; i < uint32_t(objects.size()); i++)
+		if (objects[i].alive && reference(objects[i].aabb))
+			expected.push_back(i);
+
+	if (got != expected)
+	{
+		LOGE("%s query mismatch: got %zu, expected %zu.\n", tag, got.size(), expected.size());
+		exit(EXIT_FAILURE);
+	}
+}
+
+static AABB random_aabb(std::mt19937 &rnd)
+{
+	std::uniform_real_distribution<float> pos(-50.0f, 50.0f);
+	std::uniform_real_distribution<float> size(0.05f, 3.0f);
+	vec3 center(pos(rnd), pos(rnd), pos(rnd));
+	vec3 extent(size(rnd), size(rnd), size(rnd));
+	return AABB(center - extent, center + extent);
+}
+
+int main()
+{
+	std::mt19937 rnd(42);
+	DynamicBVH bvh;
+	std::vector<Object> objects;
+
+	for (unsigned round = 0; round < 20; round++)
+	{
+		// Insert, move (both small and large motion) and remove at random.
+		for (unsigned i = 0; i < 500; i++)
+		{
+			auto aabb = random_aabb(rnd);
+			objects.push_back({ aabb, bvh.insert(aabb, uint32_t(objects.size())), true });
+		}
+
+		for (auto &o : objects)
+		{
+			if (!o.alive)
+				continue;
+
+			unsigned action = rnd() % 8;
+			if (action == 0)
+			{
+				bvh.remove(o.leaf);
+				o.alive = false;
+			}
+			else if (action == 1)
+			{
+				o.aabb = random_aabb(rnd);
+				bvh.move(o.leaf, o.aabb);
+			}
+			else if (action == 2)
+			{
+				vec3 nudge(0.01f, -0.02f, 0.015f);
+				o.aabb = AABB(o.aabb.get_minimum() + nudge, o.aabb.get_maximum() + nudge);
+				bvh.move(o.leaf, o.aabb);
+			}
+		}
+
+		size_t alive = std::count_if(objects.begin(), objects.end(), [](const Object &o) { return o.alive; });
+		if (bvh.get_leaf_count() != alive)
+		{
+			LOGE("Leaf count mismatch.\n");
+			return EXIT_FAILURE;
+		}
+
+		// An AVL-balanced tree should stay far below this.
+		if (bvh.get_height() > 4 * 16)
+		{
+			LOGE("Tree is badly imbalanced, height %u.\n", bvh.get_height());
+			return EXIT_FAILURE;
+		}
+
+		AABB box = random_aabb(rnd);
+		box = AABB(box.get_minimum() - vec3(10.0f), box.get_maximum() + vec3(10.0f));
+		verify("AABB", bvh, objects,
+		       [&](const std::function<void (uint32_t)> &f) { bvh.query_aabb(box, f); },
+		       [&](const AABB &a) { return aabb_overlaps(a, box); });
+
+		vec3 center = random_aabb(rnd).get_center();
+		float radius = 15.0f;
+		verify("Sphere", bvh, objects,
+		       [&](const std::function<void (uint32_t)> &f) { bvh.query_sphere(center, radius, f); },
+		       [&](const AABB &a) { return sphere_overlaps(a, center, radius); });
+
+		Frustum frustum;
+		mat4 view = mat4_cast(look_at(normalize(vec3(float(round) - 10.0f, 1.0f, -3.0f)), vec3(0.0f, 1.0f, 0.0f)));
+		frustum.build_planes(inverse(projection(0.8f, 1.5f, 0.5f, 60.0f) * view));
+		verify("Frustum", bvh, objects,
+		       [&](const std::function<void (uint32_t)> &f) { bvh.query_frustum(frustum, f); },
+		       [&](const AABB &a) { return SIMD::frustum_cull(a, frustum.get_planes()); });
+
+		for (unsigned num_indices : { 1u, 3u, 8u })
+		{
+			verify("Frustum subset", bvh, objects,
+			       [&](const std::function<void (uint32_t)> &f) {
+				       for (unsigned i = 0; i < num_indices; i++)
+					       bvh.query_frustum_subset(frustum, i, num_indices, f);
+			       },
+			       [&](const AABB &a) { return SIMD::frustum_cull(a, frustum.get_planes()); });
+		}
+
+		// Cube faces overlap at the edges, so leaves are regularly visible in several views.
+		Frustum faces[6];
+		const Frustum *face_ptrs[6];
+		vec3 cube_center = random_aabb(rnd).get_center();
+		for (unsigned face = 0; face < 6; face++)
+		{
+			mat4 face_view, face_proj;
+			compute_cube_render_transform(cube_center, face, face_proj, face_view, 0.1f, 40.0f);
+			faces[face].build_planes(inverse(face_proj * face_view));
+			face_ptrs[face] = &faces[face];
+		}
+
+		for (unsigned num_indices : { 1u, 3u })
+		{
+			std::vector<uint32_t> masks(objects.size());
+			auto query = [&](uint32_t leaf, uint32_t mask) {
+				auto &m = masks[bvh.get_user_data(leaf)];
+				if (m != 0 || mask == 0)
+				{
+					LOGE("Leaf visited twice or with empty mask.\n");
+					exit(EXIT_FAILURE);
+				}
+				m = mask;
+			};
+
+			if (num_indices == 1)
+				bvh.query_frusta(face_ptrs, 6, query);
+			else
+				for (unsigned i = 0; i < num_indices; i++)
+					bvh.query_frusta_subset(face_ptrs, 6, i, num_indices, query);
+
+			for (unsigned face = 0; face < 6; face++)
+			{
+				verify("Frusta", bvh, objects,
+				       [&](const std::function<void (uint32_t)> &f) {
+					       for (auto &o : objects)
+						       if (o.alive && (masks[bvh.get_user_data(o.leaf)] & (1u << face)))
+							       f(o.leaf);
+				       },
+				       [&](const AABB &a) { return SIMD::frustum_cull(a, faces[face].get_planes()); });
+			}
+		}
+	}
+
+	LOGI("DynamicBVH test passed with %zu leaves, height %u.\n", bvh.get_leaf_count(), bvh.get_height());
+}
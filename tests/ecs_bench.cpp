@@ -0,0 +1,301 @@
+#include "ecs.hpp"
+#include "ecs_parallel.hpp"
+#include "ecs_command_buffer.hpp"
+#include "thread_id.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <thread>
+#include <vector>
+
+using namespace Granite;
+
+struct PositionComponent : ComponentBase
+{
+	GRANITE_COMPONENT_TYPE_DECL(PositionComponent)
+	PositionComponent(float x_, float y_, float z_)
+		: x(x_), y(y_), z(z_)
+	{
+	}
+	float x, y, z;
+};
+
+struct VelocityComponent : ComponentBase
+{
+	GRANITE_COMPONENT_TYPE_DECL(VelocityComponent)
+	VelocityComponent(float x_, float y_, float z_)
+		: x(x_), y(y_), z(z_)
+	{
+	}
+	float x, y, z;
+};
+
+struct HealthComponent : ComponentBase
+{
+	GRANITE_COMPONENT_TYPE_DECL(HealthComponent)
+	explicit HealthComponent(int v_)
+		: v(v_)
+	{
+	}
+	int v;
+};
+
+// Mixes component sets like a scene does, so there is more than one archetype,
+// and per-component pools get interleaved allocations.
+static void populate(EntityPool &pool, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto *entity = pool.create_entity();
+		entity->allocate_component<PositionComponent>(float(i), 0.0f, 0.0f);
+		if (i % 3 == 0)
+			entity->allocate_component<HealthComponent>(100);
+		entity->allocate_component<VelocityComponent>(1.0f, 2.0f, 3.0f);
+	}
+}
+
+static double bench_group_iteration(EntityPool &pool)
+{
+	auto &group = pool.get_component_group<PositionComponent, VelocityComponent>();
+	auto start = Util::get_current_time_nsecs();
+	for (auto &e : group)
+	{
+		auto *pos = get_component<PositionComponent>(e);
+		auto *vel = get_component<VelocityComponent>(e);
+		pos->x += vel->x * 0.016f;
+		pos->y += vel->y * 0.016f;
+		pos->z += vel->z * 0.016f;
+	}
+	auto end = Util::get_current_time_nsecs();
+	return double(end - start) / double(group.size());
+}
+
+static double bench_for_each(EntityPool &pool, size_t count)
+{
+	auto start = Util::get_current_time_nsecs();
+	pool.for_each<PositionComponent, VelocityComponent>([](PositionComponent &pos, VelocityComponent &vel) {
+		pos.x += vel.x * 0.016f;
+		pos.y += vel.y * 0.016f;
+		pos.z += vel.z * 0.016f;
+	});
+	auto end = Util::get_current_time_nsecs();
+	return double(end - start) / double(count);
+}
+
+static void run_bench(unsigned count)
+{
+	constexpr unsigned Iterations = 10;
+
+	EntityPool per_component;
+	auto start = Util::get_current_time_nsecs();
+	populate(per_component, count);
+	double per_component_create = double(Util::get_current_time_nsecs() - start) / count;
+
+	EntityPool archetype(EntityStorage::Archetype);
+	start = Util::get_current_time_nsecs();
+	populate(archetype, count);
+	double archetype_create = double(Util::get_current_time_nsecs() - start) / count;
+
+	// Builds the group once.
+	bench_group_iteration(per_component);
+	bench_group_iteration(archetype);
+
+	double per_component_group = 0.0, archetype_group = 0.0, archetype_for_each = 0.0;
+	for (unsigned i = 0; i < Iterations; i++)
+	{
+		per_component_group += bench_group_iteration(per_component);
+		archetype_group += bench_group_iteration(archetype);
+		archetype_for_each += bench_for_each(archetype, count);
+	}
+
+	LOGI("%8u entities | create: per-component %7.2f ns, archetype %7.2f ns | "
+	     "iterate: per-component group %6.2f ns, archetype group %6.2f ns, archetype for_each %6.2f ns\n",
+	     count, per_component_create, archetype_create,
+	     per_component_group / Iterations, archetype_group / Iterations, archetype_for_each / Iterations);
+}
+
+static void integrate(PositionComponent &pos, const VelocityComponent &vel)
+{
+	pos.x += vel.x * 0.016f;
+	pos.y += vel.y * 0.016f;
+	pos.z += vel.z * 0.016f;
+}
+
+static void damage(HealthComponent &health)
+{
+	health.v -= 1;
+}
+
+static double bench_parallel(EntityPool &pool, ThreadGroup &group, size_t count, bool two_systems, bool track_access)
+{
+	auto start = Util::get_current_time_nsecs();
+	TaskComposer composer(group);
+	ComponentAccessTracker tracker;
+	auto *tracker_ptr = track_access ? &tracker : nullptr;
+
+	for_each_parallel<PositionComponent, const VelocityComponent>(pool, composer, integrate, tracker_ptr);
+	// Disjoint from the first system, so with access tracking both run in the same stage.
+	if (two_systems)
+		for_each_parallel<HealthComponent>(pool, composer, damage, tracker_ptr);
+
+	composer.get_outgoing_task()->wait();
+	auto end = Util::get_current_time_nsecs();
+	return double(end - start) / double(count);
+}
+
+static void run_parallel_bench(ThreadGroup &group, EntityStorage storage, unsigned count)
+{
+	constexpr unsigned Iterations = 10;
+	EntityPool pool(storage);
+	populate(pool, count);
+
+	// Warmup, builds groups.
+	bench_parallel(pool, group, count, true, true);
+
+	double serial = 0.0, parallel = 0.0, two_serial_stages = 0.0, two_tracked = 0.0;
+	for (unsigned i = 0; i < Iterations; i++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		pool.for_each<PositionComponent, VelocityComponent>(integrate);
+		pool.for_each<HealthComponent>(damage);
+		serial += double(Util::get_current_time_nsecs() - start) / count;
+
+		parallel += bench_parallel(pool, group, count, false, false);
+		two_serial_stages += bench_parallel(pool, group, count, true, false);
+		two_tracked += bench_parallel(pool, group, count, true, true);
+	}
+
+	LOGI("%8u entities | %13s | serial (2 systems) %6.2f ns | parallel (1 system) %6.2f ns | "
+	     "parallel (2 systems, 2 stages) %6.2f ns | parallel (2 systems, tracked) %6.2f ns\n",
+	     count, storage == EntityStorage::Archetype ? "archetype" : "per-component",
+	     serial / Iterations, parallel / Iterations, two_serial_stages / Iterations, two_tracked / Iterations);
+}
+
+enum class SpawnMode
+{
+	Immediate,
+	CommandBuffer,
+	ParallelCommandBuffer
+};
+
+static void record_spawns(EntityCommandRecorder &recorder, std::vector<PendingEntity> &pending, unsigned begin, unsigned end)
+{
+	for (unsigned i = begin; i < end; i++)
+	{
+		auto e = recorder.create_entity();
+		recorder.add_component<PositionComponent>(e, float(i), 0.0f, 0.0f);
+		recorder.add_component<VelocityComponent>(e, 1.0f, 2.0f, 3.0f);
+		if (i % 3 == 0)
+			recorder.add_component<HealthComponent>(e, 100);
+		pending[i] = e;
+	}
+}
+
+// Despawns everything spawned in the previous frame, and spawns a new batch.
+static double bench_spawn_frame(EntityPool &pool, ThreadGroup &group, EntityCommandBuffer &buffer,
+                                std::vector<Entity *> &live, std::vector<PendingEntity> &pending, SpawnMode mode)
+{
+	auto count = unsigned(live.size());
+	auto start = Util::get_current_time_nsecs();
+
+	if (mode == SpawnMode::Immediate)
+	{
+		for (auto *entity : live)
+			pool.delete_entity(entity);
+		for (unsigned i = 0; i < count; i++)
+		{
+			auto *entity = pool.create_entity();
+			entity->allocate_component<PositionComponent>(float(i), 0.0f, 0.0f);
+			entity->allocate_component<VelocityComponent>(1.0f, 2.0f, 3.0f);
+			if (i % 3 == 0)
+				entity->allocate_component<HealthComponent>(100);
+			live[i] = entity;
+		}
+	}
+	else
+	{
+		if (mode == SpawnMode::ParallelCommandBuffer)
+		{
+			unsigned num_tasks = buffer.get_num_recorders();
+			auto task = group.create_task();
+			for (unsigned t = 0; t < num_tasks; t++)
+			{
+				group.enqueue_task(*task, [&, t]() {
+					auto &recorder = buffer.get_thread_recorder();
+					unsigned begin = t * count / num_tasks;
+					unsigned end = (t + 1) * count / num_tasks;
+					for (unsigned i = begin; i < end; i++)
+						recorder.destroy_entity(live[i]);
+					record_spawns(recorder, pending, begin, end);
+				});
+			}
+			task->wait();
+		}
+		else
+		{
+			auto &recorder = buffer.get_recorder(0);
+			for (auto *entity : live)
+				recorder.destroy_entity(entity);
+			record_spawns(recorder, pending, 0, count);
+		}
+
+		buffer.playback(pool);
+		for (unsigned i = 0; i < count; i++)
+			live[i] = buffer.resolve(pending[i]);
+	}
+
+	// Systems look at the groups every frame.
+	pool.get_component_group<PositionComponent, VelocityComponent>();
+	pool.get_component_group<HealthComponent>();
+
+	return double(Util::get_current_time_nsecs() - start) * 1e-6;
+}
+
+static void run_spawn_bench(ThreadGroup &group, EntityStorage storage, SpawnMode mode)
+{
+	constexpr unsigned Frames = 20;
+	constexpr unsigned SpawnsPerFrame = 50000;
+
+	EntityPool pool(storage);
+	// Long-lived entities which share groups with the spawned ones.
+	populate(pool, 100000);
+
+	std::vector<Entity *> live(SpawnsPerFrame);
+	for (auto &entity : live)
+		entity = pool.create_entity();
+
+	EntityCommandBuffer buffer(group.get_num_threads() + 1);
+	std::vector<PendingEntity> pending(SpawnsPerFrame);
+
+	// Warmup, builds groups and recorder blocks.
+	bench_spawn_frame(pool, group, buffer, live, pending, mode);
+
+	double total = 0.0;
+	for (unsigned i = 0; i < Frames; i++)
+		total += bench_spawn_frame(pool, group, buffer, live, pending, mode);
+
+	static const char *mode_names[] = { "immediate", "command buffer", "parallel command buffer" };
+	LOGI("%13s | %23s | %u spawns + %u despawns per frame: %7.3f ms\n",
+	     storage == EntityStorage::Archetype ? "archetype" : "per-component",
+	     mode_names[int(mode)], SpawnsPerFrame, SpawnsPerFrame, total / Frames);
+}
+
+int main()
+{
+	for (unsigned count : { 10000u, 100000u, 1000000u })
+		run_bench(count);
+
+	ThreadGroup group;
+	group.start(std::max(1u, std::thread::hardware_concurrency()), 0, {});
+	LOGI("=== for_each_parallel, %u threads ===\n", group.get_num_threads());
+	for (unsigned count : { 10000u, 100000u, 1000000u })
+	{
+		run_parallel_bench(group, EntityStorage::PerComponent, count);
+		run_parallel_bench(group, EntityStorage::Archetype, count);
+	}
+
+	Util::register_thread_index(0);
+	LOGI("=== Spawn/despawn ===\n");
+	for (auto storage : { EntityStorage::PerComponent, EntityStorage::Archetype })
+		for (auto mode : { SpawnMode::Immediate, SpawnMode::CommandBuffer, SpawnMode::ParallelCommandBuffer })
+			run_spawn_bench(group, storage, mode);
+}
@@ -1,5 +1,9 @@
 #include "ecs.hpp"
+#include "ecs_parallel.hpp"
+#include "ecs_command_buffer.hpp"
+#include "thread_id.hpp"
 #include "logging.hpp"
+#include <stdlib.h>
 
 using namespace Granite;
 
@@ -33,6 +37,283 @@ struct CComponent : ComponentBase
 	int v;
 };
 
+static bool check(bool cond, const char *what)
+{
+	if (!cond)
+		LOGE("Check failed: %s\n", what);
+	return cond;
+}
+
+static int sum_a(EntityPool &pool)
+{
+	int sum = 0;
+	pool.for_each<AComponent>([&](AComponent &a) { sum += a.v; });
+	return sum;
+}
+
+static bool run_archetype_test()
+{
+	EntityPool pool(EntityStorage::Archetype);
+
+	auto *a = pool.create_entity();
+	a->allocate_component<AComponent>(1);
+	a->allocate_component<BComponent>(2);
+	auto *b = pool.create_entity();
+	b->allocate_component<AComponent>(3);
+	auto *c = pool.create_entity();
+	c->allocate_component<AComponent>(4);
+	c->allocate_component<BComponent>(5);
+	c->allocate_component<CComponent>(6);
+
+	bool ok = true;
+	ok &= check(pool.get_component_group<AComponent, BComponent>().size() == 2, "AB group size");
+	ok &= check(sum_a(pool) == 8, "sum of A");
+	ok &= check(a->get_component<BComponent>()->v == 2, "component survives migration");
+
+	// In-place reallocation does not migrate.
+	a->allocate_component<AComponent>(10);
+	ok &= check(a->get_component<AComponent>()->v == 10, "in-place reallocation");
+
+	a->free_component<BComponent>();
+	ok &= check(!a->has_component<BComponent>(), "component freed");
+	ok &= check(a->get_component<AComponent>()->v == 10, "component survives removal migration");
+
+	auto &group_ab = pool.get_component_group<AComponent, BComponent>();
+	ok &= check(group_ab.size() == 1 && get_component<CComponent>(pool.get_component_group<CComponent, BComponent>().front())->v == 6,
+	            "group refresh after migration");
+
+	pool.delete_entity(b);
+	ok &= check(sum_a(pool) == 14, "sum after delete");
+
+	// Spans many chunks, and deleting entities moves rows between chunks.
+	std::vector<Entity *> entities;
+	int expected = sum_a(pool);
+	for (int i = 0; i < 10000; i++)
+	{
+		auto *e = pool.create_entity();
+		e->allocate_component<AComponent>(i);
+		if (i & 1)
+			e->allocate_component<BComponent>(i);
+		entities.push_back(e);
+		expected += i;
+	}
+
+	for (size_t i = 0; i < entities.size(); i += 3)
+	{
+		expected -= entities[i]->get_component<AComponent>()->v;
+		pool.delete_entity(entities[i]);
+		entities[i] = nullptr;
+	}
+
+	ok &= check(sum_a(pool) == expected, "sum after mass delete");
+	for (auto *e : entities)
+		if (e)
+			ok &= check(!e->has_component<BComponent>() || e->get_component<BComponent>()->v == e->get_component<AComponent>()->v,
+			            "rows stay consistent");
+
+	size_t chunked = 0;
+	pool.for_each_chunk<AComponent, BComponent>([&](size_t count, Entity * const *chunk_entities, AComponent *as, BComponent *bs) {
+		for (size_t i = 0; i < count; i++)
+		{
+			ok &= check(chunk_entities[i]->get_component<AComponent>() == &as[i], "chunk entity mapping");
+			ok &= check(as[i].v == bs[i].v || chunk_entities[i] == c, "chunk arrays are aligned");
+		}
+		chunked += count;
+	});
+	ok &= check(chunked == pool.get_component_entities<AComponent, BComponent>().size(), "chunk iteration count");
+
+	return ok;
+}
+
+static bool run_parallel_test(EntityStorage storage)
+{
+	ThreadGroup group;
+	group.start(4, 0, {});
+
+	EntityPool pool(storage);
+	for (int i = 0; i < 5000; i++)
+	{
+		auto *e = pool.create_entity();
+		e->allocate_component<AComponent>(i);
+		e->allocate_component<BComponent>(1);
+		if (i & 1)
+			e->allocate_component<CComponent>(0);
+	}
+
+	TaskComposer composer(group);
+	ComponentAccessTracker tracker;
+	for_each_parallel<AComponent, const BComponent>(pool, composer, [](AComponent &a, const BComponent &b) {
+		a.v += b.v;
+	}, &tracker);
+	// Disjoint, can run in the same stage.
+	for_each_parallel<CComponent>(pool, composer, [](CComponent &c) {
+		c.v = 1;
+	}, &tracker);
+	// Reads A, which the first system writes, so must run in a later stage.
+	for_each_parallel<const AComponent, CComponent>(pool, composer, [](const AComponent &a, CComponent &c) {
+		c.v += a.v;
+	}, &tracker);
+	composer.get_outgoing_task()->wait();
+
+	bool ok = true;
+	pool.for_each<AComponent>([&](AComponent &a) {
+		ok &= check(a.v >= 1 && a.v <= 5000, "A updated exactly once");
+	});
+	int sum_c = 0;
+	pool.for_each<CComponent>([&](CComponent &c) { sum_c += c.v; });
+
+	// Odd i in [0, 5000) have C, each ends up with 1 + (i + 1).
+	int expected = 0;
+	for (int i = 1; i < 5000; i += 2)
+		expected += 1 + i + 1;
+	ok &= check(sum_c == expected, "stages ordered by access");
+	return ok;
+}
+
+static bool run_command_buffer_test(EntityStorage storage)
+{
+	ThreadGroup group;
+	group.start(4, 0, {});
+	Util::register_thread_index(0);
+
+	EntityPool pool(storage);
+	std::vector<Entity *> existing;
+	for (int i = 0; i < 1000; i++)
+	{
+		auto *e = pool.create_entity();
+		e->allocate_component<AComponent>(i);
+		e->allocate_component<BComponent>(1);
+		existing.push_back(e);
+	}
+
+	// Register the groups up front so playback has to keep them up to date.
+	pool.get_component_group<AComponent, BComponent>();
+	pool.get_component_group<CComponent>();
+
+	EntityCommandBuffer buffer(group.get_num_threads() + 1);
+	constexpr unsigned NumTasks = 16;
+	std::vector<PendingEntity> pending[NumTasks];
+
+	auto task = group.create_task();
+	for (unsigned t = 0; t < NumTasks; t++)
+	{
+		group.enqueue_task(*task, [&, t]() {
+			auto &recorder = buffer.get_thread_recorder();
+			for (int i = 0; i < 100; i++)
+			{
+				auto e = recorder.create_entity();
+				recorder.add_component<AComponent>(e, 10000);
+				recorder.add_component<CComponent>(e, int(t));
+				pending[t].push_back(e);
+			}
+
+			// Every task owns a disjoint slice of the existing entities.
+			for (size_t i = t; i < existing.size(); i += NumTasks)
+			{
+				if (i % 4 == 0)
+					recorder.destroy_entity(existing[i]);
+				else if (i % 4 == 1)
+					recorder.remove_component<BComponent>(existing[i]);
+				else if (i % 4 == 2)
+				{
+					// Only the last add survives.
+					recorder.add_component<CComponent>(existing[i], 1);
+					recorder.add_component<CComponent>(existing[i], 2);
+					recorder.add_component<AComponent>(existing[i], -1);
+				}
+				else
+				{
+					// Changes to destroyed entities are dropped.
+					recorder.add_component<CComponent>(existing[i], 3);
+					recorder.destroy_entity(existing[i]);
+				}
+			}
+		});
+	}
+	task->wait();
+
+	// Nothing is applied until playback.
+	bool ok = true;
+	ok &= check(pool.get_component_group<CComponent>().empty(), "no changes before playback");
+
+	buffer.playback(pool);
+
+	auto &group_ab = pool.get_component_group<AComponent, BComponent>();
+	auto &group_c = pool.get_component_group<CComponent>();
+	ok &= check(group_ab.size() == 250, "AB group after playback");
+	ok &= check(group_c.size() == 250 + NumTasks * 100, "C group after playback");
+
+	int sum_c = 0;
+	pool.for_each<CComponent>([&](CComponent &c) { sum_c += c.v; });
+	int expected_c = 250 * 2;
+	for (int t = 0; t < int(NumTasks); t++)
+		expected_c += 100 * t;
+	ok &= check(sum_c == expected_c, "C values after playback");
+
+	int num_a = 0, sum_a = 0;
+	pool.for_each<AComponent>([&](AComponent &a) { num_a++; sum_a += a.v; });
+	ok &= check(num_a == 500 + int(NumTasks) * 100, "A count after playback");
+
+	int expected_a = 0;
+	for (int i = 0; i < 1000; i++)
+	{
+		if (i % 4 == 1)
+			expected_a += i;
+		else if (i % 4 == 2)
+			expected_a -= 1;
+	}
+	expected_a += NumTasks * 100 * 10000;
+	ok &= check(sum_a == expected_a, "A values after playback");
+
+	for (unsigned t = 0; t < NumTasks; t++)
+	{
+		for (auto &e : pending[t])
+		{
+			auto *entity = buffer.resolve(e);
+			ok &= check(entity && entity->get_component<CComponent>()->v == int(t), "resolve created entity");
+		}
+	}
+
+	// Recorders are empty after playback and can be reused.
+	for (unsigned i = 0; i < buffer.get_num_recorders(); i++)
+		ok &= check(buffer.get_recorder(i).empty(), "recorder cleared");
+
+	auto &recorder = buffer.get_recorder(0);
+	for (auto *entity : pool.get_component_entities<CComponent>())
+		recorder.destroy_entity(entity);
+	buffer.playback(pool);
+	ok &= check(pool.get_component_group<CComponent>().empty(), "destroy all with C");
+	ok &= check(pool.get_component_group<AComponent, BComponent>().empty(), "AB entities also had C");
+	ok &= check(pool.get_component_group<AComponent>().size() == 250, "entities without C untouched");
+
+	return ok;
+}
+
+static bool run_structure_version_test(EntityStorage storage)
+{
+	EntityPool pool(storage);
+	auto *e = pool.create_entity();
+	e->allocate_component<AComponent>(1);
+
+	bool ok = true;
+	uint64_t version = pool.get_structure_version();
+	e->allocate_component<AComponent>(2);
+	ok &= check(pool.get_structure_version() == version, "in-place reallocation keeps structure version");
+
+	e->allocate_component<BComponent>(3);
+	ok &= check(pool.get_structure_version() != version, "adding a component changes structure version");
+
+	version = pool.get_structure_version();
+	e->free_component<BComponent>();
+	ok &= check(pool.get_structure_version() != version, "freeing a component changes structure version");
+
+	version = pool.get_structure_version();
+	pool.delete_entity(e);
+	ok &= check(pool.get_structure_version() != version, "deleting an entity changes structure version");
+
+	return ok;
+}
+
 int main()
 {
 	EntityPool pool;
@@ -52,4 +333,23 @@ int main()
 		LOGI("BA: %d, %d\n", get<0>(e)->v, get<1>(e)->v);
 	for (auto &e : group_bc)
 		LOGI("BC: %d\n", get<0>(e)->v);
+
+	if (!run_archetype_test())
+		return EXIT_FAILURE;
+	LOGI("Archetype storage OK.\n");
+
+	for (auto storage : { EntityStorage::PerComponent, EntityStorage::Archetype })
+		if (!run_parallel_test(storage))
+			return EXIT_FAILURE;
+	LOGI("Parallel iteration OK.\n");
+
+	for (auto storage : { EntityStorage::PerComponent, EntityStorage::Archetype })
+		if (!run_command_buffer_test(storage))
+			return EXIT_FAILURE;
+	LOGI("Command buffers OK.\n");
+
+	for (auto storage : { EntityStorage::PerComponent, EntityStorage::Archetype })
+		if (!run_structure_version_test(storage))
+			return EXIT_FAILURE;
+	LOGI("Structure versions OK.\n");
 }
\ No newline at end of file
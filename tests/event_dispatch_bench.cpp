@@ -0,0 +1,326 @@
+#include "event.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <atomic>
+#include <random>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <stdlib.h>
+
+using namespace Granite;
+
+// Counts heap allocations, so we can tell whether the steady state of enqueue + dispatch allocates.
+static std::atomic<uint64_t> allocation_count;
+
+void *operator new(size_t size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+// Stand-ins for the events which flood the event manager: input, audio and device notifications.
+class PointerMoveEvent : public Event
+{
+public:
+	GRANITE_EVENT_TYPE_DECL(PointerMoveEvent)
+	PointerMoveEvent(unsigned index_, double x_, double y_)
+		: index(index_), x(x_), y(y_)
+	{
+	}
+
+	unsigned index;
+	double x, y;
+};
+
+class AudioTimingEvent : public Event
+{
+public:
+	GRANITE_EVENT_TYPE_DECL(AudioTimingEvent)
+	AudioTimingEvent(unsigned stream_, uint64_t sample_count_, double latency_)
+		: stream(stream_), sample_count(sample_count_), latency(latency_)
+	{
+	}
+
+	unsigned stream;
+	uint64_t sample_count;
+	double latency;
+};
+
+class DeviceStateEvent : public Event
+{
+public:
+	GRANITE_EVENT_TYPE_DECL(DeviceStateEvent)
+	DeviceStateEvent(unsigned device_, bool connected_)
+		: device(device_), connected(connected_)
+	{
+	}
+
+	unsigned device;
+	bool connected;
+};
+
+enum { PointerType, AudioType, DeviceType, NumTypes };
+
+static uint64_t event_hash(const PointerMoveEvent &e)
+{
+	return e.index * 3 + uint64_t(e.x) + uint64_t(e.y);
+}
+
+static uint64_t event_hash(const AudioTimingEvent &e)
+{
+	return e.stream * 5 + e.sample_count + uint64_t(e.latency);
+}
+
+static uint64_t event_hash(const DeviceStateEvent &e)
+{
+	return e.device * 7 + uint64_t(e.connected);
+}
+
+struct Consumer : EventHandler
+{
+	// Per type, since worker delivery calls handlers of different types concurrently.
+	uint64_t checksum[NumTypes] = {};
+
+	bool on_pointer(const PointerMoveEvent &e)
+	{
+		checksum[PointerType] += event_hash(e);
+		return true;
+	}
+
+	bool on_audio(const AudioTimingEvent &e)
+	{
+		checksum[AudioType] += event_hash(e);
+		return true;
+	}
+
+	bool on_device(const DeviceStateEvent &e)
+	{
+		checksum[DeviceType] += event_hash(e);
+		return true;
+	}
+
+	bool on_pointer_batch(const EventBatch<PointerMoveEvent> &batch)
+	{
+		for (auto &e : batch)
+			checksum[PointerType] += event_hash(e);
+		return true;
+	}
+
+	bool on_audio_batch(const EventBatch<AudioTimingEvent> &batch)
+	{
+		for (auto &e : batch)
+			checksum[AudioType] += event_hash(e);
+		return true;
+	}
+
+	bool on_device_batch(const EventBatch<DeviceStateEvent> &batch)
+	{
+		for (auto &e : batch)
+			checksum[DeviceType] += event_hash(e);
+		return true;
+	}
+
+	uint64_t total() const
+	{
+		return checksum[PointerType] + checksum[AudioType] + checksum[DeviceType];
+	}
+};
+
+// What EventManager used to do: every event is its own heap allocation, looked up by type for every enqueue.
+class LegacyEventManager
+{
+public:
+	template <typename T, typename... P>
+	void enqueue(P&&... p)
+	{
+		auto &l = events[T::get_type_id()];
+		l.queued_events.emplace_back(new T(std::forward<P>(p)...));
+	}
+
+	template <typename T, typename EventType, bool (T::*mem_fn)(const EventType &)>
+	void register_handler(T *handler)
+	{
+		events[EventType::get_type_id()].handlers.push_back({ member_function_invoker<bool, T, EventType, mem_fn>, handler });
+	}
+
+	void dispatch()
+	{
+		for (auto &event_type : events)
+		{
+			for (auto &handler : event_type.handlers)
+				for (auto &event : event_type.queued_events)
+					handler.mem_fn(handler.handler, *event);
+			event_type.queued_events.clear();
+		}
+	}
+
+private:
+	struct Handler
+	{
+		bool (*mem_fn)(void *object, const Event &event);
+		void *handler;
+	};
+
+	struct EventTypeData : Util::IntrusiveHashMapEnabled<EventTypeData>
+	{
+		std::vector<std::unique_ptr<Event>> queued_events;
+		std::vector<Handler> handlers;
+	};
+
+	Util::IntrusiveHashMap<EventTypeData> events;
+};
+
+struct Result
+{
+	double enqueue_ms = 0.0;
+	double dispatch_ms = 0.0;
+	double allocations = 0.0;
+	uint64_t checksum = 0;
+};
+
+// 1M events / s at 60 fps. Mostly pointer motion, some audio timing, and a trickle of device changes.
+template <typename Manager>
+static void produce_frame(Manager &manager, std::mt19937 &rnd, unsigned events_per_frame)
+{
+	for (unsigned i = 0; i < events_per_frame; i++)
+	{
+		unsigned r = rnd() % 100;
+		if (r < 70)
+			manager.template enqueue<PointerMoveEvent>(i, double(r), double(i & 255));
+		else if (r < 98)
+			manager.template enqueue<AudioTimingEvent>(r & 3, uint64_t(i) * 256, 0.01 * r);
+		else
+			manager.template enqueue<DeviceStateEvent>(r & 7, (i & 1) != 0);
+	}
+}
+
+template <typename Manager, typename Dispatch>
+static Result run_frames(Manager &manager, Consumer *consumers, unsigned num_consumers,
+                         unsigned events_per_frame, unsigned num_frames, const Dispatch &dispatch)
+{
+	constexpr unsigned WarmupFrames = 10;
+	std::mt19937 rnd(1337);
+	Result result;
+
+	for (unsigned frame = 0; frame < WarmupFrames + num_frames; frame++)
+	{
+		if (frame == WarmupFrames)
+		{
+			result = {};
+			allocation_count.store(0, std::memory_order_relaxed);
+		}
+
+		auto start = Util::get_current_time_nsecs();
+		produce_frame(manager, rnd, events_per_frame);
+		auto mid = Util::get_current_time_nsecs();
+		dispatch(manager);
+		auto end = Util::get_current_time_nsecs();
+
+		result.enqueue_ms += 1e-6 * double(mid - start);
+		result.dispatch_ms += 1e-6 * double(end - mid);
+	}
+
+	result.enqueue_ms /= num_frames;
+	result.dispatch_ms /= num_frames;
+	result.allocations = double(allocation_count.load(std::memory_order_relaxed)) / num_frames;
+
+	for (unsigned i = 0; i < num_consumers; i++)
+		result.checksum += consumers[i].total();
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	constexpr unsigned NumConsumers = 2;
+	constexpr unsigned NumFrames = 600;
+	unsigned events_per_second = argc >= 2 ? unsigned(strtoul(argv[1], nullptr, 0)) : 1000000u;
+	unsigned events_per_frame = std::max(1u, events_per_second / 60);
+
+	ThreadGroup group;
+	group.start(std::max(1u, std::thread::hardware_concurrency()), 0, {});
+
+	LOGI("%u events / frame, %u frames, %u handlers per event type, %u threads.\n",
+	     events_per_frame, NumFrames, NumConsumers, group.get_num_threads());
+
+	auto report = [&](const char *desc, const Result &result) {
+		double frame_ms = result.enqueue_ms + result.dispatch_ms;
+		LOGI("  %s enqueue %7.3f ms, dispatch %7.3f ms, %7.2f M events / s, %9.1f allocations / frame\n",
+		     desc, result.enqueue_ms, result.dispatch_ms,
+		     1e-3 * double(events_per_frame) / frame_ms, result.allocations);
+	};
+
+	Result reference;
+	{
+		LegacyEventManager manager;
+		Consumer consumers[NumConsumers];
+		for (auto &c : consumers)
+		{
+			manager.register_handler<Consumer, PointerMoveEvent, &Consumer::on_pointer>(&c);
+			manager.register_handler<Consumer, AudioTimingEvent, &Consumer::on_audio>(&c);
+			manager.register_handler<Consumer, DeviceStateEvent, &Consumer::on_device>(&c);
+		}
+		reference = run_frames(manager, consumers, NumConsumers, events_per_frame, NumFrames,
+		                       [](LegacyEventManager &m) { m.dispatch(); });
+		report("unique_ptr per event (reference):", reference);
+	}
+
+	struct Config
+	{
+		const char *desc;
+		bool batch;
+		EventDelivery delivery;
+	};
+
+	const Config configs[] = {
+		{ "pooled, per-event handlers:       ", false, EventDelivery::Inline },
+		{ "pooled, batch handlers:           ", true, EventDelivery::Inline },
+		{ "pooled, batch handlers on workers:", true, EventDelivery::Worker },
+	};
+
+	for (auto &config : configs)
+	{
+		// Handlers unregister themselves on destruction, so they must go away before the manager.
+		EventManager manager;
+		Consumer consumers[NumConsumers];
+		for (auto &c : consumers)
+		{
+			if (config.batch)
+			{
+				manager.register_batch_handler<Consumer, PointerMoveEvent, &Consumer::on_pointer_batch>(&c, config.delivery);
+				manager.register_batch_handler<Consumer, AudioTimingEvent, &Consumer::on_audio_batch>(&c, config.delivery);
+				manager.register_batch_handler<Consumer, DeviceStateEvent, &Consumer::on_device_batch>(&c, config.delivery);
+			}
+			else
+			{
+				manager.register_handler<Consumer, PointerMoveEvent, &Consumer::on_pointer>(&c, config.delivery);
+				manager.register_handler<Consumer, AudioTimingEvent, &Consumer::on_audio>(&c, config.delivery);
+				manager.register_handler<Consumer, DeviceStateEvent, &Consumer::on_device>(&c, config.delivery);
+			}
+		}
+
+		auto result = run_frames(manager, consumers, NumConsumers, events_per_frame, NumFrames,
+		                         [&](EventManager &m) { m.dispatch(&group); });
+		report(config.desc, result);
+
+		if (result.checksum != reference.checksum)
+		{
+			LOGE("Checksum mismatch, events were lost or duplicated.\n");
+			return EXIT_FAILURE;
+		}
+	}
+}
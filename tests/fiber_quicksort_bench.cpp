@@ -0,0 +1,118 @@
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <thread>
+
+using namespace Granite;
+
+static constexpr size_t NumElements = 4 * 1024 * 1024;
+static constexpr size_t SerialCutoff = 4096;
+
+// Fork/join quicksort: the left half is forked as a task, the right half is sorted inline, then we join.
+// Every forked task above the depth limit waits on its own child from inside a worker.
+static void quicksort(ThreadGroup &group, uint32_t *data, size_t count, unsigned depth)
+{
+	if (count <= SerialCutoff || depth == 0)
+	{
+		std::sort(data, data + count);
+		return;
+	}
+
+	uint32_t a = data[0], b = data[count / 2], c = data[count - 1];
+	uint32_t pivot = std::max(std::min(a, b), std::min(std::max(a, b), c));
+
+	// Three-way partition so runs of equal keys cannot degenerate the recursion.
+	uint32_t *lo = std::partition(data, data + count, [pivot](uint32_t v) { return v < pivot; });
+	uint32_t *hi = std::partition(lo, data + count, [pivot](uint32_t v) { return v == pivot; });
+
+	size_t left_count = size_t(lo - data);
+	auto left = group.create_task([&group, data, left_count, depth]() {
+		quicksort(group, data, left_count, depth - 1);
+	});
+	left->flush();
+
+	quicksort(group, hi, size_t(data + count - hi), depth - 1);
+	left->wait();
+}
+
+// Without fibers, every waiting task holds on to a worker thread.
+// A task forked with depth r waits iff r != 0, so with depth limit D there are 2^(D - 1) - 1 blocked tasks
+// at worst, and at least one worker must remain to run the leaves.
+static unsigned max_blocking_depth(unsigned num_threads)
+{
+	unsigned depth = 1;
+	while ((1u << depth) <= num_threads)
+		depth++;
+	return depth;
+}
+
+static double run_sort(TaskScheduler scheduler, unsigned num_threads, bool fibers, unsigned depth,
+                       const std::vector<uint32_t> &input)
+{
+	ThreadGroup group;
+	group.set_scheduler(scheduler);
+	group.set_fiber_mode(fibers);
+	group.start(num_threads, 0, {});
+
+	constexpr unsigned Iterations = 4;
+	double total_ms = 0.0;
+	std::vector<uint32_t> data;
+
+	for (unsigned i = 0; i < Iterations; i++)
+	{
+		data = input;
+		auto start = Util::get_current_time_nsecs();
+		quicksort(group, data.data(), data.size(), depth);
+		auto end = Util::get_current_time_nsecs();
+		total_ms += 1e-6 * double(end - start);
+
+		if (!std::is_sorted(data.begin(), data.end()))
+		{
+			LOGE("Sort failed!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return total_ms / Iterations;
+}
+
+int main()
+{
+	std::vector<uint32_t> input(NumElements);
+	uint32_t x = 1;
+	for (auto &v : input)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		v = x;
+	}
+
+	unsigned all_cores = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> thread_counts = { 1, 4, 16 };
+	if (all_cores != 1 && all_cores != 4 && all_cores != 16)
+		thread_counts.push_back(all_cores);
+
+	// Only limited by SerialCutoff.
+	constexpr unsigned UnlimitedDepth = 64;
+
+	for (auto scheduler : { TaskScheduler::GlobalQueue, TaskScheduler::WorkStealing })
+	{
+		for (unsigned count : thread_counts)
+		{
+			unsigned depth = max_blocking_depth(count);
+			double blocking = run_sort(scheduler, count, false, depth, input);
+			double fiber = run_sort(scheduler, count, true, depth, input);
+			double fiber_unlimited = run_sort(scheduler, count, true, UnlimitedDepth, input);
+
+			LOGI("%14s | %3u threads | blocking (depth %u) %8.3f ms | fibers (depth %u) %8.3f ms | "
+			     "fibers (unlimited) %8.3f ms\n",
+			     scheduler == TaskScheduler::WorkStealing ? "work-stealing" : "global-queue",
+			     count, depth, blocking, depth, fiber, fiber_unlimited);
+		}
+	}
+}
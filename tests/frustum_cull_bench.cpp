@@ -0,0 +1,159 @@
+#include "simd.hpp"
+#include "simd_cull.hpp"
+#include "frustum.hpp"
+#include "transforms.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <random>
+#include <vector>
+#include <stdlib.h>
+
+using namespace Granite;
+
+static size_t cull_per_object(const std::vector<AABB> &boxes, const Frustum &frustum, uint32_t *indices)
+{
+	size_t count = 0;
+	for (size_t i = 0, n = boxes.size(); i < n; i++)
+		if (SIMD::frustum_cull(boxes[i], frustum.get_planes()))
+			indices[count++] = uint32_t(i);
+	return count;
+}
+
+// Mirrors what Scene does when gathering: pack a block of AoS boxes, then cull the block.
+static size_t cull_pack_and_batch(const std::vector<AABB> &boxes, const Frustum &frustum,
+                                  AABBSoA &scratch, uint32_t *indices)
+{
+	constexpr size_t BlockSize = 256;
+	size_t count = 0;
+	scratch.resize(BlockSize);
+
+	for (size_t base = 0, n = boxes.size(); base < n; base += BlockSize)
+	{
+		size_t block_count = std::min(BlockSize, n - base);
+		for (size_t i = 0; i < block_count; i++)
+			scratch.set(i, boxes[base + i]);
+
+		size_t visible = SIMD::frustum_cull_batch(scratch, 0, block_count, frustum.get_planes(), indices + count);
+		for (size_t i = 0; i < visible; i++)
+			indices[count + i] += uint32_t(base);
+		count += visible;
+	}
+
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	size_t num_boxes = argc >= 2 ? size_t(strtoul(argv[1], nullptr, 0)) : 1000000;
+	constexpr unsigned Iterations = 20;
+
+	std::mt19937 rnd(1234);
+	std::uniform_real_distribution<float> pos_dist(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> size_dist(0.1f, 2.0f);
+
+	std::vector<AABB> boxes;
+	AABBSoA soa;
+	boxes.reserve(num_boxes);
+	soa.reserve(num_boxes);
+	for (size_t i = 0; i < num_boxes; i++)
+	{
+		vec3 center(pos_dist(rnd), pos_dist(rnd), pos_dist(rnd));
+		vec3 extent(size_dist(rnd), size_dist(rnd), size_dist(rnd));
+		AABB aabb(center - extent, center + extent);
+		boxes.push_back(aabb);
+		soa.push_back(aabb);
+	}
+
+	mat4 view = mat4_cast(look_at(vec3(0.3f, 0.1f, -1.0f), vec3(0.0f, 1.0f, 0.0f)));
+	Frustum frustum;
+	frustum.build_planes(inverse(projection(0.5f * pi<float>(), 16.0f / 9.0f, 0.1f, 150.0f) * view));
+
+	std::vector<uint32_t> ref_indices(num_boxes), batch_indices(num_boxes), packed_indices(num_boxes);
+	AABBSoA scratch;
+
+	double per_object = 0.0, batched = 0.0, packed = 0.0;
+	size_t ref_count = 0, batch_count = 0, packed_count = 0;
+
+	for (unsigned iter = 0; iter < Iterations; iter++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		ref_count = cull_per_object(boxes, frustum, ref_indices.data());
+		auto end = Util::get_current_time_nsecs();
+		per_object += double(end - start);
+
+		start = Util::get_current_time_nsecs();
+		batch_count = SIMD::frustum_cull_batch(soa, 0, soa.size(), frustum.get_planes(), batch_indices.data());
+		end = Util::get_current_time_nsecs();
+		batched += double(end - start);
+
+		start = Util::get_current_time_nsecs();
+		packed_count = cull_pack_and_batch(boxes, frustum, scratch, packed_indices.data());
+		end = Util::get_current_time_nsecs();
+		packed += double(end - start);
+	}
+
+	if (ref_count != batch_count || ref_count != packed_count)
+	{
+		LOGE("Visible count mismatch: %zu, %zu, %zu.\n", ref_count, batch_count, packed_count);
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < ref_count; i++)
+	{
+		if (ref_indices[i] != batch_indices[i] || ref_indices[i] != packed_indices[i])
+		{
+			LOGE("Visible index mismatch at %zu.\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Point light shadow: 6 cube faces culled one view at a time, or all at once.
+	const vec4 *cube_planes[6];
+	Frustum cube_frusta[6];
+	for (unsigned face = 0; face < 6; face++)
+	{
+		mat4 proj, face_view;
+		compute_cube_render_transform(vec3(10.0f, 0.0f, -20.0f), face, proj, face_view, 0.1f, 60.0f);
+		cube_frusta[face].build_planes(inverse(proj * face_view));
+		cube_planes[face] = cube_frusta[face].get_planes();
+	}
+
+	std::vector<uint32_t> view_masks(num_boxes);
+	double per_view = 0.0, multiview = 0.0;
+	size_t per_view_count = 0, multiview_count = 0;
+	for (unsigned iter = 0; iter < Iterations; iter++)
+	{
+		per_view_count = 0;
+		auto start = Util::get_current_time_nsecs();
+		for (auto *planes : cube_planes)
+			per_view_count += SIMD::frustum_cull_batch(soa, 0, soa.size(), planes, batch_indices.data());
+		auto end = Util::get_current_time_nsecs();
+		per_view += double(end - start);
+
+		start = Util::get_current_time_nsecs();
+		SIMD::frustum_cull_batch_multiview(soa, 0, soa.size(), cube_planes, 6, view_masks.data());
+		end = Util::get_current_time_nsecs();
+		multiview += double(end - start);
+
+		multiview_count = 0;
+		for (auto mask : view_masks)
+			multiview_count += __builtin_popcount(mask);
+	}
+
+	if (per_view_count != multiview_count)
+	{
+		LOGE("Multiview count mismatch: %zu, %zu.\n", per_view_count, multiview_count);
+		return EXIT_FAILURE;
+	}
+
+	LOGI("%zu boxes, %zu visible.\n", num_boxes, ref_count);
+	LOGI("  per-object frustum_cull:     %7.3f ms (%5.2f ns / box)\n",
+	     1e-6 * per_object / Iterations, per_object / (double(Iterations) * double(num_boxes)));
+	LOGI("  batched SoA:                 %7.3f ms (%5.2f ns / box)\n",
+	     1e-6 * batched / Iterations, batched / (double(Iterations) * double(num_boxes)));
+	LOGI("  pack AoS blocks + batched:   %7.3f ms (%5.2f ns / box)\n",
+	     1e-6 * packed / Iterations, packed / (double(Iterations) * double(num_boxes)));
+	LOGI("6 cube faces, %zu visible in total.\n", per_view_count);
+	LOGI("  batched SoA per face:        %7.3f ms\n", 1e-6 * per_view / Iterations);
+	LOGI("  batched SoA multiview:       %7.3f ms\n", 1e-6 * multiview / Iterations);
+}
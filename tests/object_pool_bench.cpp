@@ -0,0 +1,93 @@
+#include "object_pool.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+using namespace Util;
+
+// Same size as Internal::Task.
+struct Payload
+{
+	uint64_t data[8];
+};
+
+template <typename Pool>
+static double run_bench(Pool &pool, unsigned num_threads)
+{
+	constexpr unsigned Iterations = 20000;
+	constexpr unsigned BatchSize = 64;
+
+	std::vector<std::thread> threads;
+	auto start = Util::get_current_time_nsecs();
+
+	for (unsigned t = 0; t < num_threads; t++)
+	{
+		threads.emplace_back([&pool]() {
+			Payload *batch[BatchSize];
+			for (unsigned i = 0; i < Iterations; i++)
+			{
+				for (auto &b : batch)
+					b = pool.allocate();
+				for (auto *b : batch)
+					pool.free(b);
+			}
+		});
+	}
+
+	for (auto &t : threads)
+		t.join();
+
+	auto end = Util::get_current_time_nsecs();
+	double total = double(num_threads) * Iterations * BatchSize;
+	return total / (1e-9 * double(end - start));
+}
+
+// Producer allocates, consumer frees, like tasks created on the main thread and retired on workers.
+template <typename Pool>
+static double run_bench_cross_thread(Pool &pool)
+{
+	constexpr unsigned Count = 1u << 20;
+	std::vector<Payload *> objects(Count);
+
+	auto start = Util::get_current_time_nsecs();
+	std::thread producer([&]() {
+		for (auto &o : objects)
+			o = pool.allocate();
+	});
+	producer.join();
+	std::thread consumer([&]() {
+		for (auto *o : objects)
+			pool.free(o);
+	});
+	consumer.join();
+	auto end = Util::get_current_time_nsecs();
+
+	return double(Count) / (1e-9 * double(end - start));
+}
+
+int main()
+{
+	unsigned all_cores = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> thread_counts = { 1, 2, 4, 8, 16 };
+	if (std::find(thread_counts.begin(), thread_counts.end(), all_cores) == thread_counts.end())
+		thread_counts.push_back(all_cores);
+
+	for (unsigned count : thread_counts)
+	{
+		ThreadSafeObjectPool<Payload> locked_pool;
+		ThreadCachedObjectPool<Payload> cached_pool;
+		double locked = run_bench(locked_pool, count);
+		double cached = run_bench(cached_pool, count);
+		LOGI("%2u threads | ThreadSafeObjectPool %8.3f M allocs/s | ThreadCachedObjectPool %8.3f M allocs/s\n",
+		     count, 1e-6 * locked, 1e-6 * cached);
+	}
+
+	ThreadSafeObjectPool<Payload> locked_pool;
+	ThreadCachedObjectPool<Payload> cached_pool;
+	double locked = run_bench_cross_thread(locked_pool);
+	double cached = run_bench_cross_thread(cached_pool);
+	LOGI("cross-thread | ThreadSafeObjectPool %8.3f M allocs/s | ThreadCachedObjectPool %8.3f M allocs/s\n",
+	     1e-6 * locked, 1e-6 * cached);
+}
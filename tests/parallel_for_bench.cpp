@@ -0,0 +1,77 @@
+#include "parallel_for.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <stdlib.h>
+
+using namespace Granite;
+
+static void work(float *data, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++)
+		data[i] = data[i] * 0.5f + 1.0f;
+}
+
+int main()
+{
+	ThreadGroup group;
+	unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+	group.start(num_threads, 0, {});
+
+	std::vector<float> data(1u << 24, 1.0f);
+
+	// Sanity check the reduction against a serial sum.
+	uint64_t expected = 0;
+	for (size_t i = 0; i < 100000; i++)
+		expected += i;
+	uint64_t result = parallel_reduce(group, 0, 100000, 0, uint64_t(0),
+	                                  [](size_t begin, size_t end) {
+		                                  uint64_t sum = 0;
+		                                  for (size_t i = begin; i < end; i++)
+			                                  sum += i;
+		                                  return sum;
+	                                  },
+	                                  [](uint64_t a, uint64_t b) { return a + b; });
+	if (result != expected)
+	{
+		LOGE("parallel_reduce mismatch, got %llu, expected %llu.\n",
+		     static_cast<unsigned long long>(result), static_cast<unsigned long long>(expected));
+		return EXIT_FAILURE;
+	}
+
+	for (size_t count = 1000; count <= data.size(); count *= 8)
+	{
+		constexpr unsigned Iterations = 16;
+
+		auto start = Util::get_current_time_nsecs();
+		for (unsigned i = 0; i < Iterations; i++)
+			work(data.data(), 0, count);
+		auto serial_ns = double(Util::get_current_time_nsecs() - start) / Iterations;
+
+		start = Util::get_current_time_nsecs();
+		for (unsigned i = 0; i < Iterations; i++)
+		{
+			parallel_for_chunked(group, 0, count, 0, [&](size_t begin, size_t end) {
+				work(data.data(), begin, end);
+			});
+		}
+		auto blocking_ns = double(Util::get_current_time_nsecs() - start) / Iterations;
+
+		start = Util::get_current_time_nsecs();
+		for (unsigned i = 0; i < Iterations; i++)
+		{
+			auto task = group.create_task();
+			parallel_for(*task, 0, count, 0, [&](size_t index) {
+				data[index] = data[index] * 0.5f + 1.0f;
+			});
+			task->wait();
+		}
+		auto task_group_ns = double(Util::get_current_time_nsecs() - start) / Iterations;
+
+		LOGI("%9zu elements | serial %7.3f ns/elem | parallel_for_chunked %7.3f ns/elem | "
+		     "parallel_for (TaskGroup) %7.3f ns/elem\n",
+		     count, serial_ns / double(count), blocking_ns / double(count), task_group_ns / double(count));
+	}
+}
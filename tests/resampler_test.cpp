@@ -1,8 +1,16 @@
 #include "dsp/sinc_resampler.hpp"
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
 #include "global_managers_init.hpp"
 #include "filesystem.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
 
+using namespace Granite;
 using namespace Granite::Audio::DSP;
 
 static void test_reported_sizes()
@@ -13,8 +21,22 @@ static void test_reported_sizes()
 	float out_buffer[16 * 1024] = {};
 	float in_buffer[16 * 1024] = {};
 
+	// Both directions between 44.1 kHz and 48 kHz use exact phases.
+	SincResampler resampler_exact_up(48000.0f, 44100.0f, SincResampler::Quality::High);
+	SincResampler resampler_exact_down(44100.0f, 48000.0f, SincResampler::Quality::High);
+	if (!resampler_exact_up.is_using_exact_phases() || !resampler_exact_down.is_using_exact_phases())
+		exit(EXIT_FAILURE);
+
 	for (size_t i = 1; i < 8092; i++)
 	{
+		for (auto *resampler : { &resampler_exact_up, &resampler_exact_down })
+		{
+			size_t max_output = resampler->get_maximum_output_for_input_frames(i);
+			size_t rendered_output = resampler->process_and_accumulate_input_frames(out_buffer, in_buffer, i);
+			if (rendered_output > max_output)
+				exit(EXIT_FAILURE);
+		}
+
 		{
 			size_t max_output = resampler_up.get_maximum_output_for_input_frames(i);
 			size_t rendered_output = resampler_up.process_and_accumulate_input_frames(out_buffer, in_buffer, i);
@@ -31,9 +53,264 @@ static void test_reported_sizes()
 	}
 }
 
+static const SincResampler::Quality qualities[] = {
+	SincResampler::Quality::Low, SincResampler::Quality::Medium, SincResampler::Quality::High,
+};
+
+static const char *get_quality_name(SincResampler::Quality quality)
+{
+	switch (quality)
+	{
+	case SincResampler::Quality::Low:
+		return "low";
+	case SincResampler::Quality::Medium:
+		return "medium";
+	case SincResampler::Quality::High:
+		return "high";
+	default:
+		return "?";
+	}
+}
+
+struct RateConfig
+{
+	const char *desc;
+	float out_rate;
+	float in_rate;
+	// Forces the interpolated phase table for rates which would get exact phases.
+	bool interpolate;
+};
+
+static const RateConfig rate_configs[] = {
+	{ "44.1k -> 48k, exact       ", 48000.0f, 44100.0f, false },
+	{ "44.1k -> 48k, interpolated", 48000.0f, 44100.0f, true },
+	{ "48k -> 44.1k, exact       ", 44100.0f, 48000.0f, false },
+	{ "48k -> 44.1k, interpolated", 44100.0f, 48000.0f, true },
+};
+
+static std::unique_ptr<SincResampler> create_resampler(const RateConfig &config, SincResampler::Quality quality,
+                                                       unsigned channels)
+{
+	std::unique_ptr<SincResampler> resampler(new SincResampler(config.out_rate, config.in_rate, quality, channels));
+	if (config.interpolate)
+		resampler->set_sample_rate_ratio(config.out_rate / config.in_rate);
+	return resampler;
+}
+
+// Two channels of sines, well below the cutoff at either rate.
+static void fill_input(std::vector<float> *channels, size_t frames, float rate)
+{
+	for (unsigned c = 0; c < 2; c++)
+	{
+		channels[c].resize(frames);
+		for (size_t i = 0; i < frames; i++)
+			channels[c][i] = 0.5f * sinf(2.0f * 3.14159265f * (c ? 1000.0f : 440.0f) * float(i) / rate);
+	}
+}
+
+static bool resample_stereo(SincResampler::Quality quality, SIMD::BatchISA isa, const RateConfig &config,
+                            const std::vector<float> *input, std::vector<float> *output)
+{
+	if (!SincResampler::set_default_isa(isa))
+		return false;
+	auto resampler = create_resampler(config, quality, 2);
+
+	size_t frames = input[0].size();
+	for (unsigned c = 0; c < 2; c++)
+		output[c].assign(resampler->get_maximum_output_for_input_frames(frames), 0.0f);
+
+	const float *in_ptrs[2];
+	float *out_ptrs[2];
+	size_t rendered = 0;
+	for (size_t i = 0; i < frames; i += 256)
+	{
+		size_t to_process = std::min<size_t>(256, frames - i);
+		for (unsigned c = 0; c < 2; c++)
+		{
+			in_ptrs[c] = input[c].data() + i;
+			out_ptrs[c] = output[c].data() + rendered;
+		}
+		rendered += resampler->process_input_frames(out_ptrs, in_ptrs, to_process);
+	}
+
+	for (unsigned c = 0; c < 2; c++)
+		output[c].resize(rendered);
+	return true;
+}
+
+// Every instruction set and the multi-channel path must match mono scalar resampling,
+// and exact phases must match interpolated phases.
+static bool test_kernels()
+{
+	const SIMD::BatchISA isas[] = {
+		SIMD::BatchISA::SSE2, SIMD::BatchISA::NEON, SIMD::BatchISA::AVX2, SIMD::BatchISA::AVX512,
+	};
+	auto default_isa = SincResampler::get_default_isa();
+
+	std::vector<float> input[2];
+	bool ok = true;
+
+	for (auto quality : qualities)
+	{
+		for (auto &config : rate_configs)
+		{
+			fill_input(input, 8000, config.in_rate);
+
+			// Reference is one mono scalar resampler per channel.
+			std::vector<float> reference[2];
+			SincResampler::set_default_isa(SIMD::BatchISA::Scalar);
+			for (unsigned c = 0; c < 2; c++)
+			{
+				auto resampler = create_resampler(config, quality, 1);
+				reference[c].resize(resampler->get_maximum_output_for_input_frames(input[c].size()));
+				reference[c].resize(resampler->process_input_frames(reference[c].data(), input[c].data(), input[c].size()));
+			}
+
+			for (auto isa : isas)
+			{
+				std::vector<float> output[2];
+				if (!resample_stereo(quality, isa, config, input, output))
+					continue;
+
+				float max_diff = 0.0f;
+				for (unsigned c = 0; c < 2; c++)
+				{
+					if (output[c].size() != reference[c].size())
+						max_diff = INFINITY;
+					else
+						for (size_t i = 0; i < output[c].size(); i++)
+							max_diff = fmaxf(max_diff, fabsf(output[c][i] - reference[c][i]));
+				}
+
+				if (max_diff > 1e-5f)
+				{
+					LOGE("%s, %s quality: %s differs from scalar by %g.\n",
+					     config.desc, get_quality_name(quality), SIMD::get_batch_isa_name(isa), max_diff);
+					ok = false;
+				}
+			}
+		}
+
+		// Exact and interpolated phases approximate the same filter. Skip the start, where the histories differ.
+		for (unsigned i = 0; i < 4; i += 2)
+		{
+			std::vector<float> exact[2], interpolated[2];
+			fill_input(input, 8000, rate_configs[i].in_rate);
+			resample_stereo(quality, default_isa, rate_configs[i], input, exact);
+			resample_stereo(quality, default_isa, rate_configs[i + 1], input, interpolated);
+
+			float max_diff = 0.0f;
+			size_t count = std::min(exact[0].size(), interpolated[0].size());
+			for (unsigned c = 0; c < 2; c++)
+				for (size_t j = 1000; j < count; j++)
+					max_diff = fmaxf(max_diff, fabsf(exact[c][j] - interpolated[c][j]));
+
+			if (max_diff > 1e-3f)
+			{
+				LOGE("%s quality: exact phases differ from interpolated phases by %g.\n",
+				     get_quality_name(quality), max_diff);
+				ok = false;
+			}
+		}
+	}
+
+	SincResampler::set_default_isa(default_isa);
+	return ok;
+}
+
+// Output frames per second for a stereo stream, like ResampledStream renders it.
+static double measure_throughput(SincResampler::Quality quality, const RateConfig &config, bool multi_channel)
+{
+	constexpr size_t BlockFrames = 512;
+	constexpr unsigned Iterations = 2000;
+
+	std::vector<float> input[2];
+	fill_input(input, 4096, config.in_rate);
+	std::vector<float> output[2];
+	for (auto &o : output)
+		o.resize(BlockFrames);
+
+	std::unique_ptr<SincResampler> resamplers[2];
+	resamplers[0] = create_resampler(config, quality, multi_channel ? 2 : 1);
+	if (!multi_channel)
+		resamplers[1] = create_resampler(config, quality, 1);
+
+	// Best of a few runs, since other work on the machine only ever makes a run slower.
+	int64_t best_time = INT64_MAX;
+	size_t offset = 0;
+	for (unsigned run = 0; run < 3; run++)
+	{
+		auto start = Util::get_current_time_nsecs();
+		for (unsigned iter = 0; iter < Iterations; iter++)
+		{
+			size_t need = resamplers[0]->get_current_input_for_output_frames(BlockFrames);
+			if (offset + need > input[0].size())
+				offset = 0;
+
+			const float *in_ptrs[2] = { input[0].data() + offset, input[1].data() + offset };
+			float *out_ptrs[2] = { output[0].data(), output[1].data() };
+			if (multi_channel)
+				resamplers[0]->process_and_accumulate_output_frames(out_ptrs, in_ptrs, BlockFrames);
+			else
+				for (unsigned c = 0; c < 2; c++)
+					resamplers[c]->process_and_accumulate_output_frames(out_ptrs[c], in_ptrs[c], BlockFrames);
+			offset += need;
+		}
+		best_time = std::min(best_time, Util::get_current_time_nsecs() - start);
+	}
+
+	return double(BlockFrames) * Iterations / (1e-9 * double(best_time));
+}
+
+static void run_benchmark()
+{
+	const SIMD::BatchISA isas[] = {
+		SIMD::BatchISA::Scalar, SIMD::BatchISA::SSE2, SIMD::BatchISA::NEON,
+		SIMD::BatchISA::AVX2, SIMD::BatchISA::AVX512,
+	};
+	auto default_isa = SincResampler::get_default_isa();
+
+	LOGI("Stereo output throughput in M frames / s, default is %s.\n", SIMD::get_batch_isa_name(default_isa));
+	for (auto quality : qualities)
+	{
+		LOGI("%s quality:\n", get_quality_name(quality));
+		for (auto isa : isas)
+		{
+			if (!SincResampler::set_default_isa(isa))
+				continue;
+
+			SincResampler probe(48000.0f, 44100.0f, quality);
+			if (probe.get_isa() != isa)
+			{
+				LOGI("  %-7s is wider than the filter, uses %s.\n",
+				     SIMD::get_batch_isa_name(isa), SIMD::get_batch_isa_name(probe.get_isa()));
+				continue;
+			}
+
+			for (auto &config : rate_configs)
+			{
+				LOGI("  %-7s %s: %8.2f (2x mono) %8.2f (stereo)\n", SIMD::get_batch_isa_name(isa), config.desc,
+				     1e-6 * measure_throughput(quality, config, false),
+				     1e-6 * measure_throughput(quality, config, true));
+			}
+		}
+	}
+
+	SincResampler::set_default_isa(default_isa);
+}
+
 int main(int argc, char **argv)
 {
 	test_reported_sizes();
+	if (!test_kernels())
+		return EXIT_FAILURE;
+
+	if (argc == 2 && strcmp(argv[1], "--bench") == 0)
+	{
+		run_benchmark();
+		return EXIT_SUCCESS;
+	}
+
 	if (argc != 4)
 		return EXIT_FAILURE;
 
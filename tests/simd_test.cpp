@@ -1,11 +1,17 @@
 #include "simd.hpp"
+#include "simd_cull.hpp"
+#include "simd_transform.hpp"
+#include "simd_batch.hpp"
 #include "muglm/muglm_impl.hpp"
 #include "muglm/matrix_helper.hpp"
 #include "logging.hpp"
 #include "transforms.hpp"
 #include "frustum.hpp"
+#include "timer.hpp"
 #include <assert.h>
 #include <string.h>
+#include <random>
+#include <vector>
 
 using namespace Granite;
 
@@ -71,6 +77,247 @@ static void test_frustum_cull()
 	}
 }
 
+static void test_frustum_cull_batch()
+{
+	mat4 m = projection(0.4f, 1.0f, 0.1f, 5.0f);
+	Frustum frustum;
+	frustum.build_planes(inverse(m));
+
+	AABBSoA boxes;
+	std::vector<AABB> reference;
+	for (int z = -10; z <= 10; z++)
+	{
+		for (int y = -10; y <= 10; y++)
+		{
+			for (int x = -10; x <= 10; x++)
+			{
+				AABB aabb(vec3(x, y, z) * 0.25f - 0.1f, vec3(x, y, z) * 0.25f + 0.1f);
+				boxes.push_back(aabb);
+				reference.push_back(aabb);
+			}
+		}
+	}
+
+	boxes.resize(boxes.size() + 1);
+	boxes.set_unbounded(boxes.size() - 1);
+
+	std::vector<uint32_t> indices(boxes.size());
+	std::vector<uint32_t> scalar_indices(boxes.size());
+
+	// Odd ranges exercise unaligned heads and partial tails.
+	const size_t ranges[][2] = { { 0, boxes.size() }, { 3, boxes.size() - 5 }, { 17, 18 }, { 100, 100 } };
+	for (auto &range : ranges)
+	{
+		size_t count = SIMD::frustum_cull_batch(boxes, range[0], range[1], frustum.get_planes(), indices.data());
+		size_t scalar_count = SIMD::frustum_cull_batch_scalar(boxes, range[0], range[1], frustum.get_planes(),
+		                                                      scalar_indices.data());
+
+		if (count != scalar_count || memcmp(indices.data(), scalar_indices.data(), count * sizeof(uint32_t)) != 0)
+		{
+			LOGE("Batched frustum cull mismatch against scalar path.\n");
+			exit(1);
+		}
+
+		size_t expected = 0;
+		for (size_t i = range[0]; i < range[1]; i++)
+		{
+			bool visible = i >= reference.size() || SIMD::frustum_cull(reference[i], frustum.get_planes());
+			if (visible)
+			{
+				if (expected >= count || indices[expected] != i - range[0])
+				{
+					LOGE("Batched frustum cull mismatch.\n");
+					exit(1);
+				}
+				expected++;
+			}
+		}
+
+		if (expected != count)
+		{
+			LOGE("Batched frustum cull mismatch.\n");
+			exit(1);
+		}
+	}
+}
+
+static void test_frustum_cull_batch_partial_tail()
+{
+	mat4 m = projection(0.4f, 1.0f, 0.1f, 5.0f);
+	Frustum frustum;
+	frustum.build_planes(inverse(m));
+
+	// Every box is visible and the last batch is partial, so a kernel which emits padded lanes
+	// writes past the room for (end - begin) indices, which is caught by the guard entry.
+	const size_t counts[] = { 1, 3, 7, 9, 17, 31 };
+	for (auto count : counts)
+	{
+		AABBSoA boxes;
+		boxes.resize(count);
+		for (size_t i = 0; i < count; i++)
+			boxes.set_unbounded(i);
+
+		for (size_t begin = 0; begin < std::min<size_t>(count, 3); begin++)
+		{
+			constexpr uint32_t Guard = 0xdeadbeefu;
+			std::vector<uint32_t> indices(count - begin + 1, Guard);
+			size_t visible = SIMD::frustum_cull_batch(boxes, begin, count, frustum.get_planes(), indices.data());
+
+			if (visible != count - begin || indices.back() != Guard)
+			{
+				LOGE("Batched frustum cull wrote outside of its range for %u boxes.\n", unsigned(count - begin));
+				exit(1);
+			}
+
+			for (size_t i = 0; i < visible; i++)
+			{
+				if (indices[i] != i)
+				{
+					LOGE("Batched frustum cull indices are not relative to the range.\n");
+					exit(1);
+				}
+			}
+		}
+	}
+}
+
+static void test_frustum_cull_multiview()
+{
+	AABBSoA boxes;
+	std::vector<AABB> reference;
+	for (int z = -12; z <= 12; z++)
+	{
+		for (int y = -6; y <= 6; y++)
+		{
+			for (int x = -12; x <= 12; x++)
+			{
+				AABB aabb(vec3(x, y, z) * 0.5f - 0.2f, vec3(x, y, z) * 0.5f + 0.2f);
+				boxes.push_back(aabb);
+				reference.push_back(aabb);
+			}
+		}
+	}
+
+	// Cube faces around a point, as used by point light shadows.
+	Frustum frusta[6];
+	const vec4 *planes[6];
+	for (unsigned face = 0; face < 6; face++)
+	{
+		mat4 proj, view;
+		compute_cube_render_transform(vec3(0.3f, -0.2f, 0.1f), face, proj, view, 0.1f, 4.0f);
+		frusta[face].build_planes(inverse(proj * view));
+		planes[face] = frusta[face].get_planes();
+	}
+
+	std::vector<uint32_t> masks(boxes.size()), scalar_masks(boxes.size());
+	const size_t ranges[][2] = { { 0, boxes.size() }, { 5, boxes.size() - 3 }, { 31, 33 } };
+	for (auto &range : ranges)
+	{
+		size_t count = range[1] - range[0];
+		SIMD::frustum_cull_batch_multiview(boxes, range[0], range[1], planes, 6, masks.data());
+		SIMD::frustum_cull_batch_multiview_scalar(boxes, range[0], range[1], planes, 6, scalar_masks.data());
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t expected = 0;
+			for (unsigned face = 0; face < 6; face++)
+				if (SIMD::frustum_cull(reference[range[0] + i], planes[face]))
+					expected |= 1u << face;
+
+			if (masks[i] != expected || scalar_masks[i] != expected)
+			{
+				LOGE("Multiview frustum cull mismatch.\n");
+				exit(1);
+			}
+		}
+	}
+}
+
+static void test_transform_batch()
+{
+	// Odd count, so both full batches and the scalar tail are exercised.
+	constexpr size_t Count = 37;
+	TransformSoA transforms;
+	transforms.resize(Count);
+	AABBSoA boxes, batch_boxes;
+	boxes.resize(Count);
+	batch_boxes.resize(Count);
+
+	std::vector<mat4> reference(Count), parents(Count), worlds(Count);
+	std::vector<const mat4 *> parent_ptrs(Count);
+	std::vector<mat4 *> world_ptrs(Count);
+	std::vector<AABB> local_boxes;
+
+	for (size_t i = 0; i < Count; i++)
+	{
+		float f = float(i);
+		vec3 scale(1.0f + 0.1f * f, 0.5f + 0.05f * f, -2.0f + 0.2f * f);
+		quat rotation = angleAxis(0.3f * f, normalize(vec3(0.1f * f - 1.0f, 0.4f, 0.2f + 0.01f * f)));
+		vec3 translation(f, -2.0f * f, 0.5f * f - 3.0f);
+
+		auto &parent = parents[i];
+		compute_model_transform(parent, vec3(0.5f + f), angleAxis(-0.1f * f, vec3(0.0f, 1.0f, 0.0f)),
+		                        vec3(3.0f, f, -f), mat4(1.0f));
+		compute_model_transform(reference[i], scale, rotation, translation, parent);
+
+		transforms.set_local(i, scale, rotation, translation);
+		parent_ptrs[i] = &parent;
+		world_ptrs[i] = &worlds[i];
+
+		AABB aabb(vec3(-f, 0.5f, -1.0f), vec3(1.0f, 2.0f + f, 3.0f));
+		local_boxes.push_back(aabb);
+		boxes.set(i, aabb);
+	}
+
+	// Offset, so both transposed groups of four and the remainder are exercised.
+	transforms.set_parent(0, parents[0]);
+	transforms.set_parents(1, parent_ptrs.data() + 1, Count - 1);
+
+	for (int scalar = 0; scalar < 2; scalar++)
+	{
+		if (scalar)
+			SIMD::compute_model_transform_batch_scalar(transforms, 0, Count);
+		else
+			SIMD::compute_model_transform_batch(transforms, 0, Count);
+
+		transforms.get_worlds(0, world_ptrs.data(), Count);
+		for (size_t i = 0; i < Count; i++)
+		{
+			auto &m = worlds[i];
+			for (unsigned col = 0; col < 4; col++)
+			{
+				if (distance(m[col], reference[i][col]) > 0.0001f * (1.0f + length(reference[i][col])))
+				{
+					LOGE("Batched model transform mismatch.\n");
+					exit(1);
+				}
+			}
+		}
+
+		if (scalar)
+			SIMD::transform_aabb_batch_scalar(batch_boxes, boxes, transforms, 0, Count);
+		else
+			SIMD::transform_aabb_batch(batch_boxes, boxes, transforms, 0, Count);
+
+		for (size_t i = 0; i < Count; i++)
+		{
+			mat4 m;
+			transforms.get_world(i, m);
+			AABB ref_aabb;
+			SIMD::transform_aabb(ref_aabb, local_boxes[i], m);
+			AABB aabb = batch_boxes.get(i);
+
+			float tolerance = 0.0001f * (1.0f + length(ref_aabb.get_maximum() - ref_aabb.get_minimum()));
+			if (distance(ref_aabb.get_minimum(), aabb.get_minimum()) > tolerance ||
+			    distance(ref_aabb.get_maximum(), aabb.get_maximum()) > tolerance)
+			{
+				LOGE("Batched AABB transform mismatch.\n");
+				exit(1);
+			}
+		}
+	}
+}
+
 static void test_quat()
 {
 	quat q(-0.91354f, 0.123415f, 0.4325f, -0.8434f);
@@ -98,11 +345,243 @@ static void test_quat()
 	}
 }
 
-int main()
+static const SIMD::BatchISA batch_isas[] = {
+	SIMD::BatchISA::Scalar, SIMD::BatchISA::SSE2, SIMD::BatchISA::AVX,
+	SIMD::BatchISA::AVX2, SIMD::BatchISA::AVX512, SIMD::BatchISA::NEON,
+};
+
+// Structure-of-arrays test data for the batch math functions.
+struct BatchData
+{
+	explicit BatchData(size_t count_)
+		: count(count_), a(16 * count), b(16 * count), out(16 * count), t(count)
+	{
+		std::mt19937 rnd(1337);
+		std::uniform_real_distribution<float> uni(-1.0f, 1.0f);
+		for (auto &v : a)
+			v = uni(rnd);
+		for (auto &v : b)
+			v = uni(rnd);
+		for (auto &v : t)
+			v = 0.5f + 0.5f * uni(rnd);
+
+		// Quaternions in the first four streams. Some pairs are almost the same rotation,
+		// which is where slerp usually has to fall back to nlerp.
+		for (size_t i = 0; i < count; i++)
+		{
+			quat qa = normalize(quat(a[3 * count + i], a[i], a[count + i], a[2 * count + i]));
+			quat qb = normalize(quat(b[3 * count + i], b[i], b[count + i], b[2 * count + i]));
+			if ((i % 7) == 0)
+				qb = normalize(quat(qa.as_vec4() + 0.001f * qb.as_vec4()));
+			if ((i % 5) == 0)
+				qb = quat(-qb.as_vec4());
+			set_quat(a.data(), i, qa);
+			set_quat(b.data(), i, qb);
+		}
+	}
+
+	void set_quat(float *streams, size_t i, const quat &q)
+	{
+		streams[i] = q.x;
+		streams[count + i] = q.y;
+		streams[2 * count + i] = q.z;
+		streams[3 * count + i] = q.w;
+	}
+
+	quat get_quat(const float *streams, size_t i) const
+	{
+		return quat(streams[3 * count + i], streams[i], streams[count + i], streams[2 * count + i]);
+	}
+
+	mat4 get_mat4(const float *streams, size_t i) const
+	{
+		mat4 m;
+		for (unsigned col = 0; col < 4; col++)
+			for (unsigned row = 0; row < 4; row++)
+				m[col][row] = streams[(4 * col + row) * count + i];
+		return m;
+	}
+
+	void get_streams(float **ptrs, float *streams) const
+	{
+		for (unsigned i = 0; i < 4; i++)
+			ptrs[i] = streams + i * count;
+	}
+
+	size_t count;
+	std::vector<float> a, b, out, t;
+};
+
+static void test_batch_math()
+{
+	// Odd count, so both full batches and the scalar tail are exercised.
+	constexpr size_t Count = 1037;
+	BatchData data(Count);
+	float *a[4], *b[4], *out[4];
+	data.get_streams(a, data.a.data());
+	data.get_streams(b, data.b.data());
+	data.get_streams(out, data.out.data());
+
+	SIMD::mat4_multiply_batch(data.out.data(), data.a.data(), data.b.data(), Count, Count);
+	for (size_t i = 0; i < Count; i++)
+	{
+		mat4 ref = data.get_mat4(data.a.data(), i) * data.get_mat4(data.b.data(), i);
+		mat4 m = data.get_mat4(data.out.data(), i);
+		for (unsigned col = 0; col < 4; col++)
+		{
+			if (distance(m[col], ref[col]) > 0.00001f * (1.0f + length(ref[col])))
+			{
+				LOGE("Batched matrix multiply mismatch.\n");
+				exit(1);
+			}
+		}
+	}
+
+	SIMD::vec3_normalize_batch(out, a, Count);
+	for (size_t i = 0; i < Count; i++)
+	{
+		vec3 ref = normalize(vec3(a[0][i], a[1][i], a[2][i]));
+		if (distance(ref, vec3(out[0][i], out[1][i], out[2][i])) > 0.000001f)
+		{
+			LOGE("Batched normalize mismatch.\n");
+			exit(1);
+		}
+	}
+
+	for (int slerp = 0; slerp < 2; slerp++)
+	{
+		if (slerp)
+			SIMD::quat_slerp_batch(out, a, b, data.t.data(), Count);
+		else
+			SIMD::quat_nlerp_batch(out, a, b, data.t.data(), Count);
+
+		for (size_t i = 0; i < Count; i++)
+		{
+			quat qa = data.get_quat(data.a.data(), i);
+			quat qb = data.get_quat(data.b.data(), i);
+			float l = data.t[i];
+
+			quat ref;
+			if (slerp)
+				ref = muglm::slerp(qa, qb, l);
+			else
+				ref = normalize(quat(mix(qa.as_vec4(), dot(qa.as_vec4(), qb.as_vec4()) < 0.0f ? -qb.as_vec4() : qb.as_vec4(), l)));
+
+			if (distance(ref.as_vec4(), data.get_quat(data.out.data(), i).as_vec4()) > 0.00001f)
+			{
+				LOGE("Batched %s mismatch.\n", slerp ? "slerp" : "nlerp");
+				exit(1);
+			}
+		}
+	}
+
+	// In-place.
+	SIMD::quat_slerp_batch(a, a, b, data.t.data(), Count);
+	if (memcmp(data.a.data(), data.out.data(), 4 * Count * sizeof(float)) != 0)
+	{
+		LOGE("In-place slerp mismatch.\n");
+		exit(1);
+	}
+}
+
+template <typename Func>
+static double measure_throughput(size_t count, const Func &func)
+{
+	// Repeat until the measurement is long enough to be meaningful.
+	unsigned iterations = 0;
+	auto start = Util::get_current_time_nsecs();
+	auto end = start;
+	do
+	{
+		func();
+		iterations++;
+		end = Util::get_current_time_nsecs();
+	} while (end - start < 100000000);
+
+	return 1e3 * double(count) * iterations / double(end - start);
+}
+
+static void run_batch_bench()
+{
+	// Fits in L2, so this mostly measures the kernels, not memory.
+	// A power of two stream stride would also make every stream compete for the same cache sets.
+	constexpr size_t Count = 4000;
+	BatchData data(Count);
+	float *a[4], *b[4], *out[4];
+	data.get_streams(a, data.a.data());
+	data.get_streams(b, data.b.data());
+	data.get_streams(out, data.out.data());
+
+	std::vector<mat4> ma(Count), mb(Count), mout(Count);
+	std::vector<vec3> va(Count);
+	std::vector<quat> qa(Count), qb(Count), qout(Count);
+	for (size_t i = 0; i < Count; i++)
+	{
+		ma[i] = data.get_mat4(data.a.data(), i);
+		mb[i] = data.get_mat4(data.b.data(), i);
+		va[i] = vec3(a[0][i], a[1][i], a[2][i]);
+		qa[i] = data.get_quat(data.a.data(), i);
+		qb[i] = data.get_quat(data.b.data(), i);
+	}
+
+	LOGI("Batch math throughput, %u elements, M elements / s:\n", unsigned(Count));
+	LOGI("  %-10s %10s %10s %10s %10s\n", "", "mat4 mul", "normalize", "nlerp", "slerp");
+
+	// One element at a time with muglm, which is what callers do today.
+	LOGI("  %-10s %10.1f %10.1f %10s %10.1f\n", "muglm",
+	     measure_throughput(Count, [&]() {
+		     for (size_t i = 0; i < Count; i++)
+			     mout[i] = ma[i] * mb[i];
+	     }),
+	     measure_throughput(Count, [&]() {
+		     for (size_t i = 0; i < Count; i++)
+			     va[i] = normalize(va[i]);
+	     }),
+	     "",
+	     measure_throughput(Count, [&]() {
+		     for (size_t i = 0; i < Count; i++)
+			     qout[i] = muglm::slerp(qa[i], qb[i], data.t[i]);
+	     }));
+
+	for (auto isa : batch_isas)
+	{
+		if (!SIMD::set_batch_isa(isa))
+			continue;
+
+		LOGI("  %-10s %10.1f %10.1f %10.1f %10.1f\n", SIMD::get_batch_isa_name(isa),
+		     measure_throughput(Count, [&]() {
+			     SIMD::mat4_multiply_batch(data.out.data(), data.a.data(), data.b.data(), Count, Count);
+		     }),
+		     measure_throughput(Count, [&]() { SIMD::vec3_normalize_batch(out, a, Count); }),
+		     measure_throughput(Count, [&]() { SIMD::quat_nlerp_batch(out, a, b, data.t.data(), Count); }),
+		     measure_throughput(Count, [&]() { SIMD::quat_slerp_batch(out, a, b, data.t.data(), Count); }));
+	}
+}
+
+int main(int argc, char **argv)
 {
 	test_matrix_multiply();
 	test_frustum_cull();
+	test_frustum_cull_batch();
+	test_frustum_cull_batch_partial_tail();
+	test_frustum_cull_multiview();
 	test_aabb_transform();
 	test_quat();
+
+	// Every instruction set the build and the CPU support must agree with muglm.
+	auto default_isa = SIMD::get_batch_isa();
+	for (auto isa : batch_isas)
+	{
+		if (!SIMD::set_batch_isa(isa))
+			continue;
+		LOGI("Testing batch math with %s.\n", SIMD::get_batch_isa_name(isa));
+		test_transform_batch();
+		test_batch_math();
+	}
+
+	if (argc >= 2 && strcmp(argv[1], "--bench") == 0)
+		run_batch_bench();
+
+	SIMD::set_batch_isa(default_isa);
 	LOGI(":D\n");
-}
\ No newline at end of file
+}
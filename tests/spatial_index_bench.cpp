@@ -0,0 +1,180 @@
+#include "dynamic_bvh.hpp"
+#include "simd_cull.hpp"
+#include "frustum.hpp"
+#include "transforms.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <random>
+#include <vector>
+#include <stdlib.h>
+
+using namespace Granite;
+
+// City-style layout: a grid of blocks, each with a few large buildings and many small props.
+// A small fraction of the props (traffic) moves every frame.
+struct City
+{
+	std::vector<AABB> boxes;
+	std::vector<uint32_t> dynamic_objects;
+};
+
+static City build_city(unsigned num_objects)
+{
+	constexpr float BlockSize = 50.0f;
+	constexpr unsigned ObjectsPerBlock = 50;
+	constexpr unsigned BuildingsPerBlock = 8;
+
+	City city;
+	std::mt19937 rnd(1337);
+	std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+
+	unsigned num_blocks = (num_objects + ObjectsPerBlock - 1) / ObjectsPerBlock;
+	auto blocks_per_row = unsigned(muglm::ceil(muglm::sqrt(float(num_blocks))));
+	float half_city = 0.5f * BlockSize * float(blocks_per_row);
+
+	for (unsigned i = 0; i < num_objects; i++)
+	{
+		unsigned block = i / ObjectsPerBlock;
+		unsigned local = i % ObjectsPerBlock;
+		vec2 block_origin = vec2(float(block % blocks_per_row), float(block / blocks_per_row)) * BlockSize - half_city;
+		vec2 pos = block_origin + vec2(uni(rnd), uni(rnd)) * BlockSize;
+
+		if (local < BuildingsPerBlock)
+		{
+			vec3 extent(2.0f + 6.0f * uni(rnd), 5.0f + 40.0f * uni(rnd), 2.0f + 6.0f * uni(rnd));
+			city.boxes.emplace_back(vec3(pos.x - extent.x, 0.0f, pos.y - extent.z),
+			                        vec3(pos.x + extent.x, 2.0f * extent.y, pos.y + extent.z));
+		}
+		else
+		{
+			vec3 extent(0.2f + 1.5f * uni(rnd), 0.2f + 1.0f * uni(rnd), 0.2f + 1.5f * uni(rnd));
+			city.boxes.emplace_back(vec3(pos.x - extent.x, 0.0f, pos.y - extent.z),
+			                        vec3(pos.x + extent.x, 2.0f * extent.y, pos.y + extent.z));
+			if (local % 25 == 0)
+				city.dynamic_objects.push_back(i);
+		}
+	}
+
+	return city;
+}
+
+// 4 directional shadow cascades around the camera, 2 point lights (12 cube faces) and 4 spot lights.
+static std::vector<Frustum> build_shadow_frusta(unsigned frame)
+{
+	std::vector<Frustum> frusta;
+	vec3 camera(40.0f * muglm::sin(0.01f * float(frame)), 2.0f, 10.0f * float(frame % 100));
+
+	mat4 sun_view = mat4_cast(look_at(normalize(vec3(0.3f, -1.0f, 0.2f)), vec3(0.0f, 0.0f, 1.0f))) *
+	                translate(-camera);
+	for (float radius : { 20.0f, 60.0f, 180.0f, 500.0f })
+	{
+		Frustum f;
+		f.build_planes(inverse(ortho(AABB(vec3(-radius, -radius, -300.0f), vec3(radius, radius, 300.0f))) * sun_view));
+		frusta.push_back(f);
+	}
+
+	for (unsigned light = 0; light < 2; light++)
+	{
+		vec3 center = camera + vec3(15.0f * float(light) - 7.0f, 4.0f, 12.0f);
+		for (unsigned face = 0; face < 6; face++)
+		{
+			mat4 proj, view;
+			compute_cube_render_transform(center, face, proj, view, 0.1f, 25.0f);
+			Frustum f;
+			f.build_planes(inverse(proj * view));
+			frusta.push_back(f);
+		}
+	}
+
+	for (unsigned light = 0; light < 4; light++)
+	{
+		vec3 pos = camera + vec3(30.0f * float(light) - 45.0f, 8.0f, 20.0f);
+		mat4 view = mat4_cast(look_at(normalize(vec3(0.1f, -1.0f, 0.3f)), vec3(0.0f, 0.0f, 1.0f))) * translate(-pos);
+		Frustum f;
+		f.build_planes(inverse(projection(0.8f, 1.0f, 0.1f, 40.0f) * view));
+		frusta.push_back(f);
+	}
+
+	return frusta;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned num_objects = argc >= 2 ? unsigned(strtoul(argv[1], nullptr, 0)) : 500000;
+	constexpr unsigned Frames = 30;
+
+	auto city = build_city(num_objects);
+
+	AABBSoA soa;
+	soa.resize(city.boxes.size());
+	for (size_t i = 0; i < city.boxes.size(); i++)
+		soa.set(i, city.boxes[i]);
+
+	DynamicBVH bvh;
+	std::vector<uint32_t> leaves(city.boxes.size());
+	auto start = Util::get_current_time_nsecs();
+	for (size_t i = 0; i < city.boxes.size(); i++)
+		leaves[i] = bvh.insert(city.boxes[i], uint32_t(i));
+	double build_ms = 1e-6 * double(Util::get_current_time_nsecs() - start);
+
+	std::vector<uint32_t> indices(city.boxes.size());
+	double update_ns = 0.0, linear_ns = 0.0, batched_ns = 0.0, bvh_ns = 0.0;
+	size_t total_visible = 0, reinserted = 0;
+
+	for (unsigned frame = 0; frame < Frames; frame++)
+	{
+		// Traffic moves a bit every frame.
+		start = Util::get_current_time_nsecs();
+		vec3 delta(0.3f * muglm::sin(0.1f * float(frame)), 0.0f, 0.3f);
+		for (auto index : city.dynamic_objects)
+		{
+			auto &box = city.boxes[index];
+			box = AABB(box.get_minimum() + delta, box.get_maximum() + delta);
+			reinserted += bvh.move(leaves[index], box) ? 1 : 0;
+		}
+		update_ns += double(Util::get_current_time_nsecs() - start);
+
+		for (auto index : city.dynamic_objects)
+			soa.set(index, city.boxes[index]);
+
+		auto frusta = build_shadow_frusta(frame);
+		for (auto &frustum : frusta)
+		{
+			start = Util::get_current_time_nsecs();
+			size_t linear_count = 0;
+			for (auto &box : city.boxes)
+				linear_count += SIMD::frustum_cull(box, frustum.get_planes()) ? 1 : 0;
+			linear_ns += double(Util::get_current_time_nsecs() - start);
+
+			start = Util::get_current_time_nsecs();
+			size_t batched_count = SIMD::frustum_cull_batch(soa, 0, soa.size(), frustum.get_planes(), indices.data());
+			batched_ns += double(Util::get_current_time_nsecs() - start);
+
+			start = Util::get_current_time_nsecs();
+			size_t bvh_count = 0;
+			bvh.query_frustum(frustum, [&](uint32_t leaf) {
+				indices[bvh_count++] = bvh.get_user_data(leaf);
+			});
+			bvh_ns += double(Util::get_current_time_nsecs() - start);
+
+			if (linear_count != batched_count || linear_count != bvh_count)
+			{
+				LOGE("Visible count mismatch: linear %zu, batched %zu, BVH %zu.\n",
+				     linear_count, batched_count, bvh_count);
+				return EXIT_FAILURE;
+			}
+
+			total_visible += bvh_count;
+		}
+	}
+
+	LOGI("%u objects, %zu moving, BVH height %u, build %.2f ms.\n",
+	     num_objects, city.dynamic_objects.size(), bvh.get_height(), build_ms);
+	LOGI("20 shadow frusta per frame, %.1f visible objects per frustum on average.\n",
+	     double(total_visible) / (20.0 * Frames));
+	LOGI("  BVH update:              %8.3f ms / frame (%.1f%% of moves reinserted)\n",
+	     1e-6 * update_ns / Frames, 100.0 * double(reinserted) / double(city.dynamic_objects.size() * Frames));
+	LOGI("  linear frustum_cull:     %8.3f ms / frame\n", 1e-6 * linear_ns / Frames);
+	LOGI("  linear batched SoA:      %8.3f ms / frame\n", 1e-6 * batched_ns / Frames);
+	LOGI("  BVH query:               %8.3f ms / frame\n", 1e-6 * bvh_ns / Frames);
+}
@@ -0,0 +1,144 @@
+#include "thread_group.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace Granite;
+
+static std::atomic_uint sink;
+
+static void tiny_work(unsigned seed)
+{
+	unsigned v = seed;
+	for (unsigned i = 0; i < 64; i++)
+		v = v * 1664525u + 1013904223u;
+	sink.fetch_add(v & 1, std::memory_order_relaxed);
+}
+
+// Many independent groups submitted from the main thread.
+static double bench_fan_out(ThreadGroup &group)
+{
+	constexpr unsigned NumGroups = 64;
+	constexpr unsigned TasksPerGroup = 1024;
+
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned g = 0; g < NumGroups; g++)
+	{
+		auto task = group.create_task();
+		for (unsigned i = 0; i < TasksPerGroup; i++)
+			task->enqueue_task([i]() { tiny_work(i); });
+		group.submit(task);
+	}
+	group.wait_idle();
+	auto end = Util::get_current_time_nsecs();
+	return double(NumGroups * TasksPerGroup) / (1e-9 * double(end - start));
+}
+
+// Chain of stages where each stage is released by the completion of the previous one on a worker.
+// This is the typical shape of frame jobs built with TaskComposer.
+static double bench_chained(ThreadGroup &group)
+{
+	constexpr unsigned NumStages = 256;
+	constexpr unsigned TasksPerStage = 64;
+
+	std::vector<TaskGroupHandle> stages;
+	stages.reserve(NumStages);
+
+	auto start = Util::get_current_time_nsecs();
+	for (unsigned s = 0; s < NumStages; s++)
+	{
+		auto task = group.create_task();
+		for (unsigned i = 0; i < TasksPerStage; i++)
+			task->enqueue_task([i]() { tiny_work(i); });
+		if (!stages.empty())
+			group.add_dependency(*task, *stages.back());
+		stages.push_back(std::move(task));
+	}
+
+	for (auto &stage : stages)
+		group.submit(stage);
+	group.wait_idle();
+	auto end = Util::get_current_time_nsecs();
+	return double(NumStages * TasksPerStage) / (1e-9 * double(end - start));
+}
+
+static void spin_for_us(unsigned us)
+{
+	auto end = Util::get_current_time_nsecs() + int64_t(us) * 1000;
+	while (Util::get_current_time_nsecs() < end)
+		tiny_work(us);
+}
+
+// Simulates asset streaming saturating the background threads while small frame tasks are submitted.
+// Frame tasks should not queue up behind streaming work.
+static void run_mixed_priority_bench(TaskScheduler scheduler, unsigned num_threads)
+{
+	ThreadGroup group;
+	group.set_scheduler(scheduler);
+	group.set_queue_latency_tracking(true);
+	group.start(num_threads, (num_threads + 1) / 2, {});
+
+	constexpr unsigned NumFrames = 60;
+	for (unsigned frame = 0; frame < NumFrames; frame++)
+	{
+		auto streaming = group.create_task();
+		streaming->set_task_class(TaskClass::Background);
+		streaming->set_priority(TaskPriority::Low);
+		for (unsigned i = 0; i < 32; i++)
+			streaming->enqueue_task([]() { spin_for_us(200); });
+		group.submit(streaming);
+
+		auto frame_task = group.create_task();
+		frame_task->set_priority(TaskPriority::High);
+		for (unsigned i = 0; i < 16; i++)
+			frame_task->enqueue_task([]() { spin_for_us(20); });
+		frame_task->wait();
+	}
+
+	group.wait_idle();
+	LOGI("=== Mixed priority | %s | %u threads ===\n",
+	     scheduler == TaskScheduler::WorkStealing ? "work-stealing" : "global-queue", num_threads);
+	group.log_queue_latency_histograms();
+}
+
+static void run_bench(TaskScheduler scheduler, unsigned num_threads)
+{
+	ThreadGroup group;
+	group.set_scheduler(scheduler);
+	group.start(num_threads, 0, {});
+
+	// Warmup.
+	bench_fan_out(group);
+
+	double fan_out = 0.0;
+	double chained = 0.0;
+	constexpr unsigned Iterations = 8;
+	for (unsigned i = 0; i < Iterations; i++)
+	{
+		fan_out += bench_fan_out(group);
+		chained += bench_chained(group);
+	}
+
+	LOGI("%14s | %3u threads | fan-out %8.3f M tasks/s | chained %8.3f M tasks/s\n",
+	     scheduler == TaskScheduler::WorkStealing ? "work-stealing" : "global-queue",
+	     num_threads, 1e-6 * fan_out / Iterations, 1e-6 * chained / Iterations);
+}
+
+int main()
+{
+	unsigned all_cores = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> thread_counts = { 1, 4, 16 };
+	if (all_cores != 1 && all_cores != 4 && all_cores != 16)
+		thread_counts.push_back(all_cores);
+
+	for (unsigned count : thread_counts)
+	{
+		run_bench(TaskScheduler::GlobalQueue, count);
+		run_bench(TaskScheduler::WorkStealing, count);
+	}
+
+	run_mixed_priority_bench(TaskScheduler::GlobalQueue, 4);
+	run_mixed_priority_bench(TaskScheduler::WorkStealing, 4);
+}
@@ -22,12 +22,15 @@
 
 #include "thread_group.hpp"
 #include "logging.hpp"
+#include <atomic>
+#include <stdlib.h>
 
 using namespace Granite;
 
-int main()
+static void run_test(TaskScheduler scheduler)
 {
 	ThreadGroup group;
+	group.set_scheduler(scheduler);
 	group.start(4, 0, {});
 
 	auto task1 = group.create_task([]() {
@@ -53,4 +56,82 @@ int main()
 	group.submit(task3);
 
 	group.wait_idle();
+
+	// There are no background threads, so foreground threads must pick this up.
+	auto bg_task = group.create_task([]() {
+		LOGI("Background work on foreground thread.\n");
+	});
+	bg_task->set_task_class(TaskClass::Background);
+	bg_task->set_priority(TaskPriority::Low);
+	bg_task->wait();
+
+	auto high_task = group.create_task([]() {
+		LOGI("High priority.\n");
+	});
+	high_task->set_priority(TaskPriority::High);
+	high_task->wait();
+}
+
+// Three levels of tasks waiting for their children.
+// With blocking waits, a single worker deadlocks on the first nested wait.
+static bool run_fiber_test(TaskScheduler scheduler, unsigned num_threads)
+{
+	ThreadGroup group;
+	group.set_scheduler(scheduler);
+	group.set_fiber_mode(true);
+	group.start(num_threads, 0, {});
+
+	constexpr unsigned Width = 4;
+	std::atomic_uint counter;
+	counter.store(0);
+
+	auto outer = group.create_task();
+	for (unsigned i = 0; i < Width; i++)
+	{
+		outer->enqueue_task([&group, &counter]() {
+			auto middle = group.create_task();
+			for (unsigned j = 0; j < Width; j++)
+			{
+				middle->enqueue_task([&group, &counter]() {
+					auto inner = group.create_task();
+					for (unsigned k = 0; k < Width; k++)
+						inner->enqueue_task([&counter]() { counter.fetch_add(1, std::memory_order_relaxed); });
+					inner->wait();
+					// Waiting on a completed group must return immediately.
+					inner->wait();
+					counter.fetch_add(1, std::memory_order_relaxed);
+				});
+			}
+			middle->wait();
+			counter.fetch_add(1, std::memory_order_relaxed);
+		});
+	}
+	outer->wait();
+
+	unsigned expected = Width + Width * Width + Width * Width * Width;
+	if (counter.load() != expected)
+	{
+		LOGE("Nested fiber waits with %u threads: expected %u, got %u.\n", num_threads, expected, counter.load());
+		return false;
+	}
+
+	LOGI("Nested fiber waits with %u threads OK.\n", num_threads);
+	return true;
+}
+
+int main()
+{
+	LOGI("=== Global queue ===\n");
+	run_test(TaskScheduler::GlobalQueue);
+	LOGI("=== Work stealing ===\n");
+	run_test(TaskScheduler::WorkStealing);
+
+	for (auto scheduler : { TaskScheduler::GlobalQueue, TaskScheduler::WorkStealing })
+	{
+		for (unsigned num_threads : { 1u, 4u })
+		{
+			if (!run_fiber_test(scheduler, num_threads))
+				return EXIT_FAILURE;
+		}
+	}
 }
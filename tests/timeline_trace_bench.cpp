@@ -0,0 +1,84 @@
+#include "timeline_trace_file.hpp"
+#include "timer.hpp"
+#include "logging.hpp"
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+using namespace Util;
+
+// Small batches with pauses in between, so the drainer gets a chance to keep up.
+static constexpr unsigned EventsPerBatch = 4096;
+static constexpr unsigned NumBatches = 64;
+
+static double bench_scoped_events(TimelineTraceFile *file, const char *desc)
+{
+	int64_t total_ns = 0;
+	for (unsigned batch = 0; batch < NumBatches; batch++)
+	{
+		auto start = get_current_time_nsecs();
+		for (unsigned i = 0; i < EventsPerBatch; i++)
+		{
+			GRANITE_SCOPED_TIMELINE_EVENT_FILE(file, desc);
+		}
+		total_ns += get_current_time_nsecs() - start;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return double(total_ns) / double(NumBatches * EventsPerBatch);
+}
+
+// Each scoped event reads the tick counter twice. Under some hypervisors this dominates.
+static double bench_ticks()
+{
+	constexpr unsigned Iterations = 1000000;
+	uint64_t sum = 0;
+	auto start = get_current_time_nsecs();
+	for (unsigned i = 0; i < Iterations; i++)
+		sum += TimelineTraceFile::get_ticks();
+	auto end = get_current_time_nsecs();
+	if (sum == 0)
+		LOGI("Tick counter is broken.\n");
+	return double(end - start) / Iterations;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = argc >= 2 ? argv[1] : "timeline-trace-bench.trace";
+
+	TimelineTraceFile::set_tid("main");
+	double disabled = bench_scoped_events(nullptr, "bench-event");
+
+	double enabled, enabled_mt;
+	{
+		TimelineTraceFile file(path);
+		// Warm up the thread ring and string interning.
+		bench_scoped_events(&file, "bench-event");
+		enabled = bench_scoped_events(&file, "bench-event");
+
+		constexpr unsigned NumThreads = 4;
+		std::vector<std::thread> threads;
+		std::vector<double> results(NumThreads);
+		for (unsigned i = 0; i < NumThreads; i++)
+		{
+			threads.emplace_back([&, i]() {
+				char name[32];
+				snprintf(name, sizeof(name), "worker-%u", i);
+				TimelineTraceFile::set_tid(name);
+				results[i] = bench_scoped_events(&file, name);
+			});
+		}
+
+		enabled_mt = 0.0;
+		for (unsigned i = 0; i < NumThreads; i++)
+		{
+			threads[i].join();
+			enabled_mt += results[i] / NumThreads;
+		}
+	}
+
+	LOGI("Tick read: %.2f ns\n", bench_ticks());
+	LOGI("Scoped event cost: disabled %.2f ns | enabled %.2f ns | enabled, 4 threads %.2f ns\n",
+	     disabled, enabled, enabled_mt);
+	LOGI("Wrote %s, convert with timeline-trace-convert.\n", path);
+}
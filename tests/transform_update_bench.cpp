@@ -0,0 +1,158 @@
+#include "scene.hpp"
+#include "transforms.hpp"
+#include "task_composer.hpp"
+#include "thread_group.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <random>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <stdlib.h>
+
+using namespace Granite;
+
+// Nodes are created in level order with a branching factor of 8, so 1M nodes are 8 levels deep.
+static std::vector<NodeHandle> build_hierarchy(Scene &scene, unsigned num_nodes)
+{
+	constexpr unsigned Branching = 8;
+	std::vector<NodeHandle> nodes;
+	nodes.reserve(num_nodes);
+	std::mt19937 rnd(1337);
+	std::uniform_real_distribution<float> uni(-1.0f, 1.0f);
+
+	for (unsigned i = 0; i < num_nodes; i++)
+	{
+		auto node = scene.create_node();
+		node->transform.translation = vec3(uni(rnd), uni(rnd), uni(rnd));
+		node->transform.rotation = angleAxis(uni(rnd), normalize(vec3(uni(rnd), uni(rnd), 1.0f)));
+		node->transform.scale = vec3(1.0f + 0.1f * uni(rnd));
+		if (i)
+			nodes[(i - 1) / Branching]->add_child(node);
+		nodes.push_back(std::move(node));
+	}
+
+	return nodes;
+}
+
+static void animate(std::vector<NodeHandle> &nodes, const std::vector<uint32_t> &animated, float t)
+{
+	for (auto index : animated)
+	{
+		auto &node = nodes[index];
+		node->transform.rotation = angleAxis(t + 0.001f * float(index), vec3(0.0f, 1.0f, 0.0f));
+		node->invalidate_cached_transform();
+	}
+}
+
+// What update_transform_tree() used to do for every dirty node, without the dirty tracking.
+static double run_per_node_reference(std::vector<NodeHandle> &nodes)
+{
+	static const mat4 identity(1.0f);
+	auto start = Util::get_current_time_nsecs();
+	for (auto &node : nodes)
+	{
+		auto *parent = node->get_parent();
+		node->prev_cached_transform = node->cached_transform;
+		compute_model_transform(node->cached_transform.world_transform,
+		                        node->transform.scale, node->transform.rotation, node->transform.translation,
+		                        parent ? parent->cached_transform.world_transform : identity);
+	}
+	auto end = Util::get_current_time_nsecs();
+	return 1e-6 * double(end - start);
+}
+
+static double run_update(Scene &scene, std::vector<NodeHandle> &nodes, const std::vector<uint32_t> &animated,
+                         ThreadGroup *group, float t)
+{
+	animate(nodes, animated, t);
+	auto start = Util::get_current_time_nsecs();
+	if (group)
+	{
+		TaskComposer composer(*group);
+		scene.update_transform_tree(composer);
+		composer.get_outgoing_task()->wait();
+	}
+	else
+		scene.update_transform_tree();
+	auto end = Util::get_current_time_nsecs();
+	return 1e-6 * double(end - start);
+}
+
+static bool verify(const std::vector<NodeHandle> &nodes)
+{
+	static const mat4 identity(1.0f);
+	for (auto &node : nodes)
+	{
+		auto *parent = node->get_parent();
+		mat4 expected;
+		compute_model_transform(expected, node->transform.scale, node->transform.rotation, node->transform.translation,
+		                        parent ? parent->cached_transform.world_transform : identity);
+		for (unsigned col = 0; col < 4; col++)
+		{
+			if (distance(expected[col], node->cached_transform.world_transform[col]) >
+			    0.001f * (1.0f + length(expected[col])))
+			{
+				LOGE("World transform mismatch.\n");
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	constexpr unsigned Iterations = 10;
+	unsigned num_nodes = argc >= 2 ? unsigned(strtoul(argv[1], nullptr, 0)) : 1000000u;
+
+	ThreadGroup group;
+	group.start(std::max(1u, std::thread::hardware_concurrency()), 0, {});
+
+	Scene scene;
+	auto nodes = build_hierarchy(scene, num_nodes);
+	scene.update_transform_tree();
+
+	std::vector<uint32_t> all(num_nodes);
+	for (unsigned i = 0; i < num_nodes; i++)
+		all[i] = i;
+
+	// Sparse animation: 1% of nodes move. Their subtrees are recomputed as well.
+	std::vector<uint32_t> sparse;
+	std::mt19937 rnd(42);
+	for (unsigned i = 0; i < num_nodes / 100; i++)
+		sparse.push_back(rnd() % num_nodes);
+
+	double reference = 0.0;
+	for (unsigned iter = 0; iter < Iterations; iter++)
+		reference += run_per_node_reference(nodes);
+
+	LOGI("%u nodes, %u threads.\n", num_nodes, group.get_num_threads());
+	LOGI("  per-node compute_model_transform: %8.3f ms\n", reference / Iterations);
+
+	struct Config
+	{
+		const char *desc;
+		const std::vector<uint32_t> *animated;
+		ThreadGroup *group;
+	};
+
+	const Config configs[] = {
+		{ "fully animated, serial:        ", &all, nullptr },
+		{ "fully animated, threaded:      ", &all, &group },
+		{ "sparsely animated, serial:     ", &sparse, nullptr },
+		{ "sparsely animated, threaded:   ", &sparse, &group },
+	};
+
+	for (auto &config : configs)
+	{
+		double total = 0.0;
+		for (unsigned iter = 0; iter < Iterations; iter++)
+			total += run_update(scene, nodes, *config.animated, config.group, float(iter));
+
+		if (!verify(nodes))
+			return EXIT_FAILURE;
+
+		LOGI("  update_transform_tree %s %8.3f ms\n", config.desc, total / Iterations);
+	}
+}
@@ -0,0 +1,420 @@
+#include "audio_mixer.hpp"
+#include "audio_interface.hpp"
+#include "vorbis_stream.hpp"
+#include "global_managers_init.hpp"
+#include "logging.hpp"
+#include "timer.hpp"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace Granite;
+using namespace Granite::Audio;
+
+// Plays music and sound effects from Vorbis files through DumpBackend, paced in real time,
+// and compares where decoding happens: on the audio thread, up front, or on a background decode thread.
+// Sound effects are one-shots which are started again as soon as they end, like footsteps or gunfire would be.
+
+static constexpr float MixerRate = 48000.0f;
+static constexpr unsigned MixerChannels = 2;
+static constexpr double BlockMs = 5.0;
+
+enum class DecodeMode
+{
+	AudioThread,
+	Preload,
+	PreloadCached,
+	Service
+};
+
+static const char *get_mode_name(DecodeMode mode)
+{
+	switch (mode)
+	{
+	case DecodeMode::AudioThread:
+		return "decode on audio thread";
+	case DecodeMode::Preload:
+		return "preload, no cache";
+	case DecodeMode::PreloadCached:
+		return "preload + cache";
+	case DecodeMode::Service:
+		return "decode service + cache";
+	default:
+		return "?";
+	}
+}
+
+struct Options
+{
+	double seconds = 5.0;
+	unsigned num_music = 16;
+	unsigned num_sfx = 48;
+	std::string music_path;
+	std::string sfx_path;
+};
+
+struct Result
+{
+	double audio_cpu_percent;
+	double block_p99_us, block_max_us;
+	double create_avg_us, create_max_us;
+	unsigned creates;
+	double rss_delta_mib;
+	VorbisDecodeService::Stats service;
+	DecodedVorbisCacheStats cache;
+};
+
+static double get_resident_mib()
+{
+#ifdef __linux__
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (!file)
+		return 0.0;
+	unsigned long size = 0, resident = 0;
+	if (fscanf(file, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(file);
+	return double(resident) * double(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+#else
+	return 0.0;
+#endif
+}
+
+template <typename T>
+static double percentile(std::vector<T> &values, double p)
+{
+	if (values.empty())
+		return 0.0;
+	size_t index = std::min(values.size() - 1, size_t(p * double(values.size())));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return double(values[index]);
+}
+
+struct StreamFactory
+{
+	DecodeMode mode;
+	VorbisDecodeService *service;
+	std::vector<int64_t> create_costs;
+
+	MixerStream *create(const std::string &path, bool music)
+	{
+		auto start = Util::get_current_time_nsecs();
+		MixerStream *stream = nullptr;
+		switch (mode)
+		{
+		case DecodeMode::AudioThread:
+			stream = create_vorbis_stream(path, music);
+			break;
+		case DecodeMode::Preload:
+		case DecodeMode::PreloadCached:
+			stream = create_decoded_vorbis_stream(path, music);
+			break;
+		case DecodeMode::Service:
+			// Short effects come out of the cache, long music is streamed.
+			stream = music ? service->create_stream(path, true) : create_decoded_vorbis_stream(path, false);
+			break;
+		}
+		create_costs.push_back(Util::get_current_time_nsecs() - start);
+		return stream;
+	}
+};
+
+static bool run_mode(const Options &options, DecodeMode mode, Result &result)
+{
+	auto frames_per_block = unsigned(MixerRate * BlockMs * 1e-3 + 0.5);
+	auto num_blocks = unsigned(options.seconds * 1000.0 / BlockMs);
+	auto period_ns = int64_t(1e6 * BlockMs);
+
+	clear_decoded_vorbis_cache();
+	set_decoded_vorbis_cache_size(mode == DecodeMode::Preload ? 0 : 64 * 1024 * 1024);
+	auto cache_start = get_decoded_vorbis_cache_stats();
+	double rss_start = get_resident_mib();
+
+	std::unique_ptr<VorbisDecodeService> service;
+	if (mode == DecodeMode::Service)
+		service = std::make_unique<VorbisDecodeService>();
+
+	StreamFactory factory = { mode, service.get(), {} };
+	auto mixer = std::make_unique<Mixer>();
+	DumpBackend backend(mixer.get(), MixerRate, MixerChannels, frames_per_block);
+
+	unsigned num_streams = options.num_music + options.num_sfx;
+	float gain_db = -20.0f * std::log10(float(num_streams));
+
+	for (unsigned i = 0; i < options.num_music; i++)
+	{
+		float pan = float(int(i % 9) - 4) / 4.0f;
+		if (!mixer->add_mixer_stream(factory.create(options.music_path, true), true, gain_db, pan))
+		{
+			LOGE("Failed to start music stream.\n");
+			return false;
+		}
+	}
+
+	std::vector<StreamID> sfx(options.num_sfx);
+	auto start_sfx = [&](unsigned index) -> bool {
+		float pan = float(int(index % 7) - 3) / 3.0f;
+		sfx[index] = mixer->add_mixer_stream(factory.create(options.sfx_path, false), true, gain_db, pan);
+		return bool(sfx[index]);
+	};
+
+	for (unsigned i = 0; i < options.num_sfx; i++)
+	{
+		if (!start_sfx(i))
+		{
+			LOGE("Failed to start sound effect.\n");
+			return false;
+		}
+	}
+
+	std::vector<int16_t> block(frames_per_block * MixerChannels);
+	std::vector<int64_t> block_costs;
+	block_costs.reserve(num_blocks);
+	int64_t total_ns = 0;
+	double rss_peak = rss_start;
+
+	backend.start();
+	auto clock_start = Util::get_current_time_nsecs();
+
+	for (unsigned i = 0; i < num_blocks; i++)
+	{
+		// The device asks for the next block once the previous one has played.
+		auto deadline = clock_start + int64_t(i) * period_ns;
+		auto now = Util::get_current_time_nsecs();
+		if (now < deadline)
+			std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - now));
+
+		auto start = Util::get_current_time_nsecs();
+		backend.drain_interleaved_s16(block.data(), frames_per_block);
+		auto cost = Util::get_current_time_nsecs() - start;
+		block_costs.push_back(cost);
+		total_ns += cost;
+
+		// What the game does on its own thread in between.
+		auto &queue = mixer->get_message_queue();
+		Util::MessageQueuePayload payload;
+		while ((payload = queue.read_message()))
+			queue.recycle_payload(std::move(payload));
+		mixer->dispose_dead_streams();
+
+		for (unsigned index = 0; index < options.num_sfx; index++)
+			if (mixer->get_stream_state(sfx[index]) == Mixer::StreamState::Dead && !start_sfx(index))
+				return false;
+
+		if ((i & 63) == 0)
+			rss_peak = std::max(rss_peak, get_resident_mib());
+	}
+
+	backend.stop();
+
+	result.audio_cpu_percent = 100.0 * double(total_ns) / (double(num_blocks) * double(period_ns));
+	result.block_p99_us = 1e-3 * percentile(block_costs, 0.99);
+	result.block_max_us = 1e-3 * percentile(block_costs, 1.0);
+	result.creates = unsigned(factory.create_costs.size());
+	int64_t create_total = 0;
+	for (auto cost : factory.create_costs)
+		create_total += cost;
+	result.create_avg_us = 1e-3 * double(create_total) / double(std::max(1u, result.creates));
+	result.create_max_us = 1e-3 * percentile(factory.create_costs, 1.0);
+	result.rss_delta_mib = rss_peak - rss_start;
+	result.service = service ? service->get_stats() : VorbisDecodeService::Stats{};
+
+	result.cache = get_decoded_vorbis_cache_stats();
+	result.cache.hits -= cache_start.hits;
+	result.cache.misses -= cache_start.misses;
+	result.cache.evictions -= cache_start.evictions;
+	return true;
+}
+
+// Streams decoded ahead must sound exactly like streams decoded on the audio thread,
+// including across loop points and at the end of one-shots.
+// With a thief, the stream loses its voice to a higher priority one-shot for a while and is skipped instead of rendered.
+static bool verify_buffered_stream(const std::string &path, bool looping, double seconds,
+                                   const std::string &thief_path = {})
+{
+	constexpr unsigned FramesPerBlock = 240;
+	auto num_blocks = unsigned(seconds * MixerRate / FramesPerBlock);
+	VorbisDecodeService service;
+
+	auto render = [&](MixerStream *stream, std::vector<int16_t> &output) -> bool {
+		auto mixer = std::make_unique<Mixer>();
+		DumpBackend backend(mixer.get(), MixerRate, MixerChannels, FramesPerBlock);
+		if (!thief_path.empty())
+			mixer->set_max_real_voices(1);
+		if (!mixer->add_mixer_stream(stream, true, -6.0f, 0.5f))
+			return false;
+
+		std::vector<int16_t> block(FramesPerBlock * MixerChannels);
+		backend.start();
+		for (unsigned i = 0; i < num_blocks; i++)
+		{
+			if (!thief_path.empty() && i == num_blocks / 4 &&
+			    !mixer->add_mixer_stream(create_decoded_vorbis_stream(thief_path), true, -6.0f, -0.5f, 1))
+			{
+				return false;
+			}
+
+			backend.drain_interleaved_s16(block.data(), FramesPerBlock);
+			output.insert(output.end(), block.begin(), block.end());
+			// Real-time pacing, the decode thread only has to keep up with a device.
+			std::this_thread::sleep_for(std::chrono::microseconds(unsigned(1e6f * FramesPerBlock / MixerRate)));
+		}
+		backend.stop();
+		return true;
+	};
+
+	std::vector<int16_t> direct, buffered;
+	if (!render(create_vorbis_stream(path, looping), direct) ||
+	    !render(service.create_stream(path, looping), buffered))
+	{
+		LOGE("Failed to create stream for %s.\n", path.c_str());
+		return false;
+	}
+
+	auto stats = service.get_stats();
+	int max_diff = 0;
+	for (size_t i = 0; i < direct.size(); i++)
+		max_diff = std::max(max_diff, std::abs(int(direct[i]) - int(buffered[i])));
+
+	// The decode thread may seek to a different point while the stream is skipped than the direct stream does,
+	// and a decoder which has just seeked is not bit-exact with one which decoded up to the same point.
+	int tolerance = thief_path.empty() ? 0 : 4;
+	if (stats.underruns != 0 || max_diff > tolerance)
+	{
+		LOGE("Buffered stream differs from direct decode by %d, %u underruns (%s, looping %d, skipped %d).\n",
+		     max_diff, unsigned(stats.underruns), path.c_str(), int(looping), int(!thief_path.empty()));
+		return false;
+	}
+
+	LOGI("Buffered stream matches direct decode over %.1f s within %d / 32767 (%s, looping %d, skipped %d).\n",
+	     seconds, max_diff, path.c_str(), int(looping), int(!thief_path.empty()));
+	return true;
+}
+
+static bool verify_cache(const std::string &path)
+{
+	clear_decoded_vorbis_cache();
+	set_decoded_vorbis_cache_size(64 * 1024 * 1024);
+	auto before = get_decoded_vorbis_cache_stats();
+
+	for (unsigned i = 0; i < 4; i++)
+	{
+		auto *stream = create_decoded_vorbis_stream(path);
+		if (!stream)
+			return false;
+		stream->dispose();
+	}
+
+	auto after = get_decoded_vorbis_cache_stats();
+	if (after.misses - before.misses != 1 || after.hits - before.hits != 3 || after.cached_files != 1)
+	{
+		LOGE("Decoded clip cache: %u misses, %u hits, %u files, expected 1, 3, 1.\n",
+		     unsigned(after.misses - before.misses), unsigned(after.hits - before.hits), after.cached_files);
+		return false;
+	}
+
+	// Nothing fits anymore.
+	set_decoded_vorbis_cache_size(1);
+	after = get_decoded_vorbis_cache_stats();
+	if (after.cached_files != 0 || after.cached_bytes != 0 || after.evictions - before.evictions != 1)
+	{
+		LOGE("Decoded clip cache did not evict when shrinking.\n");
+		return false;
+	}
+
+	return true;
+}
+
+static void print_help()
+{
+	LOGI("Usage: vorbis-stream-bench <music.ogg> <sfx.ogg> [--seconds <audio seconds per run>]\n"
+	     "                           [--music <streams>] [--sfx <streams>]\n");
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	std::vector<const char *> paths;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+			options.seconds = strtod(argv[++i], nullptr);
+		else if (strcmp(argv[i], "--music") == 0 && i + 1 < argc)
+			options.num_music = unsigned(strtoul(argv[++i], nullptr, 0));
+		else if (strcmp(argv[i], "--sfx") == 0 && i + 1 < argc)
+			options.num_sfx = unsigned(strtoul(argv[++i], nullptr, 0));
+		else if (argv[i][0] != '-')
+			paths.push_back(argv[i]);
+		else
+		{
+			print_help();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (paths.size() != 2 || options.seconds <= 0.0)
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	options.music_path = paths[0];
+	options.sfx_path = paths[1];
+
+	Global::init(Global::MANAGER_FEATURE_FILESYSTEM_BIT);
+
+	bool failed = false;
+	if (!verify_buffered_stream(options.sfx_path, true, 2.0) ||
+	    !verify_buffered_stream(options.sfx_path, false, 1.0) ||
+	    !verify_buffered_stream(options.music_path, false, 2.0) ||
+	    !verify_buffered_stream(options.sfx_path, true, 2.0, options.sfx_path) ||
+	    !verify_buffered_stream(options.music_path, true, 2.0, options.sfx_path) ||
+	    !verify_cache(options.sfx_path))
+	{
+		failed = true;
+	}
+
+	LOGI("%u music + %u sound effect streams, %.0f Hz, %.1f ms blocks, %.1f s of audio per run, %u hardware threads.\n",
+	     options.num_music, options.num_sfx, MixerRate, BlockMs, options.seconds, std::thread::hardware_concurrency());
+
+	const DecodeMode modes[] = {
+		DecodeMode::AudioThread, DecodeMode::Preload, DecodeMode::PreloadCached, DecodeMode::Service,
+	};
+
+	for (auto mode : modes)
+	{
+		Result result = {};
+		if (!run_mode(options, mode, result))
+		{
+			failed = true;
+			continue;
+		}
+
+		LOGI("%s:\n", get_mode_name(mode));
+		LOGI("  audio thread %6.2f %% of real time, block p99 %7.1f us, max %7.1f us\n",
+		     result.audio_cpu_percent, result.block_p99_us, result.block_max_us);
+		LOGI("  %5u streams created, %8.1f us avg, %8.1f us max on the calling thread\n",
+		     result.creates, result.create_avg_us, result.create_max_us);
+		LOGI("  resident memory %+7.1f MiB, decoded clip cache %6.1f MiB in %u files (%u hits, %u misses, %u evictions)\n",
+		     result.rss_delta_mib, double(result.cache.cached_bytes) / (1024.0 * 1024.0), result.cache.cached_files,
+		     unsigned(result.cache.hits), unsigned(result.cache.misses), unsigned(result.cache.evictions));
+		if (mode == DecodeMode::Service)
+		{
+			LOGI("  decode service: %u streams, %.2f MiB of buffers, %.1f M frames decoded, %u underruns\n",
+			     result.service.num_streams, double(result.service.buffer_bytes) / (1024.0 * 1024.0),
+			     1e-6 * double(result.service.decoded_frames), unsigned(result.service.underruns));
+		}
+	}
+
+	Global::deinit();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,185 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "thread_group.hpp"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// Data parallel helpers on top of TaskGroup.
+// Ranges are split into contiguous chunks up front.
+// A grain of 0 lets the helpers pick a chunk size based on the number of worker threads.
+
+namespace Granite
+{
+namespace Internal
+{
+enum
+{
+	// Below this many elements, automatic grain sizing keeps the range in one chunk.
+	ParallelForAutoMinGrain = 128,
+	// Aim for a few chunks per worker so imbalance can even out.
+	ParallelForChunksPerWorker = 4,
+	// Never split further than this, task overhead starts to dominate.
+	ParallelForMaxChunksPerWorker = 16
+};
+
+static inline size_t compute_parallel_for_chunks(size_t count, size_t grain, unsigned num_workers)
+{
+	if (count == 0)
+		return 0;
+
+	num_workers = std::max(num_workers, 1u);
+	if (grain == 0)
+	{
+		grain = count / (size_t(num_workers) * ParallelForChunksPerWorker);
+		grain = std::max<size_t>(grain, ParallelForAutoMinGrain);
+	}
+
+	size_t num_chunks = (count + grain - 1) / grain;
+	return std::min<size_t>(num_chunks, size_t(num_workers) * ParallelForMaxChunksPerWorker);
+}
+
+static inline size_t get_parallel_for_chunk_begin(size_t begin, size_t count, size_t chunk, size_t num_chunks)
+{
+	return begin + (count * chunk) / num_chunks;
+}
+}
+
+// Enqueues one task per chunk on group. func(chunk_begin, chunk_end) is called for every chunk.
+// func is copied once and shared between the chunk tasks.
+template <typename Func>
+void parallel_for_chunked(TaskGroup &group, size_t begin, size_t end, size_t grain, Func &&func)
+{
+	if (end <= begin)
+		return;
+
+	size_t count = end - begin;
+	size_t num_chunks = Internal::compute_parallel_for_chunks(
+			count, grain, group.get_thread_group()->get_num_threads(group.deps->task_class));
+
+	using PlainFunc = std::decay_t<Func>;
+	auto shared_func = std::make_shared<PlainFunc>(std::forward<Func>(func));
+
+	for (size_t i = 0; i < num_chunks; i++)
+	{
+		size_t chunk_begin = Internal::get_parallel_for_chunk_begin(begin, count, i, num_chunks);
+		size_t chunk_end = Internal::get_parallel_for_chunk_begin(begin, count, i + 1, num_chunks);
+		group.enqueue_task([shared_func, chunk_begin, chunk_end]() {
+			(*shared_func)(chunk_begin, chunk_end);
+		});
+	}
+}
+
+// Same as parallel_for_chunked, but func(index) is called for every element.
+template <typename Func>
+void parallel_for(TaskGroup &group, size_t begin, size_t end, size_t grain, Func &&func)
+{
+	parallel_for_chunked(group, begin, end, grain,
+	                     [func = std::forward<Func>(func)](size_t chunk_begin, size_t chunk_end) {
+		                     for (size_t i = chunk_begin; i < chunk_end; i++)
+			                     func(i);
+	                     });
+}
+
+// Blocking variants. The calling thread processes the first chunk itself,
+// so ranges which fit in one chunk never leave the calling thread.
+// Blocking on a worker thread ties up that worker until the other chunks complete,
+// prefer the TaskGroup variants inside tasks.
+template <typename Func>
+void parallel_for_chunked(ThreadGroup &group, size_t begin, size_t end, size_t grain, Func &&func)
+{
+	if (end <= begin)
+		return;
+
+	size_t count = end - begin;
+	unsigned num_workers = group.get_num_threads(TaskClass::Foreground);
+	size_t num_chunks = Internal::compute_parallel_for_chunks(count, grain, num_workers);
+
+	if (num_chunks <= 1 || num_workers == 0)
+	{
+		func(begin, end);
+		return;
+	}
+
+	// We wait for completion before returning, so referencing func is safe.
+	auto task = group.create_task();
+	task->set_desc("parallel-for");
+	auto *func_ptr = &func;
+	for (size_t i = 1; i < num_chunks; i++)
+	{
+		size_t chunk_begin = Internal::get_parallel_for_chunk_begin(begin, count, i, num_chunks);
+		size_t chunk_end = Internal::get_parallel_for_chunk_begin(begin, count, i + 1, num_chunks);
+		task->enqueue_task([func_ptr, chunk_begin, chunk_end]() {
+			(*func_ptr)(chunk_begin, chunk_end);
+		});
+	}
+	task->flush();
+
+	func(begin, Internal::get_parallel_for_chunk_begin(begin, count, 1, num_chunks));
+	task->wait();
+}
+
+template <typename Func>
+void parallel_for(ThreadGroup &group, size_t begin, size_t end, size_t grain, Func &&func)
+{
+	parallel_for_chunked(group, begin, end, grain, [&func](size_t chunk_begin, size_t chunk_end) {
+		for (size_t i = chunk_begin; i < chunk_end; i++)
+			func(i);
+	});
+}
+
+// map(chunk_begin, chunk_end) returns the partial result T of a chunk,
+// and reduce(T, T) combines them. Partial results are reduced in chunk order,
+// so the result is deterministic for a given thread count even if reduce is not associative,
+// e.g. floating point addition.
+template <typename T, typename MapFunc, typename ReduceFunc>
+T parallel_reduce(ThreadGroup &group, size_t begin, size_t end, size_t grain, T identity,
+                  MapFunc &&map, ReduceFunc &&reduce)
+{
+	if (end <= begin)
+		return identity;
+
+	size_t count = end - begin;
+	size_t num_chunks = Internal::compute_parallel_for_chunks(
+			count, grain, group.get_num_threads(TaskClass::Foreground));
+
+	if (num_chunks <= 1)
+		return reduce(identity, map(begin, end));
+
+	std::vector<T> partials(num_chunks, identity);
+	parallel_for_chunked(group, 0, num_chunks, 1, [&](size_t chunk_begin, size_t chunk_end) {
+		for (size_t i = chunk_begin; i < chunk_end; i++)
+		{
+			partials[i] = map(Internal::get_parallel_for_chunk_begin(begin, count, i, num_chunks),
+			                  Internal::get_parallel_for_chunk_begin(begin, count, i + 1, num_chunks));
+		}
+	});
+
+	T result = std::move(identity);
+	for (auto &p : partials)
+		result = reduce(std::move(result), std::move(p));
+	return result;
+}
+}
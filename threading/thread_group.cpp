@@ -30,9 +30,67 @@
 #include "string_helpers.hpp"
 #include "timeline_trace_file.hpp"
 #include "thread_name.hpp"
+#include "timer.hpp"
+#include "libco.h"
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace Granite
 {
+namespace Internal
+{
+// Fibers never migrate between threads. A suspended fiber is only resumed by the worker which created it.
+struct Fiber
+{
+	ThreadGroup *group = nullptr;
+	FiberWorker *worker = nullptr;
+	cothread_t cothread = nullptr;
+	Task *task = nullptr;
+};
+
+struct FiberWorker
+{
+	~FiberWorker()
+	{
+		for (auto &fiber : fibers)
+			co_delete(fiber->cothread);
+	}
+
+	// The worker thread's own context, which runs the scheduler loop.
+	cothread_t scheduler = nullptr;
+	Fiber *current = nullptr;
+	std::vector<std::unique_ptr<Fiber>> fibers;
+	std::vector<Fiber *> free_fibers;
+
+	// Fibers are made resumable by whichever thread completes the task group they wait for.
+	std::mutex resume_lock;
+	std::vector<Fiber *> resumable;
+	std::vector<Fiber *> resuming;
+	std::atomic_uint num_resumable;
+
+	// The sleep condition of the worker's task class.
+	std::mutex *cond_lock = nullptr;
+	std::condition_variable *cond = nullptr;
+};
+}
+
+// Tasks should be able to use a fair amount of stack. Stacks are only committed as they are touched.
+static constexpr unsigned FiberStackSize = 512 * 1024;
+
+// Used by the work stealing scheduler to figure out if newly ready tasks can go straight to the local deque,
+// and by TaskGroup::wait() to figure out if it can suspend the current fiber.
+struct CurrentWorker
+{
+	ThreadGroup *group;
+	void *worker;
+	TaskClass task_class;
+	Internal::FiberWorker *fibers;
+};
+static thread_local CurrentWorker current_worker;
+
 namespace Internal
 {
 void TaskDeps::notify_dependees()
@@ -49,6 +107,11 @@ void TaskDeps::notify_dependees()
 		done = true;
 		cond.notify_all();
 	}
+
+	// Once done is set, no more fibers can be added.
+	for (auto *fiber : waiting_fibers)
+		group->resume_fiber(fiber);
+	waiting_fibers.clear();
 }
 
 void TaskDeps::task_completed()
@@ -96,6 +159,9 @@ void TaskGroup::wait()
 	if (!flushed)
 		flush();
 
+	if (group->wait_in_fiber(*deps))
+		return;
+
 	std::unique_lock<std::mutex> holder{deps->cond_lock};
 	deps->cond.wait(holder, [this]() {
 		return deps->done;
@@ -168,9 +234,47 @@ void ThreadGroup::start(unsigned num_threads_foreground,
 	fg.thread_group.resize(num_threads_foreground);
 	bg.thread_group.resize(num_threads_background);
 
+	if (const char *env = getenv("GRANITE_THREAD_GROUP_SCHEDULER"))
+	{
+		if (strcmp(env, "work-stealing") == 0)
+			scheduler = TaskScheduler::WorkStealing;
+		else if (strcmp(env, "queue") == 0)
+			scheduler = TaskScheduler::GlobalQueue;
+		else
+			LOGW("Unrecognized scheduler \"%s\", ignoring.\n", env);
+	}
+
+	if (const char *env = getenv("GRANITE_THREAD_GROUP_FIBERS"))
+		fiber_mode = strtoul(env, nullptr, 0) != 0;
+	if (fiber_mode)
+		LOGI("Running tasks on fibers.\n");
+
+	if (const char *env = getenv("GRANITE_THREAD_GROUP_LATENCY_STATS"))
+		if (strtoul(env, nullptr, 0) != 0)
+			set_queue_latency_tracking(true);
+
+	// If a class has no threads of its own, the other class has to run all of its work.
+	fg.max_lent = bg.thread_group.empty() ? num_threads_foreground : num_threads_foreground / 2;
+	bg.max_lent = num_threads_background;
+
+	if (scheduler == TaskScheduler::WorkStealing)
+	{
+		LOGI("Using work stealing task scheduler.\n");
+		for (auto *ctx : { &fg, &bg })
+		{
+			ctx->workers.resize(ctx->thread_group.size());
+			unsigned seed = 1;
+			for (auto &w : ctx->workers)
+			{
+				w = std::make_unique<WorkerContext>();
+				w->rng_state = seed++ * 0x9e3779b9u;
+			}
+		}
+	}
+
 	if (const char *env = getenv("GRANITE_TIMELINE_TRACE"))
 	{
-		LOGI("Enabling JSON timeline tracing to %s.\n", env);
+		LOGI("Enabling binary timeline tracing to %s, convert with timeline-trace-convert.\n", env);
 		timeline_trace_file = std::make_unique<Util::TimelineTraceFile>(env);
 	}
 
@@ -185,7 +289,10 @@ void ThreadGroup::start(unsigned num_threads_foreground,
 			set_worker_thread_name_and_prio(self_index - 1, TaskClass::Foreground);
 			if (on_thread_begin)
 				on_thread_begin();
-			thread_looper(self_index, TaskClass::Foreground);
+			if (scheduler == TaskScheduler::WorkStealing)
+				thread_looper_work_stealing(self_index, TaskClass::Foreground, *fg.workers[self_index - 1]);
+			else
+				thread_looper(self_index, TaskClass::Foreground);
 		});
 		self_index++;
 	}
@@ -197,7 +304,13 @@ void ThreadGroup::start(unsigned num_threads_foreground,
 			set_worker_thread_name_and_prio(self_index - 1, TaskClass::Background);
 			if (on_thread_begin)
 				on_thread_begin();
-			thread_looper(self_index, TaskClass::Background);
+			if (scheduler == TaskScheduler::WorkStealing)
+			{
+				unsigned worker_index = self_index - 1 - unsigned(fg.thread_group.size());
+				thread_looper_work_stealing(self_index, TaskClass::Background, *bg.workers[worker_index]);
+			}
+			else
+				thread_looper(self_index, TaskClass::Background);
 		});
 		self_index++;
 	}
@@ -220,50 +333,302 @@ void ThreadGroup::add_dependency(TaskGroup &dependee, TaskGroup &dependency)
 	dependee.deps->dependency_count.fetch_add(1, std::memory_order_relaxed);
 }
 
-void ThreadGroup::move_to_ready_tasks(const Util::SmallVector<Internal::Task *> &list)
+void ThreadGroup::set_scheduler(TaskScheduler scheduler_)
+{
+	if (active)
+		throw std::logic_error("Cannot change scheduler on a thread group which has already started.");
+	scheduler = scheduler_;
+}
+
+TaskScheduler ThreadGroup::get_scheduler() const
+{
+	return scheduler;
+}
+
+void ThreadGroup::set_fiber_mode(bool enable)
+{
+	if (active)
+		throw std::logic_error("Cannot change fiber mode on a thread group which has already started.");
+	fiber_mode = enable;
+}
+
+bool ThreadGroup::get_fiber_mode() const
+{
+	return fiber_mode;
+}
+
+static std::unique_ptr<Internal::FiberWorker> create_fiber_worker(std::mutex &cond_lock,
+                                                                   std::condition_variable &cond)
+{
+	auto fibers = std::make_unique<Internal::FiberWorker>();
+	fibers->scheduler = co_active();
+	fibers->num_resumable.store(0, std::memory_order_relaxed);
+	fibers->cond_lock = &cond_lock;
+	fibers->cond = &cond;
+	return fibers;
+}
+
+void ThreadGroup::fiber_entry(void *arg)
+{
+	auto *fiber = static_cast<Internal::Fiber *>(arg);
+	for (;;)
+	{
+		fiber->group->execute_task(fiber->task);
+		fiber->task = nullptr;
+		fiber->worker->free_fibers.push_back(fiber);
+		co_switch(fiber->worker->scheduler);
+	}
+}
+
+void ThreadGroup::run_task(Internal::FiberWorker *fibers, Internal::Task *task)
+{
+	if (!fibers)
+	{
+		execute_task(task);
+		return;
+	}
+
+	Internal::Fiber *fiber;
+	if (!fibers->free_fibers.empty())
+	{
+		fiber = fibers->free_fibers.back();
+		fibers->free_fibers.pop_back();
+	}
+	else
+	{
+		auto new_fiber = std::make_unique<Internal::Fiber>();
+		new_fiber->group = this;
+		new_fiber->worker = fibers;
+		new_fiber->cothread = co_create(FiberStackSize, fiber_entry, new_fiber.get());
+		if (!new_fiber->cothread)
+		{
+			// Any wait in this task will block the worker, but we still make progress.
+			LOGE("Failed to create fiber, running task on worker stack.\n");
+			execute_task(task);
+			return;
+		}
+		fiber = new_fiber.get();
+		fibers->fibers.push_back(std::move(new_fiber));
+	}
+
+	// Returns when the task completes or the fiber suspends in wait_in_fiber().
+	fiber->task = task;
+	fibers->current = fiber;
+	co_switch(fiber->cothread);
+	fibers->current = nullptr;
+}
+
+bool ThreadGroup::resume_fibers(Internal::FiberWorker *fibers)
+{
+	if (!fibers || fibers->num_resumable.load(std::memory_order_acquire) == 0)
+		return false;
+
+	{
+		std::lock_guard<std::mutex> holder{fibers->resume_lock};
+		fibers->resuming.swap(fibers->resumable);
+		fibers->num_resumable.store(0, std::memory_order_relaxed);
+	}
+
+	for (auto *fiber : fibers->resuming)
+	{
+		fibers->current = fiber;
+		co_switch(fiber->cothread);
+		fibers->current = nullptr;
+	}
+
+	fibers->resuming.clear();
+	return true;
+}
+
+bool ThreadGroup::wait_in_fiber(Internal::TaskDeps &deps)
+{
+	auto *fibers = current_worker.fibers;
+	if (current_worker.group != this || !fibers || !fibers->current)
+		return false;
+
+	{
+		std::lock_guard<std::mutex> holder{deps.cond_lock};
+		if (deps.done)
+			return true;
+		deps.waiting_fibers.push_back(fibers->current);
+	}
+
+	// Only this thread resumes the fiber, so it cannot be resumed before we have switched away.
+	co_switch(fibers->scheduler);
+	return true;
+}
+
+void ThreadGroup::resume_fiber(Internal::Fiber *fiber)
+{
+	auto *fibers = fiber->worker;
+
+	{
+		std::lock_guard<std::mutex> holder{fibers->resume_lock};
+		fibers->resumable.push_back(fiber);
+		fibers->num_resumable.fetch_add(1, std::memory_order_release);
+	}
+
+	// The owning worker might be asleep. We cannot target a particular thread, so wake all of them.
+	std::lock_guard<std::mutex> holder{*fibers->cond_lock};
+	fibers->cond->notify_all();
+}
+
+ThreadGroup::TaskClassContext &ThreadGroup::get_context(TaskClass task_class)
+{
+	return task_class == TaskClass::Foreground ? fg : bg;
+}
+
+ThreadGroup::TaskClassContext &ThreadGroup::get_other_context(TaskClass task_class)
+{
+	return task_class == TaskClass::Foreground ? bg : fg;
+}
+
+bool ThreadGroup::can_lend_thread(const TaskClassContext &ctx) const
+{
+	return ctx.num_lent.load(std::memory_order_relaxed) < ctx.max_lent;
+}
+
+bool ThreadGroup::try_lend_thread(TaskClassContext &ctx)
+{
+	unsigned lent = ctx.num_lent.load(std::memory_order_relaxed);
+	while (lent < ctx.max_lent)
+	{
+		if (ctx.num_lent.compare_exchange_weak(lent, lent + 1, std::memory_order_relaxed))
+			return true;
+	}
+	return false;
+}
+
+void ThreadGroup::wake_helpers(TaskClassContext &ctx, unsigned count)
+{
+	// Threads of the other class may pick up work from ctx.
+	auto &helpers = &ctx == &fg ? bg : fg;
+	if (helpers.max_lent == 0)
+		return;
+
+	std::lock_guard<std::mutex> holder{helpers.cond_lock};
+	if (count >= helpers.thread_group.size())
+		helpers.cond.notify_all();
+	else
+	{
+		for (unsigned i = 0; i < count; i++)
+			helpers.cond.notify_one();
+	}
+}
+
+void ThreadGroup::move_to_ready_tasks_work_stealing(const Util::SmallVector<Internal::Task *> &list)
 {
 	unsigned fg_task_count = 0;
 	unsigned bg_task_count = 0;
+
+	total_tasks.fetch_add(list.size(), std::memory_order_relaxed);
+
 	for (auto *t : list)
 	{
-		if (t->deps->task_class == TaskClass::Foreground)
+		auto task_class = t->deps->task_class;
+		auto priority = unsigned(t->deps->priority);
+		auto &ctx = get_context(task_class);
+
+		if (task_class == TaskClass::Foreground)
 			fg_task_count++;
 		else
 			bg_task_count++;
+
+		// Fast path, we're a worker of the right class, keep the task local.
+		if (current_worker.group == this && current_worker.task_class == task_class &&
+		    static_cast<WorkerContext *>(current_worker.worker)->deques[priority].push(t))
+		{
+			continue;
+		}
+
+		std::lock_guard<std::mutex> holder{ctx.cond_lock};
+		ctx.ready_tasks[priority].push(t);
+		ctx.num_ready.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	total_tasks.fetch_add(list.size(), std::memory_order_relaxed);
+	// Pairs with the sleeper increment in thread_looper_work_stealing().
+	// Either we observe the sleeper, or the sleeper observes our pushed work.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
 
-	if (fg_task_count)
+	for (auto *ctx : { &fg, &bg })
 	{
-		std::lock_guard<std::mutex> holder{fg.cond_lock};
-
-		for (auto &t : list)
-			fg.ready_tasks.push(t);
+		unsigned count = ctx == &fg ? fg_task_count : bg_task_count;
+		if (!count)
+			continue;
 
-		if (fg_task_count >= fg.thread_group.size())
-			fg.cond.notify_all();
+		if (ctx->num_sleeping.load(std::memory_order_seq_cst) != 0)
+		{
+			std::lock_guard<std::mutex> holder{ctx->cond_lock};
+			if (count >= ctx->thread_group.size())
+				ctx->cond.notify_all();
+			else
+			{
+				for (unsigned i = 0; i < count; i++)
+					ctx->cond.notify_one();
+			}
+		}
 		else
 		{
-			for (unsigned i = 0; i < fg_task_count; i++)
-				fg.cond.notify_one();
+			// Every thread of this class is busy, let idle threads of the other class help out.
+			auto &helpers = ctx == &fg ? bg : fg;
+			if (helpers.num_sleeping.load(std::memory_order_seq_cst) != 0)
+				wake_helpers(*ctx, count);
 		}
 	}
+}
 
-	if (bg_task_count)
+void ThreadGroup::move_to_ready_tasks(const Util::SmallVector<Internal::Task *> &list)
+{
+	if (track_queue_latency.load(std::memory_order_relaxed))
 	{
-		std::lock_guard<std::mutex> holder{bg.cond_lock};
+		auto now = Util::get_current_time_nsecs();
+		for (auto *t : list)
+			t->deps->ready_time_ns = now;
+	}
 
-		for (auto &t : list)
-			bg.ready_tasks.push(t);
+	if (scheduler == TaskScheduler::WorkStealing)
+	{
+		move_to_ready_tasks_work_stealing(list);
+		return;
+	}
+
+	total_tasks.fetch_add(list.size(), std::memory_order_relaxed);
+
+	for (auto *ctx : { &fg, &bg })
+	{
+		auto task_class = ctx == &fg ? TaskClass::Foreground : TaskClass::Background;
+		unsigned count = 0;
+		unsigned idle_threads;
 
-		if (bg_task_count >= bg.thread_group.size())
-			bg.cond.notify_all();
-		else
 		{
-			for (unsigned i = 0; i < bg_task_count; i++)
-				bg.cond.notify_one();
+			std::lock_guard<std::mutex> holder{ctx->cond_lock};
+			for (auto *t : list)
+			{
+				if (t->deps->task_class == task_class)
+				{
+					ctx->ready_tasks[unsigned(t->deps->priority)].push(t);
+					count++;
+				}
+			}
+
+			if (!count)
+				continue;
+
+			ctx->num_ready.fetch_add(count, std::memory_order_relaxed);
+			idle_threads = ctx->num_sleeping.load(std::memory_order_relaxed);
+
+			if (count >= ctx->thread_group.size())
+				ctx->cond.notify_all();
+			else
+			{
+				for (unsigned i = 0; i < count; i++)
+					ctx->cond.notify_one();
+			}
 		}
+
+		// More work than idle threads, let idle threads of the other class help out.
+		if (count > idle_threads)
+			wake_helpers(*ctx, count - idle_threads);
 	}
 }
 
@@ -316,6 +681,18 @@ TaskGroupHandle ThreadGroup::create_task()
 	return group;
 }
 
+void TaskGroup::add_external_dependency()
+{
+	if (flushed)
+		throw std::logic_error("Cannot add dependency to task group which has been flushed.");
+	deps->dependency_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TaskGroup::release_external_dependency()
+{
+	deps->dependency_satisfied();
+}
+
 void TaskGroup::set_fence_counter_signal(TaskSignal *signal)
 {
 	deps->signal = signal;
@@ -336,6 +713,11 @@ void TaskGroup::set_task_class(TaskClass task_class)
 	deps->task_class = task_class;
 }
 
+void TaskGroup::set_priority(TaskPriority priority)
+{
+	deps->priority = priority;
+}
+
 void ThreadGroup::wait_idle()
 {
 	std::unique_lock<std::mutex> holder{wait_cond_lock};
@@ -349,54 +731,321 @@ bool ThreadGroup::is_idle()
 	return total_tasks.load(std::memory_order_acquire) == completed_tasks.load(std::memory_order_acquire);
 }
 
+void ThreadGroup::record_queue_latency(const Internal::Task &task)
+{
+	auto priority = unsigned(task.deps->priority);
+	auto latency_ns = uint64_t(std::max<int64_t>(Util::get_current_time_nsecs() - task.deps->ready_time_ns, 0));
+
+	unsigned bucket = 0;
+	uint64_t latency_us = latency_ns / 1000;
+	while (latency_us > 1 && bucket + 1 < QueueLatencyHistogram::NumBuckets)
+	{
+		latency_us >>= 1;
+		bucket++;
+	}
+
+	queue_latency_buckets[priority][bucket].fetch_add(1, std::memory_order_relaxed);
+	queue_latency_count[priority].fetch_add(1, std::memory_order_relaxed);
+	queue_latency_total_ns[priority].fetch_add(latency_ns, std::memory_order_relaxed);
+
+	uint64_t current_max = queue_latency_max_ns[priority].load(std::memory_order_relaxed);
+	while (latency_ns > current_max &&
+	       !queue_latency_max_ns[priority].compare_exchange_weak(current_max, latency_ns, std::memory_order_relaxed))
+	{
+	}
+}
+
+void ThreadGroup::set_queue_latency_tracking(bool enable)
+{
+	track_queue_latency.store(enable, std::memory_order_relaxed);
+}
+
+void ThreadGroup::get_queue_latency_histogram(TaskPriority priority, QueueLatencyHistogram &histogram) const
+{
+	auto p = unsigned(priority);
+	for (unsigned i = 0; i < QueueLatencyHistogram::NumBuckets; i++)
+		histogram.buckets[i] = queue_latency_buckets[p][i].load(std::memory_order_relaxed);
+	histogram.count = queue_latency_count[p].load(std::memory_order_relaxed);
+	histogram.total_ns = queue_latency_total_ns[p].load(std::memory_order_relaxed);
+	histogram.max_ns = queue_latency_max_ns[p].load(std::memory_order_relaxed);
+}
+
+void ThreadGroup::reset_queue_latency_histograms()
+{
+	for (unsigned p = 0; p < NumPriorities; p++)
+	{
+		for (auto &bucket : queue_latency_buckets[p])
+			bucket.store(0, std::memory_order_relaxed);
+		queue_latency_count[p].store(0, std::memory_order_relaxed);
+		queue_latency_total_ns[p].store(0, std::memory_order_relaxed);
+		queue_latency_max_ns[p].store(0, std::memory_order_relaxed);
+	}
+}
+
+void ThreadGroup::log_queue_latency_histograms() const
+{
+	static const char *priority_names[NumPriorities] = { "High", "Normal", "Low" };
+
+	for (unsigned p = 0; p < NumPriorities; p++)
+	{
+		QueueLatencyHistogram histogram;
+		get_queue_latency_histogram(TaskPriority(p), histogram);
+		if (!histogram.count)
+			continue;
+
+		LOGI("Queue latency [%s]: %llu tasks, avg %.3f us, max %.3f us.\n", priority_names[p],
+		     static_cast<unsigned long long>(histogram.count),
+		     1e-3 * double(histogram.total_ns) / double(histogram.count),
+		     1e-3 * double(histogram.max_ns));
+
+		for (unsigned i = 0; i < QueueLatencyHistogram::NumBuckets; i++)
+		{
+			if (histogram.buckets[i])
+			{
+				LOGI("  [%8u us, %8u us): %llu\n", i ? (1u << i) : 0u, 1u << (i + 1),
+				     static_cast<unsigned long long>(histogram.buckets[i]));
+			}
+		}
+	}
+}
+
+void ThreadGroup::execute_task(Internal::Task *task)
+{
+	if (track_queue_latency.load(std::memory_order_relaxed) && task->deps->ready_time_ns)
+		record_queue_latency(*task);
+
+	if (task->callable)
+	{
+		GRANITE_SCOPED_TIMELINE_EVENT_FILE(timeline_trace_file.get(), task->deps->desc);
+		task->callable.call();
+	}
+
+	task->deps->task_completed();
+	task_pool.free(task);
+
+	{
+		auto completed = completed_tasks.fetch_add(1, std::memory_order_relaxed) + 1;
+		//LOGI("Task completed (%u / %u)!\n", completed, total_tasks.load(memory_order_relaxed));
+
+		if (completed == total_tasks.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> holder{wait_cond_lock};
+			wait_cond.notify_all();
+		}
+	}
+}
+
+Internal::Task *ThreadGroup::pop_ready_task_locked(TaskClassContext &ctx)
+{
+	for (auto &queue : ctx.ready_tasks)
+	{
+		if (!queue.empty())
+		{
+			auto *task = queue.front();
+			queue.pop();
+			ctx.num_ready.fetch_sub(1, std::memory_order_relaxed);
+			return task;
+		}
+	}
+
+	return nullptr;
+}
+
 void ThreadGroup::thread_looper(unsigned index, TaskClass task_class)
 {
 	Util::register_thread_index(index);
-	auto &ctx = task_class == TaskClass::Foreground ? fg : bg;
+	auto &ctx = get_context(task_class);
+	auto &other = get_other_context(task_class);
+
+	std::unique_ptr<Internal::FiberWorker> fibers;
+	if (fiber_mode)
+		fibers = create_fiber_worker(ctx.cond_lock, ctx.cond);
+	current_worker = { this, nullptr, task_class, fibers.get() };
 
 	for (;;)
 	{
 		Internal::Task *task = nullptr;
 
+		// Suspended tasks take precedence over starting new ones.
+		if (resume_fibers(fibers.get()))
+			continue;
+
 		{
 			std::unique_lock<std::mutex> holder{ctx.cond_lock};
+			ctx.num_sleeping.fetch_add(1, std::memory_order_relaxed);
 			ctx.cond.wait(holder, [&]() {
-				return dead || !ctx.ready_tasks.empty();
+				return dead || ctx.num_ready.load(std::memory_order_relaxed) != 0 ||
+				       (fibers && fibers->num_resumable.load(std::memory_order_relaxed) != 0) ||
+				       (can_lend_thread(ctx) && other.num_ready.load(std::memory_order_relaxed) != 0);
 			});
+			ctx.num_sleeping.fetch_sub(1, std::memory_order_relaxed);
 
-			if (dead && ctx.ready_tasks.empty())
+			task = pop_ready_task_locked(ctx);
+			if (!task && dead)
 				break;
+		}
+
+		if (task)
+		{
+			run_task(fibers.get(), task);
+		}
+		else if (try_lend_thread(ctx))
+		{
+			{
+				std::lock_guard<std::mutex> holder{other.cond_lock};
+				task = pop_ready_task_locked(other);
+			}
+
+			if (task)
+				run_task(fibers.get(), task);
+			ctx.num_lent.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	current_worker = {};
+}
+
+bool ThreadGroup::has_pending_work(TaskClassContext &ctx) const
+{
+	if (ctx.num_ready.load(std::memory_order_seq_cst) != 0)
+		return true;
+	for (auto &w : ctx.workers)
+		for (auto &deque : w->deques)
+			if (!deque.empty())
+				return true;
+	return false;
+}
+
+Internal::Task *ThreadGroup::find_work(TaskClassContext &ctx, WorkerContext &worker, bool allow_local)
+{
+	auto num_workers = unsigned(ctx.workers.size());
+
+	// xorshift32, start stealing from a random victim to avoid convoys.
+	uint32_t x = worker.rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	worker.rng_state = x;
+	unsigned start = num_workers ? x % num_workers : 0;
 
-			task = ctx.ready_tasks.front();
-			ctx.ready_tasks.pop();
+	for (unsigned priority = 0; priority < NumPriorities; priority++)
+	{
+		// Local LIFO first, this is the hot path for dependency chains spawned on this worker.
+		if (allow_local)
+			if (auto *task = worker.deques[priority].pop())
+				return task;
+
+		if (ctx.num_ready.load(std::memory_order_relaxed) != 0)
+		{
+			std::lock_guard<std::mutex> holder{ctx.cond_lock};
+			auto &queue = ctx.ready_tasks[priority];
+			if (!queue.empty())
+			{
+				auto *task = queue.front();
+				queue.pop();
+				ctx.num_ready.fetch_sub(1, std::memory_order_relaxed);
+				return task;
+			}
 		}
 
-		if (task->callable)
+		for (unsigned i = 0; i < num_workers; i++)
 		{
-			GRANITE_SCOPED_TIMELINE_EVENT_FILE(timeline_trace_file.get(), task->deps->desc);
-			task->callable.call();
+			auto &victim = *ctx.workers[(start + i) % num_workers];
+			if (&victim == &worker)
+				continue;
+			if (auto *task = victim.deques[priority].steal())
+				return task;
 		}
+	}
 
-		task->deps->task_completed();
-		task_pool.free(task);
+	return nullptr;
+}
 
+void ThreadGroup::thread_looper_work_stealing(unsigned index, TaskClass task_class, WorkerContext &worker)
+{
+	Util::register_thread_index(index);
+	auto &ctx = get_context(task_class);
+	auto &other = get_other_context(task_class);
+
+	std::unique_ptr<Internal::FiberWorker> fibers;
+	if (fiber_mode)
+		fibers = create_fiber_worker(ctx.cond_lock, ctx.cond);
+	current_worker = { this, &worker, task_class, fibers.get() };
+
+	// Spin for a while before parking, dependency chains tend to produce new work very soon.
+	constexpr unsigned SpinIterations = 64;
+
+	for (;;)
+	{
+		Internal::Task *task = nullptr;
+		bool lent = false;
+
+		// Suspended tasks take precedence over starting new ones.
+		if (resume_fibers(fibers.get()))
+			continue;
+
+		for (unsigned i = 0; i < SpinIterations && !task; i++)
 		{
-			auto completed = completed_tasks.fetch_add(1, std::memory_order_relaxed) + 1;
-			//LOGI("Task completed (%u / %u)!\n", completed, total_tasks.load(memory_order_relaxed));
+			task = find_work(ctx, worker, true);
+
+			if (!task && try_lend_thread(ctx))
+			{
+				task = find_work(other, worker, false);
+				if (task)
+					lent = true;
+				else
+					ctx.num_lent.fetch_sub(1, std::memory_order_relaxed);
+			}
 
-			if (completed == total_tasks.load(std::memory_order_relaxed))
+			if (!task)
 			{
-				std::lock_guard<std::mutex> holder{wait_cond_lock};
-				wait_cond.notify_all();
+				if (fibers && fibers->num_resumable.load(std::memory_order_relaxed) != 0)
+					break;
+#ifdef __SSE2__
+				_mm_pause();
+#else
+				std::this_thread::yield();
+#endif
 			}
 		}
+
+		if (task)
+		{
+			run_task(fibers.get(), task);
+			if (lent)
+				ctx.num_lent.fetch_sub(1, std::memory_order_relaxed);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> holder{ctx.cond_lock};
+		ctx.num_sleeping.fetch_add(1, std::memory_order_seq_cst);
+		ctx.cond.wait(holder, [&]() {
+			return dead || has_pending_work(ctx) ||
+			       (fibers && fibers->num_resumable.load(std::memory_order_relaxed) != 0) ||
+			       (can_lend_thread(ctx) && has_pending_work(other));
+		});
+		ctx.num_sleeping.fetch_sub(1, std::memory_order_relaxed);
+
+		if (dead && !has_pending_work(ctx))
+			break;
 	}
+
+	current_worker = {};
 }
 
 ThreadGroup::ThreadGroup()
 {
 	total_tasks.store(0);
 	completed_tasks.store(0);
+	for (auto *ctx : { &fg, &bg })
+	{
+		ctx->num_sleeping.store(0);
+		ctx->num_ready.store(0);
+		ctx->num_lent.store(0);
+	}
+
+	track_queue_latency.store(false);
+	reset_queue_latency_histograms();
 }
 
 ThreadGroup::~ThreadGroup()
@@ -437,6 +1086,11 @@ void ThreadGroup::stop()
 		}
 	}
 
+	fg.workers.clear();
+	bg.workers.clear();
+	fg.max_lent = 0;
+	bg.max_lent = 0;
+
 	active = false;
 	dead = false;
 }
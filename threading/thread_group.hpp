@@ -36,6 +36,7 @@
 #include "global_managers.hpp"
 #include "small_vector.hpp"
 #include "small_callable.hpp"
+#include "work_stealing_deque.hpp"
 
 namespace Granite
 {
@@ -58,11 +59,35 @@ enum class TaskClass : uint8_t
 	Background
 };
 
+// Ready tasks are dequeued in strict priority order.
+// The task class decides which set of threads a task belongs to,
+// the priority decides ordering within (and when borrowing threads, across) classes.
+enum class TaskPriority : uint8_t
+{
+	// Latency critical work, e.g. work the current frame is blocked on.
+	High = 0,
+	Normal,
+	// Bulk work which should yield to anything else, e.g. asset streaming.
+	Low,
+	Count
+};
+
+enum class TaskScheduler : uint8_t
+{
+	// One locked FIFO queue per task class.
+	GlobalQueue,
+	// Per-worker Chase-Lev deques with LIFO local pops and random victim stealing.
+	// Tasks submitted from non-worker threads go through a locked injection queue.
+	WorkStealing
+};
+
 struct TaskGroup;
 namespace Internal
 {
 struct TaskDeps;
 struct Task;
+struct Fiber;
+struct FiberWorker;
 
 struct TaskDepsDeleter
 {
@@ -100,7 +125,12 @@ struct TaskDeps : Util::IntrusivePtrEnabled<TaskDeps, TaskDepsDeleter, Util::Mul
 	std::condition_variable cond;
 	std::mutex cond_lock;
 	bool done = false;
+	// Fibers suspended in TaskGroup::wait(), resumed when done is set.
+	Util::SmallVector<Fiber *> waiting_fibers;
 	TaskClass task_class = TaskClass::Foreground;
+	TaskPriority priority = TaskPriority::Normal;
+	// Only written when queue latency tracking is enabled.
+	int64_t ready_time_ns = 0;
 
 	char desc[64];
 };
@@ -140,8 +170,15 @@ struct TaskGroup : Util::IntrusivePtrEnabled<TaskGroup, Internal::TaskGroupDelet
 	void set_fence_counter_signal(TaskSignal *signal);
 	ThreadGroup *get_thread_group() const;
 
+	// Holds back tasks in this group until release_external_dependency() has been called,
+	// e.g. when waiting for I/O which does not complete on a task.
+	// Must be called before flush(). Release may be called from any thread.
+	void add_external_dependency();
+	void release_external_dependency();
+
 	void set_desc(const char *desc);
 	void set_task_class(TaskClass task_class);
+	void set_priority(TaskPriority priority);
 
 	unsigned id = 0;
 	bool flushed = false;
@@ -166,8 +203,24 @@ public:
 		return unsigned(fg.thread_group.size() + bg.thread_group.size());
 	}
 
+	unsigned get_num_threads(TaskClass task_class) const
+	{
+		return unsigned(task_class == TaskClass::Foreground ? fg.thread_group.size() : bg.thread_group.size());
+	}
+
 	void stop();
 
+	// Must be called before start().
+	// Can also be overridden with GRANITE_THREAD_GROUP_SCHEDULER=queue|work-stealing.
+	void set_scheduler(TaskScheduler scheduler);
+	TaskScheduler get_scheduler() const;
+
+	// Runs tasks on fibers. A task calling TaskGroup::wait() on a worker thread then suspends its fiber
+	// and the worker keeps executing other tasks instead of blocking.
+	// Must be called before start(). Can also be enabled with GRANITE_THREAD_GROUP_FIBERS=1.
+	void set_fiber_mode(bool enable);
+	bool get_fiber_mode() const;
+
 	template <typename Func>
 	void enqueue_task(TaskGroup &group, Func&& func);
 	template <typename Func>
@@ -181,6 +234,10 @@ public:
 	void free_task_group(TaskGroup *group);
 	void free_task_deps(Internal::TaskDeps *deps);
 
+	// Returns false if not called from a fiber of this thread group, caller must block instead.
+	bool wait_in_fiber(Internal::TaskDeps &deps);
+	void resume_fiber(Internal::Fiber *fiber);
+
 	void submit(TaskGroupHandle &group);
 	void wait_idle();
 	bool is_idle();
@@ -190,20 +247,81 @@ public:
 
 	static void set_async_main_thread();
 
+	// Tracks time from a task becoming ready until a worker picks it up, per priority.
+	// Can be toggled at any time. Can also be enabled with GRANITE_THREAD_GROUP_LATENCY_STATS=1.
+	struct QueueLatencyHistogram
+	{
+		enum { NumBuckets = 24 };
+		// Bucket i counts latencies in [2^i, 2^(i + 1)) us. Bucket 0 also counts anything below 1 us,
+		// and the last bucket counts anything above.
+		uint64_t buckets[NumBuckets];
+		uint64_t count;
+		uint64_t total_ns;
+		uint64_t max_ns;
+	};
+	void set_queue_latency_tracking(bool enable);
+	void get_queue_latency_histogram(TaskPriority priority, QueueLatencyHistogram &histogram) const;
+	void reset_queue_latency_histograms();
+	void log_queue_latency_histograms() const;
+
 private:
-	Util::ThreadSafeObjectPool<Internal::Task> task_pool;
-	Util::ThreadSafeObjectPool<TaskGroup> task_group_pool;
-	Util::ThreadSafeObjectPool<Internal::TaskDeps> task_deps_pool;
+	Util::ThreadCachedObjectPool<Internal::Task> task_pool;
+	Util::ThreadCachedObjectPool<TaskGroup> task_group_pool;
+	Util::ThreadCachedObjectPool<Internal::TaskDeps> task_deps_pool;
+
+	enum { NumPriorities = unsigned(TaskPriority::Count) };
 
-	struct
+	struct WorkerContext
+	{
+		Util::WorkStealingDeque<Internal::Task> deques[NumPriorities];
+		uint32_t rng_state = 0;
+	};
+
+	struct TaskClassContext
 	{
 		std::vector<std::unique_ptr<std::thread>> thread_group;
-		std::queue<Internal::Task *> ready_tasks;
+		// For work stealing, these act as injection queues for tasks submitted outside worker threads.
+		std::queue<Internal::Task *> ready_tasks[NumPriorities];
 		std::mutex cond_lock;
 		std::condition_variable cond;
+
+		std::vector<std::unique_ptr<WorkerContext>> workers;
+		std::atomic_uint num_sleeping;
+		// Number of tasks in ready_tasks, so it can be checked without taking the lock.
+		std::atomic_uint num_ready;
+
+		// Idle threads may run tasks of the other class.
+		// Foreground only lends out half its threads so frame work always has threads available.
+		std::atomic_uint num_lent;
+		unsigned max_lent = 0;
 	} fg, bg;
 
+	TaskScheduler scheduler = TaskScheduler::GlobalQueue;
+	bool fiber_mode = false;
+
+	TaskClassContext &get_context(TaskClass task_class);
+	TaskClassContext &get_other_context(TaskClass task_class);
+
 	void thread_looper(unsigned self_index, TaskClass task_class);
+	void thread_looper_work_stealing(unsigned self_index, TaskClass task_class, WorkerContext &worker);
+	void execute_task(Internal::Task *task);
+	void run_task(Internal::FiberWorker *fibers, Internal::Task *task);
+	bool resume_fibers(Internal::FiberWorker *fibers);
+	static void fiber_entry(void *arg);
+	void move_to_ready_tasks_work_stealing(const Util::SmallVector<Internal::Task *> &list);
+	Internal::Task *pop_ready_task_locked(TaskClassContext &ctx);
+	Internal::Task *find_work(TaskClassContext &ctx, WorkerContext &worker, bool allow_local);
+	bool has_pending_work(TaskClassContext &ctx) const;
+	bool try_lend_thread(TaskClassContext &ctx);
+	bool can_lend_thread(const TaskClassContext &ctx) const;
+	void wake_helpers(TaskClassContext &ctx, unsigned count);
+
+	std::atomic_bool track_queue_latency;
+	std::atomic<uint64_t> queue_latency_buckets[NumPriorities][QueueLatencyHistogram::NumBuckets];
+	std::atomic<uint64_t> queue_latency_count[NumPriorities];
+	std::atomic<uint64_t> queue_latency_total_ns[NumPriorities];
+	std::atomic<uint64_t> queue_latency_max_ns[NumPriorities];
+	void record_queue_latency(const Internal::Task &task);
 
 	bool active = false;
 	bool dead = false;
@@ -0,0 +1,216 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "timeline_trace_file.hpp"
+#include "logging.hpp"
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+using namespace Util;
+using BinaryFormat = TimelineTraceFile::BinaryFormat;
+
+static bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	uint8_t buffer[64 * 1024];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) != 0)
+		data.insert(data.end(), buffer, buffer + count);
+
+	fclose(file);
+	return true;
+}
+
+static void write_escaped(FILE *file, const std::string &str)
+{
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+			fprintf(file, "\\%c", c);
+		else if (uint8_t(c) < 0x20)
+			fprintf(file, "\\u%04x", unsigned(uint8_t(c)));
+		else
+			fputc(c, file);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		LOGE("Usage: %s <input.trace> <output.json>\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<uint8_t> data;
+	if (!read_file(argv[1], data))
+	{
+		LOGE("Failed to read %s.\n", argv[1]);
+		return 1;
+	}
+
+	BinaryFormat::Header header;
+	if (data.size() < sizeof(header))
+	{
+		LOGE("File is too small.\n");
+		return 1;
+	}
+
+	memcpy(&header, data.data(), sizeof(header));
+	if (memcmp(header.magic, BinaryFormat::Magic, sizeof(header.magic)) != 0 ||
+	    header.version != BinaryFormat::Version)
+	{
+		LOGE("Not a timeline trace file, or unsupported version.\n");
+		return 1;
+	}
+
+	std::unordered_map<uint32_t, std::string> strings;
+	std::vector<BinaryFormat::Record> records;
+	std::vector<BinaryFormat::Calibration> calibrations;
+	uint64_t dropped = 0;
+
+	size_t offset = sizeof(header);
+	while (offset + sizeof(BinaryFormat::ChunkHeader) <= data.size())
+	{
+		BinaryFormat::ChunkHeader chunk;
+		memcpy(&chunk, data.data() + offset, sizeof(chunk));
+		offset += sizeof(chunk);
+
+		// A trace from a process which crashed can be truncated, keep what we have.
+		if (offset + chunk.size > data.size())
+		{
+			LOGW("Truncated chunk, ignoring rest of file.\n");
+			break;
+		}
+
+		const uint8_t *payload = data.data() + offset;
+		offset += chunk.size;
+
+		switch (chunk.type)
+		{
+		case BinaryFormat::ChunkStrings:
+		{
+			size_t string_offset = 0;
+			while (string_offset + 2 * sizeof(uint32_t) <= chunk.size)
+			{
+				uint32_t id, len;
+				memcpy(&id, payload + string_offset, sizeof(id));
+				memcpy(&len, payload + string_offset + sizeof(id), sizeof(len));
+				string_offset += 2 * sizeof(uint32_t);
+				if (string_offset + len > chunk.size)
+					break;
+				strings[id] = std::string(reinterpret_cast<const char *>(payload + string_offset), len);
+				string_offset += len;
+			}
+			break;
+		}
+
+		case BinaryFormat::ChunkRecords:
+		{
+			size_t count = chunk.size / sizeof(BinaryFormat::Record);
+			size_t base = records.size();
+			records.resize(base + count);
+			memcpy(records.data() + base, payload, count * sizeof(BinaryFormat::Record));
+			break;
+		}
+
+		case BinaryFormat::ChunkCalibration:
+			if (chunk.size == sizeof(BinaryFormat::Calibration))
+			{
+				BinaryFormat::Calibration calibration;
+				memcpy(&calibration, payload, sizeof(calibration));
+				calibrations.push_back(calibration);
+			}
+			break;
+
+		case BinaryFormat::ChunkDropped:
+			if (chunk.size == sizeof(uint64_t))
+				memcpy(&dropped, payload, sizeof(dropped));
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (calibrations.empty())
+	{
+		LOGE("No calibration in trace file.\n");
+		return 1;
+	}
+
+	// Map ticks linearly between the first and last calibration points.
+	auto &first = calibrations.front();
+	auto &last = calibrations.back();
+	double ns_per_tick = 1.0;
+	if (last.ticks > first.ticks)
+		ns_per_tick = double(last.ns - first.ns) / double(last.ticks - first.ticks);
+
+	auto to_us = [&](uint64_t value, bool ns_timebase) -> double {
+		if (ns_timebase)
+			return 1e-3 * double(int64_t(value) - first.ns);
+		else
+			return 1e-3 * ns_per_tick * (double(value) - double(first.ticks));
+	};
+
+	auto get_string = [&](uint32_t id) -> const std::string & {
+		static const std::string empty;
+		auto itr = strings.find(id);
+		return itr != strings.end() ? itr->second : empty;
+	};
+
+	FILE *file = fopen(argv[2], "w");
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", argv[2]);
+		return 1;
+	}
+
+	fputs("[\n", file);
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		auto &record = records[i];
+		bool ns_timebase = (record.flags & BinaryFormat::RecordTimebaseNsBit) != 0;
+		double start_us = to_us(record.start, ns_timebase);
+		double end_us = to_us(record.end, ns_timebase);
+
+		fputs("{ \"name\": \"", file);
+		write_escaped(file, get_string(record.desc_id));
+		fputs("\", \"ph\": \"X\", \"tid\": \"", file);
+		write_escaped(file, get_string(record.tid_id));
+		fprintf(file, "\", \"pid\": \"%u\", \"ts\": %f, \"dur\": %f }%s\n",
+		        record.pid, start_us, end_us - start_us, i + 1 < records.size() ? "," : "");
+	}
+	fputs("]\n", file);
+	fclose(file);
+
+	LOGI("Converted %zu events.\n", records.size());
+	if (dropped)
+		LOGW("%llu events were dropped while tracing.\n", static_cast<unsigned long long>(dropped));
+
+	return 0;
+}
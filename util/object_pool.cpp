@@ -0,0 +1,88 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "object_pool.hpp"
+#include <mutex>
+#include <vector>
+
+namespace Util
+{
+namespace Internal
+{
+static std::mutex slot_lock;
+static std::vector<unsigned> free_slots;
+static unsigned slot_count;
+
+enum : unsigned
+{
+	SlotUninitialized = ~0u,
+	SlotDead = ~0u - 1
+};
+
+// Trivially destructible so it can still be read after the releaser below has run.
+static thread_local unsigned current_slot = SlotUninitialized;
+
+struct ThreadSlotReleaser
+{
+	~ThreadSlotReleaser()
+	{
+		if (current_slot < ObjectPoolMaxThreadSlots)
+		{
+			std::lock_guard<std::mutex> holder{slot_lock};
+			free_slots.push_back(current_slot);
+		}
+		// Any pool use after this point goes through the locked path.
+		current_slot = SlotDead;
+	}
+};
+static thread_local ThreadSlotReleaser slot_releaser;
+
+static unsigned acquire_thread_slot()
+{
+	unsigned slot;
+	{
+		std::lock_guard<std::mutex> holder{slot_lock};
+		if (!free_slots.empty())
+		{
+			slot = free_slots.back();
+			free_slots.pop_back();
+		}
+		else if (slot_count < ObjectPoolMaxThreadSlots)
+			slot = slot_count++;
+		else
+			slot = ObjectPoolMaxThreadSlots;
+	}
+
+	// Touch the releaser so its destructor runs on thread exit.
+	(void)&slot_releaser;
+	return slot;
+}
+
+unsigned get_object_pool_thread_slot()
+{
+	unsigned slot = current_slot;
+	if (slot == SlotUninitialized)
+		slot = current_slot = acquire_thread_slot();
+	return slot;
+}
+}
+}
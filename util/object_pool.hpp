@@ -41,19 +41,8 @@ public:
 	T *allocate(P &&... p)
 	{
 #ifndef OBJECT_POOL_DEBUG
-		if (vacants.empty())
-		{
-			unsigned num_objects = 64u << memory.size();
-			T *ptr = static_cast<T *>(memalign_alloc(std::max<size_t>(64, alignof(T)),
-			                                         num_objects * sizeof(T)));
-			if (!ptr)
-				return nullptr;
-
-			for (unsigned i = 0; i < num_objects; i++)
-				vacants.push_back(&ptr[i]);
-
-			memory.emplace_back(ptr);
-		}
+		if (vacants.empty() && !grow())
+			return nullptr;
 
 		T *ptr = vacants.back();
 		vacants.pop_back();
@@ -86,6 +75,21 @@ protected:
 #ifndef OBJECT_POOL_DEBUG
 	std::vector<T *> vacants;
 
+	bool grow()
+	{
+		unsigned num_objects = 64u << memory.size();
+		T *ptr = static_cast<T *>(memalign_alloc(std::max<size_t>(64, alignof(T)),
+		                                         num_objects * sizeof(T)));
+		if (!ptr)
+			return false;
+
+		for (unsigned i = 0; i < num_objects; i++)
+			vacants.push_back(&ptr[i]);
+
+		memory.emplace_back(ptr);
+		return true;
+	}
+
 	struct MallocDeleter
 	{
 		void operator()(T *ptr)
@@ -129,4 +133,140 @@ public:
 private:
 	std::mutex lock;
 };
+
+namespace Internal
+{
+enum { ObjectPoolMaxThreadSlots = 64 };
+// Returns a small integer unique among live threads, recycled when threads exit.
+// Returns ObjectPoolMaxThreadSlots or larger if no slot is available, e.g. during thread teardown.
+unsigned get_object_pool_thread_slot();
+}
+
+// Like ThreadSafeObjectPool, but every thread keeps a small magazine of vacant objects.
+// Allocations and frees only touch the shared depot (and its lock) when a magazine
+// runs empty or full, and then in batches of MagazineSize / 2.
+// Objects may be freed on a different thread than they were allocated on.
+template<typename T, unsigned MagazineSize = 64>
+class ThreadCachedObjectPool : private ObjectPool<T>
+{
+public:
+	static_assert(MagazineSize >= 2, "MagazineSize must be at least 2.");
+
+	ThreadCachedObjectPool() = default;
+	ThreadCachedObjectPool(const ThreadCachedObjectPool &) = delete;
+	void operator=(const ThreadCachedObjectPool &) = delete;
+
+	~ThreadCachedObjectPool()
+	{
+#ifndef OBJECT_POOL_DEBUG
+		for (auto *mag : magazines)
+			delete mag;
+#endif
+	}
+
+	template<typename... P>
+	T *allocate(P &&... p)
+	{
+#ifndef OBJECT_POOL_DEBUG
+		auto *mag = get_magazine();
+		if (!mag)
+		{
+			std::lock_guard<std::mutex> holder{lock};
+			return ObjectPool<T>::allocate(std::forward<P>(p)...);
+		}
+
+		if (mag->count == 0 && !refill(*mag))
+			return nullptr;
+
+		T *ptr = mag->objects[--mag->count];
+		new(ptr) T(std::forward<P>(p)...);
+		return ptr;
+#else
+		return new T(std::forward<P>(p)...);
+#endif
+	}
+
+	void free(T *ptr)
+	{
+#ifndef OBJECT_POOL_DEBUG
+		ptr->~T();
+		auto *mag = get_magazine();
+		if (!mag)
+		{
+			std::lock_guard<std::mutex> holder{lock};
+			this->vacants.push_back(ptr);
+			return;
+		}
+
+		if (mag->count == MagazineSize)
+			drain(*mag);
+		mag->objects[mag->count++] = ptr;
+#else
+		delete ptr;
+#endif
+	}
+
+	// Not thread-safe with respect to concurrent allocate() and free().
+	void clear()
+	{
+		std::lock_guard<std::mutex> holder{lock};
+#ifndef OBJECT_POOL_DEBUG
+		for (auto *mag : magazines)
+			if (mag)
+				mag->count = 0;
+#endif
+		ObjectPool<T>::clear();
+	}
+
+private:
+	std::mutex lock;
+
+#ifndef OBJECT_POOL_DEBUG
+	struct Magazine
+	{
+		T *objects[MagazineSize];
+		unsigned count = 0;
+	};
+
+	// A slot is only ever accessed by the thread which currently owns it.
+	// Slot ownership is handed over through a mutex, so plain pointers are fine.
+	Magazine *magazines[Internal::ObjectPoolMaxThreadSlots] = {};
+
+	Magazine *get_magazine()
+	{
+		unsigned slot = Internal::get_object_pool_thread_slot();
+		if (slot >= Internal::ObjectPoolMaxThreadSlots)
+			return nullptr;
+
+		auto *&mag = magazines[slot];
+		if (!mag)
+			mag = new Magazine;
+		return mag;
+	}
+
+	bool refill(Magazine &mag)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		if (this->vacants.empty() && !this->grow())
+			return false;
+
+		unsigned to_move = std::min<unsigned>(MagazineSize / 2, unsigned(this->vacants.size()));
+		auto *src = this->vacants.data() + this->vacants.size() - to_move;
+		std::copy(src, src + to_move, mag.objects);
+		this->vacants.resize(this->vacants.size() - to_move);
+		mag.count = to_move;
+		return true;
+	}
+
+	void drain(Magazine &mag)
+	{
+		constexpr unsigned to_move = MagazineSize / 2;
+		std::lock_guard<std::mutex> holder{lock};
+		this->vacants.insert(this->vacants.end(),
+		                     mag.objects + mag.count - to_move,
+		                     mag.objects + mag.count);
+		mag.count -= to_move;
+	}
+#endif
+};
 }
@@ -43,6 +43,14 @@ void set_current_thread_priority(ThreadPriority priority)
 		if (pthread_setschedparam(pthread_self(), policy, &param) != 0)
 			LOGE("Failed to set thread priority.\n");
 	}
+	else if (priority == ThreadPriority::Realtime)
+	{
+		// Needs CAP_SYS_NICE or an rtprio limit, which normal users often do not have.
+		struct sched_param param = {};
+		param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+			LOGW("Failed to set real-time thread priority, keeping normal priority.\n");
+	}
 #elif defined(_WIN32)
 	if (priority == ThreadPriority::Low)
 	{
@@ -59,6 +67,11 @@ void set_current_thread_priority(ThreadPriority priority)
 		if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST))
 			LOGE("Failed to set high thread priority.\n");
 	}
+	else if (priority == ThreadPriority::Realtime)
+	{
+		if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+			LOGE("Failed to set time critical thread priority.\n");
+	}
 #else
 #warning "Unimplemented set_current_thread_priority."
 	(void)priority;
@@ -26,6 +26,8 @@ namespace Util
 {
 enum class ThreadPriority
 {
+	// For threads which work against an audio deadline. Falls back to the current priority if not permitted.
+	Realtime,
 	High,
 	Default,
 	Low
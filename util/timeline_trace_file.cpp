@@ -24,17 +24,105 @@
 #include "timeline_trace_file.hpp"
 #include "thread_name.hpp"
 #include "timer.hpp"
+#include "hash.hpp"
+#include <unordered_map>
 #include <string.h>
 #include <stdio.h>
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TIMELINE_TRACE_HAS_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIMELINE_TRACE_HAS_RDTSC
+#endif
+
 namespace Util
 {
+constexpr char TimelineTraceFile::BinaryFormat::Magic[8];
+
+// Single producer (the owning thread), single consumer (the drainer thread).
+struct TimelineTraceFile::ThreadRing
+{
+	enum { Capacity = 16 * 1024 };
+	BinaryFormat::Record records[Capacity];
+	std::atomic_uint32_t write_count;
+	std::atomic_uint32_t read_count;
+	std::atomic_uint64_t dropped;
+};
+
+struct ThreadTraceState
+{
+	uint64_t instance_id;
+	TimelineTraceFile::ThreadRing *ring;
+};
+
 static thread_local char trace_tid[32];
+static thread_local uint32_t trace_tid_id;
 static thread_local TimelineTraceFile *trace_file;
+static thread_local ThreadTraceState trace_state;
+static std::atomic_uint64_t trace_instance_counter;
+
+// Strings are interned process wide, so IDs stay valid if a thread moves between trace files.
+static std::mutex intern_lock;
+static std::unordered_map<Hash, uint32_t> intern_map;
+static std::vector<std::string> interned_strings;
+
+// Direct mapped cache in front of the global table, so the common case does not take a lock.
+struct InternCacheEntry
+{
+	Hash hash;
+	uint32_t id;
+};
+static constexpr unsigned InternCacheSize = 256;
+static thread_local InternCacheEntry intern_cache[InternCacheSize];
+
+uint64_t TimelineTraceFile::get_ticks()
+{
+#ifdef TIMELINE_TRACE_HAS_RDTSC
+	return __rdtsc();
+#else
+	return uint64_t(get_current_time_nsecs());
+#endif
+}
+
+uint32_t TimelineTraceFile::intern_string(const char *str)
+{
+	if (!str || *str == '\0')
+		return 0;
+
+	// Strings may live in reused buffers (e.g. task descriptions), so key on contents, not pointers.
+	Hasher h;
+	h.string(str);
+	auto hash = h.get();
+
+	auto &entry = intern_cache[hash & (InternCacheSize - 1)];
+	if (entry.id != 0 && entry.hash == hash)
+		return entry.id;
+
+	uint32_t id;
+	{
+		std::lock_guard<std::mutex> holder{intern_lock};
+		auto itr = intern_map.find(hash);
+		if (itr != intern_map.end())
+			id = itr->second;
+		else
+		{
+			interned_strings.emplace_back(str);
+			id = uint32_t(interned_strings.size());
+			intern_map[hash] = id;
+		}
+	}
+
+	entry.hash = hash;
+	entry.id = id;
+	return id;
+}
 
 void TimelineTraceFile::set_tid(const char *tid)
 {
 	snprintf(trace_tid, sizeof(trace_tid), "%s", tid);
+	trace_tid_id = intern_string(trace_tid);
 }
 
 void TimelineTraceFile::set_per_thread(TimelineTraceFile *file)
@@ -78,11 +166,61 @@ TimelineTraceFile::Event *TimelineTraceFile::allocate_event()
 	return e;
 }
 
-void TimelineTraceFile::submit_event(Event *e)
+TimelineTraceFile::ThreadRing *TimelineTraceFile::get_thread_ring()
 {
+	if (trace_state.instance_id == instance_id)
+		return trace_state.ring;
+
+	auto ring = std::make_unique<ThreadRing>();
+	ring->write_count.store(0, std::memory_order_relaxed);
+	ring->read_count.store(0, std::memory_order_relaxed);
+	ring->dropped.store(0, std::memory_order_relaxed);
+
+	trace_state.instance_id = instance_id;
+	trace_state.ring = ring.get();
+
 	std::lock_guard<std::mutex> holder{lock};
-	queued_events.push(e);
-	cond.notify_one();
+	rings.push_back(std::move(ring));
+	return trace_state.ring;
+}
+
+void TimelineTraceFile::push_record(const BinaryFormat::Record &record)
+{
+	auto *ring = get_thread_ring();
+	uint32_t w = ring->write_count.load(std::memory_order_relaxed);
+	uint32_t r = ring->read_count.load(std::memory_order_acquire);
+
+	if (w - r >= ThreadRing::Capacity)
+	{
+		ring->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	ring->records[w & (ThreadRing::Capacity - 1)] = record;
+	ring->write_count.store(w + 1, std::memory_order_release);
+
+	// Kick the drainer early rather than waiting for its timeout to expire.
+	// If the drainer misses this, it still wakes up on its timeout.
+	if (w - r == ThreadRing::Capacity / 2)
+	{
+		drain_requested.store(true, std::memory_order_relaxed);
+		cond.notify_one();
+	}
+}
+
+void TimelineTraceFile::submit_event(Event *e)
+{
+	BinaryFormat::Record record = {};
+	record.start = e->start_ns;
+	record.end = e->end_ns;
+	record.desc_id = intern_string(e->desc);
+	record.tid_id = intern_string(e->tid);
+	record.pid = e->pid;
+	record.flags = BinaryFormat::RecordTimebaseNsBit;
+	event_pool.free(e);
+
+	if (record.start <= record.end)
+		push_record(record);
 }
 
 void TimelineTraceFile::end_event(Event *e)
@@ -93,73 +231,162 @@ void TimelineTraceFile::end_event(Event *e)
 
 TimelineTraceFile::TimelineTraceFile(const std::string &path)
 {
+	instance_id = trace_instance_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+	drain_requested.store(false, std::memory_order_relaxed);
+	// Events can be recorded before the drainer thread gets to run.
+	start_calibration.ticks = get_ticks();
+	start_calibration.ns = get_current_time_nsecs();
 	thr = std::thread(&TimelineTraceFile::looper, this, path);
 }
 
+static void write_chunk(FILE *file, TimelineTraceFile::BinaryFormat::ChunkType type, const void *data, size_t size)
+{
+	TimelineTraceFile::BinaryFormat::ChunkHeader header = { type, uint32_t(size) };
+	fwrite(&header, sizeof(header), 1, file);
+	if (size)
+		fwrite(data, 1, size, file);
+}
+
+static void write_calibration(FILE *file)
+{
+	TimelineTraceFile::BinaryFormat::Calibration calibration = {};
+	calibration.ticks = TimelineTraceFile::get_ticks();
+	calibration.ns = get_current_time_nsecs();
+	write_chunk(file, TimelineTraceFile::BinaryFormat::ChunkCalibration, &calibration, sizeof(calibration));
+}
+
+void TimelineTraceFile::drain(FILE *file)
+{
+	std::vector<BinaryFormat::Record> records;
+
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		for (auto &ring : rings)
+		{
+			uint32_t r = ring->read_count.load(std::memory_order_relaxed);
+			uint32_t w = ring->write_count.load(std::memory_order_acquire);
+			for (uint32_t i = r; i != w; i++)
+				records.push_back(ring->records[i & (ThreadRing::Capacity - 1)]);
+			ring->read_count.store(w, std::memory_order_release);
+		}
+	}
+
+	if (!file)
+		return;
+
+	if (!records.empty())
+	{
+		write_chunk(file, BinaryFormat::ChunkRecords, records.data(),
+		            records.size() * sizeof(BinaryFormat::Record));
+	}
+
+	// Records are pushed after their strings are interned, so draining strings last covers every record above.
+	std::vector<uint8_t> strings;
+	{
+		std::lock_guard<std::mutex> holder{intern_lock};
+		for (uint32_t id = num_strings_written + 1; id <= uint32_t(interned_strings.size()); id++)
+		{
+			auto &str = interned_strings[id - 1];
+			uint32_t len = uint32_t(str.size());
+			size_t offset = strings.size();
+			strings.resize(offset + 2 * sizeof(uint32_t) + len);
+			memcpy(strings.data() + offset, &id, sizeof(id));
+			memcpy(strings.data() + offset + sizeof(id), &len, sizeof(len));
+			memcpy(strings.data() + offset + 2 * sizeof(uint32_t), str.data(), len);
+		}
+		num_strings_written = uint32_t(interned_strings.size());
+	}
+
+	if (!strings.empty())
+		write_chunk(file, BinaryFormat::ChunkStrings, strings.data(), strings.size());
+
+	write_calibration(file);
+}
+
 void TimelineTraceFile::looper(std::string path)
 {
-	set_current_thread_name("json-trace-io");
+	set_current_thread_name("trace-io");
 
-	FILE *file = fopen(path.c_str(), "w");
+	FILE *file = fopen(path.c_str(), "wb");
 	if (!file)
 		LOGE("Failed to open file: %s.\n", path.c_str());
 
 	if (file)
-		fputs("[\n", file);
-
-	uint64_t base_ts = get_current_time_nsecs();
+	{
+		BinaryFormat::Header header = {};
+		memcpy(header.magic, BinaryFormat::Magic, sizeof(header.magic));
+		header.version = BinaryFormat::Version;
+		fwrite(&header, sizeof(header), 1, file);
+		write_chunk(file, BinaryFormat::ChunkCalibration, &start_calibration, sizeof(start_calibration));
+	}
 
 	for (;;)
 	{
-		Event *e;
+		bool done;
 		{
 			std::unique_lock<std::mutex> holder{lock};
-			cond.wait(holder, [this]() {
-				return !queued_events.empty();
+			cond.wait_for(holder, std::chrono::milliseconds(10), [this]() {
+				return shutdown || drain_requested.load(std::memory_order_relaxed);
 			});
-			e = queued_events.front();
-			queued_events.pop();
+			drain_requested.store(false, std::memory_order_relaxed);
+			done = shutdown;
 		}
 
-		if (!e)
+		drain(file);
+		if (done)
 			break;
+	}
 
-		auto start_us = int64_t(e->start_ns - base_ts) * 1e-3;
-		auto end_us = int64_t(e->end_ns - base_ts) * 1e-3;
-
-		if (file && start_us <= end_us)
+	if (file)
+	{
+		uint64_t dropped = 0;
 		{
-			fprintf(file, "{ \"name\": \"%s\", \"ph\": \"B\", \"tid\": \"%s\", \"pid\": \"%u\", \"ts\": %f },\n",
-			        e->desc, e->tid, e->pid, start_us);
-			fprintf(file, "{ \"name\": \"%s\", \"ph\": \"E\", \"tid\": \"%s\", \"pid\": \"%u\", \"ts\": %f },\n",
-			        e->desc, e->tid, e->pid, end_us);
+			std::lock_guard<std::mutex> holder{lock};
+			for (auto &ring : rings)
+				dropped += ring->dropped.load(std::memory_order_relaxed);
 		}
+		write_chunk(file, BinaryFormat::ChunkDropped, &dropped, sizeof(dropped));
 
-		event_pool.free(e);
-	}
-
-	// Intentionally truncate the JSON so that we can emit "," after the last element.
-	if (file)
+		if (dropped)
+			LOGW("Timeline trace dropped %llu events, ring buffers were full.\n", static_cast<unsigned long long>(dropped));
 		fclose(file);
+	}
 }
 
 TimelineTraceFile::~TimelineTraceFile()
 {
-	submit_event(nullptr);
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		shutdown = true;
+		cond.notify_one();
+	}
+
 	if (thr.joinable())
 		thr.join();
 }
 
 TimelineTraceFile::ScopedEvent::ScopedEvent(TimelineTraceFile *file_, const char *tag)
-	: file(file_)
 {
-	if (file && tag && *tag != '\0')
-		event = file->begin_event(tag);
+	if (file_ && tag && *tag != '\0')
+	{
+		file = file_;
+		desc_id = intern_string(tag);
+		start_ticks = get_ticks();
+	}
 }
 
 TimelineTraceFile::ScopedEvent::~ScopedEvent()
 {
-	if (event)
-		file->end_event(event);
+	if (file)
+	{
+		BinaryFormat::Record record;
+		record.start = start_ticks;
+		record.end = get_ticks();
+		record.desc_id = desc_id;
+		record.tid_id = trace_tid_id;
+		record.pid = 0;
+		record.flags = 0;
+		file->push_record(record);
+	}
 }
 }
@@ -27,7 +27,10 @@
 #include <condition_variable>
 #include <mutex>
 #include <memory>
-#include <queue>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
 #include "object_pool.hpp"
 
 namespace Util
@@ -42,6 +45,8 @@ public:
 	static TimelineTraceFile *get_per_thread();
 	static void set_per_thread(TimelineTraceFile *file);
 
+	// Events with explicit timestamps in the get_current_time_nsecs() timebase, e.g. GPU timestamps.
+	// Slower than ScopedEvent since strings are interned on submission.
 	struct Event
 	{
 		char desc[256];
@@ -65,17 +70,90 @@ public:
 		void operator=(const ScopedEvent &) = delete;
 		ScopedEvent(const ScopedEvent &) = delete;
 		TimelineTraceFile *file = nullptr;
-		Event *event = nullptr;
+		uint64_t start_ticks = 0;
+		uint32_t desc_id = 0;
 	};
 
+	// Binary trace file layout. Convert to Chrome / Perfetto JSON with timeline-trace-convert.
+	// The file is a Header followed by chunks. Each chunk is a ChunkHeader followed by size bytes of payload.
+	struct BinaryFormat
+	{
+		enum { Version = 1 };
+		static constexpr char Magic[8] = { 'G', 'R', 'N', 'T', 'R', 'A', 'C', 'E' };
+
+		struct Header
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t reserved;
+		};
+
+		enum ChunkType : uint32_t
+		{
+			// Sequence of { uint32_t id; uint32_t length; char string[length]; }. ID 0 is the empty string.
+			ChunkStrings = 1,
+			// Array of Record.
+			ChunkRecords = 2,
+			// One Calibration, maps ticks to nanoseconds. Written at start, after every drain and at the end.
+			ChunkCalibration = 3,
+			// One uint64_t, total records dropped due to full ring buffers.
+			ChunkDropped = 4
+		};
+
+		struct ChunkHeader
+		{
+			uint32_t type;
+			uint32_t size;
+		};
+
+		enum RecordFlagBits : uint32_t
+		{
+			// start and end are in nanoseconds rather than ticks.
+			RecordTimebaseNsBit = 1 << 0
+		};
+
+		struct Record
+		{
+			uint64_t start;
+			uint64_t end;
+			uint32_t desc_id;
+			uint32_t tid_id;
+			uint32_t pid;
+			uint32_t flags;
+		};
+
+		struct Calibration
+		{
+			uint64_t ticks;
+			int64_t ns;
+		};
+	};
+
+	// TSC where available, otherwise nanoseconds.
+	static uint64_t get_ticks();
+
 private:
+	struct ThreadRing;
+	friend struct ThreadTraceState;
+	ThreadRing *get_thread_ring();
+	void push_record(const BinaryFormat::Record &record);
+	static uint32_t intern_string(const char *str);
+
 	void looper(std::string path);
+	void drain(FILE *file);
 	std::thread thr;
 	std::mutex lock;
 	std::condition_variable cond;
+	bool shutdown = false;
+	std::atomic_bool drain_requested;
+	BinaryFormat::Calibration start_calibration;
+
+	// Rings are owned by the file, threads only cache a pointer.
+	std::vector<std::unique_ptr<ThreadRing>> rings;
+	uint64_t instance_id;
+	uint32_t num_strings_written = 0;
 
-	ThreadSafeObjectPool<Event> event_pool;
-	std::queue<Event *> queued_events;
+	ThreadCachedObjectPool<Event> event_pool;
 };
 
 #ifndef GRANITE_SHIPPING
@@ -0,0 +1,132 @@
+/* Copyright (c) 2017-2023 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <assert.h>
+#include <memory>
+#include "bitops.hpp"
+
+namespace Util
+{
+// Fixed capacity Chase-Lev deque.
+// Owner thread pushes and pops at the bottom in LIFO order,
+// any other thread may steal from the top in FIFO order.
+// Memory ordering follows "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al.).
+template <typename T>
+class WorkStealingDeque
+{
+public:
+	explicit WorkStealingDeque(uint32_t capacity_ = 4096)
+	{
+		capacity = next_pow2(capacity_);
+		mask = capacity - 1;
+		buffer.reset(new std::atomic<T *>[capacity]);
+		for (uint32_t i = 0; i < capacity; i++)
+			buffer[i].store(nullptr, std::memory_order_relaxed);
+		top.store(0, std::memory_order_relaxed);
+		bottom.store(0, std::memory_order_relaxed);
+	}
+
+	WorkStealingDeque(const WorkStealingDeque &) = delete;
+	void operator=(const WorkStealingDeque &) = delete;
+
+	// Owner only. Returns false if the deque is full, caller must find another home for the value.
+	bool push(T *value)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		if (b - t >= int64_t(capacity))
+			return false;
+
+		buffer[b & mask].store(value, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Owner only.
+	T *pop()
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if (t > b)
+		{
+			// Empty.
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		T *value = buffer[b & mask].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			// Last element, race against stealers.
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				value = nullptr;
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+
+		return value;
+	}
+
+	// Any thread. Can spuriously fail if racing against other stealers or the owner.
+	T *steal()
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+
+		if (t >= b)
+			return nullptr;
+
+		T *value = buffer[t & mask].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return value;
+	}
+
+	// Racy snapshot, only useful as a hint.
+	// Sequentially consistent so it can be paired with a sleeper count when parking threads.
+	bool empty() const
+	{
+		int64_t b = bottom.load(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_seq_cst);
+		return b <= t;
+	}
+
+private:
+	// Keep the indices on separate cache lines, stealers hammer top while the owner hammers bottom.
+	// Padding rather than alignas since C++14 operator new does not respect over-alignment.
+	std::atomic<int64_t> top;
+	char top_padding[64 - sizeof(std::atomic<int64_t>)];
+	std::atomic<int64_t> bottom;
+	char bottom_padding[64 - sizeof(std::atomic<int64_t>)];
+	std::unique_ptr<std::atomic<T *>[]> buffer;
+	uint32_t capacity = 0;
+	uint32_t mask = 0;
+};
+}
@@ -32,7 +32,7 @@ namespace Vulkan
 using HandleCounter = Util::MultiThreadCounter;
 
 template <typename T>
-using VulkanObjectPool = Util::ThreadSafeObjectPool<T>;
+using VulkanObjectPool = Util::ThreadCachedObjectPool<T>;
 template <typename T>
 using VulkanCache = Util::ThreadSafeIntrusiveHashMapReadCached<T>;
 template <typename T>